@@ -48,6 +48,10 @@
 typedef struct ALLEGRO_FONT ALLEGRO_FONT;
 typedef struct ALLEGRO_FONT_VTABLE ALLEGRO_FONT_VTABLE;
 
+/* Type: ALLEGRO_TEXT_LAYOUT
+*/
+typedef struct ALLEGRO_TEXT_LAYOUT ALLEGRO_TEXT_LAYOUT;
+
 struct ALLEGRO_FONT
 {
    void *data;
@@ -142,6 +146,17 @@ ALLEGRO_FONT_FUNC(void, al_do_multiline_ustr, (const ALLEGRO_FONT *font,
    bool (*cb)(int line_num, const ALLEGRO_USTR *line, void *extra),
    void *extra));
 
+ALLEGRO_FONT_FUNC(ALLEGRO_TEXT_LAYOUT *, al_create_text_layout, (const ALLEGRO_FONT *font,
+   float max_width, float line_height, int flags, const char *text));
+ALLEGRO_FONT_FUNC(ALLEGRO_TEXT_LAYOUT *, al_create_ustr_layout, (const ALLEGRO_FONT *font,
+   float max_width, float line_height, int flags, const ALLEGRO_USTR *ustr));
+ALLEGRO_FONT_FUNC(void, al_destroy_text_layout, (ALLEGRO_TEXT_LAYOUT *layout));
+ALLEGRO_FONT_FUNC(void, al_draw_text_layout, (const ALLEGRO_TEXT_LAYOUT *layout,
+   ALLEGRO_COLOR color, float x, float y));
+ALLEGRO_FONT_FUNC(void, al_get_text_layout_dimensions, (const ALLEGRO_TEXT_LAYOUT *layout,
+   float *bbx, float *bby, float *bbw, float *bbh));
+ALLEGRO_FONT_FUNC(int, al_get_text_layout_line_count, (const ALLEGRO_TEXT_LAYOUT *layout));
+
 
 #ifdef __cplusplus
    }
@@ -0,0 +1,40 @@
+#ifndef __al_included_allegro5_aintern_font_h
+#define __al_included_allegro5_aintern_font_h
+
+#include "../allegro_font.h"
+
+/* Where a glyph is in one of a font's bitmaps, and where to draw it
+ * relative to the pen position.
+ */
+typedef struct ALLEGRO_GLYPH_QUAD
+{
+   ALLEGRO_BITMAP *bitmap;
+   int x, y, w, h;
+   float offset_x, offset_y;
+} ALLEGRO_GLYPH_QUAD;
+
+/* Extra methods a font type may provide so that text layouts can draw its
+ * glyphs themselves.  They are kept out of ALLEGRO_FONT_VTABLE so that its
+ * layout stays the same for fonts implemented outside Allegro.
+ *
+ * use_glyph_bitmaps starts a new draw using the given bitmaps, and returns
+ * a number which changes whenever glyphs may have moved.  It may be NULL if
+ * they never do.
+ */
+typedef struct ALLEGRO_FONT_GLYPH_VTABLE
+{
+   bool (*get_glyph_quad)(const ALLEGRO_FONT *f, int codepoint,
+      ALLEGRO_GLYPH_QUAD *quad);
+   int (*use_glyph_bitmaps)(const ALLEGRO_FONT *f, int count,
+      ALLEGRO_BITMAP * const *bitmaps);
+} ALLEGRO_FONT_GLYPH_VTABLE;
+
+ALLEGRO_FONT_FUNC(bool, _al_register_font_glyph_vtable,
+   (const ALLEGRO_FONT_VTABLE *vtable,
+    const ALLEGRO_FONT_GLYPH_VTABLE *glyph_vtable));
+ALLEGRO_FONT_FUNC(const ALLEGRO_FONT_GLYPH_VTABLE *,
+   _al_get_font_glyph_vtable, (const ALLEGRO_FONT *f));
+
+#endif
+
+/* vim: set sts=3 sw=3 et: */
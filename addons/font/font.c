@@ -16,6 +16,7 @@
 #include "allegro5/allegro.h"
 #include "allegro5/allegro_font.h"
 #include "allegro5/internal/aintern.h"
+#include "allegro5/internal/aintern_font.h"
 #include "allegro5/internal/aintern_bitmap.h"
 #include "allegro5/internal/aintern_exitfunc.h"
 #include "allegro5/internal/aintern_vector.h"
@@ -33,9 +34,17 @@ typedef struct
 } FONT_HANDLER;
 
 
+typedef struct
+{
+   const ALLEGRO_FONT_VTABLE *vtable;
+   const ALLEGRO_FONT_GLYPH_VTABLE *glyph_vtable;
+} FONT_GLYPH_HANDLER;
+
+
 /* globals */
 static bool font_inited = false;
 static _AL_VECTOR font_handlers;
+static _AL_VECTOR font_glyph_handlers;
 
 
 /* al_font_404_character:
@@ -294,6 +303,29 @@ static int color_get_glyph_advance(ALLEGRO_FONT const *f,
  * vtable declarations
  ********/
 
+static bool color_get_glyph_quad(ALLEGRO_FONT const *f, int codepoint,
+   ALLEGRO_GLYPH_QUAD *quad)
+{
+   ALLEGRO_BITMAP *glyph = _al_font_color_find_glyph(f, codepoint);
+   ALLEGRO_BITMAP *parent;
+
+   if (!glyph)
+      return false;
+
+   parent = al_get_parent_bitmap(glyph);
+   quad->bitmap = parent ? parent : glyph;
+   quad->x = parent ? al_get_bitmap_x(glyph) : 0;
+   quad->y = parent ? al_get_bitmap_y(glyph) : 0;
+   quad->w = al_get_bitmap_width(glyph);
+   quad->h = al_get_bitmap_height(glyph);
+   /* Same as color_render_char. */
+   quad->offset_x = 0;
+   quad->offset_y = ((float)f->vtable->font_height(f) - quad->h) / 2.0f;
+   return true;
+}
+
+
+
 ALLEGRO_FONT_VTABLE _al_font_vtable_color = {
     font_height,
     font_ascent,
@@ -310,6 +342,12 @@ ALLEGRO_FONT_VTABLE _al_font_vtable_color = {
 };
 
 
+static ALLEGRO_FONT_GLYPH_VTABLE color_glyph_vtable = {
+    color_get_glyph_quad,
+    NULL
+};
+
+
 static void font_shutdown(void)
 {
     if (!font_inited)
@@ -321,6 +359,7 @@ static void font_shutdown(void)
        _al_vector_delete_at(&font_handlers, _al_vector_size(&font_handlers)-1);
     }
     _al_vector_free(&font_handlers);
+    _al_vector_free(&font_glyph_handlers);
 
     font_inited = false;
 }
@@ -336,6 +375,7 @@ bool al_init_font_addon(void)
    }
 
    _al_vector_init(&font_handlers, sizeof(FONT_HANDLER));
+   _al_vector_init(&font_glyph_handlers, sizeof(FONT_GLYPH_HANDLER));
 
    al_register_font_loader(".bmp", _al_load_bitmap_font);
    al_register_font_loader(".jpg", _al_load_bitmap_font);
@@ -343,6 +383,9 @@ bool al_init_font_addon(void)
    al_register_font_loader(".png", _al_load_bitmap_font);
    al_register_font_loader(".tga", _al_load_bitmap_font);
 
+   _al_register_font_glyph_vtable(&_al_font_vtable_color,
+      &color_glyph_vtable);
+
    _al_add_exit_func(font_shutdown, "font_shutdown");
 
    font_inited = true;
@@ -398,6 +441,54 @@ bool al_register_font_loader(char const *extension,
 
 
 
+/* Internal function: _al_register_font_glyph_vtable
+ *  Tells text layouts how to draw the glyphs of fonts with the given
+ *  vtable themselves.  Passing NULL for glyph_vtable removes it again.
+ */
+bool _al_register_font_glyph_vtable(const ALLEGRO_FONT_VTABLE *vtable,
+   const ALLEGRO_FONT_GLYPH_VTABLE *glyph_vtable)
+{
+   FONT_GLYPH_HANDLER *handler;
+   unsigned int i;
+
+   for (i = 0; i < _al_vector_size(&font_glyph_handlers); i++) {
+      handler = _al_vector_ref(&font_glyph_handlers, i);
+      if (handler->vtable == vtable) {
+         if (!glyph_vtable)
+            return _al_vector_find_and_delete(&font_glyph_handlers, handler);
+         handler->glyph_vtable = glyph_vtable;
+         return true;
+      }
+   }
+
+   if (!glyph_vtable)
+      return false; /* Nothing to remove. */
+   handler = _al_vector_alloc_back(&font_glyph_handlers);
+   handler->vtable = vtable;
+   handler->glyph_vtable = glyph_vtable;
+   return true;
+}
+
+
+
+/* Internal function: _al_get_font_glyph_vtable
+ *  Returns the glyph methods registered for the font's type, or NULL.
+ */
+const ALLEGRO_FONT_GLYPH_VTABLE *_al_get_font_glyph_vtable(
+   const ALLEGRO_FONT *f)
+{
+   unsigned int i;
+
+   for (i = 0; i < _al_vector_size(&font_glyph_handlers); i++) {
+      FONT_GLYPH_HANDLER *handler = _al_vector_ref(&font_glyph_handlers, i);
+      if (handler->vtable == f->vtable)
+         return handler->glyph_vtable;
+   }
+   return NULL;
+}
+
+
+
 /* Function: al_load_font
  */
 ALLEGRO_FONT *al_load_font(char const *filename, int size, int flags)
@@ -0,0 +1,397 @@
+/*         ______   ___    ___
+ *        /\  _  \ /\_ \  /\_ \
+ *        \ \ \L\ \\//\ \ \//\ \      __     __   _ __   ___
+ *         \ \  __ \ \ \ \  \ \ \   /'__`\ /'_ `\/\`'__\/ __`\
+ *          \ \ \/\ \ \_\ \_ \_\ \_/\  __//\ \L\ \ \ \//\ \L\ \
+ *           \ \_\ \_\/\____\/\____\ \____\ \____ \ \_\\ \____/
+ *            \/_/\/_/\/____/\/____/\/____/\/___L\ \/_/ \/___/
+ *                                           /\____/
+ *                                           \_/__/
+ *
+ *      Precomputed text layouts.
+ *
+ *      See readme.txt for copyright information.
+ */
+
+
+#include <math.h>
+#include "allegro5/allegro.h"
+#include "allegro5/allegro_font.h"
+#include "allegro5/internal/aintern_font.h"
+#include "allegro5/internal/aintern_vector.h"
+
+ALLEGRO_DEBUG_CHANNEL("font")
+
+
+/* The layout stores codepoints, with kerning baked into their positions.
+ * When first drawn, they are resolved to quads on the font's bitmaps,
+ * which are sorted by bitmap and then drawn as they are.  Fonts may move
+ * glyphs around in their caches, in which case the quads are resolved
+ * again.
+ */
+typedef struct LAYOUT_GLYPH
+{
+   int codepoint;
+   float x;
+} LAYOUT_GLYPH;
+
+
+typedef struct LAYOUT_QUAD
+{
+   ALLEGRO_BITMAP *bitmap;
+   int sx, sy, sw, sh;
+   float dx, dy;  /* relative to the start of the line */
+   int line;
+   int order;     /* keeps the sort stable */
+} LAYOUT_QUAD;
+
+
+typedef struct LAYOUT_LINE
+{
+   float x;
+   float y;
+   int width;
+   int first_glyph;
+   int num_glyphs;
+} LAYOUT_LINE;
+
+
+struct ALLEGRO_TEXT_LAYOUT
+{
+   const ALLEGRO_FONT *font;
+   const ALLEGRO_FONT_GLYPH_VTABLE *glyph_vtable;  /* NULL if none */
+   int flags;
+   _AL_VECTOR glyphs;  /* of LAYOUT_GLYPH */
+   _AL_VECTOR lines;   /* of LAYOUT_LINE */
+   float line_height;
+   float bbx;
+   float bbw;
+
+   /* Filled in by the first draw. */
+   bool resolved;
+   int cache_version;
+   _AL_VECTOR quads;    /* of LAYOUT_QUAD, sorted by bitmap */
+   _AL_VECTOR bitmaps;  /* of ALLEGRO_BITMAP *, the distinct bitmaps */
+   _AL_VECTOR origins;  /* of float[2], scratch space for line origins */
+};
+
+
+
+static bool add_line_cb(int line_num, const ALLEGRO_USTR *line, void *extra)
+{
+   ALLEGRO_TEXT_LAYOUT *layout = extra;
+   LAYOUT_LINE *l;
+   int pos = 0;
+   int advance = 0;
+   int32_t ch;
+
+   l = _al_vector_alloc_back(&layout->lines);
+   l->y = layout->line_height * line_num;
+   l->first_glyph = _al_vector_size(&layout->glyphs);
+   l->num_glyphs = 0;
+
+   ch = al_ustr_get_next(line, &pos);
+   while (ch >= 0) {
+      int32_t next = al_ustr_get_next(line, &pos);
+      LAYOUT_GLYPH *g = _al_vector_alloc_back(&layout->glyphs);
+
+      g->codepoint = ch;
+      g->x = advance;
+      advance += al_get_glyph_advance(layout->font, ch,
+         next >= 0 ? next : ALLEGRO_NO_KERNING);
+      l->num_glyphs++;
+      ch = next;
+   }
+
+   /* Same as al_draw_ustr. */
+   l->width = advance;
+   l->x = 0;
+   if (layout->flags & ALLEGRO_ALIGN_CENTRE)
+      l->x = -(advance / 2);
+   else if (layout->flags & ALLEGRO_ALIGN_RIGHT)
+      l->x = -advance;
+
+   if (line_num == 0 || l->x < layout->bbx) {
+      layout->bbw += layout->bbx - l->x;
+      layout->bbx = l->x;
+   }
+   if (l->x + l->width > layout->bbx + layout->bbw)
+      layout->bbw = l->x + l->width - layout->bbx;
+
+   return true;
+}
+
+
+
+/* Function: al_create_ustr_layout
+ */
+ALLEGRO_TEXT_LAYOUT *al_create_ustr_layout(const ALLEGRO_FONT *font,
+   float max_width, float line_height, int flags, const ALLEGRO_USTR *ustr)
+{
+   ALLEGRO_TEXT_LAYOUT *layout;
+   ASSERT(font);
+   ASSERT(ustr);
+
+   layout = al_calloc(1, sizeof *layout);
+   if (!layout)
+      return NULL;
+
+   layout->font = font;
+   layout->glyph_vtable = _al_get_font_glyph_vtable(font);
+   layout->flags = flags;
+   if (line_height < 1)
+      layout->line_height = al_get_font_line_height(font);
+   else
+      layout->line_height = line_height;
+   _al_vector_init(&layout->glyphs, sizeof(LAYOUT_GLYPH));
+   _al_vector_init(&layout->lines, sizeof(LAYOUT_LINE));
+   _al_vector_init(&layout->quads, sizeof(LAYOUT_QUAD));
+   _al_vector_init(&layout->bitmaps, sizeof(ALLEGRO_BITMAP *));
+   _al_vector_init(&layout->origins, sizeof(float) * 2);
+
+   al_do_multiline_ustr(font, max_width, ustr, add_line_cb, layout);
+
+   ALLEGRO_DEBUG("Created layout with %d lines and %d glyphs.\n",
+      (int)_al_vector_size(&layout->lines),
+      (int)_al_vector_size(&layout->glyphs));
+
+   return layout;
+}
+
+
+
+/* Function: al_create_text_layout
+ */
+ALLEGRO_TEXT_LAYOUT *al_create_text_layout(const ALLEGRO_FONT *font,
+   float max_width, float line_height, int flags, const char *text)
+{
+   ALLEGRO_USTR_INFO info;
+   ASSERT(text);
+
+   return al_create_ustr_layout(font, max_width, line_height, flags,
+      al_ref_cstr(&info, text));
+}
+
+
+
+/* Function: al_destroy_text_layout
+ */
+void al_destroy_text_layout(ALLEGRO_TEXT_LAYOUT *layout)
+{
+   if (!layout)
+      return;
+
+   _al_vector_free(&layout->glyphs);
+   _al_vector_free(&layout->lines);
+   _al_vector_free(&layout->quads);
+   _al_vector_free(&layout->bitmaps);
+   _al_vector_free(&layout->origins);
+   al_free(layout);
+}
+
+
+
+static int compare_quads(const void *pa, const void *pb)
+{
+   const LAYOUT_QUAD *a = pa;
+   const LAYOUT_QUAD *b = pb;
+
+   if (a->bitmap != b->bitmap)
+      return ((uintptr_t)a->bitmap < (uintptr_t)b->bitmap) ? -1 : 1;
+   return a->order - b->order;
+}
+
+
+
+/* Looks up where every glyph is in the font's bitmaps.  The font must have
+ * been told about a new draw first, see use_glyph_bitmaps.
+ */
+static void resolve_quads(ALLEGRO_TEXT_LAYOUT *layout)
+{
+   const ALLEGRO_FONT *font = layout->font;
+   ALLEGRO_GLYPH_QUAD gq;
+   unsigned int i;
+   int j;
+
+   _al_vector_free(&layout->quads);
+   _al_vector_free(&layout->bitmaps);
+
+   for (i = 0; i < _al_vector_size(&layout->lines); i++) {
+      LAYOUT_LINE *l = _al_vector_ref(&layout->lines, i);
+
+      for (j = 0; j < l->num_glyphs; j++) {
+         LAYOUT_GLYPH *g = _al_vector_ref(&layout->glyphs, l->first_glyph + j);
+         LAYOUT_QUAD *q;
+
+         if (!layout->glyph_vtable->get_glyph_quad(font, g->codepoint, &gq))
+            continue;
+
+         q = _al_vector_alloc_back(&layout->quads);
+         q->bitmap = gq.bitmap;
+         q->sx = gq.x;
+         q->sy = gq.y;
+         q->sw = gq.w;
+         q->sh = gq.h;
+         q->dx = g->x + gq.offset_x;
+         q->dy = gq.offset_y;
+         q->line = i;
+         q->order = _al_vector_size(&layout->quads) - 1;
+      }
+   }
+
+   /* Glyphs from the same bitmap are drawn together, so that held drawing
+    * can batch them.
+    */
+   if (!_al_vector_is_empty(&layout->quads)) {
+      qsort(_al_vector_ref_front(&layout->quads),
+         _al_vector_size(&layout->quads), sizeof(LAYOUT_QUAD),
+         compare_quads);
+   }
+
+   for (i = 0; i < _al_vector_size(&layout->quads); i++) {
+      LAYOUT_QUAD *q = _al_vector_ref(&layout->quads, i);
+      if (i == 0 || q->bitmap != ((LAYOUT_QUAD *)_al_vector_ref(
+            &layout->quads, i - 1))->bitmap) {
+         ALLEGRO_BITMAP **b = _al_vector_alloc_back(&layout->bitmaps);
+         *b = q->bitmap;
+      }
+   }
+
+   layout->resolved = true;
+}
+
+
+
+static int use_glyph_bitmaps(ALLEGRO_TEXT_LAYOUT *layout)
+{
+   const ALLEGRO_FONT *font = layout->font;
+
+   if (!layout->glyph_vtable->use_glyph_bitmaps)
+      return 0;
+   return layout->glyph_vtable->use_glyph_bitmaps(font,
+      _al_vector_size(&layout->bitmaps),
+      _al_vector_is_empty(&layout->bitmaps) ? NULL :
+         _al_vector_ref_front(&layout->bitmaps));
+}
+
+
+
+/* For fonts which can't give out their glyphs. */
+static void draw_layout_glyphs(const ALLEGRO_TEXT_LAYOUT *layout,
+   ALLEGRO_COLOR color, const float *origins)
+{
+   unsigned int i;
+   int j;
+
+   for (i = 0; i < _al_vector_size(&layout->lines); i++) {
+      LAYOUT_LINE *l = _al_vector_ref(&layout->lines, i);
+
+      for (j = 0; j < l->num_glyphs; j++) {
+         LAYOUT_GLYPH *g = _al_vector_ref(&layout->glyphs, l->first_glyph + j);
+         al_draw_glyph(layout->font, color, origins[i * 2] + g->x,
+            origins[i * 2 + 1], g->codepoint);
+      }
+   }
+}
+
+
+
+/* Function: al_draw_text_layout
+ */
+void al_draw_text_layout(const ALLEGRO_TEXT_LAYOUT *layout,
+   ALLEGRO_COLOR color, float x, float y)
+{
+   /* The quads are a cache, filled in on demand. */
+   ALLEGRO_TEXT_LAYOUT *cache = (ALLEGRO_TEXT_LAYOUT *)layout;
+   ALLEGRO_TRANSFORM const *fwd = NULL;
+   ALLEGRO_TRANSFORM inv;
+   float *origins;
+   bool hold;
+   unsigned int i;
+   ASSERT(layout);
+
+   if (layout->flags & ALLEGRO_ALIGN_INTEGER) {
+      fwd = al_get_current_transform();
+      al_copy_transform(&inv, fwd);
+      al_invert_transform(&inv);
+   }
+
+   /* Where each line starts this time. */
+   while (_al_vector_size(&cache->origins) < _al_vector_size(&layout->lines))
+      _al_vector_alloc_back(&cache->origins);
+   origins = _al_vector_is_empty(&cache->origins) ? NULL :
+      _al_vector_ref_front(&cache->origins);
+   for (i = 0; i < _al_vector_size(&layout->lines); i++) {
+      LAYOUT_LINE *l = _al_vector_ref(&layout->lines, i);
+      float lx = x + l->x;
+      float ly = y + l->y;
+
+      if (fwd) {
+         al_transform_coordinates(fwd, &lx, &ly);
+         lx = floorf(lx + 0.5f);
+         ly = floorf(ly + 0.5f);
+         al_transform_coordinates(&inv, &lx, &ly);
+      }
+      origins[i * 2] = lx;
+      origins[i * 2 + 1] = ly;
+   }
+
+   hold = al_is_bitmap_drawing_held();
+   al_hold_bitmap_drawing(true);
+
+   if (!layout->glyph_vtable || !layout->glyph_vtable->get_glyph_quad) {
+      draw_layout_glyphs(layout, color, origins);
+   }
+   else {
+      int version = use_glyph_bitmaps(cache);
+
+      if (!layout->resolved || version != layout->cache_version) {
+         resolve_quads(cache);
+         /* Looking up the glyphs may have moved others. */
+         cache->cache_version = use_glyph_bitmaps(cache);
+      }
+
+      for (i = 0; i < _al_vector_size(&layout->quads); i++) {
+         LAYOUT_QUAD *q = _al_vector_ref(&layout->quads, i);
+         al_draw_tinted_bitmap_region(q->bitmap, color,
+            q->sx, q->sy, q->sw, q->sh,
+            origins[q->line * 2] + q->dx, origins[q->line * 2 + 1] + q->dy,
+            0);
+      }
+   }
+
+   al_hold_bitmap_drawing(hold);
+}
+
+
+
+/* Function: al_get_text_layout_dimensions
+ */
+void al_get_text_layout_dimensions(const ALLEGRO_TEXT_LAYOUT *layout,
+   float *bbx, float *bby, float *bbw, float *bbh)
+{
+   ASSERT(layout);
+
+   if (bbx)
+      *bbx = layout->bbx;
+   if (bby)
+      *bby = 0;
+   if (bbw)
+      *bbw = layout->bbw;
+   if (bbh)
+      *bbh = layout->line_height * _al_vector_size(&layout->lines);
+}
+
+
+
+/* Function: al_get_text_layout_line_count
+ */
+int al_get_text_layout_line_count(const ALLEGRO_TEXT_LAYOUT *layout)
+{
+   ASSERT(layout);
+
+   return _al_vector_size(&layout->lines);
+}
+
+
+/* vim: set sts=3 sw=3 et: */
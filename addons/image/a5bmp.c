@@ -0,0 +1,445 @@
+/*         ______   ___    ___
+ *        /\  _  \ /\_ \  /\_ \
+ *        \ \ \L\ \\//\ \ \//\ \      __     __   _ __   ___
+ *         \ \  __ \ \ \ \  \ \ \   /'__`\ /'_ `\/\`'__\/ __`\
+ *          \ \ \/\ \ \_\ \_ \_\ \_/\  __//\ \L\ \ \ \//\ \L\ \
+ *           \ \_\ \_\/\____\/\____\ \____\ \____ \ \_\\ \____/
+ *            \/_/\/_/\/____/\/____/\/____/\/___L\ \/_/ \/___/
+ *                                           /\____/
+ *                                           \_/__/
+ *
+ *      A5BMP reader and writer.
+ *
+ *      A5BMP is a trivial container for the raw contents of a locked
+ *      bitmap, so that loading it requires no pixel conversion at all.
+ *
+ *      See readme.txt for copyright information.
+ */
+
+#include <limits.h>
+#include <string.h>
+
+#include "allegro5/allegro.h"
+#include "allegro5/allegro_image.h"
+#include "allegro5/internal/aintern.h"
+#include "allegro5/internal/aintern_image.h"
+#include "allegro5/internal/aintern_lz4.h"
+#include "allegro5/internal/aintern_pixels.h"
+
+#include "iio.h"
+
+ALLEGRO_DEBUG_CHANNEL("image")
+
+
+/* File layout (all header fields are 32-bit little endian):
+ *
+ *    magic       "A5BM"
+ *    version     A5BMP_VERSION
+ *    flags       A5BMP_FLAG_*
+ *    width       in pixels
+ *    height      in pixels
+ *    format      ALLEGRO_PIXEL_FORMAT of the pixel data
+ *    pitch       bytes per row (row of blocks for compressed formats)
+ *    data_size   size of the pixel data which follows, as stored
+ *
+ * The pixel data is stored top to bottom, exactly as it appears in a
+ * region locked in the given format.
+ */
+#define A5BMP_MAGIC        "A5BM"
+#define A5BMP_VERSION      1
+
+#define A5BMP_FLAG_LZ4        0x1
+#define A5BMP_FLAG_BIG_ENDIAN 0x2
+
+
+typedef struct A5BMP_HEADER {
+   uint32_t version;
+   uint32_t flags;
+   uint32_t width;
+   uint32_t height;
+   uint32_t format;
+   uint32_t pitch;
+   uint32_t data_size;
+} A5BMP_HEADER;
+
+
+#ifdef ALLEGRO_BIG_ENDIAN
+   #define A5BMP_NATIVE_FLAGS A5BMP_FLAG_BIG_ENDIAN
+#else
+   #define A5BMP_NATIVE_FLAGS 0
+#endif
+
+
+/* Returns the number of bytes in one row of blocks, and the number of such
+ * rows, or false if the dimensions don't fit the format.
+ */
+static bool get_row_layout(int format, int w, int h, size_t *row_size,
+   int *rows)
+{
+   int block_width = al_get_pixel_block_width(format);
+   int block_height = al_get_pixel_block_height(format);
+   int block_size = al_get_pixel_block_size(format);
+
+   if (block_width <= 0 || block_height <= 0 || block_size <= 0)
+      return false;
+   if (w % block_width != 0 || h % block_height != 0)
+      return false;
+
+   *row_size = (size_t)(w / block_width) * block_size;
+   *rows = h / block_height;
+   return true;
+}
+
+
+
+static bool read_header(ALLEGRO_FILE *f, A5BMP_HEADER *header)
+{
+   char magic[4];
+
+   if (al_fread(f, magic, 4) != 4 || memcmp(magic, A5BMP_MAGIC, 4) != 0) {
+      ALLEGRO_ERROR("Invalid A5BMP magic number.\n");
+      return false;
+   }
+
+   header->version = al_fread32le(f);
+   header->flags = al_fread32le(f);
+   header->width = al_fread32le(f);
+   header->height = al_fread32le(f);
+   header->format = al_fread32le(f);
+   header->pitch = al_fread32le(f);
+   header->data_size = al_fread32le(f);
+
+   if (al_feof(f) || al_ferror(f)) {
+      ALLEGRO_ERROR("Failed to read A5BMP header.\n");
+      return false;
+   }
+
+   if (header->version != A5BMP_VERSION) {
+      ALLEGRO_ERROR("Unsupported A5BMP version %u.\n", header->version);
+      return false;
+   }
+
+   if ((header->flags & A5BMP_FLAG_BIG_ENDIAN) != A5BMP_NATIVE_FLAGS) {
+      ALLEGRO_ERROR("A5BMP pixel data has the wrong byte order.\n");
+      return false;
+   }
+
+   if (header->format >= ALLEGRO_NUM_PIXEL_FORMATS ||
+         !_al_pixel_format_is_real(header->format)) {
+      ALLEGRO_ERROR("Invalid A5BMP pixel format %u.\n", header->format);
+      return false;
+   }
+
+   if (header->width == 0 || header->height == 0 ||
+         header->width > INT_MAX || header->height > INT_MAX) {
+      ALLEGRO_ERROR("Invalid A5BMP dimensions %ux%u.\n",
+         header->width, header->height);
+      return false;
+   }
+
+   return true;
+}
+
+
+
+static ALLEGRO_LOCKED_REGION *lock_for_format(ALLEGRO_BITMAP *bmp,
+   int format, int flags)
+{
+   if (_al_pixel_format_is_compressed(format))
+      return al_lock_bitmap_blocked(bmp, flags);
+   return al_lock_bitmap(bmp, format, flags);
+}
+
+
+
+/* Copies rows of row_size bytes spaced src_pitch apart into the locked
+ * region.
+ */
+static void copy_rows(ALLEGRO_LOCKED_REGION *lr, const unsigned char *src,
+   size_t src_pitch, size_t row_size, int rows)
+{
+   char *dst = lr->data;
+   int y;
+
+   for (y = 0; y < rows; y++) {
+      memcpy(dst, src, row_size);
+      src += src_pitch;
+      dst += lr->pitch;
+   }
+}
+
+
+
+static bool read_pixels(ALLEGRO_FILE *f, const A5BMP_HEADER *header,
+   ALLEGRO_LOCKED_REGION *lr, size_t row_size, int rows)
+{
+   const size_t pitch = header->pitch;
+   const size_t raw_size = pitch * rows;
+   unsigned char *packed;
+   unsigned char *raw;
+   int64_t file_size, file_pos;
+   bool ret;
+   int y;
+
+   if (!(header->flags & A5BMP_FLAG_LZ4)) {
+      if (header->data_size != raw_size) {
+         ALLEGRO_ERROR("A5BMP data size mismatch.\n");
+         return false;
+      }
+
+      /* Common case: the file layout matches the locked region exactly and
+       * we can read everything in one go.
+       */
+      if (pitch == row_size && lr->pitch > 0 && (size_t)lr->pitch == pitch) {
+         return al_fread(f, lr->data, raw_size) == raw_size;
+      }
+
+      for (y = 0; y < rows; y++) {
+         char *dst = (char *)lr->data + (intptr_t)y * lr->pitch;
+         if (al_fread(f, dst, row_size) != row_size)
+            return false;
+         if (pitch > row_size && !al_fseek(f, pitch - row_size, ALLEGRO_SEEK_CUR))
+            return false;
+      }
+      return true;
+   }
+
+   /* The sizes come from the file, so check them before allocating. */
+   if (header->data_size > _al_lz4_compress_bound(raw_size)) {
+      ALLEGRO_ERROR("A5BMP compressed data size too large.\n");
+      return false;
+   }
+   file_size = al_fsize(f);
+   file_pos = al_ftell(f);
+   if (file_size >= 0 && file_pos >= 0 &&
+         header->data_size > file_size - file_pos) {
+      ALLEGRO_ERROR("Truncated A5BMP file.\n");
+      return false;
+   }
+
+   packed = al_malloc(header->data_size);
+   raw = al_malloc(raw_size);
+   ret = false;
+
+   if (packed && raw &&
+         al_fread(f, packed, header->data_size) == header->data_size) {
+      if (_al_lz4_decompress(packed, header->data_size, raw, raw_size)) {
+         copy_rows(lr, raw, pitch, row_size, rows);
+         ret = true;
+      }
+      else {
+         ALLEGRO_ERROR("Corrupt A5BMP compressed data.\n");
+      }
+   }
+
+   al_free(packed);
+   al_free(raw);
+   return ret;
+}
+
+
+
+ALLEGRO_BITMAP *_al_load_a5bmp_f(ALLEGRO_FILE *f, int flags)
+{
+   A5BMP_HEADER header;
+   ALLEGRO_BITMAP *bmp;
+   ALLEGRO_LOCKED_REGION *lr;
+   ALLEGRO_STATE state;
+   size_t row_size;
+   int rows;
+   int format;
+   ASSERT(f);
+   (void)flags;
+
+   if (!read_header(f, &header))
+      return NULL;
+
+   format = header.format;
+
+   if (!get_row_layout(format, header.width, header.height, &row_size, &rows)
+         || header.pitch < row_size) {
+      ALLEGRO_ERROR("Invalid A5BMP layout.\n");
+      return NULL;
+   }
+
+   /* The pixel data must be addressable, which may not be the case on 32-bit
+    * targets.
+    */
+   if (rows != 0 && header.pitch > SIZE_MAX / rows) {
+      ALLEGRO_ERROR("A5BMP pixel data too large.\n");
+      return NULL;
+   }
+
+   al_store_state(&state, ALLEGRO_STATE_NEW_BITMAP_PARAMETERS);
+   if (_al_pixel_format_is_video_only(format)) {
+      al_set_new_bitmap_flags((al_get_new_bitmap_flags() & ~ALLEGRO_MEMORY_BITMAP)
+         | ALLEGRO_VIDEO_BITMAP);
+   }
+   al_set_new_bitmap_format(format);
+   bmp = al_create_bitmap(header.width, header.height);
+   al_restore_state(&state);
+
+   if (!bmp) {
+      ALLEGRO_ERROR("Couldn't create bitmap.\n");
+      return NULL;
+   }
+
+   lr = lock_for_format(bmp, format, ALLEGRO_LOCK_WRITEONLY);
+   if (!lr) {
+      ALLEGRO_ERROR("Could not lock the bitmap.\n");
+      al_destroy_bitmap(bmp);
+      return NULL;
+   }
+
+   if (!read_pixels(f, &header, lr, row_size, rows)) {
+      ALLEGRO_ERROR("A5BMP file too short.\n");
+      al_unlock_bitmap(bmp);
+      al_destroy_bitmap(bmp);
+      return NULL;
+   }
+
+   al_unlock_bitmap(bmp);
+
+   return bmp;
+}
+
+
+
+/* Whether to compress saved files can be chosen with the a5bmp_compression
+ * key of the [image] section of the system configuration.
+ */
+static bool want_compression(void)
+{
+   const char *value = al_get_config_value(al_get_system_config(), "image",
+      "a5bmp_compression");
+   return value && 0 == _al_stricmp(value, "lz4");
+}
+
+
+
+bool _al_save_a5bmp_f(ALLEGRO_FILE *f, ALLEGRO_BITMAP *bmp)
+{
+   ALLEGRO_LOCKED_REGION *lr;
+   unsigned char *raw = NULL;
+   unsigned char *packed = NULL;
+   const unsigned char *data;
+   size_t row_size, raw_size, data_size;
+   uint32_t file_flags = A5BMP_NATIVE_FLAGS;
+   int format, w, h, rows, y;
+   bool ret;
+   ASSERT(f);
+   ASSERT(bmp);
+
+   format = al_get_bitmap_format(bmp);
+   w = al_get_bitmap_width(bmp);
+   h = al_get_bitmap_height(bmp);
+
+   if (!get_row_layout(format, w, h, &row_size, &rows)) {
+      ALLEGRO_ERROR("Bitmap dimensions don't fit its pixel format.\n");
+      return false;
+   }
+   /* The header stores the data size in 32 bits, which also keeps the size
+    * from overflowing below.
+    */
+   if (rows != 0 && row_size > UINT32_MAX / rows) {
+      ALLEGRO_ERROR("Bitmap too large for A5BMP.\n");
+      return false;
+   }
+   raw_size = row_size * rows;
+
+   lr = lock_for_format(bmp, format, ALLEGRO_LOCK_READONLY);
+   if (!lr) {
+      ALLEGRO_ERROR("Could not lock the bitmap.\n");
+      return false;
+   }
+
+   if (lr->pitch > 0 && (size_t)lr->pitch == row_size) {
+      data = lr->data;
+   }
+   else {
+      raw = al_malloc(raw_size);
+      if (!raw) {
+         al_unlock_bitmap(bmp);
+         return false;
+      }
+      for (y = 0; y < rows; y++) {
+         memcpy(raw + y * row_size,
+            (char *)lr->data + (intptr_t)y * lr->pitch, row_size);
+      }
+      data = raw;
+   }
+   data_size = raw_size;
+
+   if (want_compression()) {
+      size_t bound = _al_lz4_compress_bound(raw_size);
+      packed = al_malloc(bound);
+      if (packed) {
+         size_t packed_size = _al_lz4_compress(data, raw_size, packed, bound);
+         if (packed_size > 0 && packed_size < raw_size) {
+            data = packed;
+            data_size = packed_size;
+            file_flags |= A5BMP_FLAG_LZ4;
+         }
+      }
+   }
+
+   al_set_errno(0);
+
+   al_fwrite(f, A5BMP_MAGIC, 4);
+   al_fwrite32le(f, A5BMP_VERSION);
+   al_fwrite32le(f, file_flags);
+   al_fwrite32le(f, w);
+   al_fwrite32le(f, h);
+   al_fwrite32le(f, format);
+   al_fwrite32le(f, (int32_t)row_size);
+   al_fwrite32le(f, (int32_t)data_size);
+   ret = al_fwrite(f, data, data_size) == data_size;
+
+   al_unlock_bitmap(bmp);
+   al_free(raw);
+   al_free(packed);
+
+   return ret && !al_get_errno() && !al_ferror(f);
+}
+
+
+
+ALLEGRO_BITMAP *_al_load_a5bmp(const char *filename, int flags)
+{
+   ALLEGRO_FILE *f;
+   ALLEGRO_BITMAP *bmp;
+   ASSERT(filename);
+
+   f = al_fopen(filename, "rb");
+   if (!f)
+      return NULL;
+
+   bmp = _al_load_a5bmp_f(f, flags);
+
+   al_fclose(f);
+
+   return bmp;
+}
+
+
+
+bool _al_save_a5bmp(const char *filename, ALLEGRO_BITMAP *bmp)
+{
+   ALLEGRO_FILE *f;
+   bool retsave;
+   bool retclose;
+   ASSERT(filename);
+
+   f = al_fopen(filename, "wb");
+   if (!f)
+      return false;
+
+   retsave = _al_save_a5bmp_f(f, bmp);
+
+   retclose = al_fclose(f);
+
+   return retsave && retclose;
+}
+
+
+/* vim: set sts=3 sw=3 et: */
@@ -40,6 +40,11 @@ ALLEGRO_IIO_FUNC(bool, _al_save_tga_f, (ALLEGRO_FILE *f, ALLEGRO_BITMAP *bmp));
 ALLEGRO_IIO_FUNC(ALLEGRO_BITMAP *, _al_load_dds, (const char *filename, int flags));
 ALLEGRO_IIO_FUNC(ALLEGRO_BITMAP *, _al_load_dds_f, (ALLEGRO_FILE *f, int flags));
 
+ALLEGRO_IIO_FUNC(ALLEGRO_BITMAP *, _al_load_a5bmp, (const char *filename, int flags));
+ALLEGRO_IIO_FUNC(bool, _al_save_a5bmp, (const char *filename, ALLEGRO_BITMAP *bmp));
+ALLEGRO_IIO_FUNC(ALLEGRO_BITMAP *, _al_load_a5bmp_f, (ALLEGRO_FILE *f, int flags));
+ALLEGRO_IIO_FUNC(bool, _al_save_a5bmp_f, (ALLEGRO_FILE *f, ALLEGRO_BITMAP *bmp));
+
 #ifdef ALLEGRO_CFG_IIO_HAVE_GDIPLUS
 ALLEGRO_IIO_FUNC(bool, _al_init_gdiplus, (void));
 ALLEGRO_IIO_FUNC(void, _al_shutdown_gdiplus, (void));
@@ -159,6 +159,10 @@ typedef struct ALLEGRO_VERTEX_BUFFER ALLEGRO_VERTEX_BUFFER;
  */
 typedef struct ALLEGRO_INDEX_BUFFER ALLEGRO_INDEX_BUFFER;
 
+/* Type: ALLEGRO_SHAPE
+ */
+typedef struct ALLEGRO_SHAPE ALLEGRO_SHAPE;
+
 ALLEGRO_PRIM_FUNC(uint32_t, al_get_allegro_primitives_version, (void));
 
 /*
@@ -192,6 +196,15 @@ ALLEGRO_PRIM_FUNC(void*, al_lock_index_buffer, (ALLEGRO_INDEX_BUFFER* buffer, in
 ALLEGRO_PRIM_FUNC(void, al_unlock_index_buffer, (ALLEGRO_INDEX_BUFFER* buffer));
 ALLEGRO_PRIM_FUNC(int, al_get_index_buffer_size, (ALLEGRO_INDEX_BUFFER* buffer));
 
+/*
+ * Retained shapes
+ */
+ALLEGRO_PRIM_FUNC(ALLEGRO_SHAPE*, al_create_shape, (void));
+ALLEGRO_PRIM_FUNC(void, al_destroy_shape, (ALLEGRO_SHAPE* shape));
+ALLEGRO_PRIM_FUNC(void, al_begin_shape, (ALLEGRO_SHAPE* shape));
+ALLEGRO_PRIM_FUNC(void, al_end_shape, (void));
+ALLEGRO_PRIM_FUNC(int, al_draw_shape, (ALLEGRO_SHAPE* shape));
+
 /*
 * Utilities for high level primitives.
 */
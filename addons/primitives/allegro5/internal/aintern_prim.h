@@ -72,6 +72,10 @@ bool      _al_prim_are_points_equal(const float* point_a, const float* point_b);
 int _al_bitmap_region_is_locked(ALLEGRO_BITMAP* bmp, int x1, int y1, int x2, int y2);
 int _al_draw_buffer_common_soft(ALLEGRO_VERTEX_BUFFER* vertex_buffer, ALLEGRO_BITMAP* texture, ALLEGRO_INDEX_BUFFER* index_buffer, int start, int end, int type);
 
+/* Shape recording, see shape.c. */
+bool _al_init_shapes(void);
+bool _al_prim_record(const void* vtxs, const ALLEGRO_VERTEX_DECL* decl, ALLEGRO_BITMAP* texture, const int* indices, int start, int end, int type, int* num_primitives);
+
 #ifdef __cplusplus
 }
 #endif
@@ -17,6 +17,7 @@
  */
 
 
+#include <string.h>
 #include "allegro5/allegro.h"
 #include "allegro5/internal/aintern_bitmap.h"
 
@@ -100,178 +101,159 @@ static void convert_vtx(ALLEGRO_BITMAP* texture, const char* src, ALLEGRO_VERTEX
    }
 }
 
+/*
+Converts and transforms a run of consecutive vertices.  Doing a whole run at
+once keeps the transform in registers and lets the compiler vectorize the
+loop, which it can't do across calls to al_transform_coordinates.
+*/
+static void load_vertices(ALLEGRO_BITMAP* texture, const char* vtxptr, const ALLEGRO_VERTEX_DECL* decl,
+   int stride, const ALLEGRO_TRANSFORM* trans, ALLEGRO_VERTEX* dest, int count)
+{
+   const float m00 = trans->m[0][0];
+   const float m01 = trans->m[0][1];
+   const float m10 = trans->m[1][0];
+   const float m11 = trans->m[1][1];
+   const float m30 = trans->m[3][0];
+   const float m31 = trans->m[3][1];
+   int ii;
+
+   if (!decl) {
+      memcpy(dest, vtxptr, count * sizeof(ALLEGRO_VERTEX));
+   } else {
+      for (ii = 0; ii < count; ii++) {
+         convert_vtx(texture, vtxptr, &dest[ii], decl);
+         vtxptr += stride;
+      }
+   }
+
+   for (ii = 0; ii < count; ii++) {
+      const float x = dest[ii].x;
+      const float y = dest[ii].y;
+      dest[ii].x = x * m00 + y * m10 + m30;
+      dest[ii].y = x * m01 + y * m11 + m31;
+   }
+}
+
 int _al_draw_prim_soft(ALLEGRO_BITMAP* texture, const void* vtxs, const ALLEGRO_VERTEX_DECL* decl, int start, int end, int type)
 {
    LOCAL_VERTEX_CACHE;
    int num_primitives;
    int num_vtx;
-   int use_cache;
    int stride = decl ? decl->stride : (int)sizeof(ALLEGRO_VERTEX);
    const ALLEGRO_TRANSFORM* global_trans = al_get_current_transform();
    
    num_primitives = 0;
    num_vtx = end - start;
-   use_cache = num_vtx < ALLEGRO_VERTEX_CACHE_SIZE;
 
    if (texture)
       al_lock_bitmap(texture, ALLEGRO_PIXEL_FORMAT_ANY, ALLEGRO_LOCK_READONLY);
-      
-   if (use_cache) {
-      int ii;
-      int n = 0;
-      const char* vtxptr = (const char*)vtxs + start * stride;
-      for (ii = 0; ii < num_vtx; ii++) {
-         convert_vtx(texture, vtxptr, &vertex_cache[ii], decl);
-         al_transform_coordinates(global_trans, &vertex_cache[ii].x, &vertex_cache[ii].y);
-         n++;
-         vtxptr += stride;
-      }
-   }
-   
-#define SET_VERTEX(v, idx)                                             \
-   convert_vtx(texture, (const char*)vtxs + stride * (idx), &v, decl); \
-   al_transform_coordinates(global_trans, &v.x, &v.y);            \
-    
+
+   /*
+   Vertices are streamed through the vertex cache in chunks, so each one is
+   converted and transformed exactly once no matter how large the batch is.
+   Strips, loops and fans carry the vertices they still need over to the
+   start of the next chunk.
+   */
+#define LOAD_VERTICES(dest, first, count)                                        \
+   load_vertices(texture, (const char*)vtxs + stride * (first), decl, stride,    \
+      global_trans, dest, count)
+
    switch (type) {
       case ALLEGRO_PRIM_LINE_LIST: {
-         if (use_cache) {
-            int ii;
-            for (ii = 0; ii < num_vtx - 1; ii += 2) {
-               _al_line_2d(texture, &vertex_cache[ii], &vertex_cache[ii + 1]);
-            }
-         } else {
-            int ii;
-            for (ii = start; ii < end - 1; ii += 2) {
-               ALLEGRO_VERTEX v1, v2;
-               SET_VERTEX(v1, ii);
-               SET_VERTEX(v2, ii + 1);
-               
-               _al_line_2d(texture, &v1, &v2);
+         const int chunk = ALLEGRO_VERTEX_CACHE_SIZE - ALLEGRO_VERTEX_CACHE_SIZE % 2;
+         const int list_end = start + num_vtx / 2 * 2;
+         int ii, jj, n;
+         for (ii = start; ii < list_end; ii += n) {
+            n = _ALLEGRO_MIN(chunk, list_end - ii);
+            LOAD_VERTICES(vertex_cache, ii, n);
+            for (jj = 0; jj < n; jj += 2) {
+               _al_line_2d(texture, &vertex_cache[jj], &vertex_cache[jj + 1]);
             }
          }
          num_primitives = num_vtx / 2;
          break;
       };
-      case ALLEGRO_PRIM_LINE_STRIP: {
-         if (use_cache) {
-            int ii;
-            for (ii = 1; ii < num_vtx; ii++) {
-               _al_line_2d(texture, &vertex_cache[ii - 1], &vertex_cache[ii]);
-            }
-         } else {
-            int ii;
-            int idx = 1;
-            ALLEGRO_VERTEX vtx[2];
-            SET_VERTEX(vtx[0], start);
-            for (ii = start + 1; ii < end; ii++) {
-               SET_VERTEX(vtx[idx], ii)
-               _al_line_2d(texture, &vtx[0], &vtx[1]);
-               idx = 1 - idx;
-            }
-         }
-         num_primitives = num_vtx - 1;
-         break;
-      };
+      case ALLEGRO_PRIM_LINE_STRIP:
       case ALLEGRO_PRIM_LINE_LOOP: {
-         if (use_cache) {
-            int ii;
-            for (ii = 1; ii < num_vtx; ii++) {
-               _al_line_2d(texture, &vertex_cache[ii - 1], &vertex_cache[ii]);
+         ALLEGRO_VERTEX first;
+         int ii, jj, n;
+         if (num_vtx < 1)
+            break;
+         LOAD_VERTICES(vertex_cache, start, 1);
+         first = vertex_cache[0];
+         for (ii = start + 1; ii < end; ii += n) {
+            n = _ALLEGRO_MIN(ALLEGRO_VERTEX_CACHE_SIZE - 1, end - ii);
+            LOAD_VERTICES(&vertex_cache[1], ii, n);
+            for (jj = 1; jj <= n; jj++) {
+               _al_line_2d(texture, &vertex_cache[jj - 1], &vertex_cache[jj]);
             }
-            _al_line_2d(texture, &vertex_cache[num_vtx - 1], &vertex_cache[0]);
+            vertex_cache[0] = vertex_cache[n];
+         }
+         if (type == ALLEGRO_PRIM_LINE_LOOP) {
+            _al_line_2d(texture, &vertex_cache[0], &first);
+            num_primitives = num_vtx;
          } else {
-            int ii;
-            int idx = 1;
-            ALLEGRO_VERTEX vtx[2];
-            SET_VERTEX(vtx[0], start);
-            for (ii = start + 1; ii < end; ii++) {
-               SET_VERTEX(vtx[idx], ii)
-               _al_line_2d(texture, &vtx[idx], &vtx[1 - idx]);
-               idx = 1 - idx;
-            }
-            SET_VERTEX(vtx[idx], start)
-            _al_line_2d(texture, &vtx[idx], &vtx[1 - idx]);
+            num_primitives = num_vtx - 1;
          }
-         num_primitives = num_vtx;
          break;
       };
       case ALLEGRO_PRIM_TRIANGLE_LIST: {
-         if (use_cache) {
-            int ii;
-            for (ii = 0; ii < num_vtx - 2; ii += 3) {
-               _al_triangle_2d(texture, &vertex_cache[ii], &vertex_cache[ii + 1], &vertex_cache[ii + 2]);
-            }
-         } else {
-            int ii;
-            for (ii = start; ii < end - 2; ii += 3) {
-               ALLEGRO_VERTEX v1, v2, v3;
-               SET_VERTEX(v1, ii);
-               SET_VERTEX(v2, ii + 1);
-               SET_VERTEX(v3, ii + 2);
-               
-               _al_triangle_2d(texture, &v1, &v2, &v3);
+         const int chunk = ALLEGRO_VERTEX_CACHE_SIZE - ALLEGRO_VERTEX_CACHE_SIZE % 3;
+         const int list_end = start + num_vtx / 3 * 3;
+         int ii, jj, n;
+         for (ii = start; ii < list_end; ii += n) {
+            n = _ALLEGRO_MIN(chunk, list_end - ii);
+            LOAD_VERTICES(vertex_cache, ii, n);
+            for (jj = 0; jj < n; jj += 3) {
+               _al_triangle_2d(texture, &vertex_cache[jj], &vertex_cache[jj + 1], &vertex_cache[jj + 2]);
             }
          }
          num_primitives = num_vtx / 3;
          break;
       };
       case ALLEGRO_PRIM_TRIANGLE_STRIP: {
-         if (use_cache) {
-            int ii;
-            for (ii = 2; ii < num_vtx; ii++) {
-               _al_triangle_2d(texture, &vertex_cache[ii - 2], &vertex_cache[ii - 1], &vertex_cache[ii]);
-            }
-         } else {
-            int ii;
-            int idx = 2;
-            ALLEGRO_VERTEX vtx[3];
-            SET_VERTEX(vtx[0], start);
-            SET_VERTEX(vtx[1], start + 1);
-            for (ii = start + 2; ii < end; ii++) {
-               SET_VERTEX(vtx[idx], ii);
-               
-               _al_triangle_2d(texture, &vtx[0], &vtx[1], &vtx[2]);
-               idx = (idx + 1) % 3;
+         int ii, jj, n;
+         if (num_vtx < 3)
+            break;
+         LOAD_VERTICES(vertex_cache, start, 2);
+         for (ii = start + 2; ii < end; ii += n) {
+            n = _ALLEGRO_MIN(ALLEGRO_VERTEX_CACHE_SIZE - 2, end - ii);
+            LOAD_VERTICES(&vertex_cache[2], ii, n);
+            for (jj = 2; jj < n + 2; jj++) {
+               _al_triangle_2d(texture, &vertex_cache[jj - 2], &vertex_cache[jj - 1], &vertex_cache[jj]);
             }
+            vertex_cache[0] = vertex_cache[n];
+            vertex_cache[1] = vertex_cache[n + 1];
          }
          num_primitives = num_vtx - 2;
          break;
       };
       case ALLEGRO_PRIM_TRIANGLE_FAN: {
-         if (use_cache) {
-            int ii;
-            for (ii = 1; ii < num_vtx; ii++) {
-               _al_triangle_2d(texture, &vertex_cache[0], &vertex_cache[ii], &vertex_cache[ii - 1]);
-            }
-         } else {
-            int ii;
-            int idx = 1;
-            ALLEGRO_VERTEX v0;
-            ALLEGRO_VERTEX vtx[2];
-            SET_VERTEX(v0, start);
-            SET_VERTEX(vtx[0], start + 1);
-            for (ii = start + 1; ii < end; ii++) {
-               SET_VERTEX(vtx[idx], ii)
-               _al_triangle_2d(texture, &v0, &vtx[0], &vtx[1]);
-               idx = 1 - idx;
+         ALLEGRO_VERTEX v0;
+         int ii, jj, n;
+         if (num_vtx < 3)
+            break;
+         LOAD_VERTICES(vertex_cache, start, 2);
+         v0 = vertex_cache[0];
+         vertex_cache[0] = vertex_cache[1];
+         for (ii = start + 2; ii < end; ii += n) {
+            n = _ALLEGRO_MIN(ALLEGRO_VERTEX_CACHE_SIZE - 1, end - ii);
+            LOAD_VERTICES(&vertex_cache[1], ii, n);
+            for (jj = 1; jj <= n; jj++) {
+               _al_triangle_2d(texture, &v0, &vertex_cache[jj], &vertex_cache[jj - 1]);
             }
+            vertex_cache[0] = vertex_cache[n];
          }
          num_primitives = num_vtx - 2;
          break;
       };
       case ALLEGRO_PRIM_POINT_LIST: {
-         if (use_cache) {
-            int ii;
-            for (ii = 0; ii < num_vtx; ii++) {
-               _al_point_2d(texture, &vertex_cache[ii]);
-            }
-         } else {
-            int ii;
-            for (ii = start; ii < end; ii++) {
-               ALLEGRO_VERTEX v;
-               SET_VERTEX(v, ii);
-
-               _al_point_2d(texture, &v);
+         int ii, jj, n;
+         for (ii = start; ii < end; ii += n) {
+            n = _ALLEGRO_MIN(ALLEGRO_VERTEX_CACHE_SIZE, end - ii);
+            LOAD_VERTICES(vertex_cache, ii, n);
+            for (jj = 0; jj < n; jj++) {
+               _al_point_2d(texture, &vertex_cache[jj]);
             }
          }
          num_primitives = num_vtx;
@@ -283,13 +265,14 @@ int _al_draw_prim_soft(ALLEGRO_BITMAP* texture, const void* vtxs, const ALLEGRO_
        al_unlock_bitmap(texture);
    
    return num_primitives;
-#undef SET_VERTEX
+#undef LOAD_VERTICES
 }
 
 int _al_draw_prim_indexed_soft(ALLEGRO_BITMAP* texture, const void* vtxs, const ALLEGRO_VERTEX_DECL* decl,
    const int* indices, int num_vtx, int type)
 {
    LOCAL_VERTEX_CACHE;
+   ALLEGRO_VERTEX* cache = vertex_cache;
    int num_primitives;
    int use_cache;
    int min_idx, max_idx;
@@ -312,8 +295,18 @@ int _al_draw_prim_indexed_soft(ALLEGRO_BITMAP* texture, const void* vtxs, const
       else if (min_idx > indices[ii])
          min_idx = idx;
    }
+   /*
+   Meshes which don't fit in the vertex cache get one allocated for them, as
+   otherwise every vertex is transformed once for each primitive sharing it.
+   Sparse index ranges, which would need a huge cache for a few vertices,
+   and allocation failures use the per vertex path instead.
+   */
    if (max_idx - min_idx >= ALLEGRO_VERTEX_CACHE_SIZE) {
-      use_cache = 0;
+      cache = NULL;
+      if (max_idx - min_idx < num_vtx * 4)
+         cache = al_malloc((max_idx - min_idx + 1) * sizeof(ALLEGRO_VERTEX));
+      if (!cache)
+         use_cache = 0;
    }
 
    if (texture)
@@ -321,10 +314,19 @@ int _al_draw_prim_indexed_soft(ALLEGRO_BITMAP* texture, const void* vtxs, const
       
    if (use_cache) {
       int ii;
-      for (ii = 0; ii < num_vtx; ii++) {
-         int idx = indices[ii];
-         convert_vtx(texture, (const char*)vtxs + idx * stride, &vertex_cache[idx - min_idx], decl);
-         al_transform_coordinates(global_trans, &vertex_cache[idx - min_idx].x, &vertex_cache[idx - min_idx].y);
+      if (max_idx - min_idx < num_vtx) {
+         /*
+         Each vertex in the range is likely used, so do them all in one go
+         rather than once per reference.
+         */
+         load_vertices(texture, (const char*)vtxs + min_idx * stride, decl, stride,
+            global_trans, cache, max_idx - min_idx + 1);
+      } else {
+         for (ii = 0; ii < num_vtx; ii++) {
+            int idx = indices[ii];
+            convert_vtx(texture, (const char*)vtxs + idx * stride, &cache[idx - min_idx], decl);
+            al_transform_coordinates(global_trans, &cache[idx - min_idx].x, &cache[idx - min_idx].y);
+         }
       }
    }
    
@@ -340,7 +342,7 @@ int _al_draw_prim_indexed_soft(ALLEGRO_BITMAP* texture, const void* vtxs, const
                int idx1 = indices[ii] - min_idx;
                int idx2 = indices[ii + 1] - min_idx;
                
-               _al_line_2d(texture, &vertex_cache[idx1], &vertex_cache[idx2]);
+               _al_line_2d(texture, &cache[idx1], &cache[idx2]);
             }
          } else {
             int ii;
@@ -365,7 +367,7 @@ int _al_draw_prim_indexed_soft(ALLEGRO_BITMAP* texture, const void* vtxs, const
                int idx1 = indices[ii - 1] - min_idx;
                int idx2 = indices[ii] - min_idx;
                
-               _al_line_2d(texture, &vertex_cache[idx1], &vertex_cache[idx2]);
+               _al_line_2d(texture, &cache[idx1], &cache[idx2]);
             }
          } else {
             int ii;
@@ -390,12 +392,12 @@ int _al_draw_prim_indexed_soft(ALLEGRO_BITMAP* texture, const void* vtxs, const
                int idx1 = indices[ii - 1] - min_idx;
                int idx2 = indices[ii] - min_idx;
                
-               _al_line_2d(texture, &vertex_cache[idx1], &vertex_cache[idx2]);
+               _al_line_2d(texture, &cache[idx1], &cache[idx2]);
             }
             idx1 = indices[0] - min_idx;
             idx2 = indices[num_vtx - 1] - min_idx;
             
-            _al_line_2d(texture, &vertex_cache[idx2], &vertex_cache[idx1]);
+            _al_line_2d(texture, &cache[idx2], &cache[idx1]);
          } else {
             int ii;
             int idx = 1;
@@ -419,7 +421,7 @@ int _al_draw_prim_indexed_soft(ALLEGRO_BITMAP* texture, const void* vtxs, const
                int idx1 = indices[ii] - min_idx;
                int idx2 = indices[ii + 1] - min_idx;
                int idx3 = indices[ii + 2] - min_idx;
-               _al_triangle_2d(texture, &vertex_cache[idx1], &vertex_cache[idx2], &vertex_cache[idx3]);
+               _al_triangle_2d(texture, &cache[idx1], &cache[idx2], &cache[idx3]);
             }
          } else {
             int ii;
@@ -446,7 +448,7 @@ int _al_draw_prim_indexed_soft(ALLEGRO_BITMAP* texture, const void* vtxs, const
                int idx1 = indices[ii - 2] - min_idx;
                int idx2 = indices[ii - 1] - min_idx;
                int idx3 = indices[ii] - min_idx;
-               _al_triangle_2d(texture, &vertex_cache[idx1], &vertex_cache[idx2], &vertex_cache[idx3]);
+               _al_triangle_2d(texture, &cache[idx1], &cache[idx2], &cache[idx3]);
             }
          } else {
             int ii;
@@ -471,7 +473,7 @@ int _al_draw_prim_indexed_soft(ALLEGRO_BITMAP* texture, const void* vtxs, const
             for (ii = 1; ii < num_vtx; ii++) {
                int idx1 = indices[ii] - min_idx;
                int idx2 = indices[ii - 1] - min_idx;
-               _al_triangle_2d(texture, &vertex_cache[idx0], &vertex_cache[idx1], &vertex_cache[idx2]);
+               _al_triangle_2d(texture, &cache[idx0], &cache[idx1], &cache[idx2]);
             }
          } else {
             int ii;
@@ -494,7 +496,7 @@ int _al_draw_prim_indexed_soft(ALLEGRO_BITMAP* texture, const void* vtxs, const
             int ii;
             for (ii = 0; ii < num_vtx; ii++) {
                int idx = indices[ii] - min_idx;
-               _al_point_2d(texture, &vertex_cache[idx]);
+               _al_point_2d(texture, &cache[idx]);
             }
          } else {
             int ii;
@@ -512,6 +514,9 @@ int _al_draw_prim_indexed_soft(ALLEGRO_BITMAP* texture, const void* vtxs, const
 
    if(texture)
        al_unlock_bitmap(texture);
+
+   if (cache != vertex_cache)
+      al_free(cache);
    
    return num_primitives;
 #undef SET_VERTEX
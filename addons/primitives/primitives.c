@@ -47,6 +47,7 @@ bool al_init_primitives_addon(void)
 {
    bool ret = true;
    ret &= _al_init_d3d_driver();
+   ret &= _al_init_shapes();
    
    addon_initialized = ret;
    
@@ -77,6 +78,9 @@ int al_draw_prim(const void* vtxs, const ALLEGRO_VERTEX_DECL* decl,
    ASSERT(start >= 0);
    ASSERT(type >= 0 && type < ALLEGRO_PRIM_NUM_TYPES);
 
+   if (_al_prim_record(vtxs, decl, texture, NULL, start, end, type, &ret))
+      return ret;
+
    target = al_get_target_bitmap();
 
    /* In theory, if we ever get a camera concept for this addon, the transformation into
@@ -113,6 +117,9 @@ int al_draw_indexed_prim(const void* vtxs, const ALLEGRO_VERTEX_DECL* decl,
    ASSERT(num_vtx > 0);
    ASSERT(type >= 0 && type < ALLEGRO_PRIM_NUM_TYPES);
 
+   if (_al_prim_record(vtxs, decl, texture, indices, 0, num_vtx, type, &ret))
+      return ret;
+
    target = al_get_target_bitmap();
    
    /* In theory, if we ever get a camera concept for this addon, the transformation into
@@ -0,0 +1,447 @@
+/*         ______   ___    ___
+ *        /\  _  \ /\_ \  /\_ \
+ *        \ \ \L\ \\//\ \ \//\ \      __     __   _ __   ___
+ *         \ \  __ \ \ \ \  \ \ \   /'__`\ /'_ `\/\`'__\/ __`\
+ *          \ \ \/\ \ \_\ \_ \_\ \_/\  __//\ \L\ \ \ \//\ \L\ \
+ *           \ \_\ \_\/\____\/\____\ \____\ \____ \ \_\\ \____/
+ *            \/_/\/_/\/____/\/____/\/____/\/___L\ \/_/ \/___/
+ *                                           /\____/
+ *                                           \_/__/
+ *
+ *      Retained shapes.
+ *
+ *      Primitives drawn between al_begin_shape and al_end_shape are
+ *      captured instead of being drawn.  Everything is converted to
+ *      indexed lists so that consecutive primitives of the same kind can
+ *      be drawn with one call, and uploaded to vertex and index buffers
+ *      when the display supports them.
+ *
+ *      See readme.txt for copyright information.
+ */
+
+#include "allegro5/allegro.h"
+#include "allegro5/allegro_primitives.h"
+#include "allegro5/internal/aintern.h"
+#include "allegro5/internal/aintern_bitmap.h"
+#include "allegro5/internal/aintern_pixels.h"
+#include "allegro5/internal/aintern_prim.h"
+#include "allegro5/internal/aintern_tls.h"
+
+ALLEGRO_DEBUG_CHANNEL("primitives")
+
+typedef struct SHAPE_BATCH {
+   int type;   /* TRIANGLE_LIST, LINE_LIST or POINT_LIST */
+   ALLEGRO_BITMAP *texture;
+   int start;  /* Range in the index array */
+   int end;
+} SHAPE_BATCH;
+
+struct ALLEGRO_SHAPE {
+   ALLEGRO_VERTEX *vtx;
+   int num_vtx;
+   int vtx_capacity;
+
+   int *idx;
+   int num_idx;
+   int idx_capacity;
+
+   SHAPE_BATCH *batches;
+   int num_batches;
+   int batch_capacity;
+
+   /* Only valid on the display that created them. */
+   ALLEGRO_DISPLAY *display;
+   ALLEGRO_VERTEX_BUFFER *vertex_buffer;
+   ALLEGRO_INDEX_BUFFER *index_buffer;
+};
+
+/* Thread local slot holding the shape being recorded on each thread. */
+static int recording_shape_slot = -1;
+
+
+/* Internal function: _al_init_shapes
+ *  Claims the thread local slot for recording shapes, once.
+ */
+bool _al_init_shapes(void)
+{
+   if (recording_shape_slot < 0)
+      recording_shape_slot = _al_tls_new_addon_slot();
+   return recording_shape_slot >= 0;
+}
+
+
+static ALLEGRO_SHAPE *get_recording_shape(void)
+{
+   if (recording_shape_slot < 0)
+      return NULL;
+   return *_al_tls_get_addon_slot(recording_shape_slot);
+}
+
+
+static void set_recording_shape(ALLEGRO_SHAPE *shape)
+{
+   ASSERT(recording_shape_slot >= 0);
+   *_al_tls_get_addon_slot(recording_shape_slot) = shape;
+}
+
+
+static bool grow(void **array, int *capacity, int needed, size_t item_size)
+{
+   int new_capacity;
+   void *new_array;
+
+   if (needed <= *capacity)
+      return true;
+
+   new_capacity = *capacity ? *capacity : 64;
+   while (new_capacity < needed)
+      new_capacity *= 2;
+
+   new_array = al_realloc(*array, new_capacity * item_size);
+   if (!new_array)
+      return false;
+
+   *array = new_array;
+   *capacity = new_capacity;
+   return true;
+}
+
+
+static void destroy_buffers(ALLEGRO_SHAPE *shape)
+{
+   if (shape->vertex_buffer) {
+      al_destroy_vertex_buffer(shape->vertex_buffer);
+      shape->vertex_buffer = NULL;
+   }
+   if (shape->index_buffer) {
+      al_destroy_index_buffer(shape->index_buffer);
+      shape->index_buffer = NULL;
+   }
+   shape->display = NULL;
+}
+
+
+/* Function: al_create_shape
+ */
+ALLEGRO_SHAPE *al_create_shape(void)
+{
+   return al_calloc(1, sizeof(ALLEGRO_SHAPE));
+}
+
+
+/* Function: al_destroy_shape
+ */
+void al_destroy_shape(ALLEGRO_SHAPE *shape)
+{
+   if (!shape)
+      return;
+
+   if (get_recording_shape() == shape)
+      set_recording_shape(NULL);
+
+   destroy_buffers(shape);
+   al_free(shape->vtx);
+   al_free(shape->idx);
+   al_free(shape->batches);
+   al_free(shape);
+}
+
+
+/* Function: al_begin_shape
+ */
+void al_begin_shape(ALLEGRO_SHAPE *shape)
+{
+   ASSERT(shape);
+   ASSERT(!get_recording_shape());
+
+   destroy_buffers(shape);
+   shape->num_vtx = 0;
+   shape->num_idx = 0;
+   shape->num_batches = 0;
+
+   set_recording_shape(shape);
+}
+
+
+/* Upload the recorded geometry to the current display, if it can take it.
+ * The arrays are kept around for drawing to memory bitmaps and for
+ * drawing the shape into another shape.
+ */
+static void upload_shape(ALLEGRO_SHAPE *shape)
+{
+   ALLEGRO_DISPLAY *display = al_get_current_display();
+   int index_size;
+   void *idx;
+   int ii;
+
+   if (!display || shape->num_idx == 0)
+      return;
+
+   shape->vertex_buffer = al_create_vertex_buffer(NULL, shape->vtx,
+      shape->num_vtx, ALLEGRO_PRIM_BUFFER_STATIC);
+   if (!shape->vertex_buffer)
+      return;
+
+   if (shape->num_vtx <= 65536) {
+      unsigned short *short_idx = al_malloc(shape->num_idx * sizeof(*short_idx));
+      if (!short_idx) {
+         destroy_buffers(shape);
+         return;
+      }
+      for (ii = 0; ii < shape->num_idx; ii++)
+         short_idx[ii] = (unsigned short)shape->idx[ii];
+      index_size = 2;
+      idx = short_idx;
+   }
+   else {
+      index_size = 4;
+      idx = shape->idx;
+   }
+
+   shape->index_buffer = al_create_index_buffer(index_size, idx,
+      shape->num_idx, ALLEGRO_PRIM_BUFFER_STATIC);
+   if (idx != shape->idx)
+      al_free(idx);
+
+   if (!shape->index_buffer) {
+      ALLEGRO_DEBUG("Could not create an index buffer, drawing shape %p from memory.\n", shape);
+      destroy_buffers(shape);
+      return;
+   }
+
+   shape->display = display;
+}
+
+
+/* Function: al_end_shape
+ */
+void al_end_shape(void)
+{
+   ALLEGRO_SHAPE *shape = get_recording_shape();
+   ASSERT(shape);
+
+   set_recording_shape(NULL);
+   if (!shape)
+      return;
+
+   upload_shape(shape);
+}
+
+
+/* Append the indices of a primitive made from the `count` vertices at
+ * `base` to the shape, converted to the equivalent list type.  The
+ * triangle and line orders match those of the software renderer.
+ */
+static bool append_indices(ALLEGRO_SHAPE *shape, int base, int count,
+   int type, int *list_type, int *num_primitives)
+{
+   int *idx;
+   int num_idx;
+   int ii;
+
+   switch (type) {
+      case ALLEGRO_PRIM_LINE_LIST:
+         *list_type = ALLEGRO_PRIM_LINE_LIST;
+         *num_primitives = count / 2;
+         break;
+      case ALLEGRO_PRIM_LINE_STRIP:
+         *list_type = ALLEGRO_PRIM_LINE_LIST;
+         *num_primitives = count > 0 ? count - 1 : 0;
+         break;
+      case ALLEGRO_PRIM_LINE_LOOP:
+         *list_type = ALLEGRO_PRIM_LINE_LIST;
+         *num_primitives = count;
+         break;
+      case ALLEGRO_PRIM_TRIANGLE_LIST:
+         *list_type = ALLEGRO_PRIM_TRIANGLE_LIST;
+         *num_primitives = count / 3;
+         break;
+      case ALLEGRO_PRIM_TRIANGLE_STRIP:
+      case ALLEGRO_PRIM_TRIANGLE_FAN:
+         *list_type = ALLEGRO_PRIM_TRIANGLE_LIST;
+         *num_primitives = count > 2 ? count - 2 : 0;
+         break;
+      case ALLEGRO_PRIM_POINT_LIST:
+         *list_type = ALLEGRO_PRIM_POINT_LIST;
+         *num_primitives = count;
+         break;
+      default:
+         ASSERT(false);
+         return false;
+   }
+
+   num_idx = *num_primitives;
+   if (*list_type == ALLEGRO_PRIM_LINE_LIST)
+      num_idx *= 2;
+   else if (*list_type == ALLEGRO_PRIM_TRIANGLE_LIST)
+      num_idx *= 3;
+
+   if (!grow((void **)&shape->idx, &shape->idx_capacity,
+         shape->num_idx + num_idx, sizeof(int)))
+      return false;
+
+   idx = shape->idx + shape->num_idx;
+
+   switch (type) {
+      case ALLEGRO_PRIM_LINE_LIST:
+      case ALLEGRO_PRIM_TRIANGLE_LIST:
+      case ALLEGRO_PRIM_POINT_LIST:
+         for (ii = 0; ii < num_idx; ii++)
+            *idx++ = base + ii;
+         break;
+      case ALLEGRO_PRIM_LINE_STRIP:
+      case ALLEGRO_PRIM_LINE_LOOP:
+         for (ii = 1; ii < count; ii++) {
+            *idx++ = base + ii - 1;
+            *idx++ = base + ii;
+         }
+         if (type == ALLEGRO_PRIM_LINE_LOOP && count > 0) {
+            *idx++ = base + count - 1;
+            *idx++ = base;
+         }
+         break;
+      case ALLEGRO_PRIM_TRIANGLE_STRIP:
+         for (ii = 2; ii < count; ii++) {
+            *idx++ = base + ii - 2;
+            *idx++ = base + ii - 1;
+            *idx++ = base + ii;
+         }
+         break;
+      case ALLEGRO_PRIM_TRIANGLE_FAN:
+         for (ii = 2; ii < count; ii++) {
+            *idx++ = base;
+            *idx++ = base + ii;
+            *idx++ = base + ii - 1;
+         }
+         break;
+   }
+
+   shape->num_idx += num_idx;
+   return true;
+}
+
+
+static bool append_batch(ALLEGRO_SHAPE *shape, ALLEGRO_BITMAP *texture,
+   int type, int start, int end)
+{
+   SHAPE_BATCH *batch;
+
+   if (start == end)
+      return true;
+
+   if (shape->num_batches > 0) {
+      batch = &shape->batches[shape->num_batches - 1];
+      if (batch->type == type && batch->texture == texture && batch->end == start) {
+         batch->end = end;
+         return true;
+      }
+   }
+
+   if (!grow((void **)&shape->batches, &shape->batch_capacity,
+         shape->num_batches + 1, sizeof(SHAPE_BATCH)))
+      return false;
+
+   batch = &shape->batches[shape->num_batches++];
+   batch->type = type;
+   batch->texture = texture;
+   batch->start = start;
+   batch->end = end;
+   return true;
+}
+
+
+/* Internal function: _al_prim_record
+ *  If a shape is being recorded on this thread, add the primitive to it
+ *  and return true, storing the number of primitives it would have drawn
+ *  in `num_primitives`.  Only vertices of the default ALLEGRO_VERTEX
+ *  layout can be recorded.  When `indices` is not NULL the vertices it
+ *  refers to are recorded in the order given, and `start` is ignored.
+ */
+bool _al_prim_record(const void *vtxs, const ALLEGRO_VERTEX_DECL *decl,
+   ALLEGRO_BITMAP *texture, const int *indices, int start, int end,
+   int type, int *num_primitives)
+{
+   ALLEGRO_SHAPE *shape = get_recording_shape();
+   const ALLEGRO_VERTEX *vtx = vtxs;
+   int base, first_idx, list_type;
+   int count = end - start;
+   int ii;
+
+   *num_primitives = 0;
+
+   if (!shape || decl)
+      return false;
+
+   if (!grow((void **)&shape->vtx, &shape->vtx_capacity,
+         shape->num_vtx + count, sizeof(ALLEGRO_VERTEX)))
+      return true;
+
+   base = shape->num_vtx;
+   if (indices) {
+      for (ii = 0; ii < count; ii++)
+         shape->vtx[base + ii] = vtx[indices[ii]];
+   }
+   else {
+      memcpy(shape->vtx + base, vtx + start, count * sizeof(ALLEGRO_VERTEX));
+   }
+
+   first_idx = shape->num_idx;
+   if (!append_indices(shape, base, count, type, &list_type, num_primitives))
+      return true;
+
+   if (!append_batch(shape, texture, list_type, first_idx, shape->num_idx)) {
+      shape->num_idx = first_idx;
+      *num_primitives = 0;
+      return true;
+   }
+
+   shape->num_vtx += count;
+   return true;
+}
+
+
+static bool can_use_buffers(ALLEGRO_SHAPE *shape, ALLEGRO_BITMAP *target,
+   ALLEGRO_BITMAP *texture)
+{
+   if (!shape->vertex_buffer || get_recording_shape())
+      return false;
+
+   if (al_get_bitmap_flags(target) & ALLEGRO_MEMORY_BITMAP ||
+       (texture && al_get_bitmap_flags(texture) & ALLEGRO_MEMORY_BITMAP) ||
+       _al_pixel_format_is_compressed(al_get_bitmap_format(target)))
+      return false;
+
+   return _al_get_bitmap_display(target) == shape->display;
+}
+
+
+/* Function: al_draw_shape
+ */
+int al_draw_shape(ALLEGRO_SHAPE *shape)
+{
+   ALLEGRO_BITMAP *target;
+   int ret = 0;
+   int ii;
+
+   ASSERT(shape);
+   ASSERT(shape != get_recording_shape());
+
+   target = al_get_target_bitmap();
+
+   for (ii = 0; ii < shape->num_batches; ii++) {
+      const SHAPE_BATCH *batch = &shape->batches[ii];
+
+      if (can_use_buffers(shape, target, batch->texture)) {
+         ret += al_draw_indexed_buffer(shape->vertex_buffer, batch->texture,
+            shape->index_buffer, batch->start, batch->end, batch->type);
+      }
+      else {
+         ret += al_draw_indexed_prim(shape->vtx, NULL, batch->texture,
+            shape->idx + batch->start, batch->end - batch->start, batch->type);
+      }
+   }
+
+   return ret;
+}
+
+/* vim: set sts=3 sw=3 et: */
@@ -20,791 +20,754 @@
 # include "allegro5/allegro.h"
 # include "allegro5/allegro_primitives.h"
 # include "allegro5/internal/aintern_prim.h"
-# include "allegro5/internal/aintern_list.h"
-# include <float.h>
 # include <math.h>
+# include <stdlib.h>
+# include <string.h>
 
+ALLEGRO_DEBUG_CHANNEL("primitives")
 
-# define POLY_DEBUG 0
 
+/*
+ *  The polygon is triangulated in two passes, following chapter 3 of
+ *  "Computational Geometry: Algorithms and Applications" by de Berg et al.
+ *
+ *  First a line is swept from top to bottom over the vertices, adding
+ *  diagonals which split the polygon into pieces that are monotone in y.
+ *  Holes need no special treatment here: their vertices are simply swept
+ *  along with the outline.  Then the pieces are walked one by one and
+ *  triangulated in linear time each.
+ *
+ *  Everything lives in flat arrays carved from a single allocation.  The
+ *  sweep status holds the edges crossed by the sweep line, which can be
+ *  a large part of the polygon (think of a comb), so it is kept in a treap
+ *  rather than a sorted array.  Together with sorting the vertices that
+ *  makes the whole triangulation O(n log n).
+ *
+ *  Input which is not a simple polygon, such as self-intersecting outlines
+ *  or holes crossing the outline, is triangulated as far as possible, but
+ *  reported as a failure.
+ */
 
-/* */
-# define POLY_VERTEX_ATTR_REFLEX      0x0001
-# define POLY_VERTEX_ATTR_EAR_CLIP    0x0002
-# define POLY_VERTEX_ATTR_ALL         (POLY_VERTEX_ATTR_REFLEX | POLY_VERTEX_ATTR_EAR_CLIP)
-
-
-typedef void (*POLY_EMIT_TRIANGLE)(int, int, int, void*);
-
-typedef struct POLY {
-   const float*            vertex_buffer;
-   size_t                  vertex_stride;
-   size_t                  vertex_count;
-   const int*              split_indices;
-   size_t                  split_stride;
-   size_t                  split_count;
-   POLY_EMIT_TRIANGLE      emit;
-   void*                   userdata;
-   _AL_LIST*               vertex_list;
-   _AL_LIST*               reflex_list;
-   _AL_LIST*               ear_list;
-} POLY;
 
-typedef struct POLY_SPLIT {
-   int      begin;
-   size_t   size;
-   float*   point;
-   int      max_index;
-} POLY_SPLIT;
+/* Vertex types, as seen by the sweep line. */
+# define POLY_START     0
+# define POLY_END       1
+# define POLY_SPLIT     2
+# define POLY_MERGE     3
+# define POLY_REGULAR   4
+# define POLY_REMOVED   5
 
+/* Chains of a monotone piece. */
+# define POLY_LEFT      0
+# define POLY_RIGHT     1
 
-# if POLY_DEBUG
-typedef void (*poly_debug_draw_text_t)(float x, float y, int line, const char* format, ...);
+/* Parent of edges which are not in the sweep status. */
+# define POLY_NOT_IN_STATUS   -2
 
-#if defined _MSC_VER
-#define EXPORT __declspec(dllexport)
-#else
-#define EXPORT
-#define __noop ((void)0)
-#endif
 
-EXPORT int                     g_poly_debug_split_step      = -1;
-EXPORT int                     g_poly_debug_step            = -1;
-EXPORT int                     g_poly_debug_step_current    = 0;
-EXPORT poly_debug_draw_text_t  g_poly_debug_draw_text       = NULL;
-EXPORT float                   g_poly_debug_scale           = 1.0f;
+typedef void (*POLY_EMIT_TRIANGLE)(int, int, int, void*);
 
-#undef EXPORT
+typedef struct POLY_KEY {
+   float    y;
+   float    x;
+   int      index;
+} POLY_KEY;
 
-# define POLY_DEBUG_TEXT(x,y,...)            (g_poly_debug_draw_text ? g_poly_debug_draw_text(x,y,INT_MAX,__VA_ARGS__) : __noop)
-# define POLY_DEBUG_TEXT_LINE(x,y,line,...)  (g_poly_debug_draw_text ? g_poly_debug_draw_text(x,y,line,__VA_ARGS__)    : __noop)
+typedef struct POLY {
+   int                  vertex_count;
+   POLY_EMIT_TRIANGLE   emit;
+   void*                userdata;
 
-# endif
+   /* Vertex coordinates, with y pointing up. */
+   float*               x;
+   float*               y;
 
+   /* Neighbours of each vertex, such that the inside of the polygon is
+    * always to the left of the edge from a vertex to its next one.  The
+    * edges are identified by the index of the vertex they start at.
+    */
+   int*                 prev;
+   int*                 next;
+   char*                type;
 
-/* Internal functions. */
-static bool      poly_initialize(POLY* poly);
-static void      poly_classify_vertices(_AL_LIST* vertices, _AL_LIST* reflex, _AL_LIST* ear);
-static void      poly_classify_vertices_in_range(_AL_LIST_ITEM* begin, _AL_LIST_ITEM* end, _AL_LIST* vertices, _AL_LIST* reflex, _AL_LIST* ear);
-static void      poly_do_triangulate(POLY* poly);
+   /* Sweep line status: left edges crossed by the sweep line, in a treap
+    * ordered from left to right, and the helper of every edge.  Edges not
+    * in the status have a parent of POLY_NOT_IN_STATUS.
+    */
+   POLY_KEY*            order;
+   int*                 status_left;
+   int*                 status_right;
+   int*                 status_parent;
+   int                  status_root;
+   int*                 helper;
+
+   /* Diagonals, as pairs of vertex indices. */
+   int*                 diagonals;
+   int                  diagonal_count;
+
+   /* Half-edges: one for every polygon edge (identified as above) followed
+    * by two for every diagonal.  Diagonal half-edges are also grouped by the
+    * vertex they start at.
+    */
+   char*                visited;
+   int*                 out_start;
+   int*                 out_edges;
 
-static _AL_LIST* poly_create_split_list(POLY* polygon);
-static void      poly_split_list_dtor(void* user_data);
+   /* Twice the area inside the polygon, and twice the area of the
+    * triangles emitted so far.  They only differ if the input was not
+    * simple.
+    */
+   double               area;
+   double               covered;
+
+   /* Scratch space for the monotone pieces. */
+   int*                 face;
+   int*                 sorted;
+   char*                side;
+   int*                 stack;
+} POLY;
 
 
-/*
- *  Seek for closest intersection point of polygon with a ray directed
- *  to the right.
- *
- *  Returns true if intersection was found. 'point', 'edge0' and 'edge1'
- *  are set to proper values (if not NULL).
- *  Returns false if intersection was not fount and none of above
- *  are modified.
- */
-static bool poly_find_closest_intersection(_AL_LIST* vertices, const float* vertex, float* point, _AL_LIST_ITEM** edge0, _AL_LIST_ITEM** edge1)
+static bool poly_above(const POLY* poly, int a, int b)
 {
-   size_t i;
-   const float* v0 = NULL;
-   float v1[2];
-   float intersection[2];
-   float t0, t1;
-   float best_point[2] = {0, 0};
-   float best_t;
-   _AL_LIST_ITEM* item = NULL;
-   _AL_LIST_ITEM* next = NULL;
-   _AL_LIST_ITEM* best_e0 = NULL;
-   _AL_LIST_ITEM* best_e1 = NULL;
-
-   /* Assemble line pointing to the right. */
-   v0    = vertex;
-   v1[0] = v0[0] + 1.0f;
-   v1[1] = v0[1];
-
-   /* Seek for the closest intersection. */
-   best_t = FLT_MAX;
-   item = _al_list_front(vertices);
-   next = _al_list_next_circular(vertices, item);
-   for (i = 0; i < _al_list_size(vertices); ++i, item = next, next = _al_list_next_circular(vertices, next)) {
-
-      float* p0 = (float*)_al_list_item_data(item);
-      float* p1 = (float*)_al_list_item_data(next);
-
-      /* Perform quick rejection.
-       *
-       * We are interested only with outer edges. That mean only those
-       * whose go from the bottom to the up. Note we cannot intersect
-       * parallel line.
-       *
-       * Second condition reject edges lying completely on the left
-       * side of ray origin.
-       */
-      if ((p0[1] < p1[1]) || (p0[0] <= vertex[0] && p1[0] <= vertex[0]))
-         continue;
-
-      if (_al_prim_intersect_segment(v0, v1, p0, p1, intersection, &t0, &t1) && (t1 >= 0.0f) && (t1 <= 1.0f) && (t0 >= 0.0f) && (t0 < best_t)) {
-
-         best_t        = t0;
-         best_point[0] = intersection[0];
-         best_point[1] = intersection[1];
-         best_e0       = item;
-         best_e1       = next;
-      }
-   }
-
-   if (NULL != best_e0) {
-
-      if (NULL != point) {
-
-         point[0] = best_point[0];
-         point[1] = best_point[1];
-      }
+   if (poly->y[a] != poly->y[b])
+      return poly->y[a] > poly->y[b];
+   if (poly->x[a] != poly->x[b])
+      return poly->x[a] < poly->x[b];
+   return a < b;
+}
 
-      if (NULL != edge0)
-         *edge0 = best_e0;
 
-      if (NULL != edge1)
-         *edge1 = best_e1;
+static int poly_compare_keys(const void* a, const void* b)
+{
+   const POLY_KEY* ka = (const POLY_KEY*)a;
+   const POLY_KEY* kb = (const POLY_KEY*)b;
+
+   /* Same order as poly_above, topmost first. */
+   if (ka->y != kb->y)
+      return ka->y > kb->y ? -1 : 1;
+   if (ka->x != kb->x)
+      return ka->x < kb->x ? -1 : 1;
+   return ka->index - kb->index;
+}
 
-# if POLY_DEBUG
-      //al_draw_line(v0[0], v0[1], point[0], point[1], al_map_rgb(255, 0, 0), 0.0f);
-# endif
 
-      return true;
-   }
-   else
-      return false;
+/* Twice the signed area of triangle abc, positive if it turns left. */
+static double poly_orient(const POLY* poly, int a, int b, int c)
+{
+   double abx = (double)poly->x[b] - poly->x[a];
+   double aby = (double)poly->y[b] - poly->y[a];
+   double acx = (double)poly->x[c] - poly->x[a];
+   double acy = (double)poly->y[c] - poly->y[a];
+   return abx * acy - aby * acx;
 }
 
 
 /*
- *  Seek for the best vertex in polygon for doing split.
- *
- *  Returns vertex after which split (hole) vertices
- *  can be inserted.
+ *  Allocate all arrays needed to triangulate a polygon with the given
+ *  number of vertices.
  */
-static _AL_LIST_ITEM* poly_find_outter_split_vertex(POLY* polygon, POLY_SPLIT* split)
+static void* poly_allocate(POLY* poly, int n)
 {
-   float intersection[2];
-   _AL_LIST_ITEM* edge_vertex_0;
-   _AL_LIST_ITEM* edge_vertex_1;
-   _AL_LIST_ITEM* vertex;
-   _AL_LIST_ITEM* reflex_item;
-   _AL_LIST_ITEM* best_vertex;
-   float  best_distance;
-   float* p0;
-   float* p1;
-   float* p;
-
-   if (!poly_find_closest_intersection(polygon->vertex_list, split->point, intersection, &edge_vertex_0, &edge_vertex_1))
+   /* Every vertex adds at most two diagonals, each of which adds two
+    * half-edges and appears twice in the monotone pieces.
+    */
+   const int max_diagonals = 2 * n;
+   const int max_half_edges = n + 2 * max_diagonals;
+   size_t size;
+   char* block;
+   char* p;
+
+   size  = n * sizeof(POLY_KEY);
+   size += 2 * n * sizeof(float);
+   size += (7 * n + 1) * sizeof(int);
+   size += 2 * max_diagonals * sizeof(int);
+   size += 2 * max_diagonals * sizeof(int);
+   size += 3 * max_half_edges * sizeof(int);
+   size += n + 2 * max_half_edges;
+
+   block = al_malloc(size);
+   if (!block)
       return NULL;
 
-   p0 = (float*)_al_list_item_data(edge_vertex_0);
-   p1 = (float*)_al_list_item_data(edge_vertex_1);
-
-   /* Maybe we hit an edge vertex? */
-   if (_al_prim_are_points_equal(split->point, p0))
-      return edge_vertex_0;
-
-   if (_al_prim_are_points_equal(split->point, p1))
-      return edge_vertex_1;
-
-   /* No luck. Pick point which most far away from us. */
-   if (p0[0] > p1[0]) {
-
-      vertex = edge_vertex_0;
-      p      = p0;
-   }
-   else {
-
-      vertex = edge_vertex_1;
-      p      = p1;
-   }
-
-   /* Seek in reflex vertices. */
-   best_vertex = NULL;
-   best_distance = FLT_MAX;
-
-   for (reflex_item = _al_list_front(polygon->reflex_list); reflex_item; reflex_item = _al_list_next(polygon->reflex_list, reflex_item)) {
-
-      _AL_LIST_ITEM* reflex_vertex = (_AL_LIST_ITEM*)_al_list_item_data(reflex_item);
-
-      float* reflex_point = (float*)_al_list_item_data(reflex_vertex);
-
-      if (_al_prim_is_point_in_triangle(reflex_point, split->point, p, intersection)) {
-
-         float diff_x = reflex_point[0] - split->point[0];
-         float diff_y = reflex_point[1] - split->point[1];
-
-         float dist = diff_x * diff_x + diff_y * diff_y;
-
-         if (dist < best_distance) {
-
-            best_distance = dist;
-            best_vertex   = reflex_vertex;
-         }
-      }
-   }
-
-   if (NULL != best_vertex)
-      vertex = best_vertex;
-
-//# if POLY_DEBUG
-//   p0 = (float*)_al_list_item_data(vertex);
-//   al_draw_line(p0[0], p0[1], intersection[0], intersection[1], al_map_rgb(255, 0, 0), 0.0f);
-//# endif
-
-   return vertex;
+   /* Carved in order of decreasing alignment. */
+   p = block;
+   poly->order         = (POLY_KEY*)p; p += n * sizeof(POLY_KEY);
+   poly->x             = (float*)p;    p += n * sizeof(float);
+   poly->y             = (float*)p;    p += n * sizeof(float);
+   poly->prev          = (int*)p;      p += n * sizeof(int);
+   poly->next          = (int*)p;      p += n * sizeof(int);
+   poly->status_left   = (int*)p;      p += n * sizeof(int);
+   poly->status_right  = (int*)p;      p += n * sizeof(int);
+   poly->status_parent = (int*)p;      p += n * sizeof(int);
+   poly->helper        = (int*)p;      p += n * sizeof(int);
+   poly->out_start     = (int*)p;      p += (n + 1) * sizeof(int);
+   poly->diagonals     = (int*)p;      p += 2 * max_diagonals * sizeof(int);
+   poly->out_edges     = (int*)p;      p += 2 * max_diagonals * sizeof(int);
+   poly->face          = (int*)p;      p += max_half_edges * sizeof(int);
+   poly->sorted        = (int*)p;      p += max_half_edges * sizeof(int);
+   poly->stack         = (int*)p;      p += max_half_edges * sizeof(int);
+   poly->type          = p;            p += n;
+   poly->visited       = p;            p += max_half_edges;
+   poly->side          = p;
+
+   return block;
 }
 
 
-# define POLY_VERTEX(index)      ((float*)(((uint8_t*)polygon->vertex_buffer) + (index) * polygon->vertex_stride))
-# define POLY_SPLIT(index)       (*((int*)(((uint8_t*)polygon->split_indices) + (index) * polygon->split_stride)))
-# define POLY_SPLIT_INDEX(split) (((uint8_t*)split - (uint8_t*)polygon->split_indices) / polygon->split_stride)
-
-
 /*
- *  Create list of the splits.
+ *  Load the vertices and link every ring, reversing rings as necessary so
+ *  that the outline runs counter-clockwise and holes clockwise (with y
+ *  pointing up).  Vertices repeating the one after them are left out of the
+ *  rings, as the zero length edge between them has no direction.
  */
-static _AL_LIST* poly_create_split_list(POLY* polygon)
+static void poly_load(POLY* poly, const float* vertices, size_t vertex_stride,
+   const int* vertex_counts)
 {
+   int begin = 0;
+   int ring;
    int i;
-   int last_split;
-
-   _AL_LIST*       list   = _al_list_create_static(polygon->split_count);
-   POLY_SPLIT* splits = (POLY_SPLIT*)al_malloc(polygon->split_count * sizeof(POLY_SPLIT));
-
-   if ((NULL == list) || (NULL == splits)) {
-
-      _al_list_destroy(list);
-      al_free(splits);
 
-      return NULL;
+   for (i = 0; i < poly->vertex_count; ++i) {
+      const float* v = (const float*)((const char*)vertices + i * vertex_stride);
+      poly->x[i] = v[0];
+      poly->y[i] = -v[1];
    }
 
-   /* Set list destructor, so we will don't worry about
-    * manually releasing allocated memory.
-    */
-   _al_list_set_dtor(list, poly_split_list_dtor);
-   _al_list_set_user_data(list, splits);
-
-   last_split = POLY_SPLIT(0);
-   for (i = 1; i < (int)polygon->split_count; ++i) {
+   for (ring = 0; vertex_counts[ring] > 0; ++ring) {
+      const int count = vertex_counts[ring];
+      const int end = begin + count;
+      double area = 0;
+      bool reverse;
 
-      int j;
-      float max;
-      POLY_SPLIT* split = splits + i;
-      _AL_LIST_ITEM* where;
-
-      split->begin = last_split;
-      split->size  = POLY_SPLIT(i) - last_split;
-      last_split   = last_split + split->size;
-
-      max = -FLT_MAX;
-      split->max_index = -1;
-      for (j = split->begin; j < split->begin + (int)split->size; ++j) {
+      for (i = begin; i < end; ++i) {
+         int j = (i + 1 < end) ? i + 1 : begin;
+         area += (double)poly->x[i] * poly->y[j] - (double)poly->x[j] * poly->y[i];
+      }
 
-         float* point = POLY_VERTEX(j);
+      reverse = (ring == 0) ? (area < 0) : (area > 0);
+      poly->area += (ring == 0) ? fabs(area) : -fabs(area);
 
-         if (point[0] >= max) {
+      for (i = begin; i < end; ++i) {
+         int p = (i > begin) ? i - 1 : end - 1;
+         int n = (i + 1 < end) ? i + 1 : begin;
+         poly->prev[i] = reverse ? n : p;
+         poly->next[i] = reverse ? p : n;
+         poly->type[i] = POLY_REGULAR;
+      }
 
-            max               = point[0];
-            split->point      = point;
-            split->max_index  = j;
+      for (i = begin; i < end; ++i) {
+         const int n = poly->next[i];
+         if (n != i && poly->x[i] == poly->x[n] && poly->y[i] == poly->y[n]) {
+            poly->next[poly->prev[i]] = n;
+            poly->prev[n] = poly->prev[i];
+            poly->type[i] = POLY_REMOVED;
          }
       }
 
-      split->max_index -= split->begin;
-
-      ASSERT(split->max_index >= 0);
+      begin = end;
+   }
+}
 
-      where = NULL;
-      if (!_al_list_is_empty(list)) {
 
-         for (where = _al_list_front(list); where; where = _al_list_next(list, where)) {
+static void poly_classify(POLY* poly, int v)
+{
+   const int p = poly->prev[v];
+   const int n = poly->next[v];
+   const bool convex = poly_orient(poly, p, v, n) > 0;
+
+   if (poly_above(poly, v, p) && poly_above(poly, v, n))
+      poly->type[v] = convex ? POLY_START : POLY_SPLIT;
+   else if (poly_above(poly, p, v) && poly_above(poly, n, v))
+      poly->type[v] = convex ? POLY_END : POLY_MERGE;
+   else
+      poly->type[v] = POLY_REGULAR;
+}
 
-            POLY_SPLIT* local_split = (POLY_SPLIT*)_al_list_item_data(where);
 
-            if (local_split->point[0] < max)
-               break;
-         }
-      }
+/* x coordinate of an edge at the height of the sweep line. */
+static double poly_edge_x(const POLY* poly, int edge, float y)
+{
+   const int a = edge;
+   const int b = poly->next[edge];
+   const double dy = (double)poly->y[b] - poly->y[a];
 
-      if (NULL == where)
-         _al_list_push_back(list, split);
-      else
-         _al_list_insert_before(list, where, split);
-   }
+   if (dy == 0)
+      return poly->x[a];
 
-   return list;
+   return poly->x[a] + (y - (double)poly->y[a]) * (poly->x[b] - poly->x[a]) / dy;
 }
 
 
 /*
- *  Release memory allocated by split list. This method
- *  serve as callback to the list.
+ *  Treap priority of an edge.  A hash is as good as a random number here and
+ *  keeps the output deterministic.  It is a bijection, so no two edges have
+ *  the same priority.
  */
-static void poly_split_list_dtor(void* user_data)
+static unsigned int poly_status_priority(int edge)
 {
-   /* This is array of POLY_SPLIT. */
-   al_free(user_data);
+   unsigned int h = (unsigned int)edge;
+
+   h ^= h >> 16;
+   h *= 0x85ebca6bu;
+   h ^= h >> 13;
+   h *= 0xc2b2ae35u;
+   h ^= h >> 16;
+   return h;
 }
 
 
-/*
- *  Perform initialization step to polygon triangulation.
- *
- *  Three linked list are initialized: vertex_list, reflex_list
- *  and ear_list.
- *
- *  All provided splits (holes) are resolved in this step.
- *  Therefore at the end we have simple polygon.
- */
-static bool poly_initialize(POLY* polygon)
+/* Make node take the place of child old of parent. */
+static void poly_status_replace(POLY* poly, int parent, int old, int node)
 {
-   _AL_LIST* vertex_list;
-   _AL_LIST* reflex_list;
-   _AL_LIST* ear_list;
-   _AL_LIST* split_list;
-   _AL_LIST_ITEM* split_item;
-   size_t vertex_count;
-   bool use_split_list;
-   size_t j;
-   int i;
-
-# if POLY_DEBUG
-   if (g_poly_debug_split_step >= 0)
-      polygon->split_count = min(g_poly_debug_split_step, polygon->split_count);
-# endif
-
-   /* Every hole add two extra vertices to the list. */
-   vertex_count = polygon->vertex_count + (polygon->split_count - 1) * 2;
+   if (parent < 0)
+      poly->status_root = node;
+   else if (poly->status_left[parent] == old)
+      poly->status_left[parent] = node;
+   else
+      poly->status_right[parent] = node;
 
-   /* Create lists for polygon. */
-   vertex_list = _al_list_create_static(vertex_count);
-   reflex_list = _al_list_create_static(vertex_count);
-   ear_list    = _al_list_create_static(vertex_count);
+   if (node >= 0)
+      poly->status_parent[node] = parent;
+}
 
-   if (polygon->split_count > 1) {
 
-      split_list     = poly_create_split_list(polygon);
-      use_split_list = true;
+/* Rotate a node above its parent, keeping the order. */
+static void poly_status_rotate_up(POLY* poly, int node)
+{
+   const int parent = poly->status_parent[node];
+   const int grandparent = poly->status_parent[parent];
+   int middle;
+
+   if (poly->status_left[parent] == node) {
+      middle = poly->status_right[node];
+      poly->status_left[parent] = middle;
+      poly->status_right[node] = parent;
    }
    else {
-      split_list = NULL;
-      use_split_list = false;
-   }
-
-   if ((NULL == vertex_list) || (NULL == reflex_list) || (NULL == ear_list) || (use_split_list && (NULL == split_list))) {
-
-      _al_list_destroy(vertex_list);
-      _al_list_destroy(reflex_list);
-      _al_list_destroy(ear_list);
-      _al_list_destroy(split_list);
-
-      return false;
+      middle = poly->status_left[node];
+      poly->status_right[parent] = middle;
+      poly->status_left[node] = parent;
    }
 
-   /* Store lists in polygon. */
-   polygon->vertex_list = vertex_list;
-   polygon->reflex_list = reflex_list;
-   polygon->ear_list    = ear_list;
+   if (middle >= 0)
+      poly->status_parent[middle] = parent;
+   poly->status_parent[parent] = node;
+   poly_status_replace(poly, grandparent, parent, node);
+}
 
-   /* Push main polygon outline. */
-   for (i = 0; i < POLY_SPLIT(0); ++i)
-      _al_list_push_back(vertex_list, POLY_VERTEX(i));
 
-   if (use_split_list) {
+/* The edge in the status directly left of v, or -1. */
+static int poly_status_left_of(const POLY* poly, int v)
+{
+   int node = poly->status_root;
+   int left = -1;
 
-# if POLY_DEBUG
-       int current_split = 0;
-# endif
+   while (node >= 0) {
+      if (poly_edge_x(poly, node, poly->y[v]) <= poly->x[v]) {
+         left = node;
+         node = poly->status_right[node];
+      }
+      else {
+         node = poly->status_left[node];
+      }
+   }
 
-       poly_classify_vertices(vertex_list, reflex_list, NULL);
+   return left;
+}
 
-      /* Resolve all holes. */
-      for (split_item = _al_list_front(split_list); split_item; split_item = _al_list_next(split_list, split_item)) {
 
-         _AL_LIST_ITEM* first_vertex;
-         _AL_LIST_ITEM* last_vertex;
-         POLY_SPLIT* split;
+static void poly_status_insert(POLY* poly, int edge)
+{
+   int parent = -1;
+   int node = poly->status_root;
+   bool right = false;
+
+   while (node >= 0) {
+      parent = node;
+      right = poly_edge_x(poly, node, poly->y[edge]) <= poly->x[edge];
+      node = right ? poly->status_right[node] : poly->status_left[node];
+   }
 
-# if POLY_DEBUG
-         if (g_poly_debug_split_step >= 0 && current_split >= g_poly_debug_split_step)
-             break;
+   poly->status_left[edge] = -1;
+   poly->status_right[edge] = -1;
+   poly->status_parent[edge] = parent;
+   if (parent < 0)
+      poly->status_root = edge;
+   else if (right)
+      poly->status_right[parent] = edge;
+   else
+      poly->status_left[parent] = edge;
 
-         ++current_split;
-# endif
+   while (parent >= 0 &&
+         poly_status_priority(edge) > poly_status_priority(parent)) {
+      poly_status_rotate_up(poly, edge);
+      parent = poly->status_parent[edge];
+   }
 
-         split = (POLY_SPLIT*)_al_list_item_data(split_item);
+   poly->helper[edge] = edge;
+}
 
-         first_vertex = poly_find_outter_split_vertex(polygon, split);
 
-         if (NULL == first_vertex)
-            break;
+static void poly_status_remove(POLY* poly, int edge)
+{
+   int child;
 
-         /* Insert hole vertices. */
-         last_vertex = first_vertex;
-         for (j = 0; j <= split->size; ++j)
-            last_vertex = _al_list_insert_after(vertex_list, last_vertex,
-               POLY_VERTEX(split->begin + ((j + split->max_index) % split->size)));
-         last_vertex = _al_list_insert_after(vertex_list, last_vertex, _al_list_item_data(first_vertex));
+   /* Searching by position is unreliable here as the edge ends at the sweep
+    * line, so the edge is rotated down to where it can be cut out.
+    */
+   if (poly->status_parent[edge] == POLY_NOT_IN_STATUS)
+      return;
+
+   while (poly->status_left[edge] >= 0 && poly->status_right[edge] >= 0) {
+      const int l = poly->status_left[edge];
+      const int r = poly->status_right[edge];
+      poly_status_rotate_up(poly,
+         poly_status_priority(l) > poly_status_priority(r) ? l : r);
+   }
 
-         _al_list_remove(reflex_list, first_vertex);
+   child = poly->status_left[edge] >= 0 ? poly->status_left[edge] :
+      poly->status_right[edge];
+   poly_status_replace(poly, poly->status_parent[edge], edge, child);
+   poly->status_parent[edge] = POLY_NOT_IN_STATUS;
+}
 
-         poly_classify_vertices_in_range(first_vertex, _al_list_next(vertex_list, last_vertex), vertex_list, reflex_list, NULL);
-      }
 
-      _al_list_destroy(split_list);
+static void poly_add_diagonal(POLY* poly, int a, int b)
+{
+   poly->diagonals[poly->diagonal_count * 2 + 0] = a;
+   poly->diagonals[poly->diagonal_count * 2 + 1] = b;
+   poly->diagonal_count++;
+}
 
-      poly_classify_vertices(vertex_list, NULL, ear_list);
-   }
-   else
-      /* Initialize reflex and ear vertex lists. */
-      poly_classify_vertices(vertex_list, reflex_list, ear_list);
 
-   return true;
+/* Connect v to the helper of an edge if that is a merge vertex. */
+static void poly_fix_up(POLY* poly, int v, int edge)
+{
+   if (poly->type[poly->helper[edge]] == POLY_MERGE)
+      poly_add_diagonal(poly, v, poly->helper[edge]);
 }
 
-# undef POLY_VERTEX
-# undef POLY_SPLIT
-# undef POLY_SPLIT_INDEX
-
 
 /*
- *  Compute polygon vertex attributes. Currently supported attributes are:
- *    - ear clip
- *    - reflex
- *
- *  Vertex is an ear clip when triangle made by their edges does not contain
- *  any other vertices.
- *
- *  Vertex is a reflex when angle between edges is greater or equal
- *  to 180 degrees.
- *
- *  Optionally function may take reflex list (if not NULL). In this case test
- *  for ear clip is performed only on reflex vertices not on entire polygon.
- *  This is used for triangulation speed optimization, because convex
- *  (non reflect) vertices will never became reflex.
- *
- *  Flags are used to determine for which attribute we want to check.
- *  Use POLY_VERTEX_ATTR_ALL to test for all attributes.
+ *  Sweep over the vertices from top to bottom, adding diagonals to remove
+ *  split and merge vertices.  What remains are y-monotone pieces.
  */
-static int poly_compute_vertex_attributes(_AL_LIST* vertices, _AL_LIST_ITEM* item, int flags, _AL_LIST* reflex)
+static void poly_make_monotone(POLY* poly)
 {
-   size_t i;
-   _AL_LIST_ITEM* prev = _al_list_previous_circular(vertices, item);
-   _AL_LIST_ITEM* next = _al_list_next_circular(vertices, item);
-   _AL_LIST_ITEM* point = NULL;
-   int result = 0;
-   float* v0;
-   float* v1;
-   float* v2;
-   float cross;
-
-   // Oops, degenerate triangle in store.
-   if (_al_list_size(vertices) < 3)
-      return result;
-
-   // Get points.
-   v0 = (float*)_al_list_item_data(prev);
-   v1 = (float*)_al_list_item_data(item);
-   v2 = (float*)_al_list_item_data(next);
-
-   // Compute the cross product between the two edges
-   cross = (v0[0] - v1[0]) * (v2[1] - v1[1]) - (v0[1] - v1[1]) * (v2[0] - v1[0]);
+   int i;
 
-# if POLY_DEBUG
-   if (g_poly_debug_step == g_poly_debug_step_current) {
+   for (i = 0; i < poly->vertex_count; ++i) {
+      poly->order[i].x = poly->x[i];
+      poly->order[i].y = poly->y[i];
+      poly->order[i].index = i;
+      if (poly->type[i] != POLY_REMOVED)
+         poly_classify(poly, i);
+   }
 
-      float step = 0.25f * 0.0f;
+   qsort(poly->order, poly->vertex_count, sizeof(POLY_KEY), poly_compare_keys);
 
-      float dir0[2] = { v0[0] - v1[0], v0[1] - v1[1] };
-      float dir2[2] = { v2[0] - v1[0], v2[1] - v1[1] };
+   for (i = 0; i < poly->vertex_count; ++i)
+      poly->status_parent[i] = POLY_NOT_IN_STATUS;
+   poly->status_root = -1;
+   poly->diagonal_count = 0;
 
-      POLY_DEBUG_TEXT(v1[0], v1[1], "%d", cross > 0);
+   for (i = 0; i < poly->vertex_count; ++i) {
+      const int v = poly->order[i].index;
+      const int p = poly->prev[v];
+      int left;
 
-      al_draw_line(v1[0], v1[1], v1[0] + dir0[0] * step, v1[1] + dir0[1] * step, al_map_rgb(255, 0, 0), 4.0f * g_poly_debug_scale);
-      al_draw_line(v1[0], v1[1], v1[0] + dir2[0] * step, v1[1] + dir2[1] * step, al_map_rgb(255, 0, 0), 4.0f * g_poly_debug_scale);
-   }
-# endif
-
-   // If internal angle is less than 180 degrees then we may
-   // have an ear clip vertex, otherwise we have reflex.
-   if (cross >= 0)
-   {
-      if (flags & POLY_VERTEX_ATTR_EAR_CLIP)
-      {
-         _AL_LIST_ITEM* start;
-         _AL_LIST* search_list;
-         size_t size;
-
-         if (reflex) {
-
-            search_list = reflex;
-            size        = _al_list_size(search_list);
-            start       = _al_list_front(reflex);
-         }
-         else {
-            search_list = vertices;
-            size        = _al_list_size(search_list) - 3;
-            start       = _al_list_next_circular(search_list, next);
-         }
-
-         // Check for ear vertex.
-         point = start;
-         for (i = 0; i < size; ++i, point = _al_list_next_circular(search_list, point)) {
+      switch (poly->type[v]) {
 
-            float* v;
+         case POLY_START:
+            poly_status_insert(poly, v);
+            break;
 
-            // TODO: optimize this by removing if
-            if (search_list == reflex)
-               v = (float*)_al_list_item_data((_AL_LIST_ITEM*)_al_list_item_data(point));
-            else
-               v = (float*)_al_list_item_data(point);
+         case POLY_END:
+            poly_fix_up(poly, v, p);
+            poly_status_remove(poly, p);
+            break;
 
-            // Ignore vertices which belong to the triangle.
-            if ((v == v0) || (v == v1) || (v == v2))
-               continue;
+         case POLY_SPLIT:
+            left = poly_status_left_of(poly, v);
+            if (left >= 0) {
+               poly_add_diagonal(poly, v, poly->helper[left]);
+               poly->helper[left] = v;
+            }
+            poly_status_insert(poly, v);
+            break;
 
-            // Set point to NULL if we find any point inside the triangle.
-            if (_al_prim_is_point_in_triangle(v, v0, v1, v2)) {
-               point = NULL;
-               break;
+         case POLY_MERGE:
+            poly_fix_up(poly, v, p);
+            poly_status_remove(poly, p);
+            left = poly_status_left_of(poly, v);
+            if (left >= 0) {
+               poly_fix_up(poly, v, left);
+               poly->helper[left] = v;
             }
-         }
+            break;
 
-         // If point is not NULL, we have ear vertex.
-         if ((NULL != point) || _al_list_is_empty(search_list))
-            result |= POLY_VERTEX_ATTR_EAR_CLIP;
+         case POLY_REGULAR:
+            if (poly_above(poly, p, v)) {
+               /* The inside is to the right of v. */
+               poly_fix_up(poly, v, p);
+               poly_status_remove(poly, p);
+               poly_status_insert(poly, v);
+            }
+            else {
+               left = poly_status_left_of(poly, v);
+               if (left >= 0) {
+                  poly_fix_up(poly, v, left);
+                  poly->helper[left] = v;
+               }
+            }
+            break;
       }
    }
-   else if (flags & POLY_VERTEX_ATTR_REFLEX)
-      result |= POLY_VERTEX_ATTR_REFLEX;
+}
+
 
-   return result;
+static int poly_edge_origin(const POLY* poly, int edge)
+{
+   if (edge < poly->vertex_count)
+      return edge;
+   edge -= poly->vertex_count;
+   return poly->diagonals[edge ^ 1];
 }
 
 
-/*
- *  Classify all vertices into reflex or ear group.
- *
- *  One of target group may be NULL so it will be simply ignored.
- */
-static void poly_classify_vertices(_AL_LIST* vertices, _AL_LIST* reflex, _AL_LIST* ear)
+static int poly_edge_dest(const POLY* poly, int edge)
 {
-   poly_classify_vertices_in_range(_al_list_front(vertices), NULL, vertices, reflex, ear);
+   if (edge < poly->vertex_count)
+      return poly->next[edge];
+   edge -= poly->vertex_count;
+   return poly->diagonals[edge];
 }
 
 
 /*
- *  Classify selected range of vertices [begin, end) into
- *  reflex or ear group.
- *
- *  One of target group may be NULL so it will be simply ignored.
+ *  Group diagonal half-edges by the vertex they start at.  Half-edge
+ *  n + 2 * d runs along diagonal d backwards, n + 2 * d + 1 forwards.
  */
-static void poly_classify_vertices_in_range(_AL_LIST_ITEM* begin, _AL_LIST_ITEM* end, _AL_LIST* vertices, _AL_LIST* reflex, _AL_LIST* ear)
+static void poly_link_diagonals(POLY* poly)
 {
-   _AL_LIST_ITEM* item = NULL;
-   int attribute_mask = 0;
-
-   if (NULL != ear)
-      attribute_mask |= POLY_VERTEX_ATTR_EAR_CLIP;
-
-   if (NULL != reflex)
-      attribute_mask |= POLY_VERTEX_ATTR_REFLEX;
-
-   for (item = begin; item != end; item = _al_list_next(vertices, item))
-   {
-      int attr = poly_compute_vertex_attributes(vertices, item, attribute_mask, NULL);
+   const int n = poly->vertex_count;
+   const int count = poly->diagonal_count * 2;
+   int* cursor = poly->helper;   /* no longer needed after the sweep */
+   int i;
 
-      if (0 == attr)
-         continue;
+   memset(poly->out_start, 0, (n + 1) * sizeof(int));
 
-      if (attr & POLY_VERTEX_ATTR_EAR_CLIP)
-         _al_list_push_back(ear, item);
+   for (i = 0; i < count; ++i)
+      poly->out_start[poly_edge_origin(poly, n + i) + 1]++;
 
-      if (attr & POLY_VERTEX_ATTR_REFLEX)
-         _al_list_push_back(reflex, item);
+   for (i = 0; i < n; ++i) {
+      poly->out_start[i + 1] += poly->out_start[i];
+      cursor[i] = poly->out_start[i];
    }
+
+   for (i = 0; i < count; ++i)
+      poly->out_edges[cursor[poly_edge_origin(poly, n + i)]++] = n + i;
 }
 
 
 /*
- *  Reclassify vertex. After triangle was emitted one vertex
- *  is removed from the list. Two neighbor vertices may
- *  change their attributes. In this place we have general
- *  function which update lists to match new attributes
- *  of provided vertex.
+ *  Find the half-edge following the given one around the piece to its
+ *  left: the first one leaving its destination clockwise from the way back.
  */
-static void poly_update_vertex_attributes(_AL_LIST* vertices, _AL_LIST* reflex, _AL_LIST* ear, _AL_LIST_ITEM* vertex)
+static int poly_next_edge(const POLY* poly, int edge)
 {
-   _AL_LIST_ITEM* item;
+   const int v = poly_edge_dest(poly, edge);
+   const int begin = poly->out_start[v];
+   const int end = poly->out_start[v + 1];
+   double back, best_angle;
+   int best;
+   int i;
 
-   int attr = poly_compute_vertex_attributes(vertices, vertex, POLY_VERTEX_ATTR_ALL, reflex);
+   if (begin == end)
+      return v;
 
-   // Update reflex list only if an attribute change.
-   item = _al_list_find_first(reflex, vertex);
-   if (attr & POLY_VERTEX_ATTR_REFLEX) {
+   back = atan2((double)poly->y[poly_edge_origin(poly, edge)] - poly->y[v],
+      (double)poly->x[poly_edge_origin(poly, edge)] - poly->x[v]);
 
-      if (NULL == item)
-         _al_list_push_back(reflex, vertex);
+   best = -1;
+   best_angle = 0;
+   for (i = begin - 1; i < end; ++i) {
+      const int candidate = (i < begin) ? v : poly->out_edges[i];
+      const int w = poly_edge_dest(poly, candidate);
+      double angle = back - atan2((double)poly->y[w] - poly->y[v],
+         (double)poly->x[w] - poly->x[v]);
 
-      _al_list_remove(ear, vertex);
-   }
-   else {
+      while (angle <= 0)
+         angle += 2 * ALLEGRO_PI;
+      while (angle > 2 * ALLEGRO_PI)
+         angle -= 2 * ALLEGRO_PI;
 
-      if (NULL != item)
-         _al_list_erase(reflex, item);
+      if (best < 0 || angle < best_angle) {
+         best = candidate;
+         best_angle = angle;
+      }
+   }
 
-      item = _al_list_find_first(ear, vertex);
-      if (attr & POLY_VERTEX_ATTR_EAR_CLIP) {
+   return best;
+}
 
-         if (NULL == item)
-            _al_list_push_front(ear, vertex);
-      }
-      else {
 
-         if (NULL != item)
-            _al_list_erase(ear, item);
-      }
-   }
+static void poly_emit(POLY* poly, int a, int b, int c)
+{
+   poly->covered += fabs(poly_orient(poly, a, b, c));
+   poly->emit(a, b, c, poly->userdata);
 }
 
 
 /*
- *  Triangulator iterate trough list of ear vertices
- *  and clip isolated triangles. This process repeats
- *  until there are ear vertices.
+ *  Triangulate a y-monotone piece given by its vertices in counter-clockwise
+ *  order.
  */
-static void poly_do_triangulate(POLY* polygon)
+static void poly_triangulate_monotone(POLY* poly, const int* face, int count)
 {
-# define VERTEX_INDEX(vertex) ((((uint8_t*)vertex) - ((uint8_t*)polygon->vertex_buffer)) / polygon->vertex_stride)
-
-# if POLY_DEBUG
-   g_poly_debug_step_current = 0;
-
-   {
-      _AL_LIST_ITEM* item;
-      _AL_LIST_ITEM* next;
-      int* histogram = al_calloc(_al_list_size(polygon->vertex_list), sizeof(int));
-
-      /*std::map<float*, int> histogram;*/
+   int* sorted = poly->sorted;
+   char* side = poly->side;
+   int* stack = poly->stack;
+   int top = 0;
+   int bottom = 0;
+   int left, right;
+   int sp;
+   int i, j;
+
+   if (count < 3)
+      return;
+
+   if (count == 3) {
+      poly_emit(poly, face[0], face[1], face[2]);
+      return;
+   }
 
-      int index = 0;
-      for (item = _al_list_front(polygon->vertex_list); item; item = _al_list_next(polygon->vertex_list, item)) {
+   for (i = 1; i < count; ++i) {
+      if (poly_above(poly, face[i], face[top]))
+         top = i;
+      if (poly_above(poly, face[bottom], face[i]))
+         bottom = i;
+   }
 
-         float* point0;
-         float* point1;
-         float n[2];
-         float l, r;
-         char status[3] = { 0 };
-         int status_index = 0;
+   /* Going counter-clockwise from the top leads down the left chain. */
+   sorted[0] = face[top];
+   side[0] = POLY_LEFT;
+   left = (top + 1) % count;
+   right = (top + count - 1) % count;
+   for (i = 1; i < count; ++i) {
+      if (left == right) {
+         sorted[i] = face[left];
+         side[i] = POLY_RIGHT;
+      }
+      else if (poly_above(poly, face[left], face[right])) {
+         sorted[i] = face[left];
+         side[i] = POLY_LEFT;
+         left = (left + 1) % count;
+      }
+      else {
+         sorted[i] = face[right];
+         side[i] = POLY_RIGHT;
+         right = (right + count - 1) % count;
+      }
+   }
 
-         next = _al_list_next_circular(polygon->vertex_list, item);
+# define POLY_EMIT(a, b, c) \
+   poly_emit(poly, sorted[a], sorted[b], sorted[c])
 
-         point0 = (float*)_al_list_item_data(item);
-         point1 = (float*)_al_list_item_data(next);
+   stack[0] = 0;
+   stack[1] = 1;
+   sp = 2;
 
-         n[0] = -(point1[1] - point0[1]);
-         n[1] =   point1[0] - point0[0];
+   for (j = 2; j < count - 1; ++j) {
 
-         l = 2.0f * sqrtf(n[0] * n[0] + n[1] * n[1]);
+      if (side[j] != side[stack[sp - 1]]) {
+         /* Opposite chain: everything on the stack is visible from j. */
+         for (; sp > 1; --sp)
+            POLY_EMIT(j, stack[sp - 1], stack[sp - 2]);
+         sp = 0;
+         stack[sp++] = j - 1;
+         stack[sp++] = j;
+      }
+      else {
+         /* Same chain: cut off vertices as long as they form convex
+          * corners with j.
+          */
+         int last = stack[--sp];
+
+         while (sp > 0) {
+            double turn = poly_orient(poly, sorted[stack[sp - 1]], sorted[j], sorted[last]);
+            if (side[j] == POLY_LEFT ? turn >= 0 : turn <= 0)
+               break;
+            POLY_EMIT(j, last, stack[sp - 1]);
+            last = stack[--sp];
+         }
 
-         n[0] /= l;
-         n[1] /= l;
+         stack[sp++] = last;
+         stack[sp++] = j;
+      }
+   }
 
-         r = 1.0f * 0.0f;
+   for (; sp > 1; --sp)
+      POLY_EMIT(count - 1, stack[sp - 1], stack[sp - 2]);
 
-         al_draw_line(point0[0] + n[0] * r, point0[1] + n[1] * r, point1[0] + n[0] * r, point1[1] + n[1] * r, al_map_rgba(255, 0, 255, 128), r * g_poly_debug_scale);
+# undef POLY_EMIT
+}
 
-         if (_al_list_contains(polygon->reflex_list, item))
-            status[status_index++] = 'R';
-         if (_al_list_contains(polygon->ear_list, item))
-            status[status_index++] = 'E';
 
-         POLY_DEBUG_TEXT_LINE(point0[0], point0[1], -histogram[VERTEX_INDEX(point0)], "%s %d", status, index++);
+/*
+ *  Walk all the pieces left over by the diagonals and triangulate them.
+ *  Returns false if some of them did not close up, or if the triangles
+ *  overlap.
+ */
+static bool poly_triangulate_pieces(POLY* poly)
+{
+   const int half_edges = poly->vertex_count + 2 * poly->diagonal_count;
+   int broken = 0;
+   int edge;
 
-         ++histogram[VERTEX_INDEX(point0)];
-      }
+   poly_link_diagonals(poly);
 
-      al_free(histogram);
+   memset(poly->visited, 0, half_edges);
+   for (edge = 0; edge < poly->vertex_count; ++edge) {
+      if (poly->type[edge] == POLY_REMOVED)
+         poly->visited[edge] = 1;
    }
-# endif
-
-   // Repeat until there are ear clips.
-   while (!_al_list_is_empty(polygon->ear_list)) {
-
-      _AL_LIST_ITEM* ear_item;
-      _AL_LIST_ITEM* vertex_item;
-      _AL_LIST_ITEM* next;
-      _AL_LIST_ITEM* prev;
-      float* v0;
-      float* v1;
-      float* v2;
-
-      // Get point and corresponding item on polygon->vertex_list list.
-      ear_item    = _al_list_front(polygon->ear_list);
-      vertex_item = (_AL_LIST_ITEM*)_al_list_item_data(ear_item);
-      prev        = _al_list_previous_circular(polygon->vertex_list, vertex_item);
-      next        = _al_list_next_circular(polygon->vertex_list,     vertex_item);
-      v0 = (float*)_al_list_item_data(prev);
-      v1 = (float*)_al_list_item_data(vertex_item);
-      v2 = (float*)_al_list_item_data(next);
-
-# if POLY_DEBUG
-      if (g_poly_debug_step == g_poly_debug_step_current) {
-         _AL_LIST_ITEM* item;
-         ALLEGRO_COLOR color;
-         int second = 0;
-
-         al_draw_filled_triangle(v0[0], v0[1], v1[0], v1[1], v2[0], v2[1], al_map_rgba(0, 0, 255, 64));
-
-         for (item = _al_list_front(polygon->vertex_list); item; item = _al_list_next(polygon->vertex_list, item)) {
-
-            float* point = (float*)_al_list_item_data(item);
-            al_draw_filled_circle(point[0], point[1], 6.0f * g_poly_debug_scale, al_map_rgb(255, 255, 255));
-         }
-
-         for (item = _al_list_front(polygon->reflex_list); item; item = _al_list_next(polygon->reflex_list, item)) {
 
-            float* point = (float*)_al_list_item_data((_AL_LIST_ITEM*)_al_list_item_data(item));
+   for (edge = 0; edge < half_edges; ++edge) {
+      int count = 0;
+      int e = edge;
 
-            al_draw_filled_circle(point[0], point[1], 6.0f * g_poly_debug_scale, al_map_rgb(255, 255, 0));
-         }
-
-         color = al_map_rgb(255, 0, 0);
-         second = _al_list_size(polygon->ear_list) - 1;
-         for (item = _al_list_back(polygon->ear_list); item; item = _al_list_previous(polygon->ear_list, item), --second) {
+      if (poly->visited[edge])
+         continue;
 
-            float* point = (float*)_al_list_item_data((_AL_LIST_ITEM*)_al_list_item_data(item));
+      do {
+         poly->visited[e] = 1;
+         poly->face[count++] = poly_edge_origin(poly, e);
+         e = poly_next_edge(poly, e);
+      } while (e != edge && !poly->visited[e] && count < half_edges);
 
-            if (second == 0)
-               color = al_map_rgb(0, 255, 0);
-            else if (second == 1)
-               color = al_map_rgb(0, 0, 255);
+      /* Anything else means the input was not a simple polygon. */
+      if (e == edge)
+         poly_triangulate_monotone(poly, poly->face, count);
+      else
+         broken++;
+   }
 
-            al_draw_circle(point[0], point[1], 9.0f * g_poly_debug_scale, color, 2.0f * g_poly_debug_scale);
-         }
-      }
-      if (g_poly_debug_step >= 0 && g_poly_debug_step_current >= g_poly_debug_step)
-         break;
-      g_poly_debug_step_current++;
-# endif
-
-      // Emit triangle.
-      polygon->emit(VERTEX_INDEX(v0), VERTEX_INDEX(v1), VERTEX_INDEX(v2), polygon->userdata);
-
-      // Remove polygon->ear_list clip from all lists.
-      _al_list_erase(polygon->ear_list,      ear_item);
-      _al_list_erase(polygon->vertex_list, vertex_item);
-      _al_list_erase(polygon->reflex_list, _al_list_find_first(polygon->reflex_list, vertex_item));
-
-      // Update attributes of corner vertices.
-      poly_update_vertex_attributes(polygon->vertex_list, polygon->reflex_list, polygon->ear_list, prev);
-      poly_update_vertex_attributes(polygon->vertex_list, polygon->reflex_list, polygon->ear_list, next);
+   if (broken > 0) {
+      ALLEGRO_WARN("Polygon is not simple, %d pieces were left out.\n",
+         broken);
+      return false;
    }
 
-# undef VERTEX_INDEX
+   /* Crossing edges do not always break the pieces up, but the triangles
+    * then cover more than the polygon.
+    */
+   if (fabs(poly->covered - poly->area) > 1e-6 * (poly->covered + poly->area)) {
+      ALLEGRO_WARN("Polygon is not simple, triangles overlap.\n");
+      return false;
+   }
+   return true;
 }
 
 
@@ -815,54 +778,35 @@ bool al_triangulate_polygon(
    const float* vertices, size_t vertex_stride, const int* vertex_counts,
    void (*emit_triangle)(int, int, int, void*), void* userdata)
 {
-   POLY polygon;
+   POLY poly;
+   void* block;
    int vertex_count;
-   int split_count;
-   int *splits;
-   int i;
    bool ret;
+   int i;
 
-   for (i = 0; vertex_counts[i] > 0; i++) {
-      /* do nothing */
-   }
-   ASSERT(i > 0);
-   split_count = i;
-
-   splits = malloc(split_count * sizeof(int));
-   if (!splits) {
-      return false;
-   }
    vertex_count = 0;
-   for (i = 0; i < split_count; i++) {
+   for (i = 0; vertex_counts[i] > 0; i++) {
       vertex_count += vertex_counts[i];
-      splits[i] = vertex_count;
    }
+   ASSERT(i > 0);
 
-   memset(&polygon, 0, sizeof(polygon));
-   polygon.vertex_buffer = vertices;
-   polygon.vertex_stride = vertex_stride;
-   polygon.vertex_count  = vertex_count;
-   polygon.split_indices = splits;
-   polygon.split_stride  = sizeof(int);   /* XXX can simplify code now */
-   polygon.split_count   = split_count;
-   polygon.emit          = emit_triangle;
-   polygon.userdata      = userdata;
-
-   if (poly_initialize(&polygon)) {
+   if (vertex_count < 3)
+      return true;
 
-      poly_do_triangulate(&polygon);
+   memset(&poly, 0, sizeof(poly));
+   poly.vertex_count = vertex_count;
+   poly.emit         = emit_triangle;
+   poly.userdata     = userdata;
 
-      _al_list_destroy(polygon.vertex_list);
-      _al_list_destroy(polygon.reflex_list);
-      _al_list_destroy(polygon.ear_list);
+   block = poly_allocate(&poly, vertex_count);
+   if (!block)
+      return false;
 
-      ret = true;
-   }
-   else {
-      ret = false;
-   }
+   poly_load(&poly, vertices, vertex_stride, vertex_counts);
+   poly_make_monotone(&poly);
+   ret = poly_triangulate_pieces(&poly);
 
-   free(splits);
+   al_free(block);
 
    return ret;
 }
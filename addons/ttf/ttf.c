@@ -6,6 +6,7 @@
 #include "allegro5/internal/aintern_vector.h"
 
 #include "allegro5/allegro_ttf.h"
+#include "allegro5/internal/aintern_font.h"
 #include "allegro5/internal/aintern_ttf_cfg.h"
 #include "allegro5/internal/aintern_dtor.h"
 #include "allegro5/internal/aintern_system.h"
@@ -33,6 +34,18 @@ ALLEGRO_DEBUG_CHANNEL("font")
 
 #define RANGE_SIZE   128
 
+/* Codepoints below this have their glyph looked up through a table of
+ * lazily allocated pages of CHAR_PAGE_SIZE entries instead of FreeType.
+ */
+#define CHAR_PAGE_SIZE     256
+#define CACHED_CODEPOINTS  0x10000
+
+#define KERNING_CACHE_MIN_SIZE   256
+#define KERNING_CACHE_MAX_SIZE   65536
+
+/* al_prewarm_ttf_glyphs gives each job at least this many glyphs. */
+#define PREWARM_GLYPHS_PER_JOB   32
+
 
 typedef struct REGION
 {
@@ -46,6 +59,7 @@ typedef struct REGION
 typedef struct ALLEGRO_TTF_GLYPH_DATA
 {
    ALLEGRO_BITMAP *page_bitmap;
+   int page;
    REGION region;
    short offset_x;
    short offset_y;
@@ -60,16 +74,55 @@ typedef struct ALLEGRO_TTF_GLYPH_RANGE
 } ALLEGRO_TTF_GLYPH_RANGE;
 
 
+typedef struct ALLEGRO_TTF_CHAR
+{
+   int ft_index;
+   ALLEGRO_TTF_GLYPH_DATA *glyph;  /* NULL if not looked up yet */
+} ALLEGRO_TTF_CHAR;
+
+
+typedef struct ALLEGRO_TTF_KERNING
+{
+   int first;  /* -1 for an empty slot */
+   int second;
+   int kerning;
+} ALLEGRO_TTF_KERNING;
+
+
+/* A segment of the skyline of a page: everything above y between x and
+ * x + w is free.
+ */
+typedef struct SKYLINE_NODE
+{
+   int x;
+   int y;
+   int w;
+} SKYLINE_NODE;
+
+
+typedef struct ALLEGRO_TTF_PAGE
+{
+   ALLEGRO_BITMAP *bitmap;
+   _AL_VECTOR skyline;  /* of SKYLINE_NODE, sorted by x */
+   int last_use;
+} ALLEGRO_TTF_PAGE;
+
+
 typedef struct ALLEGRO_TTF_FONT_DATA
 {
    FT_Face face;
    int flags;
    _AL_VECTOR glyph_ranges;  /* sorted array of of ALLEGRO_TTF_GLYPH_RANGE */
+   ALLEGRO_TTF_CHAR *char_pages[CACHED_CODEPOINTS / CHAR_PAGE_SIZE];
+
+   ALLEGRO_TTF_KERNING *kerning_cache;  /* open addressing hash table */
+   int kerning_cache_size;
+   int kerning_cache_count;
 
-   _AL_VECTOR page_bitmaps;  /* of ALLEGRO_BITMAP pointers */
-   int page_pos_x;
-   int page_pos_y;
-   int page_line_height;
+   _AL_VECTOR pages;  /* of ALLEGRO_TTF_PAGE */
+   int current_page;
+   int use_count;
+   int cache_version;  /* changed whenever a page is evicted */
    REGION lock_rect;
    ALLEGRO_LOCKED_REGION *page_lr;
 
@@ -83,6 +136,15 @@ typedef struct ALLEGRO_TTF_FONT_DATA
 
    int min_page_size;
    int max_page_size;
+   int max_page_count;
+
+   int size_w;  /* as passed to al_load_ttf_font_stretch_f */
+   int size_h;
+
+   /* Held while the glyph cache, the pages or the face are used, so that
+    * al_prewarm_ttf_glyphs can run while other threads use the font.
+    */
+   ALLEGRO_MUTEX *mutex;
 } ALLEGRO_TTF_FONT_DATA;
 
 
@@ -90,6 +152,7 @@ typedef struct ALLEGRO_TTF_FONT_DATA
 static bool ttf_inited;
 static FT_Library ft;
 static ALLEGRO_FONT_VTABLE vt;
+static ALLEGRO_FONT_GLYPH_VTABLE glyph_vt;
 
 
 static INLINE int align4(int x)
@@ -142,21 +205,188 @@ static ALLEGRO_TTF_GLYPH_DATA *get_glyph(ALLEGRO_TTF_FONT_DATA *data,
 }
 
 
+static ALLEGRO_TTF_PAGE *get_page(ALLEGRO_TTF_FONT_DATA *data, int i)
+{
+   return _al_vector_ref(&data->pages, i);
+}
+
+
+/* Returns the glyph for a codepoint and its FreeType index. Results for the
+ * BMP are remembered, since FT_Get_Char_Index has to search the font's
+ * character map and get_glyph the glyph ranges.
+ */
+static ALLEGRO_TTF_GLYPH_DATA *get_char_glyph(ALLEGRO_TTF_FONT_DATA *data,
+   int ch, int *ft_index)
+{
+   ALLEGRO_TTF_CHAR *page;
+   ALLEGRO_TTF_CHAR *c;
+
+   if (ch < 0 || ch >= CACHED_CODEPOINTS) {
+      *ft_index = FT_Get_Char_Index(data->face, ch);
+      return get_glyph(data, *ft_index);
+   }
+
+   page = data->char_pages[ch / CHAR_PAGE_SIZE];
+   if (!page) {
+      page = al_calloc(CHAR_PAGE_SIZE, sizeof(ALLEGRO_TTF_CHAR));
+      if (!page) {
+         *ft_index = FT_Get_Char_Index(data->face, ch);
+         return get_glyph(data, *ft_index);
+      }
+      data->char_pages[ch / CHAR_PAGE_SIZE] = page;
+   }
+
+   c = &page[ch % CHAR_PAGE_SIZE];
+   if (!c->glyph) {
+      c->ft_index = FT_Get_Char_Index(data->face, ch);
+      c->glyph = get_glyph(data, c->ft_index);
+   }
+
+   *ft_index = c->ft_index;
+   return c->glyph;
+}
+
+
 static void unlock_current_page(ALLEGRO_TTF_FONT_DATA *data)
 {
    if (data->page_lr) {
-      ALLEGRO_BITMAP **back = _al_vector_ref_back(&data->page_bitmaps);
-      ASSERT(al_is_bitmap_locked(*back));
-      al_unlock_bitmap(*back);
+      ALLEGRO_TTF_PAGE *page = get_page(data, data->current_page);
+      ASSERT(al_is_bitmap_locked(page->bitmap));
+      al_unlock_bitmap(page->bitmap);
       data->page_lr = NULL;
    }
 }
 
 
-static ALLEGRO_BITMAP *push_new_page(ALLEGRO_TTF_FONT_DATA *data, int glyph_size)
+static void reset_skyline(ALLEGRO_TTF_PAGE *page)
 {
-    ALLEGRO_BITMAP **back;
-    ALLEGRO_BITMAP *page;
+   SKYLINE_NODE *node;
+
+   _al_vector_free(&page->skyline);
+   node = _al_vector_alloc_back(&page->skyline);
+   node->x = 0;
+   node->y = 0;
+   node->w = al_get_bitmap_width(page->bitmap);
+}
+
+
+/* Returns the height at which a w pixels wide glyph would rest if placed at
+ * the start of skyline node i, or -1 if it would stick out of the page.
+ */
+static int skyline_fit(ALLEGRO_TTF_PAGE *page, int i, int w)
+{
+   SKYLINE_NODE *node = _al_vector_ref(&page->skyline, i);
+   int width_left = w;
+   int y = 0;
+
+   if (node->x + w > al_get_bitmap_width(page->bitmap))
+      return -1;
+
+   while (width_left > 0) {
+      node = _al_vector_ref(&page->skyline, i++);
+      if (node->y > y)
+         y = node->y;
+      width_left -= node->w;
+   }
+
+   return y;
+}
+
+
+/* Finds the lowest free spot for a w x h region (bottom-left rule) and
+ * raises the skyline over it.
+ */
+static bool skyline_insert(ALLEGRO_TTF_PAGE *page, int w, int h,
+   int *x, int *y)
+{
+   _AL_VECTOR *skyline = &page->skyline;
+   SKYLINE_NODE *node;
+   int best = -1;
+   int best_top = 0;
+   int best_w = 0;
+   int i;
+
+   for (i = 0; i < (int)_al_vector_size(skyline); i++) {
+      int fit_y = skyline_fit(page, i, w);
+      node = _al_vector_ref(skyline, i);
+      if (fit_y < 0 || fit_y + h > al_get_bitmap_height(page->bitmap))
+         continue;
+      if (best < 0 || fit_y + h < best_top ||
+            (fit_y + h == best_top && node->w < best_w)) {
+         best = i;
+         best_top = fit_y + h;
+         best_w = node->w;
+         *y = fit_y;
+      }
+   }
+
+   if (best < 0)
+      return false;
+
+   *x = ((SKYLINE_NODE *)_al_vector_ref(skyline, best))->x;
+   node = _al_vector_alloc_mid(skyline, best);
+   node->x = *x;
+   node->y = best_top;
+   node->w = w;
+
+   /* Shrink or remove the nodes now covered by the new one. */
+   i = best + 1;
+   while (i < (int)_al_vector_size(skyline)) {
+      SKYLINE_NODE *next = _al_vector_ref(skyline, i);
+      int overlap = *x + w - next->x;
+      if (overlap <= 0)
+         break;
+      if (overlap < next->w) {
+         next->x += overlap;
+         next->w -= overlap;
+         break;
+      }
+      _al_vector_delete_at(skyline, i);
+   }
+
+   /* Merge neighbours at the same height. */
+   i = 0;
+   while (i + 1 < (int)_al_vector_size(skyline)) {
+      SKYLINE_NODE *a = _al_vector_ref(skyline, i);
+      SKYLINE_NODE *b = _al_vector_ref(skyline, i + 1);
+      if (a->y == b->y) {
+         a->w += b->w;
+         _al_vector_delete_at(skyline, i + 1);
+      }
+      else {
+         i++;
+      }
+   }
+
+   return true;
+}
+
+
+/* Returns how far to the right of x the page is free from y downwards, i.e.
+ * how wide a region at (x, y) may be locked without touching other glyphs.
+ */
+static int skyline_free_right(ALLEGRO_TTF_PAGE *page, int x, int y)
+{
+   int right = x;
+   int i;
+
+   for (i = 0; i < (int)_al_vector_size(&page->skyline); i++) {
+      SKYLINE_NODE *node = _al_vector_ref(&page->skyline, i);
+      if (node->x + node->w <= x)
+         continue;
+      if (node->x > right || node->y > y)
+         break;
+      right = node->x + node->w;
+   }
+
+   return right;
+}
+
+
+static ALLEGRO_TTF_PAGE *push_new_page(ALLEGRO_TTF_FONT_DATA *data, int glyph_size)
+{
+    ALLEGRO_TTF_PAGE *page;
+    ALLEGRO_BITMAP *bitmap;
     ALLEGRO_STATE state;
     int page_size = 1;
     /* 16 seems to work well. A particular problem are fixed width fonts which
@@ -183,92 +413,148 @@ static ALLEGRO_BITMAP *push_new_page(ALLEGRO_TTF_FONT_DATA *data, int glyph_size
     al_store_state(&state, ALLEGRO_STATE_NEW_BITMAP_PARAMETERS);
     al_set_new_bitmap_format(data->bitmap_format);
     al_set_new_bitmap_flags(data->bitmap_flags);
-    page = al_create_bitmap(page_size, page_size);
+    bitmap = al_create_bitmap(page_size, page_size);
     al_restore_state(&state);
     _al_pop_destructor_owner();
 
-    if (page) {
-       back = _al_vector_alloc_back(&data->page_bitmaps);
-       *back = page;
+    if (!bitmap)
+       return NULL;
 
-       data->page_pos_x = 0;
-       data->page_pos_y = 0;
-       data->page_line_height = 0;
-    }
+    page = _al_vector_alloc_back(&data->pages);
+    page->bitmap = bitmap;
+    page->last_use = data->use_count;
+    _al_vector_init(&page->skyline, sizeof(SKYLINE_NODE));
+    reset_skyline(page);
+
+    data->current_page = _al_vector_size(&data->pages) - 1;
 
     return page;
 }
 
 
+/* When the font is at its page budget, empties the least recently used page
+ * big enough for the glyph and returns it for reuse.
+ */
+static ALLEGRO_TTF_PAGE *evict_page(ALLEGRO_TTF_FONT_DATA *data,
+   int glyph_size)
+{
+   ALLEGRO_TTF_PAGE *victim = NULL;
+   int victim_index = -1;
+   int i, j;
+
+   if (data->max_page_count <= 0 ||
+         (int)_al_vector_size(&data->pages) < data->max_page_count)
+      return NULL;
+
+   for (i = 0; i < (int)_al_vector_size(&data->pages); i++) {
+      ALLEGRO_TTF_PAGE *page = get_page(data, i);
+      /* Pages used by the text currently being drawn are off limits, or we
+       * could end up evicting glyphs over and over within one string. The
+       * budget is exceeded instead.
+       */
+      if (page->last_use == data->use_count)
+         continue;
+      if (al_get_bitmap_width(page->bitmap) < glyph_size)
+         continue;
+      if (!victim || page->last_use < victim->last_use) {
+         victim = page;
+         victim_index = i;
+      }
+   }
+
+   if (!victim)
+      return NULL;
+
+   ALLEGRO_DEBUG("Evicting page %d.\n", victim_index);
+
+   unlock_current_page(data);
+
+   /* Draws of the old glyphs may still be pending. */
+   if (al_is_bitmap_drawing_held()) {
+      al_hold_bitmap_drawing(false);
+      al_hold_bitmap_drawing(true);
+   }
+
+   for (i = 0; i < (int)_al_vector_size(&data->glyph_ranges); i++) {
+      ALLEGRO_TTF_GLYPH_RANGE *range = _al_vector_ref(&data->glyph_ranges, i);
+      for (j = 0; j < RANGE_SIZE; j++) {
+         ALLEGRO_TTF_GLYPH_DATA *glyph = &range->glyphs[j];
+         if (glyph->page_bitmap == victim->bitmap)
+            memset(glyph, 0, sizeof *glyph);
+      }
+   }
+
+   reset_skyline(victim);
+   victim->last_use = data->use_count;
+   data->current_page = victim_index;
+   data->cache_version++;
+
+   return victim;
+}
+
+
 static unsigned char *alloc_glyph_region(ALLEGRO_TTF_FONT_DATA *data,
-   int ft_index, int w, int h, bool new, ALLEGRO_TTF_GLYPH_DATA *glyph,
+   int ft_index, int w, int h, ALLEGRO_TTF_GLYPH_DATA *glyph,
    bool lock_more)
 {
-   ALLEGRO_BITMAP *page;
+   ALLEGRO_TTF_PAGE *page = NULL;
    bool relock;
    int w4 = align4(w);
    int h4 = align4(h);
    int glyph_size = w4 > h4 ? w4 : h4;
+   int x, y;
 
-   if (_al_vector_is_empty(&data->page_bitmaps) || new) {
-      page = push_new_page(data, glyph_size);
-      relock = true;
-      if (!page)
-         return NULL;
-   }
-   else {
-      ALLEGRO_BITMAP **back = _al_vector_ref_back(&data->page_bitmaps);
-      page = *back;
-      relock = !data->page_lr;
+   if (data->current_page >= 0) {
+      page = get_page(data, data->current_page);
+      if (!skyline_insert(page, w4, h4, &x, &y))
+         page = NULL;
    }
 
-   ALLEGRO_DEBUG("Glyph %d: %dx%d (%dx%d)%s\n",
-      ft_index, w, h, w4, h4, new ? " new" : "");
-
-   if (data->page_pos_x + w4 > al_get_bitmap_width(page)) {
-      data->page_pos_y += data->page_line_height;
-      data->page_pos_y = align4(data->page_pos_y);
-      data->page_pos_x = 0;
-      data->page_line_height = 0;
-      relock = true;
+   if (!page) {
+      page = evict_page(data, glyph_size);
+      if (!page)
+         page = push_new_page(data, glyph_size);
+      if (!page || !skyline_insert(page, w4, h4, &x, &y))
+         return NULL;
    }
 
-   if (data->page_pos_y + h4 > al_get_bitmap_height(page)) {
-      return alloc_glyph_region(data, ft_index, w, h, true, glyph, lock_more);
-   }
+   ALLEGRO_DEBUG("Glyph %d: %dx%d (%dx%d) at %d,%d on page %d\n",
+      ft_index, w, h, w4, h4, x, y, data->current_page);
 
-   glyph->page_bitmap = page;
-   glyph->region.x = data->page_pos_x;
-   glyph->region.y = data->page_pos_y;
+   glyph->page_bitmap = page->bitmap;
+   glyph->page = data->current_page;
+   glyph->region.x = x;
+   glyph->region.y = y;
    glyph->region.w = w;
    glyph->region.h = h;
+   page->last_use = data->use_count;
 
-   data->page_pos_x = align4(data->page_pos_x + w4);
-   if (h > data->page_line_height) {
-      data->page_line_height = h4;
-      relock = true;
-   }
+   relock = !data->page_lr
+      || x < data->lock_rect.x
+      || y < data->lock_rect.y
+      || x + w4 > data->lock_rect.x + data->lock_rect.w
+      || y + h4 > data->lock_rect.y + data->lock_rect.h;
 
    if (relock) {
       char *ptr;
       int i;
       unlock_current_page(data);
 
-      data->lock_rect.x = glyph->region.x;
-      data->lock_rect.y = glyph->region.y;
+      data->lock_rect.x = x;
+      data->lock_rect.y = y;
       /* Do we lock up to the right edge in anticipation of caching more
-       * glyphs, or just enough for the current glyph?
+       * glyphs, or just enough for the current glyph? Either way only space
+       * which was free before is locked, as it gets cleared below.
        */
       if (lock_more) {
-         data->lock_rect.w = al_get_bitmap_width(page) - data->lock_rect.x;
-         data->lock_rect.h = data->page_line_height;
+         data->lock_rect.w = skyline_free_right(page, x + w4, y) - x;
       }
       else {
          data->lock_rect.w = w4;
-         data->lock_rect.h = h4;
       }
+      data->lock_rect.h = h4;
 
-      data->page_lr = al_lock_bitmap_region(page,
+      data->page_lr = al_lock_bitmap_region(page->bitmap,
          data->lock_rect.x, data->lock_rect.y,
          data->lock_rect.w, data->lock_rect.h,
          ALLEGRO_PIXEL_FORMAT_ABGR_8888_LE, ALLEGRO_LOCK_WRITEONLY);
@@ -296,19 +582,18 @@ static unsigned char *alloc_glyph_region(ALLEGRO_TTF_FONT_DATA *data,
 }
 
 
-static void copy_glyph_mono(ALLEGRO_TTF_FONT_DATA *font_data, FT_Face face,
-   unsigned char *glyph_data)
+static void copy_glyph_mono(ALLEGRO_TTF_FONT_DATA *font_data,
+   FT_Bitmap const *bitmap, unsigned char *glyph_data, int pitch)
 {
-   int pitch = font_data->page_lr->pitch;
    int x, y;
 
-   for (y = 0; y < (int)face->glyph->bitmap.rows; y++) {
-      unsigned char const *ptr = face->glyph->bitmap.buffer + face->glyph->bitmap.pitch * y;
+   for (y = 0; y < (int)bitmap->rows; y++) {
+      unsigned char const *ptr = bitmap->buffer + bitmap->pitch * y;
       unsigned char *dptr = glyph_data + pitch * y;
       int bit = 0;
 
       if (font_data->flags & ALLEGRO_NO_PREMULTIPLIED_ALPHA) {
-         for (x = 0; x < (int)face->glyph->bitmap.width; x++) {
+         for (x = 0; x < (int)bitmap->width; x++) {
             unsigned char set = ((*ptr >> (7-bit)) & 1) ? 255 : 0;
             *dptr++ = 255;
             *dptr++ = 255;
@@ -321,7 +606,7 @@ static void copy_glyph_mono(ALLEGRO_TTF_FONT_DATA *font_data, FT_Face face,
          }
       }
       else {
-         for (x = 0; x < (int)face->glyph->bitmap.width; x++) {
+         for (x = 0; x < (int)bitmap->width; x++) {
             unsigned char set = ((*ptr >> (7-bit)) & 1) ? 255 : 0;
             *dptr++ = set;
             *dptr++ = set;
@@ -337,18 +622,17 @@ static void copy_glyph_mono(ALLEGRO_TTF_FONT_DATA *font_data, FT_Face face,
 }
 
 
-static void copy_glyph_color(ALLEGRO_TTF_FONT_DATA *font_data, FT_Face face,
-   unsigned char *glyph_data)
+static void copy_glyph_color(ALLEGRO_TTF_FONT_DATA *font_data,
+   FT_Bitmap const *bitmap, unsigned char *glyph_data, int pitch)
 {
-   int pitch = font_data->page_lr->pitch;
    int x, y;
 
-   for (y = 0; y < (int)face->glyph->bitmap.rows; y++) {
-      unsigned char const *ptr = face->glyph->bitmap.buffer + face->glyph->bitmap.pitch * y;
+   for (y = 0; y < (int)bitmap->rows; y++) {
+      unsigned char const *ptr = bitmap->buffer + bitmap->pitch * y;
       unsigned char *dptr = glyph_data + pitch * y;
 
       if (font_data->flags & ALLEGRO_NO_PREMULTIPLIED_ALPHA) {
-         for (x = 0; x < (int)face->glyph->bitmap.width; x++) {
+         for (x = 0; x < (int)bitmap->width; x++) {
             unsigned char c = *ptr;
             *dptr++ = 255;
             *dptr++ = 255;
@@ -358,7 +642,7 @@ static void copy_glyph_color(ALLEGRO_TTF_FONT_DATA *font_data, FT_Face face,
          }
       }
       else {
-         for (x = 0; x < (int)face->glyph->bitmap.width; x++) {
+         for (x = 0; x < (int)bitmap->width; x++) {
             unsigned char c = *ptr;
             *dptr++ = c;
             *dptr++ = c;
@@ -371,19 +655,24 @@ static void copy_glyph_color(ALLEGRO_TTF_FONT_DATA *font_data, FT_Face face,
 }
 
 
-/* NOTE: this function may disable the bitmap hold drawing state
- * and leave the current page bitmap locked.
+static void copy_glyph(ALLEGRO_TTF_FONT_DATA *font_data,
+   FT_Bitmap const *bitmap, unsigned char *glyph_data, int pitch)
+{
+   if (font_data->flags & ALLEGRO_TTF_MONOCHROME)
+      copy_glyph_mono(font_data, bitmap, glyph_data, pitch);
+   else
+      copy_glyph_color(font_data, bitmap, glyph_data, pitch);
+}
+
+
+/* Renders the glyph into face->glyph and fills in its metrics. Returns false
+ * if there is nothing to put on a page.
  */
-static void cache_glyph(ALLEGRO_TTF_FONT_DATA *font_data, FT_Face face,
-   int ft_index, ALLEGRO_TTF_GLYPH_DATA *glyph, bool lock_more)
+static bool load_glyph(ALLEGRO_TTF_FONT_DATA *font_data, FT_Face face,
+   int ft_index, ALLEGRO_TTF_GLYPH_DATA *glyph)
 {
     FT_Int32 ft_load_flags;
     FT_Error e;
-    int w, h;
-    unsigned char *glyph_data;
-
-    if (glyph->page_bitmap || glyph->region.x < 0)
-        return;
 
     // FIXME: make this a config setting? FT_LOAD_FORCE_AUTOHINT
 
@@ -405,31 +694,54 @@ static void cache_glyph(ALLEGRO_TTF_FONT_DATA *font_data, FT_Face face,
     glyph->offset_y = (face->size->metrics.ascender >> 6) - face->glyph->bitmap_top;
     glyph->advance = face->glyph->advance.x >> 6;
 
-    w = face->glyph->bitmap.width;
-    h = face->glyph->bitmap.rows;
-
-    if (w == 0 || h == 0) {
+    if (face->glyph->bitmap.width == 0 || face->glyph->bitmap.rows == 0) {
        /* Mark this glyph so we won't try to cache it next time. */
        glyph->region.x = -1;
        glyph->region.y = -1;
        ALLEGRO_DEBUG("Glyph %d has zero size.\n", ft_index);
-       return;
+       return false;
     }
 
+    return true;
+}
+
+
+static bool glyph_is_cached(ALLEGRO_TTF_GLYPH_DATA const *glyph)
+{
+   return glyph->page_bitmap || glyph->region.x < 0;
+}
+
+
+/* NOTE: this function may disable the bitmap hold drawing state
+ * and leave the current page bitmap locked.
+ */
+static void cache_glyph(ALLEGRO_TTF_FONT_DATA *font_data, FT_Face face,
+   int ft_index, ALLEGRO_TTF_GLYPH_DATA *glyph, bool lock_more)
+{
+    int w, h;
+    unsigned char *glyph_data;
+
+    if (glyph_is_cached(glyph))
+        return;
+
+    if (!load_glyph(font_data, face, ft_index, glyph))
+        return;
+
+    w = face->glyph->bitmap.width;
+    h = face->glyph->bitmap.rows;
+
     /* Each glyph has a 1-pixel border all around. Note: The border is kept
      * even against the outer bitmap edge, to ensure consistent rendering.
      */
     glyph_data = alloc_glyph_region(font_data, ft_index,
-       w + 2, h + 2, false, glyph, lock_more);
+       w + 2, h + 2, glyph, lock_more);
 
     if (glyph_data == NULL) {
        return;
     }
 
-    if (font_data->flags & ALLEGRO_TTF_MONOCHROME)
-       copy_glyph_mono(font_data, face, glyph_data);
-    else
-       copy_glyph_color(font_data, face, glyph_data);
+    copy_glyph(font_data, &face->glyph->bitmap, glyph_data,
+       font_data->page_lr->pitch);
 
     if (!lock_more) {
        unlock_current_page(font_data);
@@ -437,28 +749,108 @@ static void cache_glyph(ALLEGRO_TTF_FONT_DATA *font_data, FT_Face face,
 }
 
 
-static int get_kerning(ALLEGRO_TTF_FONT_DATA const *data, FT_Face face,
+static unsigned int kerning_hash(int first, int second)
+{
+   return ((unsigned int)first * 31u + (unsigned int)second) * 2654435761u;
+}
+
+
+static ALLEGRO_TTF_KERNING *find_kerning_slot(ALLEGRO_TTF_KERNING *cache,
+   int size, int first, int second)
+{
+   unsigned int i = kerning_hash(first, second) & (size - 1);
+
+   while (cache[i].first != -1 &&
+         (cache[i].first != first || cache[i].second != second)) {
+      i = (i + 1) & (size - 1);
+   }
+
+   return &cache[i];
+}
+
+
+/* Makes room for another kerning pair. Once the table is at its maximum
+ * size it is simply emptied.
+ */
+static bool grow_kerning_cache(ALLEGRO_TTF_FONT_DATA *data)
+{
+   ALLEGRO_TTF_KERNING *old = data->kerning_cache;
+   int old_size = data->kerning_cache_size;
+   int new_size;
+   int i;
+
+   if ((data->kerning_cache_count + 1) * 2 <= old_size)
+      return true;
+
+   new_size = old_size ? old_size * 2 : KERNING_CACHE_MIN_SIZE;
+   if (new_size > KERNING_CACHE_MAX_SIZE) {
+      new_size = KERNING_CACHE_MAX_SIZE;
+      old_size = 0;
+   }
+
+   data->kerning_cache = al_malloc(new_size * sizeof(ALLEGRO_TTF_KERNING));
+   if (!data->kerning_cache) {
+      data->kerning_cache = old;
+      return false;
+   }
+   for (i = 0; i < new_size; i++)
+      data->kerning_cache[i].first = -1;
+   data->kerning_cache_size = new_size;
+   data->kerning_cache_count = 0;
+
+   for (i = 0; i < old_size; i++) {
+      if (old[i].first != -1) {
+         *find_kerning_slot(data->kerning_cache, new_size,
+            old[i].first, old[i].second) = old[i];
+         data->kerning_cache_count++;
+      }
+   }
+
+   al_free(old);
+   return true;
+}
+
+
+static int get_kerning(ALLEGRO_TTF_FONT_DATA *data, FT_Face face,
    int prev_ft_index, int ft_index)
 {
+   ALLEGRO_TTF_KERNING *slot;
+   FT_Vector delta;
+
    /* Do kerning? */
-   if (!(data->flags & ALLEGRO_TTF_NO_KERNING) && prev_ft_index != -1) {
-      FT_Vector delta;
-      FT_Get_Kerning(face, prev_ft_index, ft_index,
-         FT_KERNING_DEFAULT, &delta);
-      return delta.x >> 6;
+   if ((data->flags & ALLEGRO_TTF_NO_KERNING) || prev_ft_index == -1 ||
+         !FT_HAS_KERNING(face)) {
+      return 0;
+   }
+
+   if (data->kerning_cache) {
+      slot = find_kerning_slot(data->kerning_cache, data->kerning_cache_size,
+         prev_ft_index, ft_index);
+      if (slot->first != -1)
+         return slot->kerning;
+   }
+
+   FT_Get_Kerning(face, prev_ft_index, ft_index, FT_KERNING_DEFAULT, &delta);
+
+   if (grow_kerning_cache(data)) {
+      slot = find_kerning_slot(data->kerning_cache, data->kerning_cache_size,
+         prev_ft_index, ft_index);
+      slot->first = prev_ft_index;
+      slot->second = ft_index;
+      slot->kerning = delta.x >> 6;
+      data->kerning_cache_count++;
    }
 
-   return 0;
+   return delta.x >> 6;
 }
 
 
 static int render_glyph(ALLEGRO_FONT const *f,
    ALLEGRO_COLOR color, int prev_ft_index, int ft_index,
-   float xpos, float ypos)
+   ALLEGRO_TTF_GLYPH_DATA *glyph, float xpos, float ypos)
 {
    ALLEGRO_TTF_FONT_DATA *data = f->data;
    FT_Face face = data->face;
-   ALLEGRO_TTF_GLYPH_DATA *glyph = get_glyph(data, ft_index);
    int advance = 0;
 
    /* We don't try to cache all glyphs in a pre-pass before drawing them.
@@ -472,6 +864,7 @@ static int render_glyph(ALLEGRO_FONT const *f,
    advance += get_kerning(data, face, prev_ft_index, ft_index);
 
    if (glyph->page_bitmap) {
+      get_page(data, glyph->page)->last_use = data->use_count;
       /* Each glyph has a 1-pixel border all around. */
       al_draw_tinted_bitmap_region(glyph->page_bitmap, color,
          glyph->region.x + 1, glyph->region.y + 1,
@@ -528,28 +921,99 @@ static int ttf_render_char(ALLEGRO_FONT const *f, ALLEGRO_COLOR color,
    int ch, float xpos, float ypos)
 {
    ALLEGRO_TTF_FONT_DATA *data = f->data;
-   FT_Face face = data->face;
    int advance = 0;
-   int32_t ch32 = (int32_t) ch;
-   
-   int ft_index = FT_Get_Char_Index(face, ch32);
-   advance = render_glyph(f, color, -1, ft_index, xpos, ypos);
+   int ft_index;
+   ALLEGRO_TTF_GLYPH_DATA *glyph;
+
+   al_lock_mutex(data->mutex);
+   glyph = get_char_glyph(data, ch, &ft_index);
+   data->use_count++;
+   advance = render_glyph(f, color, -1, ft_index, glyph, xpos, ypos);
+   al_unlock_mutex(data->mutex);
    
    return advance;
 }
 
 
+static bool ttf_get_glyph_quad(ALLEGRO_FONT const *f, int codepoint,
+   ALLEGRO_GLYPH_QUAD *quad)
+{
+   ALLEGRO_TTF_FONT_DATA *data = f->data;
+   int ft_index;
+   ALLEGRO_TTF_GLYPH_DATA *glyph;
+   bool ret = false;
+
+   al_lock_mutex(data->mutex);
+   glyph = get_char_glyph(data, codepoint, &ft_index);
+   if (glyph) {
+      cache_glyph(data, data->face, ft_index, glyph, false);
+   }
+
+   if (glyph && glyph->page_bitmap) {
+      /* The caller has started a draw with ttf_use_glyph_bitmaps. */
+      get_page(data, glyph->page)->last_use = data->use_count;
+
+      /* Each glyph has a 1-pixel border all around. */
+      quad->bitmap = glyph->page_bitmap;
+      quad->x = glyph->region.x + 1;
+      quad->y = glyph->region.y + 1;
+      quad->w = glyph->region.w - 2;
+      quad->h = glyph->region.h - 2;
+      quad->offset_x = glyph->offset_x;
+      quad->offset_y = glyph->offset_y;
+      ret = true;
+   }
+   al_unlock_mutex(data->mutex);
+
+   return ret;
+}
+
+
+/* Counts as a single use of all the given pages for the LRU eviction,
+ * however many glyphs are drawn from them.
+ */
+static int ttf_use_glyph_bitmaps(ALLEGRO_FONT const *f, int count,
+   ALLEGRO_BITMAP * const *bitmaps)
+{
+   ALLEGRO_TTF_FONT_DATA *data = f->data;
+   int version;
+   int i, j;
+
+   al_lock_mutex(data->mutex);
+   data->use_count++;
+
+   for (i = 0; i < (int)_al_vector_size(&data->pages); i++) {
+      ALLEGRO_TTF_PAGE *page = get_page(data, i);
+      for (j = 0; j < count; j++) {
+         if (page->bitmap == bitmaps[j]) {
+            page->last_use = data->use_count;
+            break;
+         }
+      }
+   }
+
+   version = data->cache_version;
+   al_unlock_mutex(data->mutex);
+
+   return version;
+}
+
+
 static int ttf_char_length(ALLEGRO_FONT const *f, int ch)
 {
-   int result;
+   int result = 0;
    ALLEGRO_TTF_FONT_DATA *data = f->data;
    FT_Face face = data->face;   
-   int ft_index = FT_Get_Char_Index(face, ch);
-   ALLEGRO_TTF_GLYPH_DATA *glyph = get_glyph(data, ft_index);
-   if (!glyph)
-      return 0;
-   cache_glyph(data, face, ft_index, glyph, false);
-   result = glyph->region.w - 2;
+   int ft_index;
+   ALLEGRO_TTF_GLYPH_DATA *glyph;
+
+   al_lock_mutex(data->mutex);
+   glyph = get_char_glyph(data, ch, &ft_index);
+   if (glyph) {
+      cache_glyph(data, face, ft_index, glyph, false);
+      result = glyph->region.w - 2;
+   }
+   al_unlock_mutex(data->mutex);
      
    return result;
 }
@@ -559,7 +1023,6 @@ static int ttf_render(ALLEGRO_FONT const *f, ALLEGRO_COLOR color,
    const ALLEGRO_USTR *text, float x, float y)
 {
    ALLEGRO_TTF_FONT_DATA *data = f->data;
-   FT_Face face = data->face;
    int pos = 0;
    int advance = 0;
    int prev_ft_index = -1;
@@ -569,12 +1032,17 @@ static int ttf_render(ALLEGRO_FONT const *f, ALLEGRO_COLOR color,
    hold = al_is_bitmap_drawing_held();
    al_hold_bitmap_drawing(true);
 
+   al_lock_mutex(data->mutex);
+   data->use_count++;
+
    while ((ch = al_ustr_get_next(text, &pos)) >= 0) {
-      int ft_index = FT_Get_Char_Index(face, ch);
-      advance += render_glyph(f, color, prev_ft_index, ft_index,
+      int ft_index;
+      ALLEGRO_TTF_GLYPH_DATA *glyph = get_char_glyph(data, ch, &ft_index);
+      advance += render_glyph(f, color, prev_ft_index, ft_index, glyph,
          x + advance, y);
       prev_ft_index = ft_index;
    }
+   al_unlock_mutex(data->mutex);
 
    al_hold_bitmap_drawing(hold);
 
@@ -591,9 +1059,11 @@ static int ttf_text_length(ALLEGRO_FONT const *f, const ALLEGRO_USTR *text)
    int x = 0;
    int32_t ch;
 
+   al_lock_mutex(data->mutex);
+
    while ((ch = al_ustr_get_next(text, &pos)) >= 0) {
-      int ft_index = FT_Get_Char_Index(face, ch);
-      ALLEGRO_TTF_GLYPH_DATA *glyph = get_glyph(data, ft_index);
+      int ft_index;
+      ALLEGRO_TTF_GLYPH_DATA *glyph = get_char_glyph(data, ch, &ft_index);
 
       cache_glyph(data, face, ft_index, glyph, true);
 
@@ -604,6 +1074,7 @@ static int ttf_text_length(ALLEGRO_FONT const *f, const ALLEGRO_USTR *text)
    }
 
    unlock_current_page(data);
+   al_unlock_mutex(data->mutex);
 
    return x;
 }
@@ -625,9 +1096,11 @@ static void ttf_get_text_dimensions(ALLEGRO_FONT const *f,
    end = al_ustr_size(text);
    *bbx = 0;
 
+   al_lock_mutex(data->mutex);
+
    while ((ch = al_ustr_get_next(text, &pos)) >= 0) {
-      int ft_index = FT_Get_Char_Index(face, ch);
-      ALLEGRO_TTF_GLYPH_DATA *glyph = get_glyph(data, ft_index);
+      int ft_index;
+      ALLEGRO_TTF_GLYPH_DATA *glyph = get_char_glyph(data, ch, &ft_index);
 
       cache_glyph(data, face, ft_index, glyph, true);
 
@@ -652,6 +1125,7 @@ static void ttf_get_text_dimensions(ALLEGRO_FONT const *f,
    *bbh = f->height; // FIXME, we want the bounding box!
 
    unlock_current_page(data);
+   al_unlock_mutex(data->mutex);
 }
 
 
@@ -660,16 +1134,15 @@ static void ttf_get_text_dimensions(ALLEGRO_FONT const *f,
 static void debug_cache(ALLEGRO_FONT *f)
 {
    ALLEGRO_TTF_FONT_DATA *data = f->data;
-   _AL_VECTOR *v = &data->page_bitmaps;
    static int j = 0;
    int i;
 
    al_init_image_addon();
 
-   for (i = 0; i < (int)_al_vector_size(v); i++) {
-      ALLEGRO_BITMAP **bmp = _al_vector_ref(v, i);
+   for (i = 0; i < (int)_al_vector_size(&data->pages); i++) {
+      ALLEGRO_TTF_PAGE *page = get_page(data, i);
       ALLEGRO_USTR *u = al_ustr_newf("font%d_%d.png", j, i);
-      al_save_bitmap(al_cstr(u), *bmp);
+      al_save_bitmap(al_cstr(u), page->bitmap);
       al_ustr_free(u);
    }
    j++;
@@ -694,11 +1167,17 @@ static void ttf_destroy(ALLEGRO_FONT *f)
       al_free(range->glyphs);
    }
    _al_vector_free(&data->glyph_ranges);
-   for (i = _al_vector_size(&data->page_bitmaps) - 1; i >= 0; i--) {
-      ALLEGRO_BITMAP **bmp = _al_vector_ref(&data->page_bitmaps, i);
-      al_destroy_bitmap(*bmp);
+   for (i = 0; i < CACHED_CODEPOINTS / CHAR_PAGE_SIZE; i++) {
+      al_free(data->char_pages[i]);
+   }
+   al_free(data->kerning_cache);
+   for (i = _al_vector_size(&data->pages) - 1; i >= 0; i--) {
+      ALLEGRO_TTF_PAGE *page = get_page(data, i);
+      al_destroy_bitmap(page->bitmap);
+      _al_vector_free(&page->skyline);
    }
-   _al_vector_free(&data->page_bitmaps);
+   _al_vector_free(&data->pages);
+   al_destroy_mutex(data->mutex);
    al_free(data);
    al_free(f);
 }
@@ -729,6 +1208,28 @@ static void ftclose(FT_Stream  stream)
 }
 
 
+static void set_face_size(FT_Face face, int w, int h)
+{
+    if (h > 0) {
+       FT_Set_Pixel_Sizes(face, w, h);
+    }
+    else {
+       /* Set the "real dimension" of the font to be the passed size,
+        * in pixels.
+        */
+       FT_Size_RequestRec req;
+       ASSERT(w <= 0);
+       ASSERT(h <= 0);
+       req.type = FT_SIZE_REQUEST_TYPE_REAL_DIM;
+       req.width = (-w) << 6;
+       req.height = (-h) << 6;
+       req.horiResolution = 0;
+       req.vertResolution = 0;
+       FT_Request_Size(face, &req);
+    }
+}
+
+
 /* Function: al_load_ttf_font_f
  */
 ALLEGRO_FONT *al_load_ttf_font_f(ALLEGRO_FILE *file,
@@ -754,6 +1255,8 @@ ALLEGRO_FONT *al_load_ttf_font_stretch_f(ALLEGRO_FILE *file,
       al_get_config_value(system_cfg, "ttf", "min_page_size");
     const char* max_page_size_str =
       al_get_config_value(system_cfg, "ttf", "max_page_size");
+    const char* max_page_count_str =
+      al_get_config_value(system_cfg, "ttf", "max_page_count");
 
     if ((h > 0 && w < 0) || (h < 0 && w > 0)) {
        ALLEGRO_ERROR("Height/width have opposite signs (w = %d, h = %d).\n", w, h);
@@ -765,7 +1268,7 @@ ALLEGRO_FONT *al_load_ttf_font_stretch_f(ALLEGRO_FILE *file,
     data->stream.close = ftclose;
     data->stream.pathname.pointer = data;
     data->base_offset = al_ftell(file);
-    data->stream.size = al_fsize(file);
+    data->stream.size = al_fsize(file) - data->base_offset;
     data->file = file;
     data->bitmap_format = al_get_new_bitmap_format();
     data->bitmap_flags = al_get_new_bitmap_flags();
@@ -786,6 +1289,13 @@ ALLEGRO_FONT *al_load_ttf_font_stretch_f(ALLEGRO_FILE *file,
       }
     }
 
+    if (max_page_count_str) {
+      int max_page_count = atoi(max_page_count_str);
+      if (max_page_count > 0) {
+         data->max_page_count = max_page_count;
+      }
+    }
+
     memset(&args, 0, sizeof args);
     args.flags = FT_OPEN_STREAM;
     args.stream = &data->stream;
@@ -819,22 +1329,13 @@ ALLEGRO_FONT *al_load_ttf_font_stretch_f(ALLEGRO_FILE *file,
     }
     al_destroy_path(path);
 
-    if (h > 0) {
-       FT_Set_Pixel_Sizes(face, w, h);
-    }
-    else {
-       /* Set the "real dimension" of the font to be the passed size,
-        * in pixels.
-        */
-       FT_Size_RequestRec req;
-       ASSERT(w <= 0);
-       ASSERT(h <= 0);
-       req.type = FT_SIZE_REQUEST_TYPE_REAL_DIM;
-       req.width = (-w) << 6;
-       req.height = (-h) << 6;
-       req.horiResolution = 0;
-       req.vertResolution = 0;
-       FT_Request_Size(face, &req);
+    set_face_size(face, w, h);
+
+    data->mutex = al_create_mutex_recursive();
+    if (!data->mutex) {
+        FT_Done_Face(face);
+        al_free(data);
+        return NULL;
     }
 
     ALLEGRO_DEBUG("Font %s loaded with pixel size %d x %d.\n", filename,
@@ -846,9 +1347,12 @@ ALLEGRO_FONT *al_load_ttf_font_stretch_f(ALLEGRO_FILE *file,
 
     data->face = face;
     data->flags = flags;
+    data->size_w = w;
+    data->size_h = h;
 
     _al_vector_init(&data->glyph_ranges, sizeof(ALLEGRO_TTF_GLYPH_RANGE));
-    _al_vector_init(&data->page_bitmaps, sizeof(ALLEGRO_BITMAP*));
+    _al_vector_init(&data->pages, sizeof(ALLEGRO_TTF_PAGE));
+    data->current_page = -1;
 
     f = al_malloc(sizeof *f);
     f->height = face->size->metrics.height >> 6;
@@ -898,8 +1402,11 @@ static int ttf_get_font_ranges(ALLEGRO_FONT *font, int ranges_count,
 {
    ALLEGRO_TTF_FONT_DATA *data = font->data;
    FT_UInt g;
-   FT_ULong unicode = FT_Get_First_Char(data->face, &g);
+   FT_ULong unicode;
    int i = 0;
+
+   al_lock_mutex(data->mutex);
+   unicode = FT_Get_First_Char(data->face, &g);
    if (i < ranges_count) {
       ranges[i * 2 + 0] = unicode;
       ranges[i * 2 + 1] = unicode;
@@ -920,6 +1427,7 @@ static int ttf_get_font_ranges(ALLEGRO_FONT *font, int ranges_count,
       }
       unicode = unicode2;
    }
+   al_unlock_mutex(data->mutex);
    return i;
 }
 
@@ -929,16 +1437,21 @@ static bool ttf_get_glyph_dimensions(ALLEGRO_FONT const *f,
 {
    ALLEGRO_TTF_FONT_DATA *data = f->data;
    FT_Face face = data->face;   
-   int ft_index = FT_Get_Char_Index(face, codepoint);
-   ALLEGRO_TTF_GLYPH_DATA *glyph = get_glyph(data, ft_index);
-   if (!glyph) return false;
-   cache_glyph(data, face, ft_index, glyph, false);
-   *bbx = glyph->offset_x;
-   *bbw = glyph->region.w - 2;
-   *bbh = glyph->region.h;
-   *bby = glyph->offset_y;
+   int ft_index;
+   ALLEGRO_TTF_GLYPH_DATA *glyph;
+
+   al_lock_mutex(data->mutex);
+   glyph = get_char_glyph(data, codepoint, &ft_index);
+   if (glyph) {
+      cache_glyph(data, face, ft_index, glyph, false);
+      *bbx = glyph->offset_x;
+      *bbw = glyph->region.w - 2;
+      *bbh = glyph->region.h;
+      *bby = glyph->offset_y;
+   }
+   al_unlock_mutex(data->mutex);
       
-   return true;
+   return glyph != NULL;
 }
 
 static int ttf_get_glyph_advance(ALLEGRO_FONT const *f, int codepoint1,
@@ -946,7 +1459,7 @@ static int ttf_get_glyph_advance(ALLEGRO_FONT const *f, int codepoint1,
 {
    ALLEGRO_TTF_FONT_DATA *data = f->data;
    FT_Face face = data->face;
-   int ft_index = FT_Get_Char_Index(face, codepoint1);
+   int ft_index;
    ALLEGRO_TTF_GLYPH_DATA *glyph; 
    int kerning = 0;
    int advance = 0;
@@ -955,26 +1468,316 @@ static int ttf_get_glyph_advance(ALLEGRO_FONT const *f, int codepoint1,
       return 0;
    }
       
-   glyph = get_glyph(data, ft_index);   
+   al_lock_mutex(data->mutex);
+   glyph = get_char_glyph(data, codepoint1, &ft_index);
    
-   if (!glyph)
+   if (!glyph) {
+      al_unlock_mutex(data->mutex);
       return 0;
+   }
       
    cache_glyph(data, face, ft_index, glyph, true);
    
    if (codepoint2 != ALLEGRO_NO_KERNING) { 
-      int ft_index1 = FT_Get_Char_Index(face, codepoint1);
-      int ft_index2 = FT_Get_Char_Index(face, codepoint2); 
-      kerning = get_kerning(data, face, ft_index1, ft_index2);
+      int ft_index2;
+      get_char_glyph(data, codepoint2, &ft_index2);
+      kerning = get_kerning(data, face, ft_index, ft_index2);
    }
    
    advance = glyph->advance;
    unlock_current_page(data);
+   al_unlock_mutex(data->mutex);
    return advance + kerning;
 }
 
 
 
+/* A glyph rendered by FreeType but not yet placed on a page.  The glyph
+ * data itself is only filled in from `metrics` when the glyph is packed,
+ * with the font's mutex held.
+ */
+typedef struct STAGED_GLYPH
+{
+   ALLEGRO_TTF_GLYPH_DATA *glyph;
+   ALLEGRO_TTF_GLYPH_DATA metrics;
+   int ft_index;
+   int w;
+   int h;
+   unsigned char *pixels;  /* w * h ABGR_8888_LE pixels */
+} STAGED_GLYPH;
+
+
+static int compare_ft_indices(const void *a, const void *b)
+{
+   return *(const int *)a - *(const int *)b;
+}
+
+
+/* Renders glyphs into staged pixels.  Glyphs with nothing to put on a
+ * page are left with a width of zero.
+ */
+static void render_staged_glyphs(ALLEGRO_TTF_FONT_DATA *data, FT_Face face,
+   STAGED_GLYPH *glyphs, int count)
+{
+   int i;
+
+   for (i = 0; i < count; i++) {
+      STAGED_GLYPH *sg = &glyphs[i];
+
+      memset(&sg->metrics, 0, sizeof sg->metrics);
+      if (!load_glyph(data, face, sg->ft_index, &sg->metrics)) {
+         sg->w = 0;
+         sg->h = 0;
+         sg->pixels = NULL;
+         continue;
+      }
+
+      sg->w = face->glyph->bitmap.width;
+      sg->h = face->glyph->bitmap.rows;
+      sg->pixels = al_malloc(sg->w * sg->h * 4);
+      if (sg->pixels) {
+         copy_glyph(data, &face->glyph->bitmap, sg->pixels, sg->w * 4);
+      }
+   }
+}
+
+
+/* A share of the glyphs for al_prewarm_ttf_glyphs, rendered by a job with
+ * its own face.  A FreeType face can only be used by one thread at a time,
+ * while the library can be shared as long as faces are only created and
+ * destroyed by one thread.
+ */
+typedef struct PREWARM_JOB
+{
+   ALLEGRO_TTF_FONT_DATA *data;
+   FT_Face face;
+   STAGED_GLYPH *glyphs;
+   int count;
+   ALLEGRO_JOB *job;
+} PREWARM_JOB;
+
+
+static void prewarm_job_proc(void *arg)
+{
+   PREWARM_JOB *pj = arg;
+   render_staged_glyphs(pj->data, pj->face, pj->glyphs, pj->count);
+}
+
+
+/* Renders the glyphs with num_jobs jobs, each with a face opened from a
+ * copy of the font file in memory.  Returns false without rendering
+ * anything if the faces could not be opened.  The font's mutex is only
+ * held while the file is read.
+ */
+static bool render_staged_glyphs_in_jobs(ALLEGRO_TTF_FONT_DATA *data,
+   STAGED_GLYPH *glyphs, int count, int num_jobs)
+{
+   unsigned char *font_file;
+   unsigned long size;
+   PREWARM_JOB *jobs;
+   int num_faces = 0;
+   int start = 0;
+   int i;
+
+   font_file = al_malloc(data->stream.size);
+   jobs = al_calloc(num_jobs, sizeof *jobs);
+   if (!font_file || !jobs) {
+      al_free(font_file);
+      al_free(jobs);
+      return false;
+   }
+   al_lock_mutex(data->mutex);
+   size = ftread(&data->stream, 0, font_file, data->stream.size);
+   al_unlock_mutex(data->mutex);
+
+   for (i = 0; i < num_jobs; i++) {
+      PREWARM_JOB *pj = &jobs[i];
+      if (FT_New_Memory_Face(ft, font_file, size, 0, &pj->face) != 0)
+         break;
+      set_face_size(pj->face, data->size_w, data->size_h);
+      pj->data = data;
+      pj->glyphs = glyphs + start;
+      pj->count = (int)((int64_t)count * (i + 1) / num_jobs) - start;
+      start += pj->count;
+      num_faces++;
+   }
+
+   if (num_faces == num_jobs) {
+      for (i = 0; i < num_jobs; i++) {
+         jobs[i].job = al_create_job(prewarm_job_proc, &jobs[i]);
+         if (jobs[i].job)
+            al_submit_job(jobs[i].job);
+         else
+            prewarm_job_proc(&jobs[i]);
+      }
+      for (i = 0; i < num_jobs; i++)
+         al_destroy_job(jobs[i].job);
+   }
+
+   for (i = 0; i < num_faces; i++)
+      FT_Done_Face(jobs[i].face);
+   al_free(jobs);
+   al_free(font_file);
+
+   return num_faces == num_jobs;
+}
+
+
+/* Tallest first, which packs tightly and lets the following glyphs mostly
+ * land in the region already locked for the previous ones.
+ */
+static int compare_staged_glyphs(const void *a, const void *b)
+{
+   STAGED_GLYPH const *sa = a;
+   STAGED_GLYPH const *sb = b;
+   if (sa->h != sb->h)
+      return sb->h - sa->h;
+   return sb->w - sa->w;
+}
+
+
+/* Function: al_prewarm_ttf_glyphs
+ */
+bool al_prewarm_ttf_glyphs(ALLEGRO_FONT *f, int ranges_count,
+   const int *ranges)
+{
+   ALLEGRO_TTF_FONT_DATA *data;
+   FT_Face face;
+   _AL_VECTOR indices;
+   _AL_VECTOR staged;
+   int num_staged;
+   int num_jobs;
+   bool ret = true;
+   int i;
+   ASSERT(f);
+   ASSERT(ranges || ranges_count == 0);
+
+   if (f->vtable != &vt)
+      return false;
+
+   data = f->data;
+   face = data->face;
+
+   /* Collect the distinct glyphs which still need caching.  Codepoints the
+    * font doesn't contain map to glyph 0, which is left alone.
+    */
+   al_lock_mutex(data->mutex);
+   _al_vector_init(&indices, sizeof(int));
+   for (i = 0; i < ranges_count; i++) {
+      int ch;
+      for (ch = ranges[i * 2]; ch <= ranges[i * 2 + 1]; ch++) {
+         int ft_index;
+         ALLEGRO_TTF_GLYPH_DATA *glyph = get_char_glyph(data, ch, &ft_index);
+         if (ft_index != 0 && !glyph_is_cached(glyph)) {
+            int *p = _al_vector_alloc_back(&indices);
+            *p = ft_index;
+         }
+      }
+   }
+
+   if (!_al_vector_is_empty(&indices)) {
+      qsort(_al_vector_ref_front(&indices), _al_vector_size(&indices),
+         sizeof(int), compare_ft_indices);
+   }
+
+   /* The glyph data is looked up here, as that may allocate.  The glyph
+    * ranges are never freed before the font, so the pointers stay valid
+    * after unlocking.
+    */
+   _al_vector_init(&staged, sizeof(STAGED_GLYPH));
+   for (i = 0; i < (int)_al_vector_size(&indices); i++) {
+      int ft_index = *(int *)_al_vector_ref(&indices, i);
+      STAGED_GLYPH *sg;
+
+      if (i > 0 && ft_index == *(int *)_al_vector_ref(&indices, i - 1))
+         continue;
+
+      sg = _al_vector_alloc_back(&staged);
+      sg->glyph = get_glyph(data, ft_index);
+      sg->ft_index = ft_index;
+   }
+   _al_vector_free(&indices);
+   al_unlock_mutex(data->mutex);
+
+   /* Rasterize everything first, without touching the glyph cache or any
+    * page bitmap, so other threads can keep using the font meanwhile.
+    */
+   num_staged = _al_vector_size(&staged);
+   num_jobs = (num_staged + PREWARM_GLYPHS_PER_JOB - 1) / PREWARM_GLYPHS_PER_JOB;
+   if (num_jobs > al_get_cpu_count())
+      num_jobs = al_get_cpu_count();
+
+   if (num_jobs <= 1 || !render_staged_glyphs_in_jobs(data,
+         _al_vector_ref_front(&staged), num_staged, num_jobs)) {
+      if (num_staged > 0) {
+         /* The font's own face is shared with the other threads. */
+         al_lock_mutex(data->mutex);
+         render_staged_glyphs(data, face, _al_vector_ref_front(&staged),
+            num_staged);
+         al_unlock_mutex(data->mutex);
+      }
+   }
+
+   /* Then pack them, keeping each page region locked for as long as
+    * possible.
+    */
+   if (!_al_vector_is_empty(&staged)) {
+      qsort(_al_vector_ref_front(&staged), _al_vector_size(&staged),
+         sizeof(STAGED_GLYPH), compare_staged_glyphs);
+   }
+
+   al_lock_mutex(data->mutex);
+   data->use_count++;
+
+   for (i = 0; i < (int)_al_vector_size(&staged); i++) {
+      STAGED_GLYPH *sg = _al_vector_ref(&staged, i);
+      ALLEGRO_TTF_GLYPH_DATA *glyph = sg->glyph;
+      unsigned char *glyph_data = NULL;
+      int y;
+
+      /* Another thread may have cached it in the meantime. */
+      if (glyph_is_cached(glyph)) {
+         al_free(sg->pixels);
+         continue;
+      }
+
+      if (sg->w == 0) {
+         *glyph = sg->metrics;
+         continue;
+      }
+
+      glyph->offset_x = sg->metrics.offset_x;
+      glyph->offset_y = sg->metrics.offset_y;
+      glyph->advance = sg->metrics.advance;
+
+      if (sg->pixels) {
+         glyph_data = alloc_glyph_region(data, sg->ft_index,
+            sg->w + 2, sg->h + 2, glyph, true);
+      }
+
+      if (glyph_data) {
+         for (y = 0; y < sg->h; y++) {
+            memcpy(glyph_data + y * data->page_lr->pitch,
+               sg->pixels + y * sg->w * 4, sg->w * 4);
+         }
+      }
+      else {
+         ret = false;
+      }
+
+      al_free(sg->pixels);
+   }
+
+   unlock_current_page(data);
+   al_unlock_mutex(data->mutex);
+
+   _al_vector_free(&staged);
+
+   return ret;
+}
+
+
+
 /* Function: al_init_ttf_addon
  */
 bool al_init_ttf_addon(void)
@@ -997,8 +1800,11 @@ bool al_init_ttf_addon(void)
    vt.get_font_ranges = ttf_get_font_ranges;
    vt.get_glyph_dimensions = ttf_get_glyph_dimensions;
    vt.get_glyph_advance = ttf_get_glyph_advance;
+   glyph_vt.get_glyph_quad = ttf_get_glyph_quad;
+   glyph_vt.use_glyph_bitmaps = ttf_use_glyph_bitmaps;
 
    al_register_font_loader(".ttf", al_load_ttf_font);
+   _al_register_font_glyph_vtable(&vt, &glyph_vt);
 
    /* Can't fail right now - in the future we might dynamically load
     * the FreeType DLL here and/or initialize FreeType (which both
@@ -1019,6 +1825,7 @@ void al_shutdown_ttf_addon(void)
    }
 
    al_register_font_loader(".ttf", NULL);
+   _al_register_font_glyph_vtable(&vt, NULL);
 
    FT_Done_FreeType(ft);
 
@@ -3,7 +3,6 @@
  * TODO:
  * - seeking
  * - generate video frame events
- * - better ycbcr->rgb
  * - improve frame skipping
  * - Ogg Skeleton support
  * - pass Theora test suite
@@ -92,11 +91,18 @@ struct OGG_VIDEO {
    STREAM *selected_audio_stream;   /* one of the streams */
    int seek_counter;
 
-   /* Video output. */
+   /* Video output.  The decoder's planes are only valid until the next
+    * packet, so the latest frame is copied to the back buffer.  When the
+    * frame bitmap is next updated, the buffers are swapped with the mutex
+    * held and the front buffer is converted to RGB after unlocking, so the
+    * conversion never holds up the decoder.
+    */
    th_pixel_fmt pixel_fmt;
-   th_ycbcr_buffer buffer;
+   th_ycbcr_buffer buffer;          /* back buffer, points into ycbcr_data */
+   th_ycbcr_buffer front_buffer;    /* points into front_ycbcr_data */
    bool buffer_dirty;
-   unsigned char* rgb_data;
+   unsigned char *ycbcr_data;
+   unsigned char *front_ycbcr_data;
    ALLEGRO_BITMAP *frame_bmp;
    ALLEGRO_BITMAP *pic_bmp;         /* frame_bmp, or subbitmap thereof */
 
@@ -708,6 +714,173 @@ static void update_audio_fragment(ALLEGRO_AUDIO_STREAM *audio_stream,
 }
 
 
+/* Y'CrCb to RGB conversion.
+ *
+ * Rows are converted with fixed point arithmetic and no lookup tables or
+ * branches, so that the compiler can vectorise the loops.  The pixels are
+ * written straight into the locked frame bitmap.
+ */
+
+static void get_chroma_shift(th_pixel_fmt pixel_fmt, int *xshift, int *yshift)
+{
+   switch (pixel_fmt) {
+      case TH_PF_420:
+         *xshift = 1;
+         *yshift = 1;
+         break;
+      case TH_PF_422:
+         *xshift = 1;
+         *yshift = 0;
+         break;
+      case TH_PF_444:
+         *xshift = 0;
+         *yshift = 0;
+         break;
+      default:
+         ALLEGRO_ERROR("Unsupported pixel format.\n");
+         *xshift = 0;
+         *yshift = 0;
+         break;
+   }
+}
+
+static INLINE int clamp(int x)
+{
+   return x < 0 ? 0 : (x > 255 ? 255 : x);
+}
+
+/* Returns a pixel in RGB_PIXEL_FORMAT.  `c` is the scaled luma, the others
+ * the chroma contribution to each component.
+ */
+static INLINE uint32_t ycbcr_pixel(int c, int ruv, int guv, int buv)
+{
+   const uint32_t r = clamp((c + ruv) >> 8);
+   const uint32_t g = clamp((c + guv) >> 8);
+   const uint32_t b = clamp((c + buv) >> 8);
+
+   return 0xff000000u | (b << 16) | (g << 8) | r;
+}
+
+#define SCALE_LUMA(yp)  (298 * ((yp) - 16) + 128)
+
+static void ycbcr_row_full(uint32_t *dst, const unsigned char *yp,
+   const unsigned char *cb, const unsigned char *cr, int w)
+{
+   int x;
+
+   for (x = 0; x < w; x++) {
+      const int D = cb[x] - 128;
+      const int E = cr[x] - 128;
+
+      dst[x] = ycbcr_pixel(SCALE_LUMA(yp[x]),
+         409*E, -100*D - 208*E, 516*D);
+   }
+}
+
+/* Each chroma sample covers two pixels. */
+static void ycbcr_row_half(uint32_t *dst, const unsigned char *yp,
+   const unsigned char *cb, const unsigned char *cr, int w)
+{
+   int x;
+
+   for (x = 0; x < w / 2; x++) {
+      const int D = cb[x] - 128;
+      const int E = cr[x] - 128;
+      const int ruv = 409*E;
+      const int guv = -100*D - 208*E;
+      const int buv = 516*D;
+
+      dst[2*x    ] = ycbcr_pixel(SCALE_LUMA(yp[2*x    ]), ruv, guv, buv);
+      dst[2*x + 1] = ycbcr_pixel(SCALE_LUMA(yp[2*x + 1]), ruv, guv, buv);
+   }
+
+   if (w & 1) {
+      ycbcr_row_full(dst + w - 1, yp + w - 1, cb + w / 2, cr + w / 2, 1);
+   }
+}
+
+static void convert_buffer_to_rgba(OGG_VIDEO *ogv, ALLEGRO_LOCKED_REGION *lr)
+{
+   th_img_plane * const planes = ogv->front_buffer;
+   const int w = planes[0].width;
+   const int h = planes[0].height;
+   int xshift, yshift;
+   int y;
+
+   get_chroma_shift(ogv->pixel_fmt, &xshift, &yshift);
+
+   for (y = 0; y < h; y++) {
+      uint32_t *dst = (uint32_t *)((char *)lr->data + y * lr->pitch);
+      const int y2 = y >> yshift;
+      const unsigned char *yp = planes[0].data + y  * planes[0].stride;
+      const unsigned char *cb = planes[1].data + y2 * planes[1].stride;
+      const unsigned char *cr = planes[2].data + y2 * planes[2].stride;
+
+      if (xshift)
+         ycbcr_row_half(dst, yp, cb, cr, w);
+      else
+         ycbcr_row_full(dst, yp, cb, cr, w);
+   }
+}
+
+#undef SCALE_LUMA
+
+/* Allocates one block for all three planes of a frame, and points `buffer`
+ * into it.
+ */
+static unsigned char *alloc_ycbcr_buffer(th_ycbcr_buffer buffer,
+   th_pixel_fmt pixel_fmt, int frame_w, int frame_h)
+{
+   int xshift, yshift;
+   int cw, ch;
+   unsigned char *data;
+   int i;
+
+   get_chroma_shift(pixel_fmt, &xshift, &yshift);
+   cw = (frame_w + xshift) >> xshift;
+   ch = (frame_h + yshift) >> yshift;
+
+   data = al_malloc(frame_w * frame_h + 2 * cw * ch);
+   if (!data)
+      return NULL;
+
+   buffer[0].data = data;
+   buffer[0].stride = frame_w;
+   buffer[1].data = data + frame_w * frame_h;
+   buffer[2].data = buffer[1].data + cw * ch;
+   for (i = 1; i < 3; i++) {
+      buffer[i].stride = cw;
+   }
+
+   /* Nothing decoded yet. */
+   for (i = 0; i < 3; i++) {
+      buffer[i].width = 0;
+      buffer[i].height = 0;
+   }
+
+   return data;
+}
+
+/* Copies a decoded frame into ogv->buffer. */
+static void copy_ycbcr_buffer(OGG_VIDEO *ogv, th_ycbcr_buffer frame)
+{
+   int i, y;
+
+   for (i = 0; i < 3; i++) {
+      th_img_plane *dst = &ogv->buffer[i];
+      const th_img_plane *src = &frame[i];
+
+      ASSERT(src->width <= dst->stride);
+      dst->width = src->width;
+      dst->height = src->height;
+      for (y = 0; y < src->height; y++) {
+         memcpy(dst->data + y * dst->stride, src->data + y * src->stride,
+            src->width);
+      }
+   }
+}
+
+
 /* Theora streams. */
 
 static void setup_theora_stream_decode(ALLEGRO_VIDEO *video, OGG_VIDEO *ogv,
@@ -735,8 +908,16 @@ static void setup_theora_stream_decode(ALLEGRO_VIDEO *video, OGG_VIDEO *ogv,
       ogv->pic_bmp = al_create_sub_bitmap(ogv->frame_bmp,
          pic_x, pic_y, pic_w, pic_h);
    }
-   ogv->rgb_data =
-      al_malloc(al_get_pixel_size(RGB_PIXEL_FORMAT) * frame_w * frame_h);
+   ogv->ycbcr_data = alloc_ycbcr_buffer(ogv->buffer, ogv->pixel_fmt,
+      frame_w, frame_h);
+   ogv->front_ycbcr_data = alloc_ycbcr_buffer(ogv->front_buffer,
+      ogv->pixel_fmt, frame_w, frame_h);
+   if (!ogv->ycbcr_data || !ogv->front_ycbcr_data) {
+      al_free(ogv->ycbcr_data);
+      al_free(ogv->front_ycbcr_data);
+      ogv->ycbcr_data = NULL;
+      ogv->front_ycbcr_data = NULL;
+   }
 
    video->width = pic_w;
    video->height = pic_h;
@@ -811,66 +992,6 @@ static bool handle_theora_data(ALLEGRO_VIDEO *video, THEORA_STREAM *tstream,
    return true;
 }
 
-/* Y'CrCb to RGB conversion. */
-/* XXX simple slow implementation */
-
-static unsigned char clamp(int x)
-{
-   if (x < 0)
-      return 0;
-   if (x > 255)
-      return 255;
-   return x;
-}
-
-static INLINE void ycbcr_to_rgb(th_ycbcr_buffer buffer,
-   unsigned char* rgb_data, int pixel_size, int pitch, int xshift, int yshift)
-{
-   const int w = buffer[0].width;
-   const int h = buffer[0].height;
-   int x, y;
-
-   for (y = 0; y < h; y++) {
-      const int y2 = y >> yshift;
-      for (x = 0; x < w; x++) {
-         const int x2 = x >> xshift;
-         unsigned char * const data = rgb_data + y * pitch + x * pixel_size;
-         const int yp = buffer[0].data[y  * buffer[0].stride + x ];
-         const int cb = buffer[1].data[y2 * buffer[1].stride + x2];
-         const int cr = buffer[2].data[y2 * buffer[2].stride + x2];
-         const int C = yp - 16;
-         const int D = cb - 128;
-         const int E = cr - 128;
-
-         data[0] = clamp((298*C         + 409*E + 128) >> 8);
-         data[1] = clamp((298*C - 100*D - 208*E + 128) >> 8);
-         data[2] = clamp((298*C + 516*D         + 128) >> 8);
-         data[3] = 0xff;
-      }
-   }
-}
-
-static void convert_buffer_to_rgba(OGG_VIDEO *ogv)
-{
-   const int pixel_size = al_get_pixel_size(RGB_PIXEL_FORMAT);
-   const int pitch = pixel_size * al_get_bitmap_width(ogv->frame_bmp);
-
-   switch (ogv->pixel_fmt) {
-      case TH_PF_420:
-         ycbcr_to_rgb(ogv->buffer, ogv->rgb_data, pixel_size, pitch, 1, 1);
-         break;
-      case TH_PF_422:
-         ycbcr_to_rgb(ogv->buffer, ogv->rgb_data, pixel_size, pitch, 1, 0);
-         break;
-      case TH_PF_444:
-         ycbcr_to_rgb(ogv->buffer, ogv->rgb_data, pixel_size, pitch, 0, 0);
-         break;
-      default:
-         ALLEGRO_ERROR("Unsupported pixel format.\n");
-         break;
-   }
-}
-
 static int poll_theora_decode(ALLEGRO_VIDEO *video, STREAM *tstream_outer)
 {
    OGG_VIDEO * const ogv = video->data;
@@ -916,13 +1037,17 @@ static int poll_theora_decode(ALLEGRO_VIDEO *video, STREAM *tstream_outer)
    }
 
    if (new_frame) {
-      al_lock_mutex(ogv->mutex);
+      th_ycbcr_buffer frame;
       ALLEGRO_EVENT event;
 
-      rc = th_decode_ycbcr_out(tstream->ctx, ogv->buffer);
+      rc = th_decode_ycbcr_out(tstream->ctx, frame);
       ASSERT(rc == 0);
 
-      convert_buffer_to_rgba(ogv);
+      al_lock_mutex(ogv->mutex);
+
+      if (ogv->ycbcr_data) {
+         copy_ycbcr_buffer(ogv, frame);
+      }
 
       ogv->buffer_dirty = true;
 
@@ -1106,8 +1231,6 @@ static void *decode_thread_func(ALLEGRO_THREAD *thread, void *_video)
 static bool update_frame_bmp(OGG_VIDEO *ogv)
 {
    ALLEGRO_LOCKED_REGION *lr;
-   int y;
-   int pitch = al_get_pixel_size(RGB_PIXEL_FORMAT) * al_get_bitmap_width(ogv->frame_bmp);
 
    lr = al_lock_bitmap(ogv->frame_bmp, RGB_PIXEL_FORMAT,
       ALLEGRO_LOCK_WRITEONLY);
@@ -1116,9 +1239,7 @@ static bool update_frame_bmp(OGG_VIDEO *ogv)
       return false;
    }
 
-   for (y = 0; y < al_get_bitmap_height(ogv->frame_bmp); y++) {
-      memcpy((unsigned char*)lr->data + y * lr->pitch, ogv->rgb_data + y * pitch, pitch);
-   }
+   convert_buffer_to_rgba(ogv, lr);
 
    al_unlock_bitmap(ogv->frame_bmp);
    return true;
@@ -1223,7 +1344,8 @@ static bool ogv_close_video(ALLEGRO_VIDEO *video)
       }
       al_destroy_bitmap(ogv->frame_bmp);
 
-      al_free(ogv->rgb_data);
+      al_free(ogv->ycbcr_data);
+      al_free(ogv->front_ycbcr_data);
 
       al_free(ogv);
    }
@@ -1299,21 +1421,37 @@ static bool ogv_seek_video(ALLEGRO_VIDEO *video, double seek_to)
 static bool ogv_update_video(ALLEGRO_VIDEO *video)
 {
    OGG_VIDEO *ogv = video->data;
+   th_ycbcr_buffer tmp_buffer;
+   unsigned char *tmp_data;
+   bool dirty;
    int w, h;
    bool ret;
 
+   /* Take the latest frame.  The front buffer is only used by this
+    * function, so it can be converted without the mutex.
+    */
    al_lock_mutex(ogv->mutex);
+   dirty = ogv->buffer_dirty;
+   if (dirty) {
+      memcpy(tmp_buffer, ogv->front_buffer, sizeof(th_ycbcr_buffer));
+      memcpy(ogv->front_buffer, ogv->buffer, sizeof(th_ycbcr_buffer));
+      memcpy(ogv->buffer, tmp_buffer, sizeof(th_ycbcr_buffer));
+      tmp_data = ogv->front_ycbcr_data;
+      ogv->front_ycbcr_data = ogv->ycbcr_data;
+      ogv->ycbcr_data = tmp_data;
+      ogv->buffer_dirty = false;
+   }
+   al_unlock_mutex(ogv->mutex);
 
-   w = ogv->buffer[0].width;
-   h = ogv->buffer[0].height;
+   w = ogv->front_buffer[0].width;
+   h = ogv->front_buffer[0].height;
 
    if (w > 0 && h && h > 0 && ogv->frame_bmp) {
       ASSERT(w == al_get_bitmap_width(ogv->frame_bmp));
       ASSERT(h == al_get_bitmap_height(ogv->frame_bmp));
 
-      if (ogv->buffer_dirty) {
+      if (dirty) {
          ret = update_frame_bmp(ogv);
-         ogv->buffer_dirty = false;
       }
       else {
          ret = true;
@@ -1326,8 +1464,6 @@ static bool ogv_update_video(ALLEGRO_VIDEO *video)
       ret = false;
    }
 
-   al_unlock_mutex(ogv->mutex);
-
    return ret;
 }
 
@@ -20,13 +20,17 @@ set(ALLEGRO_SRC_FILES
     src/evtsrc.c
     src/exitfunc.c
     src/file.c
+    src/file_buffered.c
+    src/file_mapped.c
     src/file_slice.c
     src/file_stdio.c
     src/fshook.c
+    src/fshook_pack.c
     src/fshook_stdio.c
     src/fullscreen_mode.c
     src/haptic.c
     src/inline.c
+    src/jobs.c
     src/joynu.c
     src/keybdnu.c
     src/libc.c
@@ -51,6 +55,8 @@ set(ALLEGRO_SRC_FILES
     src/misc/aatree.c
     src/misc/bstrlib.c
     src/misc/list.c
+    src/misc/lz4.c
+    src/misc/pool.c
     src/misc/vector.c
     )
 
@@ -0,0 +1,220 @@
+/*
+ *  ex_pack - Pack a directory into a single archive and read it back.
+ *
+ *  Usage: ex_pack [-s] [directory [archive]]
+ *
+ *  Packs the directory (the example data by default) into an archive,
+ *  compressing the files unless -s is given.  Then lists the archive and
+ *  reads every file in it from several threads at once, checking each
+ *  against the original on disk.
+ */
+#include <stdio.h>
+#include "allegro5/allegro.h"
+
+#include "common.c"
+
+#define NUM_THREADS 4
+
+typedef struct READER {
+   ALLEGRO_PACK *pack;
+   const ALLEGRO_FILE_INTERFACE *disk;
+   const char *directory;
+   int files;
+   int errors;
+} READER;
+
+static void list_pack(ALLEGRO_FS_ENTRY *dir)
+{
+   ALLEGRO_FS_ENTRY *entry;
+
+   if (!al_open_directory(dir))
+      return;
+
+   while ((entry = al_read_directory(dir))) {
+      if (al_get_fs_entry_mode(entry) & ALLEGRO_FILEMODE_ISDIR) {
+         log_printf("%-48s      <dir>\n", al_get_fs_entry_name(entry));
+         list_pack(entry);
+      }
+      else {
+         log_printf("%-48s %10u\n", al_get_fs_entry_name(entry),
+            (unsigned)al_get_fs_entry_size(entry));
+      }
+      al_destroy_fs_entry(entry);
+   }
+
+   al_close_directory(dir);
+}
+
+static bool same_contents(ALLEGRO_FILE *a, ALLEGRO_FILE *b)
+{
+   char buf_a[4096], buf_b[4096];
+   size_t n;
+
+   do {
+      n = al_fread(a, buf_a, sizeof(buf_a));
+      if (al_fread(b, buf_b, sizeof(buf_b)) != n)
+         return false;
+      if (memcmp(buf_a, buf_b, n) != 0)
+         return false;
+   } while (n == sizeof(buf_a));
+
+   return true;
+}
+
+static void check_file(READER *r, ALLEGRO_FS_ENTRY *entry)
+{
+   const char *name = al_get_fs_entry_name(entry);
+   ALLEGRO_USTR *orig_name;
+   ALLEGRO_FILE *packed;
+   ALLEGRO_FILE *orig;
+
+   /* Names in the archive are absolute, rooted at the packed directory. */
+   orig_name = al_ustr_newf("%s/%s", r->directory, name + 1);
+
+   packed = al_open_fs_entry(entry, "rb");
+   orig = al_fopen_interface(r->disk, al_cstr(orig_name), "rb");
+
+   if (!packed || !orig || !same_contents(packed, orig)) {
+      log_printf("%s differs from %s\n", name, al_cstr(orig_name));
+      r->errors++;
+   }
+   r->files++;
+
+   if (packed)
+      al_fclose(packed);
+   if (orig)
+      al_fclose(orig);
+   al_ustr_free(orig_name);
+}
+
+static void check_dir(READER *r, ALLEGRO_FS_ENTRY *dir)
+{
+   ALLEGRO_FS_ENTRY *entry;
+
+   if (!al_open_directory(dir)) {
+      r->errors++;
+      return;
+   }
+
+   while ((entry = al_read_directory(dir))) {
+      if (al_get_fs_entry_mode(entry) & ALLEGRO_FILEMODE_ISDIR)
+         check_dir(r, entry);
+      else
+         check_file(r, entry);
+      al_destroy_fs_entry(entry);
+   }
+
+   al_close_directory(dir);
+}
+
+static void *reader_thread(ALLEGRO_THREAD *thread, void *arg)
+{
+   READER *r = arg;
+   ALLEGRO_FS_ENTRY *root;
+   (void)thread;
+
+   /* The file interface is per thread, so each reader selects the pack. */
+   al_set_pack_file_interface(r->pack);
+
+   root = al_create_fs_entry("/");
+   check_dir(r, root);
+   al_destroy_fs_entry(root);
+
+   return NULL;
+}
+
+int main(int argc, char **argv)
+{
+   const char *directory = "data";
+   const char *archive = NULL;
+   ALLEGRO_PATH *tmp_path = NULL;
+   ALLEGRO_FILE *tmp;
+   ALLEGRO_PACK *pack;
+   ALLEGRO_FS_ENTRY *root;
+   ALLEGRO_THREAD *threads[NUM_THREADS];
+   READER readers[NUM_THREADS];
+   ALLEGRO_STATE state;
+   bool compress = true;
+   double t0;
+   int i;
+
+   if (!al_init()) {
+      abort_example("Could not init Allegro.\n");
+   }
+   open_log_monospace();
+
+   i = 1;
+   if (i < argc && strcmp(argv[i], "-s") == 0) {
+      compress = false;
+      i++;
+   }
+   if (i < argc)
+      directory = argv[i++];
+   if (i < argc)
+      archive = argv[i++];
+
+   if (!archive) {
+      tmp = al_make_temp_file("ex_pack_XXXXXX", &tmp_path);
+      if (!tmp) {
+         abort_example("Could not create a temporary file.\n");
+      }
+      al_fclose(tmp);
+      archive = al_path_cstr(tmp_path, ALLEGRO_NATIVE_PATH_SEP);
+   }
+
+   t0 = al_get_time();
+   if (!al_save_pack(archive, directory, compress)) {
+      abort_example("Could not pack %s into %s.\n", directory, archive);
+   }
+   log_printf("Packed %s into %s in %.3f s.\n\n", directory, archive,
+      al_get_time() - t0);
+
+   pack = al_open_pack(archive);
+   if (!pack) {
+      abort_example("Could not open %s.\n", archive);
+   }
+
+   for (i = 0; i < NUM_THREADS; i++) {
+      readers[i].pack = pack;
+      readers[i].disk = al_get_new_file_interface();
+      readers[i].directory = directory;
+      readers[i].files = 0;
+      readers[i].errors = 0;
+   }
+
+   al_store_state(&state, ALLEGRO_STATE_NEW_FILE_INTERFACE);
+   al_set_pack_file_interface(pack);
+   root = al_create_fs_entry("/");
+   list_pack(root);
+   al_destroy_fs_entry(root);
+   al_restore_state(&state);
+
+   t0 = al_get_time();
+   for (i = 0; i < NUM_THREADS; i++) {
+      threads[i] = al_create_thread(reader_thread, &readers[i]);
+      al_start_thread(threads[i]);
+   }
+   for (i = 0; i < NUM_THREADS; i++) {
+      al_join_thread(threads[i], NULL);
+      al_destroy_thread(threads[i]);
+   }
+
+   log_printf("\n%d threads checked %d files in %.3f s.\n", NUM_THREADS,
+      readers[0].files, al_get_time() - t0);
+   for (i = 0; i < NUM_THREADS; i++) {
+      if (readers[i].errors || readers[i].files != readers[0].files)
+         log_printf("Thread %d: %d errors.\n", i, readers[i].errors);
+   }
+
+   al_close_pack(pack);
+
+   if (tmp_path) {
+      al_remove_filename(archive);
+      al_destroy_path(tmp_path);
+   }
+
+   close_log(true);
+   return 0;
+}
+
+/* vim: set sts=3 sw=3 et: */
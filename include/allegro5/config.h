@@ -24,10 +24,18 @@ AL_FUNC(void, al_add_config_section, (ALLEGRO_CONFIG *config, const char *name))
 AL_FUNC(void, al_set_config_value, (ALLEGRO_CONFIG *config, const char *section, const char *key, const char *value));
 AL_FUNC(void, al_add_config_comment, (ALLEGRO_CONFIG *config, const char *section, const char *comment));
 AL_FUNC(const char*, al_get_config_value, (const ALLEGRO_CONFIG *config, const char *section, const char *key));
+AL_FUNC(int, al_get_config_int, (const ALLEGRO_CONFIG *config, const char *section, const char *key, int def));
+AL_FUNC(float, al_get_config_float, (const ALLEGRO_CONFIG *config, const char *section, const char *key, float def));
+AL_FUNC(bool, al_get_config_bool, (const ALLEGRO_CONFIG *config, const char *section, const char *key, bool def));
 AL_FUNC(ALLEGRO_CONFIG*, al_load_config_file, (const char *filename));
 AL_FUNC(ALLEGRO_CONFIG*, al_load_config_file_f, (ALLEGRO_FILE *filename));
 AL_FUNC(bool, al_save_config_file, (const char *filename, const ALLEGRO_CONFIG *config));
 AL_FUNC(bool, al_save_config_file_f, (ALLEGRO_FILE *file, const ALLEGRO_CONFIG *config));
+AL_FUNC(ALLEGRO_CONFIG*, al_load_config_binary, (const char *filename));
+AL_FUNC(ALLEGRO_CONFIG*, al_load_config_binary_f, (ALLEGRO_FILE *file));
+AL_FUNC(bool, al_save_config_binary, (const char *filename, const ALLEGRO_CONFIG *config));
+AL_FUNC(bool, al_save_config_binary_f, (ALLEGRO_FILE *file, const ALLEGRO_CONFIG *config));
+AL_FUNC(ALLEGRO_CONFIG*, al_load_config_file_cached, (const char *filename, const char *cache_filename));
 AL_FUNC(void, al_merge_config_into, (ALLEGRO_CONFIG *master, const ALLEGRO_CONFIG *add));
 AL_FUNC(ALLEGRO_CONFIG *, al_merge_config, (const ALLEGRO_CONFIG *cfg1, const ALLEGRO_CONFIG *cfg2));
 AL_FUNC(void, al_destroy_config, (ALLEGRO_CONFIG *config));
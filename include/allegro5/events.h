@@ -244,14 +244,27 @@ AL_FUNC(intptr_t, al_get_event_source_data, (const ALLEGRO_EVENT_SOURCE*));
  */
 typedef struct ALLEGRO_EVENT_QUEUE ALLEGRO_EVENT_QUEUE;
 
+/* Enum: ALLEGRO_EVENT_QUEUE_OVERFLOW
+ */
+typedef enum ALLEGRO_EVENT_QUEUE_OVERFLOW
+{
+   ALLEGRO_EVENT_QUEUE_DROP_NEWEST = 0,
+   ALLEGRO_EVENT_QUEUE_DROP_OLDEST = 1,
+   ALLEGRO_EVENT_QUEUE_BLOCK = 2
+} ALLEGRO_EVENT_QUEUE_OVERFLOW;
+
 AL_FUNC(ALLEGRO_EVENT_QUEUE*, al_create_event_queue, (void));
+AL_FUNC(ALLEGRO_EVENT_QUEUE*, al_create_bounded_event_queue, (int capacity,
+   ALLEGRO_EVENT_QUEUE_OVERFLOW overflow));
 AL_FUNC(void, al_destroy_event_queue, (ALLEGRO_EVENT_QUEUE*));
 AL_FUNC(void, al_register_event_source, (ALLEGRO_EVENT_QUEUE*, ALLEGRO_EVENT_SOURCE*));
 AL_FUNC(void, al_unregister_event_source, (ALLEGRO_EVENT_QUEUE*, ALLEGRO_EVENT_SOURCE*));
 AL_FUNC(void, al_pause_event_queue, (ALLEGRO_EVENT_QUEUE*, bool));
 AL_FUNC(bool, al_is_event_queue_paused, (const ALLEGRO_EVENT_QUEUE*));
+AL_FUNC(void, al_set_event_queue_coalesce, (ALLEGRO_EVENT_QUEUE*, ALLEGRO_EVENT_TYPE type, bool coalesce));
 AL_FUNC(bool, al_is_event_queue_empty, (ALLEGRO_EVENT_QUEUE*));
 AL_FUNC(bool, al_get_next_event, (ALLEGRO_EVENT_QUEUE*, ALLEGRO_EVENT *ret_event));
+AL_FUNC(int, al_get_next_events, (ALLEGRO_EVENT_QUEUE*, ALLEGRO_EVENT *ret_events, int max));
 AL_FUNC(bool, al_peek_next_event, (ALLEGRO_EVENT_QUEUE*, ALLEGRO_EVENT *ret_event));
 AL_FUNC(bool, al_drop_next_event, (ALLEGRO_EVENT_QUEUE*));
 AL_FUNC(void, al_flush_event_queue, (ALLEGRO_EVENT_QUEUE*));
@@ -263,6 +276,9 @@ AL_FUNC(bool, al_wait_for_event_timed, (ALLEGRO_EVENT_QUEUE*,
 AL_FUNC(bool, al_wait_for_event_until, (ALLEGRO_EVENT_QUEUE *queue,
                                         ALLEGRO_EVENT *ret_event,
                                         ALLEGRO_TIMEOUT *timeout));
+AL_FUNC(int, al_wait_for_events_timed, (ALLEGRO_EVENT_QUEUE*,
+                                        ALLEGRO_EVENT *ret_events,
+                                        int max, float secs));
 
 #ifdef __cplusplus
    }
@@ -88,6 +88,15 @@ AL_FUNC(ALLEGRO_FILE*, al_make_temp_file, (const char *tmpl,
 AL_FUNC(ALLEGRO_FILE*, al_fopen_slice, (ALLEGRO_FILE *fp,
       size_t initial_size, const char *mode));
 
+/* Specific to buffered files. */
+AL_FUNC(ALLEGRO_FILE*, al_fopen_buffered, (ALLEGRO_FILE *fp,
+      size_t buffer_size));
+
+/* Specific to memory mapped files. */
+AL_FUNC(ALLEGRO_FILE*, al_fopen_mapped, (const char *path));
+AL_FUNC(const void *, al_fmap_view, (ALLEGRO_FILE *f, int64_t offset,
+      size_t size));
+
 /* Thread-local state. */
 AL_FUNC(const ALLEGRO_FILE_INTERFACE *, al_get_new_file_interface, (void));
 AL_FUNC(void, al_set_new_file_interface, (const ALLEGRO_FILE_INTERFACE *
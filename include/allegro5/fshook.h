@@ -133,12 +133,48 @@ AL_FUNC(int,  al_for_each_fs_entry, (ALLEGRO_FS_ENTRY *dir,
                                      void *extra));
 
 
+/* Reading whole directories at once. */
+
+/* Type: ALLEGRO_DIRECTORY_ITEM
+ */
+typedef struct ALLEGRO_DIRECTORY_ITEM ALLEGRO_DIRECTORY_ITEM;
+
+struct ALLEGRO_DIRECTORY_ITEM {
+   const char *name;
+   uint32_t mode;
+   off_t size;
+   time_t mtime;
+};
+
+/* Enum: ALLEGRO_SCAN_DIRECTORY_FLAGS
+ */
+typedef enum ALLEGRO_SCAN_DIRECTORY_FLAGS {
+   ALLEGRO_SCAN_TYPES_ONLY = 1
+} ALLEGRO_SCAN_DIRECTORY_FLAGS;
+
+AL_FUNC(ALLEGRO_DIRECTORY_ITEM *, al_scan_directory, (const char *path,
+                                                      int flags, int *count));
+
+
 /* Thread-local state. */
 AL_FUNC(const ALLEGRO_FS_INTERFACE *, al_get_fs_interface, (void));
 AL_FUNC(void, al_set_fs_interface, (const ALLEGRO_FS_INTERFACE *vtable));
 AL_FUNC(void, al_set_standard_fs_interface, (void));
 
 
+/* Pack files. */
+
+/* Type: ALLEGRO_PACK
+ */
+typedef struct ALLEGRO_PACK ALLEGRO_PACK;
+
+AL_FUNC(ALLEGRO_PACK *, al_open_pack, (const char *filename));
+AL_FUNC(void, al_close_pack, (ALLEGRO_PACK *pack));
+AL_FUNC(void, al_set_pack_file_interface, (ALLEGRO_PACK *pack));
+AL_FUNC(bool, al_save_pack, (const char *filename, const char *directory,
+                             bool compress));
+
+
 #ifdef __cplusplus
    }
 #endif
@@ -19,6 +19,89 @@
       return __sync_sub_and_fetch(ptr, 1);
    })
 
+   AL_INLINE(bool,
+      _al_compare_and_swap, (volatile _AL_ATOMIC *ptr, _AL_ATOMIC oldval,
+         _AL_ATOMIC newval),
+   {
+      return __sync_bool_compare_and_swap(ptr, oldval, newval);
+   })
+
+   AL_INLINE(bool,
+      _al_compare_and_swap_ptr, (void * volatile *ptr, void *oldval,
+         void *newval),
+   {
+      return __sync_bool_compare_and_swap(ptr, oldval, newval);
+   })
+
+   #ifdef __ATOMIC_SEQ_CST
+
+   /* gcc 4.7 and above can do sequentially consistent loads and stores
+    * without a full fence on every access.
+    */
+   AL_INLINE(_AL_ATOMIC,
+      _al_atomic_load, (volatile _AL_ATOMIC *ptr),
+   {
+      return __atomic_load_n(ptr, __ATOMIC_SEQ_CST);
+   })
+
+   AL_INLINE(void,
+      _al_atomic_store, (volatile _AL_ATOMIC *ptr, _AL_ATOMIC value),
+   {
+      __atomic_store_n(ptr, value, __ATOMIC_SEQ_CST);
+   })
+
+   AL_INLINE(void *,
+      _al_atomic_load_ptr, (void * volatile *ptr),
+   {
+      return __atomic_load_n(ptr, __ATOMIC_SEQ_CST);
+   })
+
+   AL_INLINE(void,
+      _al_atomic_store_ptr, (void * volatile *ptr, void *value),
+   {
+      __atomic_store_n(ptr, value, __ATOMIC_SEQ_CST);
+   })
+
+   #else
+
+   AL_INLINE(_AL_ATOMIC,
+      _al_atomic_load, (volatile _AL_ATOMIC *ptr),
+   {
+      _AL_ATOMIC value;
+      __sync_synchronize();
+      value = *ptr;
+      __sync_synchronize();
+      return value;
+   })
+
+   AL_INLINE(void,
+      _al_atomic_store, (volatile _AL_ATOMIC *ptr, _AL_ATOMIC value),
+   {
+      __sync_synchronize();
+      *ptr = value;
+      __sync_synchronize();
+   })
+
+   AL_INLINE(void *,
+      _al_atomic_load_ptr, (void * volatile *ptr),
+   {
+      void *value;
+      __sync_synchronize();
+      value = *ptr;
+      __sync_synchronize();
+      return value;
+   })
+
+   AL_INLINE(void,
+      _al_atomic_store_ptr, (void * volatile *ptr, void *value),
+   {
+      __sync_synchronize();
+      *ptr = value;
+      __sync_synchronize();
+   })
+
+   #endif
+
 #elif defined(__GNUC__) && (defined(__i386__) || defined(__x86_64__))
 
    /* gcc, x86 or x86-64 */
@@ -49,9 +132,80 @@
       return old - 1;
    })
 
-#elif defined(_MSC_VER) && _M_IX86 >= 400
+   AL_INLINE(bool,
+      _al_compare_and_swap, (volatile _AL_ATOMIC *ptr, _AL_ATOMIC oldval,
+         _AL_ATOMIC newval),
+   {
+      _AL_ATOMIC prev;
+      __asm__ __volatile__ (
+         "lock; cmpxchgl %2, %1"
+         : "=a" (prev), "+m" (*ptr)
+         : "r" (newval), "0" (oldval)
+         : "memory"
+      );
+      return prev == oldval;
+   })
+
+   AL_INLINE(bool,
+      _al_compare_and_swap_ptr, (void * volatile *ptr, void *oldval,
+         void *newval),
+   {
+      void *prev;
+      __asm__ __volatile__ (
+         "lock; cmpxchg %2, %1"
+         : "=a" (prev), "+m" (*ptr)
+         : "r" (newval), "0" (oldval)
+         : "memory"
+      );
+      return prev == oldval;
+   })
+
+   /* x86 loads are never reordered with older loads, so only the
+    * compiler needs to be kept in check.  Stores use xchg, which
+    * implies a full fence.
+    */
+   AL_INLINE(_AL_ATOMIC,
+      _al_atomic_load, (volatile _AL_ATOMIC *ptr),
+   {
+      _AL_ATOMIC value = *ptr;
+      __asm__ __volatile__ ("" : : : "memory");
+      return value;
+   })
+
+   AL_INLINE(void,
+      _al_atomic_store, (volatile _AL_ATOMIC *ptr, _AL_ATOMIC value),
+   {
+      __asm__ __volatile__ (
+         "xchgl %0, %1"
+         : "+r" (value), "+m" (*ptr)
+         :
+         : "memory"
+      );
+   })
 
-   /* MSVC, x86 */
+   AL_INLINE(void *,
+      _al_atomic_load_ptr, (void * volatile *ptr),
+   {
+      void *value = *ptr;
+      __asm__ __volatile__ ("" : : : "memory");
+      return value;
+   })
+
+   AL_INLINE(void,
+      _al_atomic_store_ptr, (void * volatile *ptr, void *value),
+   {
+      __asm__ __volatile__ (
+         "xchg %0, %1"
+         : "+r" (value), "+m" (*ptr)
+         :
+         : "memory"
+      );
+   })
+
+#elif defined(_MSC_VER) && (_M_IX86 >= 400 || defined(_M_X64) || \
+   defined(_M_AMD64) || defined(_M_ARM64))
+
+   /* MSVC, x86, x86-64 or ARM64 */
    /* MinGW supports these too, but we already have asm code above. */
 
    typedef LONG _AL_ATOMIC;
@@ -68,6 +222,44 @@
       return InterlockedDecrement(ptr);
    })
 
+   AL_INLINE(bool,
+      _al_compare_and_swap, (volatile _AL_ATOMIC *ptr, _AL_ATOMIC oldval,
+         _AL_ATOMIC newval),
+   {
+      return InterlockedCompareExchange(ptr, newval, oldval) == oldval;
+   })
+
+   AL_INLINE(bool,
+      _al_compare_and_swap_ptr, (void * volatile *ptr, void *oldval,
+         void *newval),
+   {
+      return InterlockedCompareExchangePointer(ptr, newval, oldval) == oldval;
+   })
+
+   AL_INLINE(_AL_ATOMIC,
+      _al_atomic_load, (volatile _AL_ATOMIC *ptr),
+   {
+      return InterlockedCompareExchange(ptr, 0, 0);
+   })
+
+   AL_INLINE(void,
+      _al_atomic_store, (volatile _AL_ATOMIC *ptr, _AL_ATOMIC value),
+   {
+      InterlockedExchange(ptr, value);
+   })
+
+   AL_INLINE(void *,
+      _al_atomic_load_ptr, (void * volatile *ptr),
+   {
+      return InterlockedCompareExchangePointer(ptr, NULL, NULL);
+   })
+
+   AL_INLINE(void,
+      _al_atomic_store_ptr, (void * volatile *ptr, void *value),
+   {
+      InterlockedExchangePointer(ptr, value);
+   })
+
 #elif defined(ALLEGRO_HAVE_OSATOMIC_H)
 
    /* OS X, GCC < 4.1
@@ -93,28 +285,75 @@
       return OSAtomicDecrement32Barrier((_AL_ATOMIC *)ptr);
    })
 
+   AL_INLINE(bool,
+      _al_compare_and_swap, (volatile _AL_ATOMIC *ptr, _AL_ATOMIC oldval,
+         _AL_ATOMIC newval),
+   {
+      return OSAtomicCompareAndSwap32Barrier(oldval, newval,
+         (_AL_ATOMIC *)ptr);
+   })
 
-#else
+   AL_INLINE(bool,
+      _al_compare_and_swap_ptr, (void * volatile *ptr, void *oldval,
+         void *newval),
+   {
+      return OSAtomicCompareAndSwapPtrBarrier(oldval, newval, ptr);
+   })
 
-   /* Hope for the best? */
-   #warning Atomic operations undefined for your compiler/architecture.
+   AL_INLINE(_AL_ATOMIC,
+      _al_atomic_load, (volatile _AL_ATOMIC *ptr),
+   {
+      _AL_ATOMIC value;
+      OSMemoryBarrier();
+      value = *ptr;
+      OSMemoryBarrier();
+      return value;
+   })
 
-   typedef int _AL_ATOMIC;
+   AL_INLINE(void,
+      _al_atomic_store, (volatile _AL_ATOMIC *ptr, _AL_ATOMIC value),
+   {
+      OSMemoryBarrier();
+      *ptr = value;
+      OSMemoryBarrier();
+   })
 
-   AL_INLINE(_AL_ATOMIC,
-      _al_fetch_and_add1, (volatile _AL_ATOMIC *ptr),
+   AL_INLINE(void *,
+      _al_atomic_load_ptr, (void * volatile *ptr),
    {
-      return (*ptr)++;
+      void *value;
+      OSMemoryBarrier();
+      value = *ptr;
+      OSMemoryBarrier();
+      return value;
    })
 
-   AL_INLINE(_AL_ATOMIC,
-      _al_sub1_and_fetch, (volatile _AL_ATOMIC *ptr),
+   AL_INLINE(void,
+      _al_atomic_store_ptr, (void * volatile *ptr, void *value),
    {
-      return --(*ptr);
+      OSMemoryBarrier();
+      *ptr = value;
+      OSMemoryBarrier();
    })
 
+
+#else
+
+   /* The event queues, jobs, locks and pools all depend on these being
+    * atomic, so there is nothing sensible to fall back to.
+    */
+   #error Atomic operations undefined for your compiler/architecture.
+
 #endif
 
+
+/* A lock for state which is used before al_install_system or after
+ * al_uninstall_system, when no _AL_MUTEX is available.  Only for short
+ * critical sections.  Defined in threads.c.
+ */
+void _al_spin_lock(volatile _AL_ATOMIC *lock);
+void _al_spin_unlock(volatile _AL_ATOMIC *lock);
+
 #endif
 
 /* vim: set sts=3 sw=3 et: */
@@ -1,29 +1,58 @@
 #ifndef __al_included_allegro5_aintern_config_h
 #define __al_included_allegro5_aintern_config_h
 
-#include "allegro5/internal/aintern_aatree.h"
+/* Hash table from names to sections, or keys to entries. */
+typedef struct _AL_CONFIG_SLOT {
+   uint32_t hash;
+   const ALLEGRO_USTR *key;   /* NULL if the slot is empty */
+   void *item;
+} _AL_CONFIG_SLOT;
+
+typedef struct _AL_CONFIG_INDEX {
+   _AL_CONFIG_SLOT *slots;
+   unsigned capacity;         /* zero or a power of two */
+   unsigned count;
+} _AL_CONFIG_INDEX;
 
 struct ALLEGRO_CONFIG_ENTRY {
    bool is_comment;
    ALLEGRO_USTR *key;    /* comment if is_comment is true */
    ALLEGRO_USTR *value;
    ALLEGRO_CONFIG_ENTRY *prev, *next;
+
+   /* The value as parsed by the typed getters.  Each state is one of the
+    * _AL_CONFIG_* values below.  The getters may be called from several
+    * threads at once, so a value is only read after its state has been
+    * seen as _AL_CONFIG_PARSED.
+    */
+   volatile _AL_ATOMIC int_state;
+   volatile _AL_ATOMIC float_state;
+   volatile _AL_ATOMIC bool_state;
+   int int_value;
+   float float_value;
+   bool bool_value;
+};
+
+enum {
+   _AL_CONFIG_NOT_PARSED = 0,
+   _AL_CONFIG_PARSING,     /* some thread is storing the value */
+   _AL_CONFIG_PARSED,
+   _AL_CONFIG_INVALID
 };
 
 struct ALLEGRO_CONFIG_SECTION {
    ALLEGRO_USTR *name;
    ALLEGRO_CONFIG_ENTRY *head;
    ALLEGRO_CONFIG_ENTRY *last;
-   _AL_AATREE *tree;
+   _AL_CONFIG_INDEX index;
    ALLEGRO_CONFIG_SECTION *prev, *next;
 };
 
 struct ALLEGRO_CONFIG {
    ALLEGRO_CONFIG_SECTION *head;
    ALLEGRO_CONFIG_SECTION *last;
-   _AL_AATREE *tree;
+   _AL_CONFIG_INDEX index;
 };
 
 
 #endif
-
@@ -37,6 +37,8 @@ bool _al_event_source_needs_to_generate_event(ALLEGRO_EVENT_SOURCE*);
 void _al_event_source_emit_event(ALLEGRO_EVENT_SOURCE *, ALLEGRO_EVENT*);
 
 void _al_event_queue_push_event(ALLEGRO_EVENT_QUEUE*, const ALLEGRO_EVENT*);
+bool _al_event_queue_try_push_event(ALLEGRO_EVENT_QUEUE*, const ALLEGRO_EVENT*);
+void _al_event_queue_push_blocked_event(ALLEGRO_EVENT_QUEUE*, ALLEGRO_EVENT_SOURCE*, const ALLEGRO_EVENT*);
 
 
 #ifdef __cplusplus
@@ -10,12 +10,22 @@ extern const ALLEGRO_FILE_INTERFACE _al_file_interface_stdio;
 
 #define ALLEGRO_UNGETC_SIZE 16
 
+AL_FUNC(uint32_t, _al_get_u32le, (const void *p));
+AL_FUNC(uint64_t, _al_get_u64le, (const void *p));
+
 struct ALLEGRO_FILE
 {
    const ALLEGRO_FILE_INTERFACE *vtable;
    void *userdata;
    unsigned char ungetc[ALLEGRO_UNGETC_SIZE];
    int ungetc_len;
+   /* Windows into a buffer owned by the file interface, which the
+    * convenience functions read from or write to directly.  Interfaces
+    * without a buffer leave them NULL.  Only one of them is in use at a
+    * time.
+    */
+   unsigned char *rpos, *rend;
+   unsigned char *wpos, *wend;
 };
 
 #ifdef __cplusplus
@@ -17,6 +17,7 @@
 #define __al_included_allegro5_aintern_fshook_h
 
 #include "allegro5/base.h"
+#include "allegro5/internal/aintern_vector.h"
 
 #ifdef __cplusplus
    extern "C" {
@@ -26,6 +27,22 @@
 extern struct ALLEGRO_FS_INTERFACE _al_fs_interface_stdio;
 
 
+/* Collects the results of al_scan_directory. */
+typedef struct _AL_FS_SCAN
+{
+   int flags;
+   _AL_VECTOR items;
+   char *names;
+   size_t names_size;
+   size_t names_capacity;
+} _AL_FS_SCAN;
+
+bool _al_fs_scan_add(_AL_FS_SCAN *scan, const char *name, uint32_t mode,
+   off_t size, time_t mtime);
+
+bool _al_fs_stdio_scan_directory(const char *path, _AL_FS_SCAN *scan);
+
+
 #ifdef __cplusplus
    }
 #endif
@@ -0,0 +1,21 @@
+#ifndef __al_included_allegro5_aintern_lz4_h
+#define __al_included_allegro5_aintern_lz4_h
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+AL_FUNC(size_t, _al_lz4_compress_bound, (size_t size));
+AL_FUNC(size_t, _al_lz4_compress, (const void *src, size_t src_size,
+   void *dst, size_t dst_capacity));
+AL_FUNC(size_t, _al_lz4_decompress_bound, (size_t src_size));
+AL_FUNC(bool, _al_lz4_decompress, (const void *src, size_t src_size,
+   void *dst, size_t dst_size));
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
+
+/* vim: set sts=3 sw=3 et: */
@@ -0,0 +1,25 @@
+#ifndef __al_included_allegro5_aintern_memory_h
+#define __al_included_allegro5_aintern_memory_h
+
+#ifdef __cplusplus
+   extern "C" {
+#endif
+
+
+void *_al_malloc_untracked(size_t n,
+   int line, const char *file, const char *func);
+void _al_free_untracked(void *ptr,
+   int line, const char *file, const char *func);
+void _al_track_allocation(void *ptr, size_t n, int line, const char *file);
+void _al_untrack_allocation(void *ptr);
+
+void _al_report_memory_leaks(void);
+
+
+#ifdef __cplusplus
+   }
+#endif
+
+#endif
+
+/* vim: set ts=8 sts=3 sw=3 et: */
@@ -0,0 +1,40 @@
+#ifndef __al_included_allegro5_aintern_pool_h
+#define __al_included_allegro5_aintern_pool_h
+
+#ifdef __cplusplus
+   extern "C" {
+#endif
+
+
+/* Objects up to this size come from the pools, anything larger goes
+ * straight to al_malloc.
+ */
+#define _AL_POOL_MAX_SIZE     256
+
+typedef struct _AL_POOL_CACHE _AL_POOL_CACHE;
+
+
+void _al_init_pools(void);
+void _al_pool_attach_thread(void);
+void _al_pool_detach_thread(void);
+
+/* Memory tracking charges the objects to the caller, like al_malloc. */
+#define _al_pool_alloc(size) \
+   (_al_pool_alloc_with_context((size), __LINE__, __FILE__, __func__))
+#define _al_pool_calloc(size) \
+   (_al_pool_calloc_with_context((size), __LINE__, __FILE__, __func__))
+
+void *_al_pool_alloc_with_context(size_t size,
+   int line, const char *file, const char *func);
+void *_al_pool_calloc_with_context(size_t size,
+   int line, const char *file, const char *func);
+void _al_pool_free(void *ptr, size_t size);
+
+
+#ifdef __cplusplus
+   }
+#endif
+
+#endif
+
+/* vim: set ts=8 sts=3 sw=3 et: */
@@ -25,6 +25,7 @@ void _al_mutex_init_recursive(_AL_MUTEX*);
 void _al_mutex_destroy(_AL_MUTEX*);
 /* static inline void _al_mutex_lock(_AL_MUTEX*); */
 /* static inline void _al_mutex_unlock(_AL_MUTEX*); */
+/* static inline bool _al_mutex_trylock(_AL_MUTEX*); */
 
 /* All 5 functions below are declared inline in aintuthr.h.
  * FIXME: Why are they all inline? And if they have to be, why not treat them
@@ -9,6 +9,15 @@
 void _al_tls_init_once(void);
 
 int *_al_tls_get_dtor_owner_count(void);
+int *_al_tls_get_job_worker(void);
+ALLEGRO_PACK **_al_tls_get_pack(void);
+struct _AL_POOL_CACHE **_al_tls_get_pool_cache(void);
+
+/* Opaque per-thread pointers which addons can claim for their own state. */
+#define _AL_TLS_MAX_ADDON_SLOTS  8
+
+AL_FUNC(int, _al_tls_new_addon_slot, (void));
+AL_FUNC(void **, _al_tls_get_addon_slot, (int slot));
 
 
 #ifdef __cplusplus
@@ -16,6 +16,8 @@
 #ifndef __al_included_allegro5_memory_h
 #define __al_included_allegro5_memory_h
 
+#include "allegro5/file.h"
+
 #ifdef __cplusplus
    extern "C" {
 #endif
@@ -66,6 +68,24 @@ AL_FUNC(void *, al_calloc_with_context, (size_t count, size_t n,
    int line, const char *file, const char *func));
 
 
+/* Type: ALLEGRO_MEMORY_STATS
+ */
+typedef struct ALLEGRO_MEMORY_STATS ALLEGRO_MEMORY_STATS;
+
+struct ALLEGRO_MEMORY_STATS {
+   const char *module;
+   size_t current_bytes;
+   size_t peak_bytes;
+   size_t current_allocations;
+   size_t total_allocations;
+};
+
+AL_FUNC(void, al_set_memory_tracking, (bool enable));
+AL_FUNC(bool, al_get_memory_tracking, (void));
+AL_FUNC(int, al_get_memory_stats, (ALLEGRO_MEMORY_STATS *stats, int max_stats));
+AL_FUNC(void, al_dump_memory_allocations, (ALLEGRO_FILE *f));
+
+
 #ifdef __cplusplus
    }
 #endif
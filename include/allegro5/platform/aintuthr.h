@@ -67,6 +67,12 @@ AL_INLINE(void, _al_mutex_unlock, (struct _AL_MUTEX *m),
    if (m->inited)
       pthread_mutex_unlock(&m->mutex);
 })
+AL_INLINE(bool, _al_mutex_trylock, (struct _AL_MUTEX *m),
+{
+   if (m->inited)
+      return pthread_mutex_trylock(&m->mutex) == 0;
+   return true;
+})
 
 AL_INLINE(void, _al_cond_init, (struct _AL_COND *cond),
 {
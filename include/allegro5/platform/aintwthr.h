@@ -66,6 +66,12 @@ AL_INLINE(void, _al_mutex_unlock, (struct _AL_MUTEX *m),
    if (m->cs)
       LeaveCriticalSection(m->cs);
 })
+AL_INLINE(bool, _al_mutex_trylock, (struct _AL_MUTEX *m),
+{
+   if (m->cs)
+      return TryEnterCriticalSection(m->cs) != 0;
+   return true;
+})
 
 
 #ifdef __cplusplus
@@ -67,6 +67,22 @@ AL_INLINE(void, _al_mutex_unlock, (struct _AL_MUTEX *m),
    if (m->mutex)
       SDL_UnlockMutex(m->mutex);
 })
+AL_INLINE(bool, _al_mutex_trylock, (struct _AL_MUTEX *m),
+{
+   int *v = NULL;
+   if (m->lock_count) {
+      v = (int *)SDL_TLSGet(m->lock_count);
+      if (*v > 0) {
+         (*v)++;
+         return true;
+      }
+   }
+   if (m->mutex && SDL_TryLockMutex(m->mutex) != 0)
+      return false;
+   if (v)
+      (*v)++;
+   return true;
+})
 
 AL_INLINE(void, _al_cond_init, (struct _AL_COND *cond),
 {
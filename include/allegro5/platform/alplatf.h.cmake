@@ -51,6 +51,7 @@
 #cmakedefine ALLEGRO_HAVE_SAL_H
 
 /* Define to 1 if the corresponding functions are available. */
+#cmakedefine ALLEGRO_HAVE_FSTATAT
 #cmakedefine ALLEGRO_HAVE_GETEXECNAME
 #cmakedefine ALLEGRO_HAVE_MKSTEMP
 #cmakedefine ALLEGRO_HAVE_MMAP
@@ -34,6 +34,14 @@ typedef struct ALLEGRO_MUTEX ALLEGRO_MUTEX;
  */
 typedef struct ALLEGRO_COND ALLEGRO_COND;
 
+/* Type: ALLEGRO_RWLOCK
+ */
+typedef struct ALLEGRO_RWLOCK ALLEGRO_RWLOCK;
+
+/* Type: ALLEGRO_JOB
+ */
+typedef struct ALLEGRO_JOB ALLEGRO_JOB;
+
 
 AL_FUNC(ALLEGRO_THREAD *, al_create_thread,
    (void *(*proc)(ALLEGRO_THREAD *thread, void *arg), void *arg));
@@ -46,6 +54,7 @@ AL_FUNC(void, al_run_detached_thread, (void *(*proc)(void *arg), void *arg));
 
 AL_FUNC(ALLEGRO_MUTEX *, al_create_mutex, (void));
 AL_FUNC(ALLEGRO_MUTEX *, al_create_mutex_recursive, (void));
+AL_FUNC(ALLEGRO_MUTEX *, al_create_mutex_adaptive, (void));
 AL_FUNC(void, al_lock_mutex, (ALLEGRO_MUTEX *mutex));
 AL_FUNC(void, al_unlock_mutex, (ALLEGRO_MUTEX *mutex));
 AL_FUNC(void, al_destroy_mutex, (ALLEGRO_MUTEX *mutex));
@@ -58,6 +67,29 @@ AL_FUNC(int, al_wait_cond_until, (ALLEGRO_COND *cond, ALLEGRO_MUTEX *mutex,
 AL_FUNC(void, al_broadcast_cond, (ALLEGRO_COND *cond));
 AL_FUNC(void, al_signal_cond, (ALLEGRO_COND *cond));
 
+AL_FUNC(ALLEGRO_RWLOCK *, al_create_rwlock, (void));
+AL_FUNC(void, al_destroy_rwlock, (ALLEGRO_RWLOCK *rwlock));
+AL_FUNC(void, al_lock_rwlock_read, (ALLEGRO_RWLOCK *rwlock));
+AL_FUNC(void, al_lock_rwlock_write, (ALLEGRO_RWLOCK *rwlock));
+AL_FUNC(void, al_unlock_rwlock, (ALLEGRO_RWLOCK *rwlock));
+
+AL_FUNC(int, al_atomic_load_int, (volatile int *ptr));
+AL_FUNC(void, al_atomic_store_int, (volatile int *ptr, int value));
+AL_FUNC(int, al_atomic_add_int, (volatile int *ptr, int value));
+AL_FUNC(bool, al_atomic_compare_and_swap_int, (volatile int *ptr,
+   int oldval, int newval));
+AL_FUNC(void *, al_atomic_load_ptr, (void * volatile *ptr));
+AL_FUNC(void, al_atomic_store_ptr, (void * volatile *ptr, void *value));
+AL_FUNC(bool, al_atomic_compare_and_swap_ptr, (void * volatile *ptr,
+   void *oldval, void *newval));
+
+AL_FUNC(ALLEGRO_JOB *, al_create_job, (void (*proc)(void *arg), void *arg));
+AL_FUNC(void, al_add_job_dependency, (ALLEGRO_JOB *job, ALLEGRO_JOB *dependency));
+AL_FUNC(void, al_submit_job, (ALLEGRO_JOB *job));
+AL_FUNC(bool, al_is_job_finished, (ALLEGRO_JOB *job));
+AL_FUNC(void, al_wait_for_job, (ALLEGRO_JOB *job));
+AL_FUNC(void, al_destroy_job, (ALLEGRO_JOB *job));
+
 #ifdef __cplusplus
    }
 #endif
@@ -57,6 +57,7 @@ AL_FUNC(bool, al_ustr_prev, (const ALLEGRO_USTR *us, int *pos));
 AL_FUNC(int32_t, al_ustr_get, (const ALLEGRO_USTR *us, int pos));
 AL_FUNC(int32_t, al_ustr_get_next, (const ALLEGRO_USTR *us, int *pos));
 AL_FUNC(int32_t, al_ustr_prev_get, (const ALLEGRO_USTR *us, int *pos));
+AL_FUNC(bool, al_ustr_is_valid, (const ALLEGRO_USTR *us));
 
 /* Insert */
 AL_FUNC(bool, al_ustr_insert, (ALLEGRO_USTR *us1, int pos,
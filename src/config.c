@@ -18,17 +18,171 @@
 
 
 #include <stdio.h>
+#include <stdlib.h>
 #include <ctype.h>
+#include <limits.h>
 #include "allegro5/allegro.h"
 #include "allegro5/internal/aintern.h"
-#include "allegro5/internal/aintern_aatree.h"
+#include "allegro5/internal/aintern_atomicops.h"
 #include "allegro5/internal/aintern_config.h"
+#include "allegro5/internal/aintern_file.h"
+#include "allegro5/internal/aintern_pool.h"
 
 
 
-static int cmp_ustr(void const *a, void const *b)
+/*
+ * Sections and entries are found through open addressing hash tables with
+ * linear probing.  Removal shifts later entries back, so there are no
+ * tombstones to clean up.
+ */
+
+static uint32_t hash_ustr(const ALLEGRO_USTR *us)
+{
+   /* FNV-1a */
+   const unsigned char *p = (const unsigned char *)al_cstr(us);
+   size_t n = al_ustr_size(us);
+   uint32_t h = 2166136261u;
+
+   while (n--) {
+      h ^= *p++;
+      h *= 16777619u;
+   }
+
+   return h;
+}
+
+
+static _AL_CONFIG_SLOT *index_lookup(const _AL_CONFIG_INDEX *index,
+   const ALLEGRO_USTR *key, uint32_t hash)
+{
+   unsigned mask = index->capacity - 1;
+   unsigned i;
+
+   if (index->capacity == 0)
+      return NULL;
+
+   for (i = hash & mask; index->slots[i].key; i = (i + 1) & mask) {
+      _AL_CONFIG_SLOT *slot = &index->slots[i];
+      if (slot->hash == hash && al_ustr_equal(slot->key, key))
+         return slot;
+   }
+
+   return NULL;
+}
+
+
+static void *index_find(const _AL_CONFIG_INDEX *index,
+   const ALLEGRO_USTR *key)
 {
-   return al_ustr_compare(a, b);
+   _AL_CONFIG_SLOT *slot = index_lookup(index, key, hash_ustr(key));
+   return slot ? slot->item : NULL;
+}
+
+
+static void index_put(_AL_CONFIG_INDEX *index, uint32_t hash,
+   const ALLEGRO_USTR *key, void *item)
+{
+   unsigned mask = index->capacity - 1;
+   unsigned i;
+
+   for (i = hash & mask; index->slots[i].key; i = (i + 1) & mask)
+      ;
+
+   index->slots[i].hash = hash;
+   index->slots[i].key = key;
+   index->slots[i].item = item;
+   index->count++;
+}
+
+
+static void index_resize(_AL_CONFIG_INDEX *index, unsigned capacity)
+{
+   _AL_CONFIG_SLOT *old_slots = index->slots;
+   unsigned old_capacity = index->capacity;
+   unsigned i;
+
+   index->capacity = capacity;
+   index->slots = al_calloc(index->capacity, sizeof(_AL_CONFIG_SLOT));
+   ASSERT(index->slots);
+   index->count = 0;
+
+   for (i = 0; i < old_capacity; i++) {
+      if (old_slots[i].key) {
+         index_put(index, old_slots[i].hash, old_slots[i].key,
+            old_slots[i].item);
+      }
+   }
+   al_free(old_slots);
+}
+
+
+/* Makes room for `count` items in total without resizing again. */
+static void index_reserve(_AL_CONFIG_INDEX *index, unsigned count)
+{
+   unsigned capacity = index->capacity ? index->capacity : 8;
+
+   if (count == 0)
+      return;
+
+   while (count * 4 > capacity * 3)
+      capacity *= 2;
+
+   if (capacity != index->capacity)
+      index_resize(index, capacity);
+}
+
+
+/* The key must not be in the index yet.  The key is not copied, so it must
+ * live as long as the item does.
+ */
+static void index_insert(_AL_CONFIG_INDEX *index, const ALLEGRO_USTR *key,
+   void *item)
+{
+   /* Keep the load factor at most 3/4. */
+   if ((index->count + 1) * 4 > index->capacity * 3)
+      index_resize(index, index->capacity ? index->capacity * 2 : 8);
+
+   index_put(index, hash_ustr(key), key, item);
+}
+
+
+static void *index_remove(_AL_CONFIG_INDEX *index, const ALLEGRO_USTR *key)
+{
+   _AL_CONFIG_SLOT *slot = index_lookup(index, key, hash_ustr(key));
+   unsigned mask = index->capacity - 1;
+   unsigned hole, i;
+   void *item;
+
+   if (!slot)
+      return NULL;
+
+   item = slot->item;
+   hole = slot - index->slots;
+   index->slots[hole].key = NULL;
+   index->count--;
+
+   /* Move back any later entries that can no longer be reached. */
+   for (i = (hole + 1) & mask; index->slots[i].key; i = (i + 1) & mask) {
+      unsigned home = index->slots[i].hash & mask;
+      bool reachable = (hole <= i) ? (hole < home && home <= i)
+                                   : (hole < home || home <= i);
+      if (!reachable) {
+         index->slots[hole] = index->slots[i];
+         index->slots[i].key = NULL;
+         hole = i;
+      }
+   }
+
+   return item;
+}
+
+
+static void index_free(_AL_CONFIG_INDEX *index)
+{
+   al_free(index->slots);
+   index->slots = NULL;
+   index->capacity = 0;
+   index->count = 0;
 }
 
 
@@ -46,33 +200,14 @@ ALLEGRO_CONFIG *al_create_config(void)
 static ALLEGRO_CONFIG_SECTION *find_section(const ALLEGRO_CONFIG *config,
    const ALLEGRO_USTR *section)
 {
-   return _al_aa_search(config->tree, section, cmp_ustr);
+   return index_find(&config->index, section);
 }
 
 
 static ALLEGRO_CONFIG_ENTRY *find_entry(const ALLEGRO_CONFIG_SECTION *section,
    const ALLEGRO_USTR *key)
 {
-   return _al_aa_search(section->tree, key, cmp_ustr);
-}
-
-
-static void get_key_and_value(const ALLEGRO_USTR *buf,
-   ALLEGRO_USTR *key, ALLEGRO_USTR *value)
-{
-   int eq = al_ustr_find_chr(buf, 0, '=');
-
-   if (eq == -1) {
-      al_ustr_assign(key, buf);
-      al_ustr_assign_cstr(value, "");
-   }
-   else {
-      al_ustr_assign_substr(key, buf, 0, eq);
-      al_ustr_assign_substr(value, buf, eq + 1, al_ustr_size(buf));
-   }
-
-   al_ustr_trim_ws(key);
-   al_ustr_trim_ws(value);
+   return index_find(&section->index, key);
 }
 
 
@@ -85,7 +220,7 @@ static ALLEGRO_CONFIG_SECTION *config_add_section(ALLEGRO_CONFIG *config,
    if ((section = find_section(config, name)))
       return section;
 
-   section = al_calloc(1, sizeof(ALLEGRO_CONFIG_SECTION));
+   section = _al_pool_calloc(sizeof(ALLEGRO_CONFIG_SECTION));
    section->name = al_ustr_dup(name);
 
    if (sec == NULL) {
@@ -99,7 +234,7 @@ static ALLEGRO_CONFIG_SECTION *config_add_section(ALLEGRO_CONFIG *config,
       config->last = section;
    }
 
-   config->tree = _al_aa_insert(config->tree, section->name, section, cmp_ustr);
+   index_insert(&config->index, section->name, section);
 
    return section;
 }
@@ -117,33 +252,27 @@ void al_add_config_section(ALLEGRO_CONFIG *config, const char *name)
 }
 
 
-static void config_set_value(ALLEGRO_CONFIG *config,
-   const ALLEGRO_USTR *section, const ALLEGRO_USTR *key,
-   const ALLEGRO_USTR *value)
+static void section_set_value(ALLEGRO_CONFIG_SECTION *s,
+   const ALLEGRO_USTR *key, const ALLEGRO_USTR *value)
 {
-   ALLEGRO_CONFIG_SECTION *s;
    ALLEGRO_CONFIG_ENTRY *entry;
 
-   s = find_section(config, section);
-   if (s) {
-      entry = find_entry(s, key);
-      if (entry) {
-         al_ustr_assign(entry->value, value);
-         al_ustr_trim_ws(entry->value);
-         return;
-      }
+   entry = find_entry(s, key);
+   if (entry) {
+      al_ustr_assign(entry->value, value);
+      al_ustr_trim_ws(entry->value);
+      _al_atomic_store(&entry->int_state, _AL_CONFIG_NOT_PARSED);
+      _al_atomic_store(&entry->float_state, _AL_CONFIG_NOT_PARSED);
+      _al_atomic_store(&entry->bool_state, _AL_CONFIG_NOT_PARSED);
+      return;
    }
 
-   entry = al_calloc(1, sizeof(ALLEGRO_CONFIG_ENTRY));
+   entry = _al_pool_calloc(sizeof(ALLEGRO_CONFIG_ENTRY));
    entry->is_comment = false;
    entry->key = al_ustr_dup(key);
    entry->value = al_ustr_dup(value);
    al_ustr_trim_ws(entry->value);
 
-   if (!s) {
-      s = config_add_section(config, section);
-   }
-
    if (s->head == NULL) {
       s->head = entry;
       s->last = entry;
@@ -155,7 +284,15 @@ static void config_set_value(ALLEGRO_CONFIG *config,
       s->last = entry;
    }
 
-   s->tree = _al_aa_insert(s->tree, entry->key, entry, cmp_ustr);
+   index_insert(&s->index, entry->key, entry);
+}
+
+
+static void config_set_value(ALLEGRO_CONFIG *config,
+   const ALLEGRO_USTR *section, const ALLEGRO_USTR *key,
+   const ALLEGRO_USTR *value)
+{
+   section_set_value(config_add_section(config, section), key, value);
 }
 
 
@@ -186,15 +323,12 @@ void al_set_config_value(ALLEGRO_CONFIG *config,
 }
 
 
-static void config_add_comment(ALLEGRO_CONFIG *config,
-   const ALLEGRO_USTR *section, const ALLEGRO_USTR *comment)
+static void section_add_comment(ALLEGRO_CONFIG_SECTION *s,
+   const ALLEGRO_USTR *comment)
 {
-   ALLEGRO_CONFIG_SECTION *s;
    ALLEGRO_CONFIG_ENTRY *entry;
 
-   s = find_section(config, section);
-
-   entry = al_calloc(1, sizeof(ALLEGRO_CONFIG_ENTRY));
+   entry = _al_pool_calloc(sizeof(ALLEGRO_CONFIG_ENTRY));
    entry->is_comment = true;
    entry->key = al_ustr_dup(comment);
 
@@ -203,10 +337,6 @@ static void config_add_comment(ALLEGRO_CONFIG *config,
     */
    al_ustr_find_replace_cstr(entry->key, 0, "\n", " ");
 
-   if (!s) {
-      s = config_add_section(config, section);
-   }
-
    if (s->head == NULL) {
       s->head = entry;
       s->last = entry;
@@ -220,6 +350,13 @@ static void config_add_comment(ALLEGRO_CONFIG *config,
 }
 
 
+static void config_add_comment(ALLEGRO_CONFIG *config,
+   const ALLEGRO_USTR *section, const ALLEGRO_USTR *comment)
+{
+   section_add_comment(config_add_section(config, section), comment);
+}
+
+
 /* Function: al_add_config_comment
  */
 void al_add_config_comment(ALLEGRO_CONFIG *config,
@@ -288,21 +425,237 @@ const char *al_get_config_value(const ALLEGRO_CONFIG *config,
 }
 
 
-static bool readline(ALLEGRO_FILE *file, ALLEGRO_USTR *line)
+static ALLEGRO_CONFIG_ENTRY *get_entry(const ALLEGRO_CONFIG *config,
+   const char *section, const char *key)
 {
-   char buf[128];
+   ALLEGRO_USTR_INFO section_info;
+   ALLEGRO_USTR_INFO key_info;
+   ALLEGRO_CONFIG_SECTION *s;
+   ALLEGRO_CONFIG_ENTRY *e;
+
+   if (section == NULL) {
+      section = "";
+   }
+
+   ASSERT(key);
+
+   s = find_section(config, al_ref_cstr(&section_info, section));
+   if (!s)
+      return NULL;
+
+   e = find_entry(s, al_ref_cstr(&key_info, key));
+   if (!e || e->is_comment)
+      return NULL;
+
+   return e;
+}
+
+
+static bool parse_int(const ALLEGRO_USTR *value, int *ret)
+{
+   const char *s = al_cstr(value);
+   const char *digits = (*s == '-' || *s == '+') ? s + 1 : s;
+   int base = (digits[0] == '0' && (digits[1] == 'x' || digits[1] == 'X')) ?
+      16 : 10;
+   char *end;
+   long l;
+
+   if (!isdigit((unsigned char)*digits))
+      return false;
+
+   errno = 0;
+   l = strtol(s, &end, base);
+   if (*end != '\0' || errno == ERANGE || l < INT_MIN || l > INT_MAX)
+      return false;
+
+   *ret = l;
+   return true;
+}
+
+
+static bool parse_float(const ALLEGRO_USTR *value, float *ret)
+{
+   const char *s = al_cstr(value);
+   char *end;
+   double d;
+
+   if (*s == '\0')
+      return false;
 
-   if (!al_fgets(file, buf, sizeof(buf))) {
+   d = strtod(s, &end);
+   if (*end != '\0')
       return false;
+
+   *ret = d;
+   return true;
+}
+
+
+static bool parse_bool(const ALLEGRO_USTR *value, bool *ret)
+{
+   static const char *const true_words[] = {"true", "yes", "on", "1"};
+   static const char *const false_words[] = {"false", "no", "off", "0"};
+   const char *s = al_cstr(value);
+   unsigned i;
+
+   for (i = 0; i < sizeof(true_words) / sizeof(true_words[0]); i++) {
+      if (_al_stricmp(s, true_words[i]) == 0) {
+         *ret = true;
+         return true;
+      }
+      if (_al_stricmp(s, false_words[i]) == 0) {
+         *ret = false;
+         return true;
+      }
+   }
+
+   return false;
+}
+
+
+/* The typed getters remember the parsed value in the entry, so reading the
+ * same value again costs no more than the lookup.  The getters take a const
+ * config and may run in several threads at once, so the value is parsed
+ * into a local first.  Only the thread which claims the entry stores it,
+ * and the state is published last.
+ */
+
+/* Returns true if the caller should store the value it parsed, after
+ * which it must call publish_value.  A value which failed to parse is
+ * just marked invalid.
+ */
+static bool claim_value(volatile _AL_ATOMIC *state, bool valid)
+{
+   if (!valid) {
+      _al_compare_and_swap(state, _AL_CONFIG_NOT_PARSED, _AL_CONFIG_INVALID);
+      return false;
+   }
+   return _al_compare_and_swap(state, _AL_CONFIG_NOT_PARSED,
+      _AL_CONFIG_PARSING);
+}
+
+
+static void publish_value(volatile _AL_ATOMIC *state)
+{
+   _al_atomic_store(state, _AL_CONFIG_PARSED);
+}
+
+
+/* Function: al_get_config_int
+ */
+int al_get_config_int(const ALLEGRO_CONFIG *config,
+   const char *section, const char *key, int def)
+{
+   ALLEGRO_CONFIG_ENTRY *e = get_entry(config, section, key);
+   int state;
+   int value;
+   bool valid;
+
+   if (!e)
+      return def;
+
+   state = _al_atomic_load(&e->int_state);
+   if (state == _AL_CONFIG_PARSED)
+      return e->int_value;
+   if (state == _AL_CONFIG_INVALID)
+      return def;
+
+   valid = parse_int(e->value, &value);
+   if (claim_value(&e->int_state, valid)) {
+      e->int_value = value;
+      publish_value(&e->int_state);
    }
+   return valid ? value : def;
+}
 
-   do {
-      al_ustr_append_cstr(line, buf);
-      if (al_ustr_has_suffix_cstr(line, "\n"))
+
+/* Function: al_get_config_float
+ */
+float al_get_config_float(const ALLEGRO_CONFIG *config,
+   const char *section, const char *key, float def)
+{
+   ALLEGRO_CONFIG_ENTRY *e = get_entry(config, section, key);
+   int state;
+   float value;
+   bool valid;
+
+   if (!e)
+      return def;
+
+   state = _al_atomic_load(&e->float_state);
+   if (state == _AL_CONFIG_PARSED)
+      return e->float_value;
+   if (state == _AL_CONFIG_INVALID)
+      return def;
+
+   valid = parse_float(e->value, &value);
+   if (claim_value(&e->float_state, valid)) {
+      e->float_value = value;
+      publish_value(&e->float_state);
+   }
+   return valid ? value : def;
+}
+
+
+/* Function: al_get_config_bool
+ */
+bool al_get_config_bool(const ALLEGRO_CONFIG *config,
+   const char *section, const char *key, bool def)
+{
+   ALLEGRO_CONFIG_ENTRY *e = get_entry(config, section, key);
+   int state;
+   bool value;
+   bool valid;
+
+   if (!e)
+      return def;
+
+   state = _al_atomic_load(&e->bool_state);
+   if (state == _AL_CONFIG_PARSED)
+      return e->bool_value;
+   if (state == _AL_CONFIG_INVALID)
+      return def;
+
+   valid = parse_bool(e->value, &value);
+   if (claim_value(&e->bool_state, valid)) {
+      e->bool_value = value;
+      publish_value(&e->bool_state);
+   }
+   return valid ? value : def;
+}
+
+
+/* Reads the rest of the file into memory, so that it can be parsed in
+ * place.
+ */
+static char *read_whole_file(ALLEGRO_FILE *file, size_t *ret_size)
+{
+   int64_t size = al_fsize(file);
+   int64_t pos = al_ftell(file);
+   size_t capacity = 4096;
+   size_t n = 0;
+   char *buf = NULL;
+
+   /* The size is only a hint; text mode may make the contents shorter. */
+   if (size > 0 && pos >= 0 && size >= pos && (uint64_t)(size - pos) < (size_t)-1)
+      capacity = size - pos + 1;
+
+   while (1) {
+      char *tmp = al_realloc(buf, capacity);
+      if (!tmp) {
+         al_free(buf);
+         return NULL;
+      }
+      buf = tmp;
+
+      n += al_fread(file, buf + n, capacity - n);
+      if (n < capacity)
          break;
-   } while (al_fgets(file, buf, sizeof(buf)));
+      capacity *= 2;
+   }
 
-   return true;
+   *ret_size = n;
+   return buf;
 }
 
 
@@ -329,58 +682,75 @@ ALLEGRO_CONFIG *al_load_config_file_f(ALLEGRO_FILE *file)
 {
    ALLEGRO_CONFIG *config;
    ALLEGRO_CONFIG_SECTION *current_section = NULL;
-   ALLEGRO_USTR *line;
-   ALLEGRO_USTR *section;
-   ALLEGRO_USTR *key;
-   ALLEGRO_USTR *value;
+   ALLEGRO_USTR_INFO info[2];
+   char *buf;
+   const char *p;
+   const char *end;
+   size_t size;
    ASSERT(file);
 
+   buf = read_whole_file(file, &size);
+   if (!buf) {
+      return NULL;
+   }
+
    config = al_create_config();
    if (!config) {
+      al_free(buf);
       return NULL;
    }
 
-   line = al_ustr_new("");
-   section = al_ustr_new("");
-   key = al_ustr_new("");
-   value = al_ustr_new("");
+   /* Parse each line in place, only copying out the final keys and
+    * values.
+    */
+   for (p = buf, end = buf + size; p < end; ) {
+      const char *eol = memchr(p, '\n', end - p);
+      const char *s = p;
+      const char *e = eol ? eol : end;
+      const ALLEGRO_USTR *line;
 
-   while (1) {
-      al_ustr_assign_cstr(line, "");
-      if (!readline(file, line))
-         break;
-      al_ustr_trim_ws(line);
+      p = eol ? eol + 1 : end;
 
-      if (al_ustr_has_prefix_cstr(line, "#") || al_ustr_size(line) == 0) {
+      while (s < e && isspace((unsigned char)*s))
+         s++;
+      while (e > s && isspace((unsigned char)e[-1]))
+         e--;
+      line = al_ref_buffer(&info[0], s, e - s);
+
+      if (s == e || *s == '#') {
          /* Preserve comments and blank lines */
-         const ALLEGRO_USTR *name;
-         if (current_section)
-            name = current_section->name;
-         else
-            name = al_ustr_empty_string();
-         config_add_comment(config, name, line);
+         if (!current_section)
+            current_section = config_add_section(config, al_ustr_empty_string());
+         section_add_comment(current_section, line);
       }
-      else if (al_ustr_has_prefix_cstr(line, "[")) {
+      else if (*s == '[') {
          int rbracket = al_ustr_rfind_chr(line, al_ustr_size(line), ']');
          if (rbracket == -1)
             rbracket = al_ustr_size(line);
-         al_ustr_assign_substr(section, line, 1, rbracket);
-         current_section = config_add_section(config, section);
+         current_section = config_add_section(config,
+            al_ref_buffer(&info[1], s + 1, rbracket - 1));
       }
       else {
-         get_key_and_value(line, key, value);
-         if (current_section == NULL)
-            config_set_value(config, al_ustr_empty_string(), key, value);
-         else
-            config_set_value(config, current_section->name, key, value);
+         const char *eq = memchr(s, '=', e - s);
+         const char *ks = s;
+         const char *ke = eq ? eq : e;
+         const char *vs = eq ? eq + 1 : e;
+         const char *ve = e;
+
+         while (ke > ks && isspace((unsigned char)ke[-1]))
+            ke--;
+         while (vs < ve && isspace((unsigned char)*vs))
+            vs++;
+
+         if (!current_section)
+            current_section = config_add_section(config, al_ustr_empty_string());
+         section_set_value(current_section,
+            al_ref_buffer(&info[0], ks, ke - ks),
+            al_ref_buffer(&info[1], vs, ve - vs));
       }
    }
 
-   al_ustr_free(line);
-   al_ustr_free(section);
-   al_ustr_free(key);
-   al_ustr_free(value);
-
+   al_free(buf);
    return config;
 }
 
@@ -484,6 +854,353 @@ bool al_save_config_file_f(ALLEGRO_FILE *file, const ALLEGRO_CONFIG *config)
 }
 
 
+/*
+ * Binary config files.
+ *
+ * These hold the same sections, entries and comments as text config files
+ * but need no parsing.  All integers are little endian:
+ *
+ *    header    "A5CF", u32 version, u32 section count, u32 entry count,
+ *              u32 string table size, u32 reserved, i64 source size,
+ *              i64 source modification time
+ *    sections  u32 name offset, u32 name size, u32 first entry,
+ *              u32 entry count
+ *    entries   u32 key offset, u32 key size, u32 value offset,
+ *              u32 value size; comments have a value offset of ~0
+ *    strings   the names, keys and values, each followed by a NUL
+ *
+ * The source fields are only used by al_load_config_file_cached, to tell
+ * if the cache is still up to date.
+ */
+
+#define BINARY_MAGIC          "A5CF"
+#define BINARY_VERSION        1
+#define BINARY_HEADER_SIZE    40
+#define BINARY_RECORD_SIZE    16
+#define BINARY_COMMENT        0xFFFFFFFFu
+
+
+static int64_t get_i64(const unsigned char *p)
+{
+   return (int64_t)_al_get_u64le(p);
+}
+
+
+static void put_i64(ALLEGRO_FILE *file, int64_t v)
+{
+   al_fwrite32le(file, (int32_t)((uint64_t)v & 0xFFFFFFFF));
+   al_fwrite32le(file, (int32_t)((uint64_t)v >> 32));
+}
+
+
+static bool save_binary(ALLEGRO_FILE *file, const ALLEGRO_CONFIG *config,
+   int64_t source_size, int64_t source_mtime)
+{
+   ALLEGRO_CONFIG_SECTION *s;
+   ALLEGRO_CONFIG_ENTRY *e;
+   uint32_t num_sections = 0;
+   uint32_t num_entries = 0;
+   uint32_t strings_size = 0;
+
+   for (s = config->head; s; s = s->next) {
+      num_sections++;
+      strings_size += al_ustr_size(s->name) + 1;
+      for (e = s->head; e; e = e->next) {
+         num_entries++;
+         strings_size += al_ustr_size(e->key) + 1;
+         if (!e->is_comment)
+            strings_size += al_ustr_size(e->value) + 1;
+      }
+   }
+
+   al_fwrite(file, BINARY_MAGIC, 4);
+   al_fwrite32le(file, BINARY_VERSION);
+   al_fwrite32le(file, num_sections);
+   al_fwrite32le(file, num_entries);
+   al_fwrite32le(file, strings_size);
+   al_fwrite32le(file, 0);
+   put_i64(file, source_size);
+   put_i64(file, source_mtime);
+
+   /* The strings are written in the same order as the records, so the
+    * offsets can be worked out as we go.
+    */
+   strings_size = 0;
+   num_entries = 0;
+   for (s = config->head; s; s = s->next) {
+      uint32_t first = num_entries;
+      for (e = s->head; e; e = e->next)
+         num_entries++;
+      al_fwrite32le(file, strings_size);
+      al_fwrite32le(file, al_ustr_size(s->name));
+      al_fwrite32le(file, first);
+      al_fwrite32le(file, num_entries - first);
+      strings_size += al_ustr_size(s->name) + 1;
+      for (e = s->head; e; e = e->next) {
+         strings_size += al_ustr_size(e->key) + 1;
+         if (!e->is_comment)
+            strings_size += al_ustr_size(e->value) + 1;
+      }
+   }
+
+   strings_size = 0;
+   for (s = config->head; s; s = s->next) {
+      strings_size += al_ustr_size(s->name) + 1;
+      for (e = s->head; e; e = e->next) {
+         al_fwrite32le(file, strings_size);
+         al_fwrite32le(file, al_ustr_size(e->key));
+         strings_size += al_ustr_size(e->key) + 1;
+         if (e->is_comment) {
+            al_fwrite32le(file, (int32_t)BINARY_COMMENT);
+            al_fwrite32le(file, 0);
+         }
+         else {
+            al_fwrite32le(file, strings_size);
+            al_fwrite32le(file, al_ustr_size(e->value));
+            strings_size += al_ustr_size(e->value) + 1;
+         }
+      }
+   }
+
+   for (s = config->head; s; s = s->next) {
+      al_fwrite(file, al_cstr(s->name), al_ustr_size(s->name) + 1);
+      for (e = s->head; e; e = e->next) {
+         al_fwrite(file, al_cstr(e->key), al_ustr_size(e->key) + 1);
+         if (!e->is_comment)
+            al_fwrite(file, al_cstr(e->value), al_ustr_size(e->value) + 1);
+      }
+   }
+
+   return !al_ferror(file);
+}
+
+
+/* Checks that a string lies inside the string table. */
+static bool get_string(ALLEGRO_USTR_INFO *info, const ALLEGRO_USTR **us,
+   const char *strings, uint32_t strings_size, uint32_t offset, uint32_t size)
+{
+   if (offset > strings_size || size > strings_size - offset)
+      return false;
+   *us = al_ref_buffer(info, strings + offset, size);
+   return true;
+}
+
+
+static ALLEGRO_CONFIG *load_binary(const unsigned char *data, size_t size,
+   int64_t *source_size, int64_t *source_mtime)
+{
+   ALLEGRO_CONFIG *config;
+   const unsigned char *sections;
+   const unsigned char *entries;
+   const char *strings;
+   uint32_t num_sections, num_entries, strings_size;
+   uint32_t i, j;
+
+   if (size < BINARY_HEADER_SIZE || memcmp(data, BINARY_MAGIC, 4) != 0 ||
+         _al_get_u32le(data + 4) != BINARY_VERSION) {
+      return NULL;
+   }
+
+   num_sections = _al_get_u32le(data + 8);
+   num_entries = _al_get_u32le(data + 12);
+   strings_size = _al_get_u32le(data + 16);
+
+   if ((uint64_t)BINARY_HEADER_SIZE +
+         ((uint64_t)num_sections + num_entries) * BINARY_RECORD_SIZE +
+         strings_size != size) {
+      return NULL;
+   }
+
+   if (source_size)
+      *source_size = get_i64(data + 24);
+   if (source_mtime)
+      *source_mtime = get_i64(data + 32);
+
+   sections = data + BINARY_HEADER_SIZE;
+   entries = sections + (size_t)num_sections * BINARY_RECORD_SIZE;
+   strings = (const char *)entries + (size_t)num_entries * BINARY_RECORD_SIZE;
+
+   config = al_create_config();
+   index_reserve(&config->index, num_sections);
+
+   for (i = 0; i < num_sections; i++) {
+      const unsigned char *rec = sections + (size_t)i * BINARY_RECORD_SIZE;
+      uint32_t first = _al_get_u32le(rec + 8);
+      uint32_t count = _al_get_u32le(rec + 12);
+      ALLEGRO_USTR_INFO name_info;
+      const ALLEGRO_USTR *name;
+      ALLEGRO_CONFIG_SECTION *s;
+
+      if (!get_string(&name_info, &name, strings, strings_size,
+            _al_get_u32le(rec), _al_get_u32le(rec + 4)) ||
+            first > num_entries || count > num_entries - first) {
+         goto error;
+      }
+
+      s = config_add_section(config, name);
+      index_reserve(&s->index, s->index.count + count);
+
+      for (j = first; j < first + count; j++) {
+         const unsigned char *erec = entries + (size_t)j * BINARY_RECORD_SIZE;
+         ALLEGRO_USTR_INFO key_info, value_info;
+         const ALLEGRO_USTR *key, *value;
+
+         if (!get_string(&key_info, &key, strings, strings_size,
+               _al_get_u32le(erec), _al_get_u32le(erec + 4))) {
+            goto error;
+         }
+
+         if (_al_get_u32le(erec + 8) == BINARY_COMMENT) {
+            section_add_comment(s, key);
+            continue;
+         }
+
+         if (!get_string(&value_info, &value, strings, strings_size,
+               _al_get_u32le(erec + 8), _al_get_u32le(erec + 12))) {
+            goto error;
+         }
+         section_set_value(s, key, value);
+      }
+   }
+
+   return config;
+
+error:
+   al_destroy_config(config);
+   return NULL;
+}
+
+
+/* Function: al_load_config_binary
+ */
+ALLEGRO_CONFIG *al_load_config_binary(const char *filename)
+{
+   ALLEGRO_FILE *file;
+   ALLEGRO_CONFIG *cfg = NULL;
+
+   file = al_fopen(filename, "rb");
+   if (file) {
+      cfg = al_load_config_binary_f(file);
+      al_fclose(file);
+   }
+
+   return cfg;
+}
+
+
+/* Function: al_load_config_binary_f
+ */
+ALLEGRO_CONFIG *al_load_config_binary_f(ALLEGRO_FILE *file)
+{
+   ALLEGRO_CONFIG *config;
+   char *buf;
+   size_t size;
+   ASSERT(file);
+
+   buf = read_whole_file(file, &size);
+   if (!buf)
+      return NULL;
+
+   config = load_binary((unsigned char *)buf, size, NULL, NULL);
+   al_free(buf);
+   return config;
+}
+
+
+/* Function: al_save_config_binary
+ */
+bool al_save_config_binary(const char *filename, const ALLEGRO_CONFIG *config)
+{
+   ALLEGRO_FILE *file;
+
+   file = al_fopen(filename, "wb");
+   if (file) {
+      bool retsave = al_save_config_binary_f(file, config);
+      bool retclose = al_fclose(file);
+      return retsave && retclose;
+   }
+
+   return false;
+}
+
+
+/* Function: al_save_config_binary_f
+ */
+bool al_save_config_binary_f(ALLEGRO_FILE *file, const ALLEGRO_CONFIG *config)
+{
+   ASSERT(file);
+   ASSERT(config);
+
+   return save_binary(file, config, -1, 0);
+}
+
+
+/* Function: al_load_config_file_cached
+ */
+ALLEGRO_CONFIG *al_load_config_file_cached(const char *filename,
+   const char *cache_filename)
+{
+   ALLEGRO_FS_ENTRY *entry;
+   ALLEGRO_USTR *cache_path;
+   ALLEGRO_CONFIG *config = NULL;
+   ALLEGRO_FILE *file;
+   int64_t size, mtime;
+   ASSERT(filename);
+
+   entry = al_create_fs_entry(filename);
+   if (!entry)
+      return NULL;
+   if (!al_fs_entry_exists(entry)) {
+      al_destroy_fs_entry(entry);
+      return NULL;
+   }
+   size = al_get_fs_entry_size(entry);
+   mtime = al_get_fs_entry_mtime(entry);
+   al_destroy_fs_entry(entry);
+
+   if (cache_filename)
+      cache_path = al_ustr_new(cache_filename);
+   else
+      cache_path = al_ustr_newf("%s.cache", filename);
+
+   file = al_fopen(al_cstr(cache_path), "rb");
+   if (file) {
+      int64_t cached_size, cached_mtime;
+      size_t n;
+      char *buf = read_whole_file(file, &n);
+
+      al_fclose(file);
+      if (buf) {
+         config = load_binary((unsigned char *)buf, n, &cached_size,
+            &cached_mtime);
+         if (config && (cached_size != size || cached_mtime != mtime)) {
+            al_destroy_config(config);
+            config = NULL;
+         }
+         al_free(buf);
+      }
+   }
+
+   if (!config) {
+      config = al_load_config_file(filename);
+
+      /* Failing to write the cache is not an error, it will just be tried
+       * again next time.
+       */
+      file = config ? al_fopen(al_cstr(cache_path), "wb") : NULL;
+      if (file) {
+         bool retsave = save_binary(file, config, size, mtime);
+         bool retclose = al_fclose(file);
+         if (!retsave || !retclose)
+            al_remove_filename(al_cstr(cache_path));
+      }
+   }
+
+   al_ustr_free(cache_path);
+   return config;
+}
+
+
 /* do_config_merge_into:
  *  Helper function for merging.
  */
@@ -543,7 +1260,7 @@ static void destroy_entry(ALLEGRO_CONFIG_ENTRY *e)
 {
    al_ustr_free(e->key);
    al_ustr_free(e->value);
-   al_free(e);
+   _al_pool_free(e, sizeof(ALLEGRO_CONFIG_ENTRY));
 }
 
 
@@ -556,8 +1273,8 @@ static void destroy_section(ALLEGRO_CONFIG_SECTION *s)
       e = tmp;
    }
    al_ustr_free(s->name);
-   _al_aa_free(s->tree);
-   al_free(s);
+   index_free(&s->index);
+   _al_pool_free(s, sizeof(ALLEGRO_CONFIG_SECTION));
 }
 
    
@@ -578,7 +1295,7 @@ void al_destroy_config(ALLEGRO_CONFIG *config)
       s = tmp;
    }
 
-   _al_aa_free(config->tree);
+   index_free(&config->index);
    al_free(config);
 }
 
@@ -666,15 +1383,11 @@ bool al_remove_config_section(ALLEGRO_CONFIG *config, char const *section)
 {
    ALLEGRO_USTR_INFO section_info;
    ALLEGRO_USTR const *usection = al_ref_cstr(&section_info, section);
-   void *value;
    ALLEGRO_CONFIG_SECTION *s;
    
-   value = NULL;
-   config->tree = _al_aa_delete(config->tree, usection, cmp_ustr, &value);
-   if (!value)
+   s = index_remove(&config->index, usection);
+   if (!s)
       return false;
-   
-   s = value;
 
    if (s->prev) {
       s->prev->next = s->next;
@@ -706,20 +1419,16 @@ bool al_remove_config_key(ALLEGRO_CONFIG *config, char const *section,
    ALLEGRO_USTR_INFO key_info;
    ALLEGRO_USTR const *usection = al_ref_cstr(&section_info, section);
    ALLEGRO_USTR const *ukey = al_ref_cstr(&key_info, key);
-   void *value;
    ALLEGRO_CONFIG_ENTRY * e;
 
    ALLEGRO_CONFIG_SECTION *s = find_section(config, usection);
    if (!s)
       return false;
 
-   value = NULL;
-   s->tree = _al_aa_delete(s->tree, ukey, cmp_ustr, &value);
-   if (!value)
+   e = index_remove(&s->index, ukey);
+   if (!e)
       return false;
    
-   e = value;
-   
    if (e->prev) {
       e->prev->next = e->next;
    }
@@ -26,6 +26,7 @@
 
 #include "allegro5/allegro.h"
 #include "allegro5/internal/aintern.h"
+#include "allegro5/internal/aintern_atomicops.h"
 #include "allegro5/internal/aintern_dtor.h"
 #include "allegro5/internal/aintern_exitfunc.h"
 #include "allegro5/internal/aintern_events.h"
@@ -33,6 +34,25 @@
 
 
 
+/* How many of the most recent events are searched for one to merge a
+ * new event into.
+ */
+#define COALESCE_SCAN_LIMIT   64
+
+
+
+/* A slot in the ring of a bounded queue.  The sequence number tells
+ * producers and consumers whose turn it is to use the slot, see
+ * ring_push and ring_pop.
+ */
+typedef struct EVENT_SLOT
+{
+   volatile _AL_ATOMIC seq;
+   ALLEGRO_EVENT event;
+} EVENT_SLOT;
+
+
+
 struct ALLEGRO_EVENT_QUEUE
 {
    _AL_VECTOR sources;  /* vector of (ALLEGRO_EVENT_SOURCE *) */
@@ -42,6 +62,33 @@ struct ALLEGRO_EVENT_QUEUE
    bool paused;
    _AL_MUTEX mutex;
    _AL_COND cond;
+   volatile _AL_ATOMIC waiters;  /* threads waiting on cond */
+   _AL_VECTOR coalesce_types;    /* vector of ALLEGRO_EVENT_TYPE */
+
+   /* Only used by bounded queues, which have slots != NULL.  Producers
+    * never take the mutex unless a thread is waiting on the queue.
+    * Producers blocked on a full ring wait on space_cond, which is
+    * protected by a separate mutex so that the consumer can wake them
+    * while holding the queue mutex.  They never wait while holding the
+    * lock of an event source, see _al_event_queue_push_blocked_event.
+    * Events which the consumer has taken out of the ring but not yet
+    * returned, e.g. after al_peek_next_event, are kept in order in
+    * pending.
+    */
+   EVENT_SLOT *slots;
+   unsigned int slot_mask;
+   ALLEGRO_EVENT_QUEUE_OVERFLOW overflow;
+   volatile _AL_ATOMIC enqueue_pos;
+   volatile _AL_ATOMIC dequeue_pos;
+   volatile _AL_ATOMIC blocked_producers;
+   volatile _AL_ATOMIC dropping_producers;
+   volatile _AL_ATOMIC compacting;  /* threads discarding events */
+   unsigned int unregister_count;   /* protected by space_mutex */
+   _AL_MUTEX space_mutex;
+   _AL_COND space_cond;
+   _AL_VECTOR pending;  /* vector of ALLEGRO_EVENT */
+   unsigned int pending_pos;
+   ALLEGRO_EVENT scratch;
 };
 
 
@@ -100,6 +147,9 @@ ALLEGRO_EVENT_QUEUE *al_create_event_queue(void)
       queue->events_head = 0;
       queue->events_tail = 0;
       queue->paused = false;
+      queue->waiters = 0;
+      _al_vector_init(&queue->coalesce_types, sizeof(ALLEGRO_EVENT_TYPE));
+      queue->slots = NULL;
 
       _AL_MARK_MUTEX_UNINITED(queue->mutex);
       _al_mutex_init(&queue->mutex);
@@ -114,6 +164,51 @@ ALLEGRO_EVENT_QUEUE *al_create_event_queue(void)
 
 
 
+/* Function: al_create_bounded_event_queue
+ */
+ALLEGRO_EVENT_QUEUE *al_create_bounded_event_queue(int capacity,
+   ALLEGRO_EVENT_QUEUE_OVERFLOW overflow)
+{
+   ALLEGRO_EVENT_QUEUE *queue;
+   unsigned int size = 2;
+   unsigned int i;
+
+   ASSERT(capacity > 0);
+
+   while (size < (unsigned int)capacity)
+      size *= 2;
+
+   queue = al_create_event_queue();
+   if (!queue)
+      return NULL;
+
+   queue->slots = al_malloc(size * sizeof(EVENT_SLOT));
+   if (!queue->slots) {
+      al_destroy_event_queue(queue);
+      return NULL;
+   }
+
+   for (i = 0; i < size; i++)
+      queue->slots[i].seq = i;
+   queue->slot_mask = size - 1;
+   queue->overflow = overflow;
+   queue->enqueue_pos = 0;
+   queue->dequeue_pos = 0;
+   queue->blocked_producers = 0;
+   queue->dropping_producers = 0;
+   queue->compacting = 0;
+   queue->unregister_count = 0;
+   _AL_MARK_MUTEX_UNINITED(queue->space_mutex);
+   _al_mutex_init(&queue->space_mutex);
+   _al_cond_init(&queue->space_cond);
+   _al_vector_init(&queue->pending, sizeof(ALLEGRO_EVENT));
+   queue->pending_pos = 0;
+
+   return queue;
+}
+
+
+
 /* Function: al_destroy_event_queue
  */
 void al_destroy_event_queue(ALLEGRO_EVENT_QUEUE *queue)
@@ -133,6 +228,26 @@ void al_destroy_event_queue(ALLEGRO_EVENT_QUEUE *queue)
 
    ASSERT(queue->events_head == queue->events_tail);
    _al_vector_free(&queue->events);
+   _al_vector_free(&queue->coalesce_types);
+
+   if (queue->slots) {
+      /* Producers waiting for room give up once they see that their
+       * source was unregistered, but may still be using the queue.
+       */
+      _al_mutex_lock(&queue->space_mutex);
+      while (_al_atomic_load(&queue->blocked_producers) > 0)
+         _al_cond_wait(&queue->space_cond, &queue->space_mutex);
+      _al_mutex_unlock(&queue->space_mutex);
+
+      /* Events which were being pushed while the sources were
+       * unregistered may still have been added.
+       */
+      al_flush_event_queue(queue);
+      _al_vector_free(&queue->pending);
+      _al_cond_destroy(&queue->space_cond);
+      _al_mutex_destroy(&queue->space_mutex);
+      al_free(queue->slots);
+   }
 
    _al_cond_destroy(&queue->cond);
    _al_mutex_destroy(&queue->mutex);
@@ -180,6 +295,16 @@ void al_unregister_event_source(ALLEGRO_EVENT_QUEUE *queue,
       /* Tell the event source that it was unregistered. */
       _al_event_source_on_unregistration_from_queue(source, queue);
 
+      /* Wake producers waiting for room, in case they were emitting from
+       * this source.
+       */
+      if (queue->slots) {
+         _al_mutex_lock(&queue->space_mutex);
+         queue->unregister_count++;
+         _al_cond_broadcast(&queue->space_cond);
+         _al_mutex_unlock(&queue->space_mutex);
+      }
+
       /* Drop all the events in the queue that belonged to the source. */
       _al_mutex_lock(&queue->mutex);
       discard_events_of_source(queue, source);
@@ -202,6 +327,29 @@ void al_pause_event_queue(ALLEGRO_EVENT_QUEUE *queue, bool pause)
 
 
 
+/* Function: al_set_event_queue_coalesce
+ */
+void al_set_event_queue_coalesce(ALLEGRO_EVENT_QUEUE *queue,
+   ALLEGRO_EVENT_TYPE type, bool coalesce)
+{
+   ALLEGRO_EVENT_TYPE *slot;
+   ASSERT(queue);
+
+   _al_mutex_lock(&queue->mutex);
+   if (coalesce) {
+      if (!_al_vector_contains(&queue->coalesce_types, &type)) {
+         slot = _al_vector_alloc_back(&queue->coalesce_types);
+         *slot = type;
+      }
+   }
+   else {
+      _al_vector_find_and_delete(&queue->coalesce_types, &type);
+   }
+   _al_mutex_unlock(&queue->mutex);
+}
+
+
+
 /* Function: al_is_event_queue_paused
  */
 bool al_is_event_queue_paused(const ALLEGRO_EVENT_QUEUE *queue)
@@ -222,8 +370,113 @@ static void heartbeat(void)
 
 
 
+/* ring_push:
+ *  Add an event to the ring of a bounded queue.  Returns false if the
+ *  ring is full.  Any number of threads may call this at the same time.
+ *
+ *  This is the bounded queue by Dmitry Vyukov: each slot carries a
+ *  sequence number which equals the position a producer may fill it at,
+ *  and that position plus one once it is filled.  Claiming a position is
+ *  a single compare-and-swap.
+ */
+static bool ring_push(ALLEGRO_EVENT_QUEUE *queue, const ALLEGRO_EVENT *event)
+{
+   EVENT_SLOT *slot;
+   unsigned int pos = _al_atomic_load(&queue->enqueue_pos);
+
+   for (;;) {
+      int dif;
+      slot = &queue->slots[pos & queue->slot_mask];
+      dif = (int)((unsigned int)_al_atomic_load(&slot->seq) - pos);
+      if (dif == 0) {
+         if (_al_compare_and_swap(&queue->enqueue_pos, pos, pos + 1))
+            break;
+         pos = _al_atomic_load(&queue->enqueue_pos);
+      }
+      else if (dif < 0) {
+         return false;
+      }
+      else {
+         pos = _al_atomic_load(&queue->enqueue_pos);
+      }
+   }
+
+   slot->event = *event;
+   _al_atomic_store(&slot->seq, pos + 1);
+   return true;
+}
+
+
+
+/* ring_pop:
+ *  Remove the oldest event from the ring of a bounded queue.  Returns
+ *  false if the ring is empty.  This is normally only called by the
+ *  consumer, but producers call it too to drop the oldest event.
+ */
+static bool ring_pop(ALLEGRO_EVENT_QUEUE *queue, ALLEGRO_EVENT *ret_event)
+{
+   EVENT_SLOT *slot;
+   unsigned int pos = _al_atomic_load(&queue->dequeue_pos);
+
+   for (;;) {
+      int dif;
+      slot = &queue->slots[pos & queue->slot_mask];
+      dif = (int)((unsigned int)_al_atomic_load(&slot->seq) - (pos + 1));
+      if (dif == 0) {
+         if (_al_compare_and_swap(&queue->dequeue_pos, pos, pos + 1))
+            break;
+         pos = _al_atomic_load(&queue->dequeue_pos);
+      }
+      else if (dif < 0) {
+         return false;
+      }
+      else {
+         pos = _al_atomic_load(&queue->dequeue_pos);
+      }
+   }
+
+   *ret_event = slot->event;
+   _al_atomic_store(&slot->seq, pos + queue->slot_mask + 1);
+
+   /* Wake up producers blocked on a full ring. */
+   if (_al_atomic_load(&queue->blocked_producers) > 0) {
+      _al_mutex_lock(&queue->space_mutex);
+      _al_cond_broadcast(&queue->space_cond);
+      _al_mutex_unlock(&queue->space_mutex);
+   }
+
+   return true;
+}
+
+
+
+static bool is_ring_empty(ALLEGRO_EVENT_QUEUE *queue)
+{
+   unsigned int pos = _al_atomic_load(&queue->dequeue_pos);
+   EVENT_SLOT *slot = &queue->slots[pos & queue->slot_mask];
+
+   return (unsigned int)_al_atomic_load(&slot->seq) != pos + 1;
+}
+
+
+
+static bool is_ring_full(ALLEGRO_EVENT_QUEUE *queue)
+{
+   unsigned int pos = _al_atomic_load(&queue->enqueue_pos);
+   EVENT_SLOT *slot = &queue->slots[pos & queue->slot_mask];
+
+   return (int)((unsigned int)_al_atomic_load(&slot->seq) - pos) < 0;
+}
+
+
+
 static bool is_event_queue_empty(ALLEGRO_EVENT_QUEUE *queue)
 {
+   if (queue->slots) {
+      return (queue->pending_pos == _al_vector_size(&queue->pending))
+         && is_ring_empty(queue);
+   }
+
    return (queue->events_head == queue->events_tail);
 }
 
@@ -252,6 +505,16 @@ static unsigned int circ_array_next(const _AL_VECTOR *vector, unsigned int i)
 
 
 
+/* circ_array_prev:
+ *  Return the previous index in a circular array.
+ */
+static unsigned int circ_array_prev(const _AL_VECTOR *vector, unsigned int i)
+{
+   return (i + _al_vector_size(vector) - 1) % _al_vector_size(vector);
+}
+
+
+
 /* get_next_event_if_any: [primary thread]
  *  Helper function.  It returns a pointer to the next event in the
  *  queue, or NULL.  Optionally the event is removed from the queue.
@@ -264,6 +527,28 @@ static ALLEGRO_EVENT *get_next_event_if_any(ALLEGRO_EVENT_QUEUE *queue,
 {
    ALLEGRO_EVENT *event;
 
+   if (queue->slots) {
+      /* The pending events are older than anything in the ring. */
+      if (queue->pending_pos == _al_vector_size(&queue->pending)) {
+         _al_vector_free(&queue->pending);
+         queue->pending_pos = 0;
+         if (delete) {
+            return ring_pop(queue, &queue->scratch) ? &queue->scratch : NULL;
+         }
+         event = _al_vector_alloc_back(&queue->pending);
+         if (!ring_pop(queue, event)) {
+            _al_vector_free(&queue->pending);
+            return NULL;
+         }
+         return event;
+      }
+      event = _al_vector_ref(&queue->pending, queue->pending_pos);
+      if (delete) {
+         queue->pending_pos++;
+      }
+      return event;
+   }
+
    if (is_event_queue_empty(queue)) {
       return NULL;
    }
@@ -302,6 +587,75 @@ bool al_get_next_event(ALLEGRO_EVENT_QUEUE *queue, ALLEGRO_EVENT *ret_event)
 
 
 
+/* get_next_events_if_any:
+ *  Helper function.  Moves up to max events from the front of the
+ *  queue into ret_events, returning the number of events moved.  The
+ *  events are copied at most two contiguous runs at a time, one on each
+ *  side of the wrap-around point.  The event queue must be locked
+ *  before entering this function.
+ */
+static int get_next_events_if_any(ALLEGRO_EVENT_QUEUE *queue,
+   ALLEGRO_EVENT *ret_events, int max)
+{
+   const unsigned int size = _al_vector_size(&queue->events);
+   int count = 0;
+
+   if (queue->slots) {
+      ALLEGRO_EVENT *event;
+      while (count < max && (event = get_next_event_if_any(queue, true))) {
+         copy_event(ret_events + count, event);
+         count++;
+      }
+      return count;
+   }
+
+   while (count < max && !is_event_queue_empty(queue)) {
+      unsigned int end;
+      int n;
+
+      if (queue->events_head > queue->events_tail)
+         end = queue->events_head;
+      else
+         end = size;
+
+      n = end - queue->events_tail;
+      if (n > max - count)
+         n = max - count;
+
+      memcpy(ret_events + count,
+         _al_vector_ref(&queue->events, queue->events_tail),
+         n * sizeof(ALLEGRO_EVENT));
+      count += n;
+      queue->events_tail = (queue->events_tail + n) % size;
+   }
+
+   return count;
+}
+
+
+
+/* Function: al_get_next_events
+ */
+int al_get_next_events(ALLEGRO_EVENT_QUEUE *queue, ALLEGRO_EVENT *ret_events,
+   int max)
+{
+   int count;
+   ASSERT(queue);
+   ASSERT(ret_events);
+   ASSERT(max >= 0);
+
+   heartbeat();
+
+   _al_mutex_lock(&queue->mutex);
+   count = get_next_events_if_any(queue, ret_events, max);
+   /* Don't increment reference count on user events. */
+   _al_mutex_unlock(&queue->mutex);
+
+   return count;
+}
+
+
+
 /* Function: al_peek_next_event
  */
 bool al_peek_next_event(ALLEGRO_EVENT_QUEUE *queue, ALLEGRO_EVENT *ret_event)
@@ -361,6 +715,15 @@ void al_flush_event_queue(ALLEGRO_EVENT_QUEUE *queue)
 
    _al_mutex_lock(&queue->mutex);
 
+   if (queue->slots) {
+      ALLEGRO_EVENT *old_ev;
+      while ((old_ev = get_next_event_if_any(queue, true))) {
+         unref_if_user_event(old_ev);
+      }
+      _al_mutex_unlock(&queue->mutex);
+      return;
+   }
+
    /* Decrement reference counts on all user events. */
    i = queue->events_tail;
    while (i != queue->events_head) {
@@ -388,9 +751,11 @@ void al_wait_for_event(ALLEGRO_EVENT_QUEUE *queue, ALLEGRO_EVENT *ret_event)
 
    _al_mutex_lock(&queue->mutex);
    {
+      _al_fetch_and_add1(&queue->waiters);
       while (is_event_queue_empty(queue)) {
          _al_cond_wait(&queue->cond, &queue->mutex);
       }
+      _al_sub1_and_fetch(&queue->waiters);
 
       if (ret_event) {
          next_event = get_next_event_if_any(queue, true);
@@ -439,6 +804,48 @@ bool al_wait_for_event_until(ALLEGRO_EVENT_QUEUE *queue,
 
 
 
+/* [primary thread] */
+/* Function: al_wait_for_events_timed
+ */
+int al_wait_for_events_timed(ALLEGRO_EVENT_QUEUE *queue,
+   ALLEGRO_EVENT *ret_events, int max, float secs)
+{
+   ALLEGRO_TIMEOUT timeout;
+   int count = 0;
+
+   ASSERT(queue);
+   ASSERT(ret_events);
+   ASSERT(max >= 0);
+   ASSERT(secs >= 0);
+
+   heartbeat();
+
+   if (secs < 0.0)
+      al_init_timeout(&timeout, 0);
+   else
+      al_init_timeout(&timeout, secs);
+
+   _al_mutex_lock(&queue->mutex);
+   {
+      int result = 0;
+
+      /* Only block if there is nothing to return straight away. */
+      _al_fetch_and_add1(&queue->waiters);
+      while (is_event_queue_empty(queue) && (result != -1)) {
+         result = _al_cond_timedwait(&queue->cond, &queue->mutex, &timeout);
+      }
+      _al_sub1_and_fetch(&queue->waiters);
+
+      if (result != -1)
+         count = get_next_events_if_any(queue, ret_events, max);
+   }
+   _al_mutex_unlock(&queue->mutex);
+
+   return count;
+}
+
+
+
 static bool do_wait_for_event(ALLEGRO_EVENT_QUEUE *queue,
    ALLEGRO_EVENT *ret_event, ALLEGRO_TIMEOUT *timeout)
 {
@@ -453,9 +860,11 @@ static bool do_wait_for_event(ALLEGRO_EVENT_QUEUE *queue,
        * variable, which will be signaled when an event is placed into
        * the queue.
        */
+      _al_fetch_and_add1(&queue->waiters);
       while (is_event_queue_empty(queue) && (result != -1)) {
          result = _al_cond_timedwait(&queue->cond, &queue->mutex, timeout);
       }
+      _al_sub1_and_fetch(&queue->waiters);
 
       if (result == -1)
          timed_out = true;
@@ -554,6 +963,24 @@ static void ref_if_user_event(ALLEGRO_EVENT *event)
 
 
 
+/* Take back a reference added by ref_if_user_event for an event which
+ * never made it into a queue.  The emitter still holds a reference, see
+ * al_emit_user_event, so the destructor is never called here.
+ */
+static void unref_dropped_user_event(ALLEGRO_EVENT *event)
+{
+   if (ALLEGRO_EVENT_TYPE_IS_USER(event->type)) {
+      ALLEGRO_USER_EVENT_DESCRIPTOR *descr = event->user.__internal__descr;
+      if (descr) {
+         _al_mutex_lock(&user_event_refcount_mutex);
+         descr->refcount--;
+         _al_mutex_unlock(&user_event_refcount_mutex);
+      }
+   }
+}
+
+
+
 /* Decrement a user event's reference count, if the event passed is a user
  * event and requires it.
  */
@@ -566,6 +993,189 @@ static void unref_if_user_event(ALLEGRO_EVENT *event)
 
 
 
+/* wake_waiters:
+ *  Wake up threads that are waiting for an event to be placed in a
+ *  bounded queue.  Waiters increment the count before checking whether
+ *  the queue is empty, so either they see the new event or we see them.
+ */
+static void wake_waiters(ALLEGRO_EVENT_QUEUE *queue)
+{
+   if (_al_atomic_load(&queue->waiters) > 0) {
+      _al_mutex_lock(&queue->mutex);
+      _al_cond_broadcast(&queue->cond);
+      _al_mutex_unlock(&queue->mutex);
+   }
+}
+
+
+
+/* drop_oldest_event:
+ *  Make room in a full bounded queue by dropping its oldest event.  This
+ *  is skipped while the consumer is compacting the ring, see
+ *  discard_ring_events_of_source.  Returns false if nothing was dropped.
+ */
+static bool drop_oldest_event(ALLEGRO_EVENT_QUEUE *queue)
+{
+   ALLEGRO_EVENT old_event;
+   bool dropped = false;
+
+   _al_fetch_and_add1(&queue->dropping_producers);
+   if (!_al_atomic_load(&queue->compacting)) {
+      dropped = ring_pop(queue, &old_event);
+      if (dropped)
+         unref_if_user_event(&old_event);
+   }
+   _al_sub1_and_fetch(&queue->dropping_producers);
+
+   return dropped;
+}
+
+
+
+/* push_bounded_event:
+ *  Add an event to a bounded queue, applying the queue's overflow policy
+ *  if the ring is full.  The caller has already taken the queue's
+ *  reference to a user event.  The mutex is only taken to wake up other
+ *  threads.
+ *
+ *  The caller holds the lock of the event source, so this never waits.
+ *  If the queue blocks on overflow, returns false when `may_block` is
+ *  true, and the caller keeps the reference.  Otherwise the new event is
+ *  dropped.
+ */
+static bool push_bounded_event(ALLEGRO_EVENT_QUEUE *queue,
+   ALLEGRO_EVENT *new_event, bool may_block)
+{
+   while (!ring_push(queue, new_event)) {
+      switch (queue->overflow) {
+         case ALLEGRO_EVENT_QUEUE_BLOCK:
+            if (may_block)
+               return false;
+            unref_dropped_user_event(new_event);
+            return true;
+
+         case ALLEGRO_EVENT_QUEUE_DROP_NEWEST:
+            unref_dropped_user_event(new_event);
+            return true;
+
+         case ALLEGRO_EVENT_QUEUE_DROP_OLDEST:
+            if (!drop_oldest_event(queue)) {
+               unref_dropped_user_event(new_event);
+               return true;
+            }
+            break;
+      }
+   }
+
+   wake_waiters(queue);
+   return true;
+}
+
+
+
+/* is_same_stream:
+ *  Return true if the two events, of the same type and from the same
+ *  source, describe the same thing, e.g. the same joystick axis or the
+ *  same finger, and so the newer one may replace the older one.
+ */
+static bool is_same_stream(const ALLEGRO_EVENT *a, const ALLEGRO_EVENT *b)
+{
+   switch (a->type) {
+      case ALLEGRO_EVENT_JOYSTICK_AXIS:
+         return a->joystick.id == b->joystick.id
+            && a->joystick.stick == b->joystick.stick
+            && a->joystick.axis == b->joystick.axis;
+
+      case ALLEGRO_EVENT_TOUCH_MOVE:
+         return a->touch.id == b->touch.id;
+
+      default:
+         return true;
+   }
+}
+
+
+
+/* merge_event:
+ *  Merge a new event into an older queued one.  Relative motion is
+ *  accumulated, everything else is taken from the newer event.
+ */
+static void merge_event(ALLEGRO_EVENT *old_event,
+   const ALLEGRO_EVENT *new_event)
+{
+   switch (new_event->type) {
+      case ALLEGRO_EVENT_MOUSE_AXES:
+      case ALLEGRO_EVENT_MOUSE_WARPED: {
+         int dx = old_event->mouse.dx + new_event->mouse.dx;
+         int dy = old_event->mouse.dy + new_event->mouse.dy;
+         int dz = old_event->mouse.dz + new_event->mouse.dz;
+         int dw = old_event->mouse.dw + new_event->mouse.dw;
+         copy_event(old_event, new_event);
+         old_event->mouse.dx = dx;
+         old_event->mouse.dy = dy;
+         old_event->mouse.dz = dz;
+         old_event->mouse.dw = dw;
+         break;
+      }
+
+      case ALLEGRO_EVENT_TOUCH_MOVE: {
+         float dx = old_event->touch.dx + new_event->touch.dx;
+         float dy = old_event->touch.dy + new_event->touch.dy;
+         copy_event(old_event, new_event);
+         old_event->touch.dx = dx;
+         old_event->touch.dy = dy;
+         break;
+      }
+
+      default:
+         /* Timer events carry the timer's count, so replacing them keeps
+          * the number of ticks that passed available.
+          */
+         unref_if_user_event(old_event);
+         copy_event(old_event, new_event);
+         ref_if_user_event(old_event);
+         break;
+   }
+}
+
+
+
+/* coalesce_event:
+ *  Try to merge the event into the newest queued event from the same
+ *  source, if coalescing was enabled for its type.  Returns true if the
+ *  event was merged.  The queue must be locked.
+ */
+static bool coalesce_event(ALLEGRO_EVENT_QUEUE *queue,
+   const ALLEGRO_EVENT *event)
+{
+   ALLEGRO_EVENT *old_event;
+   unsigned int i;
+   int n;
+
+   if (!_al_vector_contains(&queue->coalesce_types, &event->type))
+      return false;
+
+   i = queue->events_head;
+   for (n = 0; n < COALESCE_SCAN_LIMIT && i != queue->events_tail; n++) {
+      i = circ_array_prev(&queue->events, i);
+      old_event = _al_vector_ref(&queue->events, i);
+      if (old_event->any.source != event->any.source)
+         continue;
+      /* Never move an event past another one from the same source. */
+      if (old_event->type != event->type)
+         return false;
+      /* Other axes or fingers are independent, so look past them. */
+      if (!is_same_stream(old_event, event))
+         continue;
+      merge_event(old_event, event);
+      return true;
+   }
+
+   return false;
+}
+
+
+
 /* Internal function: _al_event_queue_push_event
  *  Event sources call this function when they have something to add to
  *  the queue.  If a queue cannot accept the event, the event's
@@ -584,8 +1194,19 @@ void _al_event_queue_push_event(ALLEGRO_EVENT_QUEUE *queue,
    if (queue->paused)
       return;
 
+   if (queue->slots) {
+      ALLEGRO_EVENT event;
+      copy_event(&event, orig_event);
+      /* The consumer may unreference the event as soon as it is in the
+       * ring, so the reference must be taken first.
+       */
+      ref_if_user_event(&event);
+      push_bounded_event(queue, &event, false);
+      return;
+   }
+
    _al_mutex_lock(&queue->mutex);
-   {
+   if (!coalesce_event(queue, orig_event)) {
       new_event = alloc_event(queue);
       copy_event(new_event, orig_event);
       ref_if_user_event(new_event);
@@ -600,6 +1221,96 @@ void _al_event_queue_push_event(ALLEGRO_EVENT_QUEUE *queue,
 
 
 
+/* Internal function: _al_event_queue_try_push_event
+ *  Like _al_event_queue_push_event, but if the queue is a full bounded
+ *  queue which blocks on overflow, returns false instead of dropping the
+ *  event.  The queue then keeps a reference to a user event, and must not
+ *  be destroyed until the caller has released the event source's lock and
+ *  called _al_event_queue_push_blocked_event.
+ */
+bool _al_event_queue_try_push_event(ALLEGRO_EVENT_QUEUE *queue,
+   const ALLEGRO_EVENT *orig_event)
+{
+   ALLEGRO_EVENT event;
+   ASSERT(queue);
+   ASSERT(orig_event);
+
+   if (!queue->slots || queue->overflow != ALLEGRO_EVENT_QUEUE_BLOCK) {
+      _al_event_queue_push_event(queue, orig_event);
+      return true;
+   }
+
+   if (queue->paused)
+      return true;
+
+   copy_event(&event, orig_event);
+   ref_if_user_event(&event);
+   if (push_bounded_event(queue, &event, true))
+      return true;
+
+   /* While this is held, al_destroy_event_queue waits for us. */
+   _al_fetch_and_add1(&queue->blocked_producers);
+   return false;
+}
+
+
+
+/* Internal function: _al_event_queue_push_blocked_event
+ *  Waits for room in a queue for which _al_event_queue_try_push_event
+ *  returned false, then adds the event.  The event source's lock must not
+ *  be held.  The event is dropped if the source is unregistered from the
+ *  queue in the meantime.
+ */
+void _al_event_queue_push_blocked_event(ALLEGRO_EVENT_QUEUE *queue,
+   ALLEGRO_EVENT_SOURCE *source, const ALLEGRO_EVENT *orig_event)
+{
+   ALLEGRO_EVENT_SOURCE_REAL *rsrc = (ALLEGRO_EVENT_SOURCE_REAL *)source;
+   ALLEGRO_EVENT event;
+   unsigned int unregister_count;
+   bool done;
+
+   copy_event(&event, orig_event);
+
+   for (;;) {
+      /* Read the count before checking the registration, so an
+       * unregistration after the check will end the wait below.
+       */
+      _al_mutex_lock(&queue->space_mutex);
+      unregister_count = queue->unregister_count;
+      _al_mutex_unlock(&queue->space_mutex);
+
+      _al_event_source_lock(source);
+      if (_al_vector_contains(&rsrc->queues, &queue)) {
+         done = push_bounded_event(queue, &event, true);
+      }
+      else {
+         /* Other queues may be done with the event, so this may be the
+          * last reference.
+          */
+         unref_if_user_event(&event);
+         done = true;
+      }
+      _al_event_source_unlock(source);
+
+      if (done)
+         break;
+
+      _al_mutex_lock(&queue->space_mutex);
+      while (is_ring_full(queue)
+            && queue->unregister_count == unregister_count) {
+         _al_cond_wait(&queue->space_cond, &queue->space_mutex);
+      }
+      _al_mutex_unlock(&queue->space_mutex);
+   }
+
+   _al_mutex_lock(&queue->space_mutex);
+   _al_sub1_and_fetch(&queue->blocked_producers);
+   _al_cond_broadcast(&queue->space_cond);
+   _al_mutex_unlock(&queue->space_mutex);
+}
+
+
+
 /* contains_event_of_source:
  *  Return true iff the event queue contains an event from the given source.
  *  The queue must be locked.
@@ -634,6 +1345,91 @@ static int pot(int x)
 
 
 
+/* discard_ring_events_of_source:
+ *  discard_events_of_source for bounded queues.  The events in the ring
+ *  are filtered in place, so the queue never holds more than its
+ *  capacity.  The queue must be locked.  It is unlocked while waiting for
+ *  producers, so other threads using the queue don't stall meanwhile.
+ */
+static void discard_ring_events_of_source(ALLEGRO_EVENT_QUEUE *queue,
+   const ALLEGRO_EVENT_SOURCE *source)
+{
+   const unsigned int size = queue->slot_mask + 1;
+   ALLEGRO_EVENT *event;
+   unsigned int i, j;
+   unsigned int head, tail, pos;
+   EVENT_SLOT *slot;
+
+   /* Producers only take events out of the ring to drop the oldest one.
+    * Stop them and wait for any which already started, after which only
+    * threads holding the mutex remove events.  This is a count, as another
+    * thread may start discarding while we wait.
+    */
+   _al_fetch_and_add1(&queue->compacting);
+   if (_al_atomic_load(&queue->dropping_producers) > 0) {
+      _al_mutex_unlock(&queue->mutex);
+      while (_al_atomic_load(&queue->dropping_producers) > 0)
+         al_rest(0);
+      _al_mutex_lock(&queue->mutex);
+   }
+
+   /* Events taken out for al_peek_next_event. */
+   j = queue->pending_pos;
+   for (i = queue->pending_pos; i < _al_vector_size(&queue->pending); i++) {
+      event = _al_vector_ref(&queue->pending, i);
+      if (event->any.source == source)
+         unref_if_user_event(event);
+      else
+         copy_event(_al_vector_ref(&queue->pending, j++), event);
+   }
+   while (_al_vector_size(&queue->pending) > j)
+      _al_vector_delete_at(&queue->pending, j);
+
+   /* Producers may keep adding events after the filled slots we see here,
+    * so the kept events are moved towards the newest end and the slots
+    * freed at the oldest end.
+    */
+   head = _al_atomic_load(&queue->dequeue_pos);
+   tail = head;
+   while (tail - head < size &&
+         (unsigned int)_al_atomic_load(&queue->slots[tail & queue->slot_mask].seq)
+            == tail + 1) {
+      tail++;
+   }
+
+   pos = tail;
+   for (i = tail; i != head; i--) {
+      slot = &queue->slots[(i - 1) & queue->slot_mask];
+      if (slot->event.any.source == source) {
+         unref_if_user_event(&slot->event);
+      }
+      else {
+         pos--;
+         if (pos != i - 1)
+            copy_event(&queue->slots[pos & queue->slot_mask].event, &slot->event);
+      }
+   }
+
+   if (pos != head) {
+      _al_atomic_store(&queue->dequeue_pos, pos);
+      for (i = head; i != pos; i++) {
+         slot = &queue->slots[i & queue->slot_mask];
+         _al_atomic_store(&slot->seq, i + size);
+      }
+
+      /* Wake up producers blocked on a full ring. */
+      if (_al_atomic_load(&queue->blocked_producers) > 0) {
+         _al_mutex_lock(&queue->space_mutex);
+         _al_cond_broadcast(&queue->space_cond);
+         _al_mutex_unlock(&queue->space_mutex);
+      }
+   }
+
+   _al_sub1_and_fetch(&queue->compacting);
+}
+
+
+
 /* discard_events_of_source:
  *  Discard all the events in the queue that belong to the source.
  *  The queue must be locked.
@@ -648,6 +1444,11 @@ static void discard_events_of_source(ALLEGRO_EVENT_QUEUE *queue,
    size_t new_size;
    unsigned int i;
 
+   if (queue->slots) {
+      discard_ring_events_of_source(queue, source);
+      return;
+   }
+
    if (!contains_event_of_source(queue, source)) {
       return;
    }
@@ -218,6 +218,9 @@ bool al_emit_user_event(ALLEGRO_EVENT_SOURCE *src,
    ALLEGRO_EVENT *event, void (*dtor)(ALLEGRO_USER_EVENT *))
 {
    size_t num_queues;
+   _AL_VECTOR blocked;
+   ALLEGRO_EVENT_QUEUE **slot;
+   unsigned int i;
    bool rc;
 
    ASSERT(src);
@@ -225,7 +228,10 @@ bool al_emit_user_event(ALLEGRO_EVENT_SOURCE *src,
 
    if (dtor) {
       ALLEGRO_USER_EVENT_DESCRIPTOR *descr = al_malloc(sizeof(*descr));
-      descr->refcount = 0;
+      /* Our own reference, so that the destructor is called here if no
+       * queue keeps the event.
+       */
+      descr->refcount = 1;
       descr->dtor = dtor;
       event->user.__internal__descr = descr;
    }
@@ -233,6 +239,8 @@ bool al_emit_user_event(ALLEGRO_EVENT_SOURCE *src,
       event->user.__internal__descr = NULL;
    }
 
+   _al_vector_init(&blocked, sizeof(ALLEGRO_EVENT_QUEUE *));
+
    _al_event_source_lock(src);
    {
       ALLEGRO_EVENT_SOURCE_REAL *rsrc = (ALLEGRO_EVENT_SOURCE_REAL *)src;
@@ -240,7 +248,15 @@ bool al_emit_user_event(ALLEGRO_EVENT_SOURCE *src,
       num_queues = _al_vector_size(&rsrc->queues);
       if (num_queues > 0) {
          event->any.timestamp = al_get_time();
-         _al_event_source_emit_event(src, event);
+         event->any.source = src;
+         /* Like _al_event_source_emit_event, but full bounded queues
+          * which block are set aside.
+          */
+         for (i = 0; i < num_queues; i++) {
+            slot = _al_vector_ref(&rsrc->queues, i);
+            if (!_al_event_queue_try_push_event(*slot, event))
+               *(ALLEGRO_EVENT_QUEUE **)_al_vector_alloc_back(&blocked) = *slot;
+         }
          rc = true;
       }
       else {
@@ -249,10 +265,17 @@ bool al_emit_user_event(ALLEGRO_EVENT_SOURCE *src,
    }
    _al_event_source_unlock(src);
 
-   if (dtor && !rc) {
-      dtor(&event->user);
-      al_free(event->user.__internal__descr);
+   /* Wait for room without holding the lock, which would stop the thread
+    * reading the queue from unregistering the source.
+    */
+   for (i = 0; i < _al_vector_size(&blocked); i++) {
+      slot = _al_vector_ref(&blocked, i);
+      _al_event_queue_push_blocked_event(*slot, src, event);
    }
+   _al_vector_free(&blocked);
+
+   if (dtor)
+      al_unref_user_event(&event->user);
 
    return rc;
 }
@@ -45,8 +45,10 @@ ALLEGRO_FILE *al_fopen_interface(const ALLEGRO_FILE_INTERFACE *drv,
       }
       else {
          f->vtable = drv;
-         f->userdata = drv->fi_fopen(path, mode);
          f->ungetc_len = 0;
+         f->rpos = f->rend = NULL;
+         f->wpos = f->wend = NULL;
+         f->userdata = drv->fi_fopen(path, mode);
          if (!f->userdata) {
             al_free(f);
             f = NULL;
@@ -75,6 +77,8 @@ ALLEGRO_FILE *al_create_file_handle(const ALLEGRO_FILE_INTERFACE *drv,
       f->vtable = drv;
       f->userdata = userdata;
       f->ungetc_len = 0;
+      f->rpos = f->rend = NULL;
+      f->wpos = f->wend = NULL;
    }
 
    return f;
@@ -103,6 +107,12 @@ size_t al_fread(ALLEGRO_FILE *f, void *ptr, size_t size)
    ASSERT(f);
    ASSERT(ptr);
 
+   if (f->rpos && size <= (size_t)(f->rend - f->rpos) && f->ungetc_len == 0) {
+      memcpy(ptr, f->rpos, size);
+      f->rpos += size;
+      return size;
+   }
+
    if (f->ungetc_len) {
       int bytes_ungetc = 0;
       unsigned char *cptr = ptr;
@@ -129,6 +139,13 @@ size_t al_fwrite(ALLEGRO_FILE *f, const void *ptr, size_t size)
    ASSERT(ptr);
 
    f->ungetc_len = 0;
+
+   if (f->wpos && size <= (size_t)(f->wend - f->wpos)) {
+      memcpy(f->wpos, ptr, size);
+      f->wpos += size;
+      return size;
+   }
+
    return f->vtable->fi_fwrite(f, ptr, size);
 }
 
@@ -226,6 +243,10 @@ int al_fgetc(ALLEGRO_FILE *f)
    uint8_t c;
    ASSERT(f);
 
+   if (f->rpos < f->rend && f->ungetc_len == 0) {
+      return *f->rpos++;
+   }
+
    if (al_fread(f, &c, 1) != 1) {
       return EOF;
    }
@@ -241,6 +262,12 @@ int al_fputc(ALLEGRO_FILE *f, int c)
    uint8_t b = (c & 0xff);
    ASSERT(f);
 
+   if (f->wpos < f->wend) {
+      f->ungetc_len = 0;
+      *f->wpos++ = b;
+      return b;
+   }
+
    if (al_fwrite(f, &b, 1) != 1) {
       return EOF;
    }
@@ -280,6 +307,28 @@ int32_t al_fread32le(ALLEGRO_FILE *f)
 }
 
 
+/* Internal function: _al_get_u32le
+ *  Reads a 32-bit little endian value from memory.
+ */
+uint32_t _al_get_u32le(const void *p)
+{
+   const unsigned char *b = p;
+
+   return b[0] | (b[1] << 8) | (b[2] << 16) | ((uint32_t)b[3] << 24);
+}
+
+
+/* Internal function: _al_get_u64le
+ *  Reads a 64-bit little endian value from memory.
+ */
+uint64_t _al_get_u64le(const void *p)
+{
+   const unsigned char *b = p;
+
+   return _al_get_u32le(b) | ((uint64_t)_al_get_u32le(b + 4) << 32);
+}
+
+
 /* Function: al_fwrite16le
  */
 size_t al_fwrite16le(ALLEGRO_FILE *f, int16_t w)
@@ -0,0 +1,335 @@
+/*         ______   ___    ___
+ *        /\  _  \ /\_ \  /\_ \
+ *        \ \ \L\ \\//\ \ \//\ \      __     __   _ __   ___
+ *         \ \  __ \ \ \ \  \ \ \   /'__`\ /'_ `\/\`'__\/ __`\
+ *          \ \ \/\ \ \_\ \_ \_\ \_/\  __//\ \L\ \ \ \//\ \L\ \
+ *           \ \_\ \_\/\____\/\____\ \____\ \____ \ \_\\ \____/
+ *            \/_/\/_/\/____/\/____/\/____/\/___L\ \/_/ \/___/
+ *                                           /\____/
+ *                                           \_/__/
+ *
+ *      Buffered files - read and write another file in large blocks
+ *
+ *      The buffer is exposed through the rpos/rend and wpos/wend windows
+ *      of ALLEGRO_FILE, so al_fgetc, al_fputc and small reads and writes
+ *      are served without calling into the file interface at all.  The
+ *      methods below are only called when a window runs out.
+ *
+ *      See LICENSE.txt for copyright information.
+ */
+
+#include "allegro5/allegro.h"
+#include "allegro5/internal/aintern.h"
+#include "allegro5/internal/aintern_file.h"
+
+#define DEFAULT_BUFFER_SIZE   4096
+
+typedef struct BUFFERED_DATA BUFFERED_DATA;
+
+enum {
+   LAST_NONE,
+   LAST_READ,
+   LAST_WRITE
+};
+
+struct BUFFERED_DATA
+{
+   ALLEGRO_FILE *fp;    /* parent file handle */
+   unsigned char *buf;
+   size_t size;
+   int last_op;         /* last kind of access to the parent */
+   bool eof;
+};
+
+
+/* Like stdio, many file interfaces need a seek between reading and
+ * writing.  Callers of a buffered file don't know when the parent
+ * switches, so do it for them.
+ */
+static void switch_parent(BUFFERED_DATA *b, int op)
+{
+   if (b->last_op != op && b->last_op != LAST_NONE)
+      al_fseek(b->fp, 0, ALLEGRO_SEEK_CUR);
+   b->last_op = op;
+}
+
+
+/* Write out whatever is in the write window. */
+static bool flush_writes(ALLEGRO_FILE *f)
+{
+   BUFFERED_DATA *b = al_get_file_userdata(f);
+   size_t n;
+
+   if (!f->wpos)
+      return true;
+
+   n = f->wpos - b->buf;
+   f->wpos = f->wend = NULL;
+
+   if (n == 0)
+      return true;
+
+   switch_parent(b, LAST_WRITE);
+   return al_fwrite(b->fp, b->buf, n) == n;
+}
+
+
+/* Forget the read window, moving the parent back to where the caller
+ * thinks we are.
+ */
+static bool drop_reads(ALLEGRO_FILE *f)
+{
+   BUFFERED_DATA *b = al_get_file_userdata(f);
+   int64_t unread;
+
+   if (!f->rpos)
+      return true;
+
+   unread = f->rend - f->rpos;
+   f->rpos = f->rend = NULL;
+
+   if (unread == 0)
+      return true;
+
+   b->last_op = LAST_NONE;
+   return al_fseek(b->fp, -unread, ALLEGRO_SEEK_CUR);
+}
+
+
+static bool buffered_fclose(ALLEGRO_FILE *f)
+{
+   BUFFERED_DATA *b = al_get_file_userdata(f);
+   bool ret;
+
+   ret = flush_writes(f);
+   drop_reads(f);
+
+   al_free(b->buf);
+   al_free(b);
+
+   return ret;
+}
+
+
+static size_t buffered_fread(ALLEGRO_FILE *f, void *ptr, size_t size)
+{
+   BUFFERED_DATA *b = al_get_file_userdata(f);
+   unsigned char *dest = ptr;
+   size_t done = 0;
+   size_t n;
+
+   if (!flush_writes(f))
+      return 0;
+
+   /* Use up what is left in the buffer first. */
+   if (f->rpos) {
+      n = _ALLEGRO_MIN(size, (size_t)(f->rend - f->rpos));
+      memcpy(dest, f->rpos, n);
+      f->rpos += n;
+      done = n;
+   }
+
+   if (done == size)
+      return done;
+
+   switch_parent(b, LAST_READ);
+
+   /* Large reads go straight to the destination. */
+   if (size - done >= b->size) {
+      f->rpos = f->rend = NULL;
+      n = al_fread(b->fp, dest + done, size - done);
+   }
+   else {
+      n = al_fread(b->fp, b->buf, b->size);
+      f->rpos = b->buf;
+      f->rend = b->buf + n;
+
+      n = _ALLEGRO_MIN(size - done, n);
+      memcpy(dest + done, f->rpos, n);
+      f->rpos += n;
+   }
+
+   if (done + n < size)
+      b->eof = true;
+
+   return done + n;
+}
+
+
+static size_t buffered_fwrite(ALLEGRO_FILE *f, const void *ptr, size_t size)
+{
+   BUFFERED_DATA *b = al_get_file_userdata(f);
+
+   if (!drop_reads(f))
+      return 0;
+
+   if (!flush_writes(f))
+      return 0;
+
+   /* Large writes go straight to the parent. */
+   if (size >= b->size) {
+      switch_parent(b, LAST_WRITE);
+      return al_fwrite(b->fp, ptr, size);
+   }
+
+   memcpy(b->buf, ptr, size);
+   f->wpos = b->buf + size;
+   f->wend = b->buf + b->size;
+
+   return size;
+}
+
+
+static bool buffered_fflush(ALLEGRO_FILE *f)
+{
+   BUFFERED_DATA *b = al_get_file_userdata(f);
+
+   if (!flush_writes(f))
+      return false;
+
+   return al_fflush(b->fp);
+}
+
+
+static int64_t buffered_ftell(ALLEGRO_FILE *f)
+{
+   BUFFERED_DATA *b = al_get_file_userdata(f);
+   int64_t pos = al_ftell(b->fp);
+
+   if (pos == -1)
+      return -1;
+
+   if (f->rpos)
+      return pos - (f->rend - f->rpos);
+   if (f->wpos)
+      return pos + (f->wpos - b->buf);
+   return pos;
+}
+
+
+static bool buffered_fseek(ALLEGRO_FILE *f, int64_t offset, int whence)
+{
+   BUFFERED_DATA *b = al_get_file_userdata(f);
+
+   /* Seeks that stay inside the read window don't touch the parent. */
+   if (f->rpos && whence == ALLEGRO_SEEK_CUR) {
+      if (offset >= b->buf - f->rpos && offset <= f->rend - f->rpos) {
+         f->rpos += offset;
+         b->eof = false;
+         return true;
+      }
+   }
+
+   /* Put the parent where the caller thinks we are first, so a failed
+    * seek leaves the position unchanged.
+    */
+   if (!flush_writes(f) || !drop_reads(f))
+      return false;
+
+   b->last_op = LAST_NONE;
+   b->eof = false;
+   return al_fseek(b->fp, offset, whence);
+}
+
+
+static bool buffered_feof(ALLEGRO_FILE *f)
+{
+   BUFFERED_DATA *b = al_get_file_userdata(f);
+
+   return b->eof;
+}
+
+
+static int buffered_ferror(ALLEGRO_FILE *f)
+{
+   BUFFERED_DATA *b = al_get_file_userdata(f);
+   return al_ferror(b->fp);
+}
+
+
+static const char *buffered_ferrmsg(ALLEGRO_FILE *f)
+{
+   BUFFERED_DATA *b = al_get_file_userdata(f);
+   return al_ferrmsg(b->fp);
+}
+
+
+static void buffered_fclearerr(ALLEGRO_FILE *f)
+{
+   BUFFERED_DATA *b = al_get_file_userdata(f);
+   b->eof = false;
+   al_fclearerr(b->fp);
+}
+
+
+static off_t buffered_fsize(ALLEGRO_FILE *f)
+{
+   BUFFERED_DATA *b = al_get_file_userdata(f);
+
+   /* Pending writes may extend the file. */
+   if (!flush_writes(f))
+      return -1;
+
+   return al_fsize(b->fp);
+}
+
+
+static const ALLEGRO_FILE_INTERFACE buffered_vtable =
+{
+   NULL,
+   buffered_fclose,
+   buffered_fread,
+   buffered_fwrite,
+   buffered_fflush,
+   buffered_ftell,
+   buffered_fseek,
+   buffered_feof,
+   buffered_ferror,
+   buffered_ferrmsg,
+   buffered_fclearerr,
+   NULL,
+   buffered_fsize
+};
+
+
+/* Function: al_fopen_buffered
+ */
+ALLEGRO_FILE *al_fopen_buffered(ALLEGRO_FILE *fp, size_t buffer_size)
+{
+   BUFFERED_DATA *userdata;
+   ALLEGRO_FILE *f;
+
+   ASSERT(fp);
+
+   if (buffer_size == 0)
+      buffer_size = DEFAULT_BUFFER_SIZE;
+
+   userdata = al_malloc(sizeof(*userdata));
+   if (!userdata) {
+      al_set_errno(ENOMEM);
+      return NULL;
+   }
+
+   userdata->buf = al_malloc(buffer_size);
+   if (!userdata->buf) {
+      al_free(userdata);
+      al_set_errno(ENOMEM);
+      return NULL;
+   }
+
+   userdata->fp = fp;
+   userdata->size = buffer_size;
+   userdata->last_op = LAST_NONE;
+   userdata->eof = false;
+
+   f = al_create_file_handle(&buffered_vtable, userdata);
+   if (!f) {
+      al_free(userdata->buf);
+      al_free(userdata);
+      return NULL;
+   }
+
+   return f;
+}
+
+/* vim: set sts=3 sw=3 et: */
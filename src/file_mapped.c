@@ -0,0 +1,424 @@
+/*         ______   ___    ___
+ *        /\  _  \ /\_ \  /\_ \
+ *        \ \ \L\ \\//\ \ \//\ \      __     __   _ __   ___
+ *         \ \  __ \ \ \ \  \ \ \   /'__`\ /'_ `\/\`'__\/ __`\
+ *          \ \ \/\ \ \_\ \_ \_\ \_/\  __//\ \L\ \ \ \//\ \L\ \
+ *           \ \_\ \_\/\____\/\____\ \____\ \____ \ \_\\ \____/
+ *            \/_/\/_/\/____/\/____/\/____/\/___L\ \/_/ \/___/
+ *                                           /\____/
+ *                                           \_/__/
+ *
+ *      Memory mapped files - read only files whose contents can be
+ *                            accessed in place
+ *
+ *      See LICENSE.txt for copyright information.
+ */
+
+#include "allegro5/allegro.h"
+
+/* enable large file support in gcc/glibc */
+#if defined ALLEGRO_HAVE_FTELLO && defined ALLEGRO_HAVE_FSEEKO
+#ifndef _LARGEFILE_SOURCE
+   #define _LARGEFILE_SOURCE
+#endif
+#ifndef _LARGEFILE_SOURCE64
+   #define _LARGEFILE_SOURCE64
+#endif
+#ifndef _FILE_OFFSET_BITS
+   #define _FILE_OFFSET_BITS 64
+#endif
+#endif
+
+#include <stdio.h>
+
+#include "allegro5/internal/aintern.h"
+#include "allegro5/internal/aintern_file.h"
+
+#if defined(ALLEGRO_WINDOWS)
+   #include "allegro5/internal/aintern_wunicode.h"
+   #include <windows.h>
+#elif defined(ALLEGRO_HAVE_MMAP)
+   #include <fcntl.h>
+   #include <sys/mman.h>
+   #include <sys/stat.h>
+   #include <unistd.h>
+#endif
+
+
+/* forward declaration */
+static const ALLEGRO_FILE_INTERFACE mapped_vtable;
+
+
+typedef struct MAPPED_DATA
+{
+   const unsigned char *data;
+   int64_t size;
+   int64_t pos;
+   bool eof;
+   int errnum;
+   /* Set if data was read into memory because the file could not be
+    * mapped.
+    */
+   bool on_heap;
+#ifdef ALLEGRO_WINDOWS
+   HANDLE mapping;
+#endif
+} MAPPED_DATA;
+
+
+static void free_mapped_data(MAPPED_DATA *mf)
+{
+   if (mf->on_heap) {
+      al_free((void *)mf->data);
+   }
+   else if (mf->data) {
+#if defined(ALLEGRO_WINDOWS)
+      UnmapViewOfFile(mf->data);
+      CloseHandle(mf->mapping);
+#elif defined(ALLEGRO_HAVE_MMAP)
+      munmap((void *)mf->data, mf->size);
+#endif
+   }
+
+   al_free(mf);
+}
+
+
+static bool mapped_fclose(ALLEGRO_FILE *f)
+{
+   free_mapped_data(al_get_file_userdata(f));
+   return true;
+}
+
+
+static size_t mapped_fread(ALLEGRO_FILE *f, void *ptr, size_t size)
+{
+   MAPPED_DATA *mf = al_get_file_userdata(f);
+   int64_t left = mf->size - mf->pos;
+
+   if (left <= 0) {
+      mf->eof = true;
+      return 0;
+   }
+
+   if ((int64_t)size > left) {
+      size = left;
+      mf->eof = true;
+   }
+
+   if (size == 1) {
+      /* Optimise common case. */
+      *((unsigned char *)ptr) = mf->data[mf->pos];
+   }
+   else {
+      memcpy(ptr, mf->data + mf->pos, size);
+   }
+   mf->pos += size;
+
+   return size;
+}
+
+
+static size_t mapped_fwrite(ALLEGRO_FILE *f, const void *ptr, size_t size)
+{
+   MAPPED_DATA *mf = al_get_file_userdata(f);
+   (void)ptr;
+   (void)size;
+
+   mf->errnum = EBADF;
+   al_set_errno(EBADF);
+   return 0;
+}
+
+
+static bool mapped_fflush(ALLEGRO_FILE *f)
+{
+   (void)f;
+   return true;
+}
+
+
+static int64_t mapped_ftell(ALLEGRO_FILE *f)
+{
+   MAPPED_DATA *mf = al_get_file_userdata(f);
+   return mf->pos;
+}
+
+
+static bool mapped_fseek(ALLEGRO_FILE *f, int64_t offset, int whence)
+{
+   MAPPED_DATA *mf = al_get_file_userdata(f);
+
+   switch (whence) {
+      case ALLEGRO_SEEK_SET: break;
+      case ALLEGRO_SEEK_CUR: offset += mf->pos; break;
+      case ALLEGRO_SEEK_END: offset += mf->size; break;
+      default: offset = -1; break;
+   }
+
+   if (offset < 0) {
+      mf->errnum = EINVAL;
+      al_set_errno(EINVAL);
+      return false;
+   }
+
+   /* Like stdio, seeking past the end is allowed; reads there just fail. */
+   mf->pos = offset;
+   mf->eof = false;
+   return true;
+}
+
+
+static bool mapped_feof(ALLEGRO_FILE *f)
+{
+   MAPPED_DATA *mf = al_get_file_userdata(f);
+   return mf->eof;
+}
+
+
+static int mapped_ferror(ALLEGRO_FILE *f)
+{
+   MAPPED_DATA *mf = al_get_file_userdata(f);
+   return mf->errnum;
+}
+
+
+static const char *mapped_ferrmsg(ALLEGRO_FILE *f)
+{
+   MAPPED_DATA *mf = al_get_file_userdata(f);
+
+   switch (mf->errnum) {
+      case 0: return "";
+      case EBADF: return "File is read only";
+      case EINVAL: return "Invalid seek position";
+   }
+   return "Unknown error";
+}
+
+
+static void mapped_fclearerr(ALLEGRO_FILE *f)
+{
+   MAPPED_DATA *mf = al_get_file_userdata(f);
+   mf->errnum = 0;
+   mf->eof = false;
+}
+
+
+static off_t mapped_fsize(ALLEGRO_FILE *f)
+{
+   MAPPED_DATA *mf = al_get_file_userdata(f);
+   return mf->size;
+}
+
+
+static const ALLEGRO_FILE_INTERFACE mapped_vtable =
+{
+   NULL,
+   mapped_fclose,
+   mapped_fread,
+   mapped_fwrite,
+   mapped_fflush,
+   mapped_ftell,
+   mapped_fseek,
+   mapped_feof,
+   mapped_ferror,
+   mapped_ferrmsg,
+   mapped_fclearerr,
+   NULL,
+   mapped_fsize
+};
+
+
+/* Read the whole file into memory, for platforms or files that can't be
+ * mapped.
+ */
+static bool read_whole_file(MAPPED_DATA *mf, const char *path)
+{
+   ALLEGRO_FILE *fp;
+   int64_t size;
+   void *data;
+
+   fp = al_fopen_interface(&_al_file_interface_stdio, path, "rb");
+   if (!fp)
+      return false;
+
+   size = al_fsize(fp);
+   if (size < 0 || (uint64_t)size > (size_t)-1) {
+      al_fclose(fp);
+      al_set_errno(EFBIG);
+      return false;
+   }
+
+   data = al_malloc(size ? size : 1);
+   if (!data) {
+      al_fclose(fp);
+      al_set_errno(ENOMEM);
+      return false;
+   }
+
+   if (al_fread(fp, data, size) != (size_t)size) {
+      al_free(data);
+      al_fclose(fp);
+      return false;
+   }
+
+   al_fclose(fp);
+   mf->data = data;
+   mf->size = size;
+   mf->on_heap = true;
+   return true;
+}
+
+
+#if defined(ALLEGRO_WINDOWS)
+
+static bool map_file(MAPPED_DATA *mf, const char *path)
+{
+   wchar_t *wpath;
+   HANDLE file;
+   LARGE_INTEGER size;
+
+   wpath = _al_win_utf16(path);
+   if (!wpath)
+      return false;
+   file = CreateFileW(wpath, GENERIC_READ, FILE_SHARE_READ, NULL,
+      OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+   al_free(wpath);
+   if (file == INVALID_HANDLE_VALUE) {
+      al_set_errno(ENOENT);
+      return false;
+   }
+
+   if (!GetFileSizeEx(file, &size) || (uint64_t)size.QuadPart > (size_t)-1) {
+      CloseHandle(file);
+      return false;
+   }
+
+   mf->size = size.QuadPart;
+   if (mf->size == 0) {
+      /* Empty files can't be mapped, but there is nothing to map anyway. */
+      CloseHandle(file);
+      return true;
+   }
+
+   mf->mapping = CreateFileMapping(file, NULL, PAGE_READONLY, 0, 0, NULL);
+   CloseHandle(file);
+   if (!mf->mapping)
+      return false;
+
+   mf->data = MapViewOfFile(mf->mapping, FILE_MAP_READ, 0, 0, 0);
+   if (!mf->data) {
+      CloseHandle(mf->mapping);
+      return false;
+   }
+
+   return true;
+}
+
+#elif defined(ALLEGRO_HAVE_MMAP)
+
+static bool map_file(MAPPED_DATA *mf, const char *path)
+{
+   struct stat st;
+   void *data;
+   int fd;
+
+   fd = open(path, O_RDONLY);
+   if (fd == -1) {
+      al_set_errno(errno);
+      return false;
+   }
+
+   if (fstat(fd, &st) != 0 || !S_ISREG(st.st_mode) ||
+         (uint64_t)st.st_size > (size_t)-1) {
+      close(fd);
+      return false;
+   }
+
+   mf->size = st.st_size;
+   if (mf->size == 0) {
+      /* Empty files can't be mapped, but there is nothing to map anyway. */
+      close(fd);
+      return true;
+   }
+
+   data = mmap(NULL, mf->size, PROT_READ, MAP_PRIVATE, fd, 0);
+   close(fd);
+   if (data == MAP_FAILED) {
+      al_set_errno(errno);
+      return false;
+   }
+
+   mf->data = data;
+   return true;
+}
+
+#else
+
+static bool map_file(MAPPED_DATA *mf, const char *path)
+{
+   (void)mf;
+   (void)path;
+   return false;
+}
+
+#endif
+
+
+/* Function: al_fopen_mapped
+ */
+ALLEGRO_FILE *al_fopen_mapped(const char *path)
+{
+   MAPPED_DATA *mf;
+   ALLEGRO_FILE *f;
+
+   ASSERT(path);
+
+   mf = al_calloc(1, sizeof(*mf));
+   if (!mf) {
+      al_set_errno(ENOMEM);
+      return NULL;
+   }
+
+   if (!map_file(mf, path)) {
+      memset(mf, 0, sizeof(*mf));
+      if (!read_whole_file(mf, path)) {
+         al_free(mf);
+         return NULL;
+      }
+   }
+
+   f = al_create_file_handle(&mapped_vtable, mf);
+   if (!f) {
+      free_mapped_data(mf);
+      return NULL;
+   }
+
+   return f;
+}
+
+
+/* Function: al_fmap_view
+ */
+const void *al_fmap_view(ALLEGRO_FILE *f, int64_t offset, size_t size)
+{
+   MAPPED_DATA *mf;
+
+   ASSERT(f);
+
+   if (f->vtable != &mapped_vtable)
+      return NULL;
+
+   mf = al_get_file_userdata(f);
+   if (offset < 0 || offset > mf->size || (int64_t)size > mf->size - offset)
+      return NULL;
+
+   /* Empty files have no data pointer, but a view of nothing is valid. */
+   if (!mf->data)
+      return "";
+
+   return mf->data + offset;
+}
+
+
+/* vim: set sts=3 sw=3 et: */
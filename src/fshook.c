@@ -19,6 +19,7 @@
 */
 
 #include "allegro5/allegro.h"
+#include "allegro5/internal/aintern.h"
 #include "allegro5/internal/aintern_fshook.h"
 
 
@@ -274,6 +275,160 @@ int al_for_each_fs_entry(ALLEGRO_FS_ENTRY *dir,
 
 
 
+/* Bulk directory scanning. */
+
+typedef struct SCAN_ITEM {
+   size_t name_offset;
+   uint32_t mode;
+   off_t size;
+   time_t mtime;
+} SCAN_ITEM;
+
+
+/* Internal function: _al_fs_scan_add
+ *  Adds an item to a directory scan.  The names are packed into a single
+ *  buffer, so there is no allocation per item.
+ */
+bool _al_fs_scan_add(_AL_FS_SCAN *scan, const char *name, uint32_t mode,
+   off_t size, time_t mtime)
+{
+   size_t len = strlen(name) + 1;
+   SCAN_ITEM *item;
+
+   if (scan->names_size + len > scan->names_capacity) {
+      size_t capacity = scan->names_capacity ? scan->names_capacity * 2 : 1024;
+      char *names;
+
+      while (capacity < scan->names_size + len)
+         capacity *= 2;
+      names = al_realloc(scan->names, capacity);
+      if (!names) {
+         al_set_errno(ENOMEM);
+         return false;
+      }
+      scan->names = names;
+      scan->names_capacity = capacity;
+   }
+
+   item = _al_vector_alloc_back(&scan->items);
+   if (!item) {
+      al_set_errno(ENOMEM);
+      return false;
+   }
+
+   if (scan->flags & ALLEGRO_SCAN_TYPES_ONLY) {
+      mode &= ALLEGRO_FILEMODE_ISDIR | ALLEGRO_FILEMODE_ISFILE |
+         ALLEGRO_FILEMODE_HIDDEN;
+      size = 0;
+      mtime = 0;
+   }
+
+   item->name_offset = scan->names_size;
+   item->mode = mode;
+   item->size = size;
+   item->mtime = mtime;
+
+   memcpy(scan->names + scan->names_size, name, len);
+   scan->names_size += len;
+   return true;
+}
+
+
+/* Reads a directory through whatever interface is in use. */
+static bool scan_directory_entries(const char *path, _AL_FS_SCAN *scan)
+{
+   ALLEGRO_FS_ENTRY *dir;
+   ALLEGRO_FS_ENTRY *entry;
+   bool ret = true;
+
+   dir = al_create_fs_entry(path);
+   if (!dir)
+      return false;
+
+   if (!al_open_directory(dir)) {
+      al_destroy_fs_entry(dir);
+      return false;
+   }
+
+   while (ret && (entry = al_read_directory(dir))) {
+      const char *name = al_get_fs_entry_name(entry);
+      const char *p;
+
+      /* Only keep the last path component. */
+      for (p = name; *p; p++) {
+         if (*p == '/' || *p == ALLEGRO_NATIVE_PATH_SEP)
+            name = p + 1;
+      }
+
+      ret = _al_fs_scan_add(scan, name, al_get_fs_entry_mode(entry),
+         al_get_fs_entry_size(entry), al_get_fs_entry_mtime(entry));
+      al_destroy_fs_entry(entry);
+   }
+
+   al_close_directory(dir);
+   al_destroy_fs_entry(dir);
+   return ret;
+}
+
+
+/* Function: al_scan_directory
+ */
+ALLEGRO_DIRECTORY_ITEM *al_scan_directory(const char *path, int flags,
+   int *count)
+{
+   _AL_FS_SCAN scan;
+   ALLEGRO_DIRECTORY_ITEM *items = NULL;
+   char *names;
+   bool ok;
+   unsigned i, n;
+
+   ASSERT(path);
+   ASSERT(count);
+
+   *count = 0;
+
+   scan.flags = flags;
+   _al_vector_init(&scan.items, sizeof(SCAN_ITEM));
+   scan.names = NULL;
+   scan.names_size = 0;
+   scan.names_capacity = 0;
+
+   if (al_get_fs_interface() == &_al_fs_interface_stdio)
+      ok = _al_fs_stdio_scan_directory(path, &scan);
+   else
+      ok = scan_directory_entries(path, &scan);
+
+   /* Return the items and their names in a single block, so the caller
+    * only has one thing to free.
+    */
+   n = _al_vector_size(&scan.items);
+   if (ok) {
+      items = al_malloc(n * sizeof(*items) + scan.names_size + 1);
+      if (!items)
+         al_set_errno(ENOMEM);
+   }
+
+   if (items) {
+      names = (char *)(items + n);
+      if (scan.names_size > 0)
+         memcpy(names, scan.names, scan.names_size);
+      for (i = 0; i < n; i++) {
+         const SCAN_ITEM *item = _al_vector_ref(&scan.items, i);
+         items[i].name = names + item->name_offset;
+         items[i].mode = item->mode;
+         items[i].size = item->size;
+         items[i].mtime = item->mtime;
+      }
+      *count = n;
+   }
+
+   _al_vector_free(&scan.items);
+   al_free(scan.names);
+   return items;
+}
+
+
+
 
 /*
  * Local Variables:
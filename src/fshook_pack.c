@@ -0,0 +1,1198 @@
+/*         ______   ___    ___
+ *        /\  _  \ /\_ \  /\_ \
+ *        \ \ \L\ \\//\ \ \//\ \      __     __   _ __   ___
+ *         \ \  __ \ \ \ \  \ \ \   /'__`\ /'_ `\/\`'__\/ __`\
+ *          \ \ \/\ \ \_\ \_ \_\ \_/\  __//\ \L\ \ \ \//\ \L\ \
+ *           \ \_\ \_\/\____\/\____\ \____\ \____ \ \_\\ \____/
+ *            \/_/\/_/\/____/\/____/\/____/\/___L\ \/_/ \/___/
+ *                                           /\____/
+ *                                           \_/__/
+ *
+ *      File System Hook, pack file "driver".
+ *
+ *      See readme.txt for copyright information.
+ *
+ *
+ *      A pack file is a read only archive that is memory mapped as a
+ *      whole.  Opening a file inside it never touches shared state: the
+ *      index is immutable once loaded and each open file gets its own
+ *      view of the mapping, so any number of threads can read at once.
+ *
+ *      Layout, all integers little endian:
+ *
+ *         header   "A5PK", u32 version, u32 entry count, u32 reserved,
+ *                  u64 index offset, u64 index size
+ *         data     file contents, each stored or LZ4 compressed
+ *         index    entry records sorted by name, then the names
+ *
+ *      Each entry record is u64 offset, u64 size, u64 stored size,
+ *      i64 modification time, u32 name offset and u32 flags.  Names are
+ *      NUL terminated paths relative to the root, separated by '/'.
+ *      Directories are not stored; they exist if some file is in them.
+ */
+
+#include "allegro5/allegro.h"
+#include "allegro5/internal/aintern.h"
+#include "allegro5/internal/aintern_file.h"
+#include "allegro5/internal/aintern_fshook.h"
+#include "allegro5/internal/aintern_lz4.h"
+#include "allegro5/internal/aintern_tls.h"
+#include "allegro5/internal/aintern_vector.h"
+
+ALLEGRO_DEBUG_CHANNEL("fshook")
+
+#ifndef EROFS
+   #define EROFS EACCES
+#endif
+
+#define PACK_MAGIC         "A5PK"
+#define PACK_VERSION       1
+#define PACK_HEADER_SIZE   32
+#define PACK_RECORD_SIZE   40
+
+#define PACK_COMPRESSED    1
+
+
+typedef struct PACK_ENTRY {
+   const char *name;
+   int64_t offset;
+   int64_t size;
+   int64_t stored_size;
+   time_t mtime;
+   uint32_t flags;
+} PACK_ENTRY;
+
+struct ALLEGRO_PACK {
+   ALLEGRO_FILE *archive;
+   PACK_ENTRY *entries;
+   int num_entries;
+
+   /* Current directory, always ending with a slash. */
+   ALLEGRO_RWLOCK *cwd_lock;
+   ALLEGRO_USTR *cwd;
+};
+
+typedef struct PACK_FS_ENTRY {
+   ALLEGRO_FS_ENTRY fs_entry; /* must be first */
+   ALLEGRO_PACK *pack;
+   ALLEGRO_USTR *path;        /* absolute, without trailing slash */
+   int index;                 /* of the file, or -1 */
+   bool is_dir;
+
+   /* For directory listing. */
+   bool is_dir_open;
+   int dir_pos;
+   int dir_end;
+} PACK_FS_ENTRY;
+
+typedef struct PACK_FILE {
+   const unsigned char *data;
+   int64_t size;
+   int64_t pos;      /* Only used when rpos is NULL. */
+   bool eof;
+   bool on_heap;
+} PACK_FILE;
+
+
+/* forward declarations */
+static const ALLEGRO_FS_INTERFACE fs_pack_vtable;
+static const ALLEGRO_FILE_INTERFACE file_pack_vtable;
+
+
+static ALLEGRO_PACK *current_pack(void)
+{
+   ALLEGRO_PACK **pack = _al_tls_get_pack();
+   return pack ? *pack : NULL;
+}
+
+
+/*
+ * Looking up names.
+ */
+
+/* Returns the first entry whose name is not less than the first `len`
+ * bytes of `key`.
+ */
+static int lower_bound(ALLEGRO_PACK *pack, const char *key, size_t len)
+{
+   int lo = 0;
+   int hi = pack->num_entries;
+
+   while (lo < hi) {
+      int mid = lo + (hi - lo) / 2;
+      if (strncmp(pack->entries[mid].name, key, len) < 0)
+         lo = mid + 1;
+      else
+         hi = mid;
+   }
+
+   return lo;
+}
+
+
+static int find_file(ALLEGRO_PACK *pack, const char *name)
+{
+   int i = lower_bound(pack, name, strlen(name) + 1);
+
+   if (i < pack->num_entries && strcmp(pack->entries[i].name, name) == 0)
+      return i;
+   return -1;
+}
+
+
+/* Finds the range of entries inside directory `name` ("" for the root).
+ * Returns false if there are none, i.e. the directory doesn't exist.
+ */
+static bool find_directory(ALLEGRO_PACK *pack, const char *name,
+   int *start, int *end)
+{
+   ALLEGRO_USTR *prefix;
+   size_t len;
+   int lo, hi;
+
+   if (name[0] == '\0') {
+      *start = 0;
+      *end = pack->num_entries;
+      return true;
+   }
+
+   prefix = al_ustr_newf("%s/", name);
+   len = al_ustr_size(prefix);
+   lo = lower_bound(pack, al_cstr(prefix), len);
+   hi = lo;
+   while (hi < pack->num_entries &&
+         strncmp(pack->entries[hi].name, al_cstr(prefix), len) == 0) {
+      hi++;
+   }
+   al_ustr_free(prefix);
+
+   *start = lo;
+   *end = hi;
+   return lo < hi;
+}
+
+
+/* Turns `path` into an absolute path without "." and ".." components,
+ * of the form "/a/b" (or "/" for the root).
+ */
+static ALLEGRO_USTR *resolve_path(ALLEGRO_PACK *pack, const char *path)
+{
+   ALLEGRO_USTR *full;
+   ALLEGRO_USTR *us;
+   const char *s;
+
+   if (path[0] == '/' || path[0] == '\\') {
+      full = al_ustr_new(path);
+   }
+   else {
+      al_lock_rwlock_read(pack->cwd_lock);
+      full = al_ustr_dup(pack->cwd);
+      al_unlock_rwlock(pack->cwd_lock);
+      al_ustr_append_cstr(full, path);
+   }
+
+   us = al_ustr_new("");
+   s = al_cstr(full);
+   while (*s) {
+      size_t n = strcspn(s, "/\\");
+      ALLEGRO_USTR_INFO info;
+
+      if (n == 0 || (n == 1 && s[0] == '.')) {
+         /* skip */
+      }
+      else if (n == 2 && s[0] == '.' && s[1] == '.') {
+         int slash = al_ustr_rfind_chr(us, al_ustr_size(us), '/');
+         al_ustr_truncate(us, slash > 0 ? slash : 0);
+      }
+      else {
+         al_ustr_append_chr(us, '/');
+         al_ustr_append(us, al_ref_buffer(&info, s, n));
+      }
+
+      s += n;
+      if (*s)
+         s++;
+   }
+
+   if (al_ustr_size(us) == 0)
+      al_ustr_assign_cstr(us, "/");
+
+   al_ustr_free(full);
+   return us;
+}
+
+
+/*
+ * Files.
+ */
+
+static int64_t pack_get_pos(ALLEGRO_FILE *f)
+{
+   PACK_FILE *pf = al_get_file_userdata(f);
+
+   if (f->rpos)
+      return f->rpos - pf->data;
+   return pf->pos;
+}
+
+
+/* The unread part of the file is exposed through the read window, so most
+ * reads are served by al_fread and al_fgetc without calling us.
+ */
+static void pack_set_pos(ALLEGRO_FILE *f, int64_t pos)
+{
+   PACK_FILE *pf = al_get_file_userdata(f);
+
+   pf->pos = pos;
+   if (pf->data && pos <= pf->size) {
+      f->rpos = (unsigned char *)pf->data + pos;
+      f->rend = (unsigned char *)pf->data + pf->size;
+   }
+   else {
+      f->rpos = f->rend = NULL;
+   }
+}
+
+
+static void free_pack_file(PACK_FILE *pf)
+{
+   if (pf->on_heap)
+      al_free((void *)pf->data);
+   al_free(pf);
+}
+
+
+static bool file_pack_fclose(ALLEGRO_FILE *f)
+{
+   free_pack_file(al_get_file_userdata(f));
+   return true;
+}
+
+
+static size_t file_pack_fread(ALLEGRO_FILE *f, void *ptr, size_t size)
+{
+   PACK_FILE *pf = al_get_file_userdata(f);
+   int64_t pos = pack_get_pos(f);
+   int64_t left = pf->size - pos;
+
+   if (left <= 0) {
+      pf->eof = true;
+      return 0;
+   }
+
+   if ((int64_t)size > left) {
+      size = left;
+      pf->eof = true;
+   }
+
+   memcpy(ptr, pf->data + pos, size);
+   pack_set_pos(f, pos + size);
+   return size;
+}
+
+
+static size_t file_pack_fwrite(ALLEGRO_FILE *f, const void *ptr, size_t size)
+{
+   (void)f;
+   (void)ptr;
+   (void)size;
+
+   al_set_errno(EROFS);
+   return 0;
+}
+
+
+static bool file_pack_fflush(ALLEGRO_FILE *f)
+{
+   (void)f;
+   return true;
+}
+
+
+static int64_t file_pack_ftell(ALLEGRO_FILE *f)
+{
+   return pack_get_pos(f);
+}
+
+
+static bool file_pack_fseek(ALLEGRO_FILE *f, int64_t offset, int whence)
+{
+   PACK_FILE *pf = al_get_file_userdata(f);
+
+   switch (whence) {
+      case ALLEGRO_SEEK_SET: break;
+      case ALLEGRO_SEEK_CUR: offset += pack_get_pos(f); break;
+      case ALLEGRO_SEEK_END: offset += pf->size; break;
+      default: offset = -1; break;
+   }
+
+   if (offset < 0) {
+      al_set_errno(EINVAL);
+      return false;
+   }
+
+   pack_set_pos(f, offset);
+   pf->eof = false;
+   return true;
+}
+
+
+static bool file_pack_feof(ALLEGRO_FILE *f)
+{
+   PACK_FILE *pf = al_get_file_userdata(f);
+   return pf->eof;
+}
+
+
+static int file_pack_ferror(ALLEGRO_FILE *f)
+{
+   (void)f;
+   return 0;
+}
+
+
+static const char *file_pack_ferrmsg(ALLEGRO_FILE *f)
+{
+   (void)f;
+   return "";
+}
+
+
+static void file_pack_fclearerr(ALLEGRO_FILE *f)
+{
+   PACK_FILE *pf = al_get_file_userdata(f);
+   pf->eof = false;
+}
+
+
+static off_t file_pack_fsize(ALLEGRO_FILE *f)
+{
+   PACK_FILE *pf = al_get_file_userdata(f);
+   return pf->size;
+}
+
+
+static PACK_FILE *open_entry(ALLEGRO_PACK *pack, int index, const char *mode)
+{
+   const PACK_ENTRY *entry = &pack->entries[index];
+   const void *stored;
+   PACK_FILE *pf;
+
+   if (strpbrk(mode, "wa+")) {
+      al_set_errno(EROFS);
+      return NULL;
+   }
+
+   stored = al_fmap_view(pack->archive, entry->offset, entry->stored_size);
+   if (!stored) {
+      al_set_errno(EIO);
+      return NULL;
+   }
+
+   pf = al_calloc(1, sizeof(*pf));
+   if (!pf) {
+      al_set_errno(ENOMEM);
+      return NULL;
+   }
+   pf->size = entry->size;
+
+   if (!(entry->flags & PACK_COMPRESSED)) {
+      pf->data = stored;
+      return pf;
+   }
+
+   /* Compressed entries are decompressed in full on the opening thread,
+    * so loaders running on several threads decompress in parallel.  The
+    * size comes from the file, so check that the data could decompress to
+    * it before allocating that much.
+    */
+   if ((uint64_t)entry->size > _al_lz4_decompress_bound(entry->stored_size)) {
+      ALLEGRO_ERROR("Corrupt pack file entry %s\n", entry->name);
+      al_free(pf);
+      al_set_errno(EIO);
+      return NULL;
+   }
+
+   pf->data = al_malloc(entry->size ? entry->size : 1);
+   pf->on_heap = true;
+   if (!pf->data) {
+      al_free(pf);
+      al_set_errno(ENOMEM);
+      return NULL;
+   }
+
+   if (!_al_lz4_decompress(stored, entry->stored_size, (void *)pf->data,
+         entry->size)) {
+      ALLEGRO_ERROR("Corrupt pack file entry %s\n", entry->name);
+      al_free((void *)pf->data);
+      al_free(pf);
+      al_set_errno(EIO);
+      return NULL;
+   }
+
+   return pf;
+}
+
+
+static void *file_pack_fopen(const char *path, const char *mode)
+{
+   ALLEGRO_PACK *pack = current_pack();
+   ALLEGRO_USTR *us;
+   int index;
+
+   if (!pack) {
+      al_set_errno(ENOENT);
+      return NULL;
+   }
+
+   us = resolve_path(pack, path);
+   index = find_file(pack, al_cstr(us) + 1);
+   al_ustr_free(us);
+
+   if (index < 0) {
+      al_set_errno(ENOENT);
+      return NULL;
+   }
+
+   return open_entry(pack, index, mode);
+}
+
+
+static const ALLEGRO_FILE_INTERFACE file_pack_vtable =
+{
+   file_pack_fopen,
+   file_pack_fclose,
+   file_pack_fread,
+   file_pack_fwrite,
+   file_pack_fflush,
+   file_pack_ftell,
+   file_pack_fseek,
+   file_pack_feof,
+   file_pack_ferror,
+   file_pack_ferrmsg,
+   file_pack_fclearerr,
+   NULL,
+   file_pack_fsize
+};
+
+
+/*
+ * File system entries.
+ */
+
+static ALLEGRO_FS_ENTRY *create_entry(ALLEGRO_PACK *pack, ALLEGRO_USTR *path)
+{
+   PACK_FS_ENTRY *e;
+   int start, end;
+
+   e = al_calloc(1, sizeof(*e));
+   if (!e) {
+      al_ustr_free(path);
+      return NULL;
+   }
+
+   e->fs_entry.vtable = &fs_pack_vtable;
+   e->pack = pack;
+   e->path = path;
+   e->index = find_file(pack, al_cstr(path) + 1);
+   if (e->index < 0)
+      e->is_dir = find_directory(pack, al_cstr(path) + 1, &start, &end);
+
+   return &e->fs_entry;
+}
+
+
+static ALLEGRO_FS_ENTRY *fs_pack_create_entry(const char *path)
+{
+   ALLEGRO_PACK *pack = current_pack();
+
+   if (!pack)
+      return NULL;
+
+   return create_entry(pack, resolve_path(pack, path));
+}
+
+
+static void fs_pack_destroy_entry(ALLEGRO_FS_ENTRY *fse)
+{
+   PACK_FS_ENTRY *e = (PACK_FS_ENTRY *)fse;
+   al_ustr_free(e->path);
+   al_free(e);
+}
+
+
+static const char *fs_pack_entry_name(ALLEGRO_FS_ENTRY *fse)
+{
+   PACK_FS_ENTRY *e = (PACK_FS_ENTRY *)fse;
+   return al_cstr(e->path);
+}
+
+
+static bool fs_pack_update_entry(ALLEGRO_FS_ENTRY *fse)
+{
+   /* Pack files never change. */
+   (void)fse;
+   return true;
+}
+
+
+static uint32_t fs_pack_entry_mode(ALLEGRO_FS_ENTRY *fse)
+{
+   PACK_FS_ENTRY *e = (PACK_FS_ENTRY *)fse;
+
+   if (e->index >= 0)
+      return ALLEGRO_FILEMODE_READ | ALLEGRO_FILEMODE_ISFILE;
+   if (e->is_dir)
+      return ALLEGRO_FILEMODE_READ | ALLEGRO_FILEMODE_EXECUTE |
+         ALLEGRO_FILEMODE_ISDIR;
+   return 0;
+}
+
+
+static time_t fs_pack_entry_mtime(ALLEGRO_FS_ENTRY *fse)
+{
+   PACK_FS_ENTRY *e = (PACK_FS_ENTRY *)fse;
+
+   if (e->index >= 0)
+      return e->pack->entries[e->index].mtime;
+   return 0;
+}
+
+
+static off_t fs_pack_entry_size(ALLEGRO_FS_ENTRY *fse)
+{
+   PACK_FS_ENTRY *e = (PACK_FS_ENTRY *)fse;
+
+   if (e->index >= 0)
+      return e->pack->entries[e->index].size;
+   return 0;
+}
+
+
+static bool fs_pack_entry_exists(ALLEGRO_FS_ENTRY *fse)
+{
+   PACK_FS_ENTRY *e = (PACK_FS_ENTRY *)fse;
+   return e->index >= 0 || e->is_dir;
+}
+
+
+static bool fs_pack_remove_entry(ALLEGRO_FS_ENTRY *fse)
+{
+   (void)fse;
+   al_set_errno(EROFS);
+   return false;
+}
+
+
+static bool fs_pack_open_directory(ALLEGRO_FS_ENTRY *fse)
+{
+   PACK_FS_ENTRY *e = (PACK_FS_ENTRY *)fse;
+
+   if (!e->is_dir) {
+      al_set_errno(ENOTDIR);
+      return false;
+   }
+
+   find_directory(e->pack, al_cstr(e->path) + 1, &e->dir_pos, &e->dir_end);
+   e->is_dir_open = true;
+   return true;
+}
+
+
+static ALLEGRO_FS_ENTRY *fs_pack_read_directory(ALLEGRO_FS_ENTRY *fse)
+{
+   PACK_FS_ENTRY *e = (PACK_FS_ENTRY *)fse;
+   const PACK_ENTRY *entries = e->pack->entries;
+   ALLEGRO_USTR *child;
+   size_t prefix_len;
+   ALLEGRO_USTR_INFO info;
+   const char *name;
+   size_t n;
+
+   if (!e->is_dir_open || e->dir_pos >= e->dir_end)
+      return NULL;
+
+   /* Skip the "dir/" part of the entry names. */
+   prefix_len = al_ustr_size(e->path);
+   if (prefix_len == 1)
+      prefix_len = 0;
+
+   name = entries[e->dir_pos].name + prefix_len;
+   n = strcspn(name, "/");
+
+   child = al_ustr_dup(e->path);
+   if (prefix_len > 0)
+      al_ustr_append_chr(child, '/');
+   al_ustr_append(child, al_ref_buffer(&info, name, n));
+
+   if (name[n] == '/') {
+      /* A subdirectory.  Everything inside it sorts together, so skip
+       * past all of it.
+       */
+      const char *dir = entries[e->dir_pos].name;
+      size_t dir_len = prefix_len + n + 1;
+      do {
+         e->dir_pos++;
+      } while (e->dir_pos < e->dir_end &&
+         strncmp(entries[e->dir_pos].name, dir, dir_len) == 0);
+   }
+   else {
+      e->dir_pos++;
+   }
+
+   return create_entry(e->pack, child);
+}
+
+
+static bool fs_pack_close_directory(ALLEGRO_FS_ENTRY *fse)
+{
+   PACK_FS_ENTRY *e = (PACK_FS_ENTRY *)fse;
+   e->is_dir_open = false;
+   return true;
+}
+
+
+static bool fs_pack_filename_exists(const char *path)
+{
+   ALLEGRO_FS_ENTRY *e = fs_pack_create_entry(path);
+   bool ret;
+
+   if (!e)
+      return false;
+
+   ret = fs_pack_entry_exists(e);
+   fs_pack_destroy_entry(e);
+   return ret;
+}
+
+
+static bool fs_pack_remove_filename(const char *path)
+{
+   (void)path;
+   al_set_errno(EROFS);
+   return false;
+}
+
+
+static char *fs_pack_get_current_directory(void)
+{
+   ALLEGRO_PACK *pack = current_pack();
+   char *s;
+
+   if (!pack)
+      return NULL;
+
+   al_lock_rwlock_read(pack->cwd_lock);
+   s = al_cstr_dup(pack->cwd);
+   al_unlock_rwlock(pack->cwd_lock);
+
+   return s;
+}
+
+
+static bool fs_pack_change_directory(const char *path)
+{
+   ALLEGRO_PACK *pack = current_pack();
+   ALLEGRO_USTR *us;
+   int start, end;
+
+   if (!pack)
+      return false;
+
+   us = resolve_path(pack, path);
+   if (!find_directory(pack, al_cstr(us) + 1, &start, &end)) {
+      al_ustr_free(us);
+      al_set_errno(ENOENT);
+      return false;
+   }
+
+   if (al_ustr_size(us) > 1)
+      al_ustr_append_chr(us, '/');
+
+   al_lock_rwlock_write(pack->cwd_lock);
+   al_ustr_assign(pack->cwd, us);
+   al_unlock_rwlock(pack->cwd_lock);
+
+   al_ustr_free(us);
+   return true;
+}
+
+
+static bool fs_pack_make_directory(const char *path)
+{
+   (void)path;
+   al_set_errno(EROFS);
+   return false;
+}
+
+
+static ALLEGRO_FILE *fs_pack_open_file(ALLEGRO_FS_ENTRY *fse, const char *mode)
+{
+   PACK_FS_ENTRY *e = (PACK_FS_ENTRY *)fse;
+   PACK_FILE *pf;
+   ALLEGRO_FILE *f;
+
+   if (e->index < 0) {
+      al_set_errno(ENOENT);
+      return NULL;
+   }
+
+   pf = open_entry(e->pack, e->index, mode);
+   if (!pf)
+      return NULL;
+
+   f = al_create_file_handle(&file_pack_vtable, pf);
+   if (!f)
+      free_pack_file(pf);
+   return f;
+}
+
+
+static const ALLEGRO_FS_INTERFACE fs_pack_vtable =
+{
+   fs_pack_create_entry,
+   fs_pack_destroy_entry,
+   fs_pack_entry_name,
+   fs_pack_update_entry,
+   fs_pack_entry_mode,
+   fs_pack_entry_mtime,
+   fs_pack_entry_mtime,
+   fs_pack_entry_mtime,
+   fs_pack_entry_size,
+   fs_pack_entry_exists,
+   fs_pack_remove_entry,
+
+   fs_pack_open_directory,
+   fs_pack_read_directory,
+   fs_pack_close_directory,
+
+   fs_pack_filename_exists,
+   fs_pack_remove_filename,
+   fs_pack_get_current_directory,
+   fs_pack_change_directory,
+   fs_pack_make_directory,
+
+   fs_pack_open_file
+};
+
+
+/*
+ * Opening packs.
+ */
+
+static bool load_index(ALLEGRO_PACK *pack)
+{
+   int64_t file_size = al_fsize(pack->archive);
+   const unsigned char *header;
+   const unsigned char *index;
+   const char *names;
+   uint64_t index_offset, index_size, names_size;
+   uint32_t num_entries;
+   uint32_t i;
+
+   header = al_fmap_view(pack->archive, 0, PACK_HEADER_SIZE);
+   if (!header || memcmp(header, PACK_MAGIC, 4) != 0) {
+      ALLEGRO_ERROR("Not a pack file\n");
+      return false;
+   }
+
+   if (_al_get_u32le(header + 4) != PACK_VERSION) {
+      ALLEGRO_ERROR("Unsupported pack file version %u\n", _al_get_u32le(header + 4));
+      return false;
+   }
+
+   num_entries = _al_get_u32le(header + 8);
+   index_offset = _al_get_u64le(header + 16);
+   index_size = _al_get_u64le(header + 24);
+
+   if (index_offset > (uint64_t)file_size ||
+         index_size > (uint64_t)file_size - index_offset ||
+         num_entries > index_size / PACK_RECORD_SIZE) {
+      ALLEGRO_ERROR("Pack file index out of bounds\n");
+      return false;
+   }
+
+   index = al_fmap_view(pack->archive, index_offset, index_size);
+   names = (const char *)index + (size_t)num_entries * PACK_RECORD_SIZE;
+   names_size = index_size - (uint64_t)num_entries * PACK_RECORD_SIZE;
+
+   /* The names must end in a NUL so that they can be used in place. */
+   if (num_entries > 0 && (names_size == 0 || names[names_size - 1] != '\0')) {
+      ALLEGRO_ERROR("Pack file names not terminated\n");
+      return false;
+   }
+
+   pack->entries = al_malloc((num_entries ? num_entries : 1) * sizeof(PACK_ENTRY));
+   if (!pack->entries)
+      return false;
+   pack->num_entries = num_entries;
+
+   for (i = 0; i < num_entries; i++) {
+      const unsigned char *rec = index + (size_t)i * PACK_RECORD_SIZE;
+      PACK_ENTRY *entry = &pack->entries[i];
+      uint64_t offset = _al_get_u64le(rec);
+      uint64_t stored_size = _al_get_u64le(rec + 16);
+      uint32_t name_offset = _al_get_u32le(rec + 32);
+
+      entry->offset = offset;
+      entry->size = _al_get_u64le(rec + 8);
+      entry->stored_size = stored_size;
+      entry->mtime = (time_t)(int64_t)_al_get_u64le(rec + 24);
+      entry->flags = _al_get_u32le(rec + 36);
+
+      if (offset > (uint64_t)file_size ||
+            stored_size > (uint64_t)file_size - offset ||
+            name_offset >= names_size ||
+            entry->size < 0 ||
+            (!(entry->flags & PACK_COMPRESSED) && entry->size != entry->stored_size)) {
+         ALLEGRO_ERROR("Pack file entry %u out of bounds\n", i);
+         return false;
+      }
+
+      entry->name = names + name_offset;
+      if (i > 0 && strcmp(entry[-1].name, entry->name) >= 0) {
+         ALLEGRO_ERROR("Pack file index not sorted at %s\n", entry->name);
+         return false;
+      }
+   }
+
+   return true;
+}
+
+
+/* Function: al_open_pack
+ */
+ALLEGRO_PACK *al_open_pack(const char *filename)
+{
+   ALLEGRO_PACK *pack;
+
+   ASSERT(filename);
+
+   pack = al_calloc(1, sizeof(*pack));
+   if (!pack) {
+      al_set_errno(ENOMEM);
+      return NULL;
+   }
+
+   pack->archive = al_fopen_mapped(filename);
+   pack->cwd_lock = al_create_rwlock();
+   pack->cwd = al_ustr_new("/");
+
+   if (!pack->archive || !pack->cwd_lock || !load_index(pack)) {
+      if (pack->archive)
+         al_set_errno(EINVAL);
+      al_close_pack(pack);
+      return NULL;
+   }
+
+   ALLEGRO_DEBUG("Opened pack file %s with %d entries\n", filename,
+      pack->num_entries);
+   return pack;
+}
+
+
+/* Function: al_close_pack
+ */
+void al_close_pack(ALLEGRO_PACK *pack)
+{
+   ALLEGRO_PACK **current;
+
+   if (!pack)
+      return;
+
+   current = _al_tls_get_pack();
+   if (current && *current == pack) {
+      al_set_standard_file_interface();
+      al_set_standard_fs_interface();
+      *current = NULL;
+   }
+
+   al_fclose(pack->archive);
+   al_destroy_rwlock(pack->cwd_lock);
+   al_ustr_free(pack->cwd);
+   al_free(pack->entries);
+   al_free(pack);
+}
+
+
+/* Function: al_set_pack_file_interface
+ */
+void al_set_pack_file_interface(ALLEGRO_PACK *pack)
+{
+   ALLEGRO_PACK **current = _al_tls_get_pack();
+
+   ASSERT(pack);
+
+   if (!current)
+      return;
+
+   *current = pack;
+   al_set_new_file_interface(&file_pack_vtable);
+   al_set_fs_interface(&fs_pack_vtable);
+}
+
+
+/*
+ * Writing packs.
+ */
+
+typedef struct PACK_SOURCE {
+   char *name;    /* relative to the packed directory, '/' separated */
+   char *path;    /* on disk */
+   time_t mtime;
+} PACK_SOURCE;
+
+typedef struct PACK_SOURCES {
+   _AL_VECTOR files;
+   size_t root_len;
+   const char *output;
+} PACK_SOURCES;
+
+
+static char *dup_string(const char *s)
+{
+   size_t n = strlen(s) + 1;
+   char *d = al_malloc(n);
+   if (d)
+      memcpy(d, s, n);
+   return d;
+}
+
+
+static int add_source(ALLEGRO_FS_ENTRY *entry, void *extra)
+{
+   PACK_SOURCES *sources = extra;
+   const char *path = al_get_fs_entry_name(entry);
+   uint32_t mode = al_get_fs_entry_mode(entry);
+   PACK_SOURCE *src;
+   char *p;
+
+   if (mode & ALLEGRO_FILEMODE_ISDIR)
+      return ALLEGRO_FOR_EACH_FS_ENTRY_OK;
+
+   /* Leave out anything that can't be read, like broken links. */
+   if (!(mode & ALLEGRO_FILEMODE_ISFILE))
+      return ALLEGRO_FOR_EACH_FS_ENTRY_SKIP;
+
+   if (strlen(path) <= sources->root_len || strcmp(path, sources->output) == 0)
+      return ALLEGRO_FOR_EACH_FS_ENTRY_SKIP;
+
+   src = _al_vector_alloc_back(&sources->files);
+   if (!src)
+      return ALLEGRO_FOR_EACH_FS_ENTRY_ERROR;
+
+   src->path = dup_string(path);
+   src->name = dup_string(path + sources->root_len);
+   src->mtime = al_get_fs_entry_mtime(entry);
+   if (!src->path || !src->name)
+      return ALLEGRO_FOR_EACH_FS_ENTRY_ERROR;
+
+   for (p = src->name; *p; p++) {
+      if (*p == ALLEGRO_NATIVE_PATH_SEP)
+         *p = '/';
+   }
+
+   return ALLEGRO_FOR_EACH_FS_ENTRY_OK;
+}
+
+
+static int compare_sources(const void *a, const void *b)
+{
+   const PACK_SOURCE *sa = a;
+   const PACK_SOURCE *sb = b;
+   return strcmp(sa->name, sb->name);
+}
+
+
+static void put_u64(ALLEGRO_FILE *f, uint64_t v)
+{
+   al_fwrite32le(f, (int32_t)(v & 0xFFFFFFFF));
+   al_fwrite32le(f, (int32_t)(v >> 32));
+}
+
+
+/* Appends one file to the pack, recording where it went. */
+static bool write_source(ALLEGRO_FILE *out, PACK_SOURCE *src, bool compress,
+   unsigned char *record)
+{
+   ALLEGRO_FILE *in;
+   int64_t size, offset;
+   unsigned char *data;
+   unsigned char *packed = NULL;
+   size_t stored_size;
+   uint32_t flags = 0;
+   bool ret;
+   int i;
+
+   in = al_fopen_interface(&_al_file_interface_stdio, src->path, "rb");
+   if (!in)
+      return false;
+
+   size = al_fsize(in);
+   if (size < 0 || (uint64_t)size > (size_t)-1) {
+      al_fclose(in);
+      return false;
+   }
+
+   data = al_malloc(size ? size : 1);
+   if (!data || al_fread(in, data, size) != (size_t)size) {
+      al_free(data);
+      al_fclose(in);
+      return false;
+   }
+   al_fclose(in);
+
+   stored_size = size;
+   if (compress && size > 0) {
+      size_t bound = _al_lz4_compress_bound(size);
+      packed = al_malloc(bound);
+      if (packed) {
+         size_t n = _al_lz4_compress(data, size, packed, bound);
+         /* Only keep it if it actually helps. */
+         if (n > 0 && n < (size_t)size - (size_t)size / 32) {
+            stored_size = n;
+            flags |= PACK_COMPRESSED;
+         }
+      }
+   }
+
+   offset = al_ftell(out);
+   if (flags & PACK_COMPRESSED)
+      ret = al_fwrite(out, packed, stored_size) == stored_size;
+   else
+      ret = al_fwrite(out, data, stored_size) == stored_size;
+
+   al_free(packed);
+   al_free(data);
+
+   /* The name offset is filled in by the caller. */
+   for (i = 0; i < 8; i++) {
+      record[i] = (uint64_t)offset >> (i * 8);
+      record[8 + i] = (uint64_t)size >> (i * 8);
+      record[16 + i] = (uint64_t)stored_size >> (i * 8);
+      record[24 + i] = (uint64_t)(int64_t)src->mtime >> (i * 8);
+   }
+   for (i = 0; i < 4; i++)
+      record[36 + i] = flags >> (i * 8);
+
+   return ret;
+}
+
+
+/* Function: al_save_pack
+ */
+bool al_save_pack(const char *filename, const char *directory, bool compress)
+{
+   PACK_SOURCES sources;
+   ALLEGRO_FS_ENTRY *root;
+   ALLEGRO_FS_ENTRY *output;
+   ALLEGRO_FILE *out = NULL;
+   const char *root_name;
+   unsigned char *records = NULL;
+   int64_t index_offset;
+   uint32_t name_offset;
+   unsigned i, num;
+   bool ret = false;
+
+   ASSERT(filename);
+   ASSERT(directory);
+
+   /* Always read the directory from disk, whatever the current
+    * interface.
+    */
+   root = _al_fs_interface_stdio.fs_create_entry(directory);
+   if (!root)
+      return false;
+
+   /* Make sure not to pack the output if it's inside the directory. */
+   output = _al_fs_interface_stdio.fs_create_entry(filename);
+   if (!output) {
+      al_destroy_fs_entry(root);
+      return false;
+   }
+
+   _al_vector_init(&sources.files, sizeof(PACK_SOURCE));
+   root_name = al_get_fs_entry_name(root);
+   sources.root_len = strlen(root_name);
+   if (sources.root_len > 0 &&
+         root_name[sources.root_len - 1] != ALLEGRO_NATIVE_PATH_SEP) {
+      sources.root_len++;
+   }
+   sources.output = al_get_fs_entry_name(output);
+
+   if (al_for_each_fs_entry(root, add_source, &sources) ==
+         ALLEGRO_FOR_EACH_FS_ENTRY_ERROR) {
+      ALLEGRO_ERROR("Could not read directory %s\n", directory);
+      goto done;
+   }
+
+   num = _al_vector_size(&sources.files);
+   if (num > 0) {
+      qsort(_al_vector_ref_front(&sources.files), num, sizeof(PACK_SOURCE),
+         compare_sources);
+   }
+
+   out = al_fopen_interface(&_al_file_interface_stdio, filename, "wb");
+   records = al_calloc(num ? num : 1, PACK_RECORD_SIZE);
+   if (!out || !records)
+      goto done;
+
+   /* The header is written again once the index position is known. */
+   for (i = 0; i < PACK_HEADER_SIZE; i++)
+      al_fputc(out, 0);
+
+   for (i = 0; i < num; i++) {
+      PACK_SOURCE *src = _al_vector_ref(&sources.files, i);
+      if (!write_source(out, src, compress, records + i * PACK_RECORD_SIZE)) {
+         ALLEGRO_ERROR("Could not add %s to the pack\n", src->path);
+         goto done;
+      }
+   }
+
+   index_offset = al_ftell(out);
+   name_offset = 0;
+   for (i = 0; i < num; i++) {
+      PACK_SOURCE *src = _al_vector_ref(&sources.files, i);
+      unsigned char *rec = records + i * PACK_RECORD_SIZE;
+      rec[32] = name_offset;
+      rec[33] = name_offset >> 8;
+      rec[34] = name_offset >> 16;
+      rec[35] = name_offset >> 24;
+      name_offset += strlen(src->name) + 1;
+   }
+   al_fwrite(out, records, (size_t)num * PACK_RECORD_SIZE);
+   for (i = 0; i < num; i++) {
+      PACK_SOURCE *src = _al_vector_ref(&sources.files, i);
+      al_fwrite(out, src->name, strlen(src->name) + 1);
+   }
+
+   al_fseek(out, 0, ALLEGRO_SEEK_SET);
+   al_fwrite(out, PACK_MAGIC, 4);
+   al_fwrite32le(out, PACK_VERSION);
+   al_fwrite32le(out, num);
+   al_fwrite32le(out, 0);
+   put_u64(out, index_offset);
+   put_u64(out, (uint64_t)num * PACK_RECORD_SIZE + name_offset);
+
+   ret = !al_ferror(out);
+
+done:
+   if (out && !al_fclose(out))
+      ret = false;
+   if (out && !ret)
+      _al_fs_interface_stdio.fs_remove_filename(filename);
+
+   for (i = 0; i < _al_vector_size(&sources.files); i++) {
+      PACK_SOURCE *src = _al_vector_ref(&sources.files, i);
+      al_free(src->name);
+      al_free(src->path);
+   }
+   _al_vector_free(&sources.files);
+   al_free(records);
+   al_destroy_fs_entry(output);
+   al_destroy_fs_entry(root);
+
+   return ret;
+}
+
+/* vim: set sts=3 sw=3 et: */
@@ -48,11 +48,16 @@ ALLEGRO_DEBUG_CHANNEL("fshook")
 
 #include "allegro5/internal/aintern_file.h"
 #include "allegro5/internal/aintern_fshook.h"
+#include "allegro5/internal/aintern_pool.h"
 
 #ifdef ALLEGRO_HAVE_SYS_STAT_H
    #include <sys/stat.h>
 #endif
 
+#ifdef ALLEGRO_HAVE_FSTATAT
+   #include <fcntl.h>
+#endif
+
 #ifdef ALLEGRO_HAVE_DIRENT_H
    #include <sys/types.h>
    #include <dirent.h>
@@ -228,7 +233,7 @@ static ALLEGRO_FS_ENTRY *create_abs_path_entry(const WRAP_CHAR *abs_path)
    ALLEGRO_FS_ENTRY_STDIO *fh;
    size_t len;
 
-   fh = al_calloc(1, sizeof(*fh));
+   fh = _al_pool_calloc(sizeof(*fh));
    if (!fh) {
       al_set_errno(errno);
       return NULL;
@@ -239,7 +244,7 @@ static ALLEGRO_FS_ENTRY *create_abs_path_entry(const WRAP_CHAR *abs_path)
    len = WRAP_STRLEN(abs_path) + 1; /* including terminator */
    fh->abs_path = al_malloc(len * sizeof(WRAP_CHAR));
    if (!fh->abs_path) {
-      al_free(fh);
+      _al_pool_free(fh, sizeof(*fh));
       return NULL;
    }
    memcpy(fh->abs_path, abs_path, len * sizeof(WRAP_CHAR));
@@ -248,7 +253,7 @@ static ALLEGRO_FS_ENTRY *create_abs_path_entry(const WRAP_CHAR *abs_path)
    fh->abs_path_utf8 = _al_win_utf8(fh->abs_path);
    if (!fh->abs_path_utf8) {
       al_free(fh->abs_path);
-      al_free(fh);
+      _al_pool_free(fh, sizeof(*fh));
       return NULL;
    }
 #endif
@@ -289,34 +294,37 @@ static bool unix_hidden_file(const char *path)
 #endif
 
 
-static void fs_update_stat_mode(ALLEGRO_FS_ENTRY_STDIO *fp_stdio)
+/* Works out the ALLEGRO_FILE_MODE flags for a file.  The path is used for
+ * telling hidden files apart, so on Unix it may be just the file name.
+ */
+static uint32_t get_stat_mode(const WRAP_STAT_TYPE *st, const WRAP_CHAR *path)
 {
-   fp_stdio->stat_mode = 0;
+   uint32_t stat_mode = 0;
 
-   if (S_ISDIR(fp_stdio->st.st_mode))
-      fp_stdio->stat_mode |= ALLEGRO_FILEMODE_ISDIR;
+   if (S_ISDIR(st->st_mode))
+      stat_mode |= ALLEGRO_FILEMODE_ISDIR;
    else /* marks special unix files as files... might want to add enum items for symlink, CHAR, BLOCK and SOCKET files. */
-      fp_stdio->stat_mode |= ALLEGRO_FILEMODE_ISFILE;
+      stat_mode |= ALLEGRO_FILEMODE_ISFILE;
 
    /*
-   if (S_ISREG(fh->st.st_mode))
-      fh->stat_mode |= ALLEGRO_FILEMODE_ISFILE;
+   if (S_ISREG(st->st_mode))
+      stat_mode |= ALLEGRO_FILEMODE_ISFILE;
    */
 
-   if (fp_stdio->st.st_mode & (S_IRUSR | S_IRGRP))
-      fp_stdio->stat_mode |= ALLEGRO_FILEMODE_READ;
+   if (st->st_mode & (S_IRUSR | S_IRGRP))
+      stat_mode |= ALLEGRO_FILEMODE_READ;
 
-   if (fp_stdio->st.st_mode & (S_IWUSR | S_IWGRP))
-      fp_stdio->stat_mode |= ALLEGRO_FILEMODE_WRITE;
+   if (st->st_mode & (S_IWUSR | S_IWGRP))
+      stat_mode |= ALLEGRO_FILEMODE_WRITE;
 
-   if (fp_stdio->st.st_mode & (S_IXUSR | S_IXGRP))
-      fp_stdio->stat_mode |= ALLEGRO_FILEMODE_EXECUTE;
+   if (st->st_mode & (S_IXUSR | S_IXGRP))
+      stat_mode |= ALLEGRO_FILEMODE_EXECUTE;
 
 #if defined(ALLEGRO_WINDOWS)
    {
-      DWORD attrib = GetFileAttributes(fp_stdio->abs_path);
+      DWORD attrib = GetFileAttributes(path);
       if (attrib & FILE_ATTRIBUTE_HIDDEN)
-         fp_stdio->stat_mode |= ALLEGRO_FILEMODE_HIDDEN;
+         stat_mode |= ALLEGRO_FILEMODE_HIDDEN;
    }
 #endif
 #if defined(ALLEGRO_MACOSX) && defined(UF_HIDDEN)
@@ -325,17 +333,25 @@ static void fs_update_stat_mode(ALLEGRO_FS_ENTRY_STDIO *fp_stdio)
        * Note that this flag does not exist on all versions of OS X (Tiger
        * doesn't seem to have it) so we need to test for it.
        */
-      if (fp_stdio->st.st_flags & UF_HIDDEN)
-         fp_stdio->stat_mode |= ALLEGRO_FILEMODE_HIDDEN;
+      if (st->st_flags & UF_HIDDEN)
+         stat_mode |= ALLEGRO_FILEMODE_HIDDEN;
    }
 #endif
 #if defined(ALLEGRO_UNIX) || defined(ALLEGRO_MACOSX)
-   if (0 == (fp_stdio->stat_mode & ALLEGRO_FILEMODE_HIDDEN)) {
-      if (unix_hidden_file(fp_stdio->abs_path)) {
-         fp_stdio->stat_mode |= ALLEGRO_FILEMODE_HIDDEN;
+   if (0 == (stat_mode & ALLEGRO_FILEMODE_HIDDEN)) {
+      if (unix_hidden_file(path)) {
+         stat_mode |= ALLEGRO_FILEMODE_HIDDEN;
       }
    }
 #endif
+
+   return stat_mode;
+}
+
+
+static void fs_update_stat_mode(ALLEGRO_FS_ENTRY_STDIO *fp_stdio)
+{
+   fp_stdio->stat_mode = get_stat_mode(&fp_stdio->st, fp_stdio->abs_path);
 }
 
 
@@ -397,8 +413,9 @@ static bool fs_stdio_close_directory(ALLEGRO_FS_ENTRY *fp)
 static ALLEGRO_FS_ENTRY *fs_stdio_read_directory(ALLEGRO_FS_ENTRY *fp)
 {
    ALLEGRO_FS_ENTRY_STDIO *fp_stdio = (ALLEGRO_FS_ENTRY_STDIO *) fp;
-   // FIXME: Must use readdir_r as Allegro allows file functions being
-   // called from different threads.
+   /* readdir is safe as long as each DIR stream is only used by one
+    * thread at a time, which holds unless the same entry is shared.
+    */
    WRAP_DIRENT_TYPE *ent;
    ALLEGRO_FS_ENTRY *ret;
 
@@ -448,6 +465,130 @@ static ALLEGRO_FS_ENTRY *fs_stdio_read_directory(ALLEGRO_FS_ENTRY *fp)
 }
 
 
+/* Internal function: _al_fs_stdio_scan_directory
+ *  Reads a whole directory for al_scan_directory.  Unlike
+ *  fs_stdio_read_directory this creates no entry per file: the type, and
+ *  on Windows everything else, comes with the directory entry itself, and
+ *  files are otherwise looked up relative to the open directory.
+ */
+#ifdef ALLEGRO_WINDOWS
+bool _al_fs_stdio_scan_directory(const char *path, _AL_FS_SCAN *scan)
+{
+   wchar_t *wpath;
+   _WDIR *dir;
+   struct _wdirent *ent;
+   char name[FILENAME_MAX * 3];
+   bool ret = true;
+
+   wpath = _al_win_utf16(path);
+   if (!wpath)
+      return false;
+   dir = _wopendir(wpath);
+   al_free(wpath);
+   if (!dir) {
+      al_set_errno(errno);
+      return false;
+   }
+
+   while (ret && (ent = _wreaddir(dir))) {
+      /* The find data of the entry just read has everything we need. */
+      const struct _wfinddata_t *fd = &dir->dd_dta;
+      uint32_t mode = ALLEGRO_FILEMODE_READ;
+
+      if (0 == wcscmp(ent->d_name, L".") || 0 == wcscmp(ent->d_name, L".."))
+         continue;
+
+      if (!WideCharToMultiByte(CP_UTF8, 0, ent->d_name, -1, name,
+            sizeof(name), NULL, NULL)) {
+         continue;
+      }
+
+      if (fd->attrib & _A_SUBDIR)
+         mode |= ALLEGRO_FILEMODE_ISDIR | ALLEGRO_FILEMODE_EXECUTE;
+      else
+         mode |= ALLEGRO_FILEMODE_ISFILE;
+      if (!(fd->attrib & _A_RDONLY))
+         mode |= ALLEGRO_FILEMODE_WRITE;
+      if (fd->attrib & _A_HIDDEN)
+         mode |= ALLEGRO_FILEMODE_HIDDEN;
+
+      ret = _al_fs_scan_add(scan, name, mode, fd->size, fd->time_write);
+   }
+
+   _wclosedir(dir);
+   return ret;
+}
+#else
+static int stat_in_dir(DIR *dir, const char *path, const char *name,
+   struct stat *st)
+{
+#ifdef ALLEGRO_HAVE_FSTATAT
+   (void)path;
+   return fstatat(dirfd(dir), name, st, 0);
+#else
+   char buf[PATH_MAX];
+   (void)dir;
+   if (snprintf(buf, sizeof(buf), "%s%c%s", path, ALLEGRO_NATIVE_PATH_SEP,
+         name) >= (int)sizeof(buf)) {
+      errno = ENAMETOOLONG;
+      return -1;
+   }
+   return stat(buf, st);
+#endif
+}
+
+
+bool _al_fs_stdio_scan_directory(const char *path, _AL_FS_SCAN *scan)
+{
+   DIR *dir;
+   struct dirent *ent;
+   bool ret = true;
+
+   dir = opendir(path);
+   if (!dir) {
+      al_set_errno(errno);
+      return false;
+   }
+
+   /* A DIR stream used by one thread only is safe with readdir. */
+   while (ret && (ent = readdir(dir))) {
+      const char *name = ent->d_name;
+      struct stat st;
+
+      if (0 == strcmp(name, ".") || 0 == strcmp(name, ".."))
+         continue;
+
+#ifdef DT_DIR
+      /* Symbolic links have to be followed to know what they are. */
+      if ((scan->flags & ALLEGRO_SCAN_TYPES_ONLY) &&
+            ent->d_type != DT_UNKNOWN && ent->d_type != DT_LNK) {
+         uint32_t mode = (ent->d_type == DT_DIR) ?
+            ALLEGRO_FILEMODE_ISDIR : ALLEGRO_FILEMODE_ISFILE;
+         if (unix_hidden_file(name))
+            mode |= ALLEGRO_FILEMODE_HIDDEN;
+         ret = _al_fs_scan_add(scan, name, mode, 0, 0);
+         continue;
+      }
+#endif
+
+      if (stat_in_dir(dir, path, name, &st) != 0) {
+         /* Like al_read_directory, still list entries that can't be
+          * looked up, such as broken links.
+          */
+         ret = _al_fs_scan_add(scan, name, 0, 0, 0);
+         continue;
+      }
+
+      ret = _al_fs_scan_add(scan, name, get_stat_mode(&st, name),
+         st.st_size, st.st_mtime);
+   }
+
+   closedir(dir);
+   return ret;
+}
+#endif
+
+
 static void fs_stdio_destroy_entry(ALLEGRO_FS_ENTRY *fh_)
 {
    ALLEGRO_FS_ENTRY_STDIO *fh = (ALLEGRO_FS_ENTRY_STDIO *) fh_;
@@ -460,7 +601,7 @@ static void fs_stdio_destroy_entry(ALLEGRO_FS_ENTRY *fh_)
    if (fh->dir)
       fs_stdio_close_directory(fh_);
 
-   al_free(fh);
+   _al_pool_free(fh, sizeof(*fh));
 }
 
 
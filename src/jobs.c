@@ -0,0 +1,447 @@
+/*         ______   ___    ___
+ *        /\  _  \ /\_ \  /\_ \
+ *        \ \ \L\ \\//\ \ \//\ \      __     __   _ __   ___
+ *         \ \  __ \ \ \ \  \ \ \   /'__`\ /'_ `\/\`'__\/ __`\
+ *          \ \ \/\ \ \_\ \_ \_\ \_/\  __//\ \L\ \ \ \//\ \L\ \
+ *           \ \_\ \_\/\____\/\____\ \____\ \____ \ \_\\ \____/
+ *            \/_/\/_/\/____/\/____/\/____/\/___L\ \/_/ \/___/
+ *                                           /\____/
+ *                                           \_/__/
+ *
+ *      Job system.
+ *
+ *      See readme.txt for copyright information.
+ */
+
+/* Title: Job system
+ *
+ * A fixed pool of worker threads, one less than the number of CPUs, is
+ * started the first time a job is submitted.  Every worker owns a deque
+ * of jobs: it pushes and pops jobs at the back, while idle workers steal
+ * the oldest jobs from the front.  Jobs submitted from threads outside
+ * the pool go to an extra deque which only has a front.
+ *
+ * A thread waiting for a job runs other queued jobs in the meantime, so
+ * jobs may wait for other jobs without tying up a worker.
+ */
+
+
+#include <string.h>
+
+#include "allegro5/allegro.h"
+#include "allegro5/internal/aintern.h"
+#include "allegro5/internal/aintern_atomicops.h"
+#include "allegro5/internal/aintern_exitfunc.h"
+#include "allegro5/internal/aintern_jobs.h"
+#include "allegro5/internal/aintern_thread.h"
+#include "allegro5/internal/aintern_tls.h"
+#include "allegro5/internal/aintern_vector.h"
+
+ALLEGRO_DEBUG_CHANNEL("jobs")
+
+
+/* The per-thread state which jobs may change, and which is restored
+ * after every job so that jobs do not affect each other, or the thread
+ * which runs them while waiting.
+ */
+#define JOB_STATE_FLAGS \
+   (ALLEGRO_STATE_NEW_BITMAP_PARAMETERS | ALLEGRO_STATE_BLENDER | \
+    ALLEGRO_STATE_NEW_FILE_INTERFACE)
+
+
+struct ALLEGRO_JOB
+{
+   void (*proc)(void *arg);
+   void *arg;
+   bool submitted;
+   /* Unfinished dependencies, plus one until the job is submitted. */
+   volatile _AL_ATOMIC unfinished;
+   volatile _AL_ATOMIC finished;
+   volatile _AL_ATOMIC waiters;
+   _AL_VECTOR dependents;  /* vector of ALLEGRO_JOB *, under pool.mutex */
+};
+
+
+typedef struct JOB_DEQUE
+{
+   _AL_MUTEX mutex;
+   _AL_VECTOR jobs;  /* vector of ALLEGRO_JOB * */
+} JOB_DEQUE;
+
+
+static struct
+{
+   int num_workers;
+   ALLEGRO_THREAD **threads;
+   JOB_DEQUE *deques;   /* num_workers + 1, the last one for other threads */
+   volatile _AL_ATOMIC started;
+   volatile _AL_ATOMIC queued;    /* jobs in all deques */
+   volatile _AL_ATOMIC sleepers;  /* threads waiting on cond */
+   bool stopping;
+   _AL_MUTEX mutex;
+   _AL_COND cond;
+} pool;
+
+
+
+/* current_worker:
+ *  Returns the index of the worker running on the calling thread, or -1.
+ */
+static int current_worker(void)
+{
+   return *_al_tls_get_job_worker() - 1;
+}
+
+
+
+static void wake_sleeper(void)
+{
+   _al_mutex_lock(&pool.mutex);
+   _al_cond_signal(&pool.cond);
+   _al_mutex_unlock(&pool.mutex);
+}
+
+
+
+static void push_job(ALLEGRO_JOB *job)
+{
+   int w = current_worker();
+   JOB_DEQUE *deque = &pool.deques[w >= 0 ? w : pool.num_workers];
+   ALLEGRO_JOB **slot;
+
+   _al_mutex_lock(&deque->mutex);
+   slot = _al_vector_alloc_back(&deque->jobs);
+   *slot = job;
+   _al_mutex_unlock(&deque->mutex);
+
+   /* Sleepers increment their count before checking this one, so either
+    * they see the job or we see them.
+    */
+   _al_fetch_and_add1(&pool.queued);
+   if (_al_atomic_load(&pool.sleepers) > 0)
+      wake_sleeper();
+}
+
+
+
+static ALLEGRO_JOB *take_job(JOB_DEQUE *deque, bool back)
+{
+   ALLEGRO_JOB *job = NULL;
+   ALLEGRO_JOB **slot;
+
+   _al_mutex_lock(&deque->mutex);
+   if (_al_vector_is_nonempty(&deque->jobs)) {
+      if (back) {
+         slot = _al_vector_ref_back(&deque->jobs);
+         job = *slot;
+         _al_vector_delete_at(&deque->jobs, _al_vector_size(&deque->jobs) - 1);
+      }
+      else {
+         slot = _al_vector_ref_front(&deque->jobs);
+         job = *slot;
+         _al_vector_delete_at(&deque->jobs, 0);
+      }
+   }
+   _al_mutex_unlock(&deque->mutex);
+
+   return job;
+}
+
+
+
+/* pop_job:
+ *  Find a job for worker w (-1 for other threads) to run.  The worker's
+ *  own newest job is preferred, as its data is most likely still in the
+ *  cache, then jobs from other threads, then the oldest jobs of other
+ *  workers.
+ */
+static ALLEGRO_JOB *pop_job(int w)
+{
+   ALLEGRO_JOB *job = NULL;
+   int i;
+
+   if (_al_atomic_load(&pool.queued) == 0)
+      return NULL;
+
+   if (w >= 0)
+      job = take_job(&pool.deques[w], true);
+
+   if (!job)
+      job = take_job(&pool.deques[pool.num_workers], false);
+
+   for (i = 1; !job && i <= pool.num_workers; i++) {
+      int victim = (w + i) % pool.num_workers;
+      if (victim != w)
+         job = take_job(&pool.deques[victim], false);
+   }
+
+   if (job)
+      _al_sub1_and_fetch(&pool.queued);
+
+   return job;
+}
+
+
+
+static void finish_job(ALLEGRO_JOB *job)
+{
+   _AL_VECTOR dependents;
+   bool has_waiters;
+   unsigned int i;
+
+   _al_mutex_lock(&pool.mutex);
+   {
+      dependents = job->dependents;
+      _al_vector_init(&job->dependents, sizeof(ALLEGRO_JOB *));
+      has_waiters = _al_atomic_load(&job->waiters) > 0;
+      /* A waiter may destroy the job as soon as this is set, so it must
+       * be the last access.  Waiters which are not counted yet check the
+       * flag again under the mutex.
+       */
+      _al_atomic_store(&job->finished, 1);
+      if (has_waiters)
+         _al_cond_broadcast(&pool.cond);
+   }
+   _al_mutex_unlock(&pool.mutex);
+
+   for (i = 0; i < _al_vector_size(&dependents); i++) {
+      ALLEGRO_JOB **slot = _al_vector_ref(&dependents, i);
+      if (_al_sub1_and_fetch(&(*slot)->unfinished) == 0)
+         push_job(*slot);
+   }
+   _al_vector_free(&dependents);
+}
+
+
+
+static void run_job(ALLEGRO_JOB *job)
+{
+   ALLEGRO_STATE state;
+
+   if (job->proc) {
+      al_store_state(&state, JOB_STATE_FLAGS);
+      job->proc(job->arg);
+      al_restore_state(&state);
+   }
+
+   finish_job(job);
+}
+
+
+
+static void *worker_proc(ALLEGRO_THREAD *thread, void *arg)
+{
+   const int w = (int)(intptr_t)arg;
+   bool stop = false;
+   (void)thread;
+
+   *_al_tls_get_job_worker() = w + 1;
+
+   while (!stop) {
+      ALLEGRO_JOB *job = pop_job(w);
+      if (job) {
+         run_job(job);
+         continue;
+      }
+
+      _al_mutex_lock(&pool.mutex);
+      _al_fetch_and_add1(&pool.sleepers);
+      if (_al_atomic_load(&pool.queued) == 0 && !pool.stopping)
+         _al_cond_wait(&pool.cond, &pool.mutex);
+      _al_sub1_and_fetch(&pool.sleepers);
+      stop = pool.stopping;
+      _al_mutex_unlock(&pool.mutex);
+   }
+
+   return NULL;
+}
+
+
+
+static void start_workers(void)
+{
+   int i;
+
+   _al_mutex_lock(&pool.mutex);
+
+   if (!_al_atomic_load(&pool.started)) {
+      pool.num_workers = al_get_cpu_count() - 1;
+      if (pool.num_workers < 1)
+         pool.num_workers = 1;
+
+      pool.deques = al_calloc(pool.num_workers + 1, sizeof(JOB_DEQUE));
+      for (i = 0; i <= pool.num_workers; i++) {
+         _AL_MARK_MUTEX_UNINITED(pool.deques[i].mutex);
+         _al_mutex_init(&pool.deques[i].mutex);
+         _al_vector_init(&pool.deques[i].jobs, sizeof(ALLEGRO_JOB *));
+      }
+
+      pool.threads = al_calloc(pool.num_workers, sizeof(ALLEGRO_THREAD *));
+      for (i = 0; i < pool.num_workers; i++) {
+         pool.threads[i] = al_create_thread(worker_proc, (void *)(intptr_t)i);
+         al_start_thread(pool.threads[i]);
+      }
+
+      ALLEGRO_INFO("Started %d job workers.\n", pool.num_workers);
+      _al_atomic_store(&pool.started, 1);
+   }
+
+   _al_mutex_unlock(&pool.mutex);
+}
+
+
+
+static void shutdown_jobs(void)
+{
+   int i;
+
+   if (_al_atomic_load(&pool.started)) {
+      _al_mutex_lock(&pool.mutex);
+      pool.stopping = true;
+      _al_cond_broadcast(&pool.cond);
+      _al_mutex_unlock(&pool.mutex);
+
+      for (i = 0; i < pool.num_workers; i++)
+         al_destroy_thread(pool.threads[i]);
+      al_free(pool.threads);
+
+      /* Jobs which never ran are simply forgotten; they are still owned
+       * by the user.
+       */
+      for (i = 0; i <= pool.num_workers; i++) {
+         _al_vector_free(&pool.deques[i].jobs);
+         _al_mutex_destroy(&pool.deques[i].mutex);
+      }
+      al_free(pool.deques);
+   }
+
+   _al_cond_destroy(&pool.cond);
+   _al_mutex_destroy(&pool.mutex);
+}
+
+
+
+void _al_init_jobs(void)
+{
+   memset(&pool, 0, sizeof pool);
+   _AL_MARK_MUTEX_UNINITED(pool.mutex);
+   _al_mutex_init(&pool.mutex);
+   _al_cond_init(&pool.cond);
+   _al_add_exit_func(shutdown_jobs, "shutdown_jobs");
+}
+
+
+
+/* Function: al_create_job
+ */
+ALLEGRO_JOB *al_create_job(void (*proc)(void *arg), void *arg)
+{
+   ALLEGRO_JOB *job = al_calloc(1, sizeof *job);
+   if (!job)
+      return NULL;
+
+   job->proc = proc;
+   job->arg = arg;
+   job->unfinished = 1;
+   _al_vector_init(&job->dependents, sizeof(ALLEGRO_JOB *));
+   return job;
+}
+
+
+
+/* Function: al_add_job_dependency
+ */
+void al_add_job_dependency(ALLEGRO_JOB *job, ALLEGRO_JOB *dependency)
+{
+   ALLEGRO_JOB **slot;
+   ASSERT(job);
+   ASSERT(dependency);
+   ASSERT(!job->submitted);
+   ASSERT(job != dependency);
+
+   _al_mutex_lock(&pool.mutex);
+   if (!_al_atomic_load(&dependency->finished)) {
+      slot = _al_vector_alloc_back(&dependency->dependents);
+      *slot = job;
+      _al_fetch_and_add1(&job->unfinished);
+   }
+   _al_mutex_unlock(&pool.mutex);
+}
+
+
+
+/* Function: al_submit_job
+ */
+void al_submit_job(ALLEGRO_JOB *job)
+{
+   ASSERT(job);
+   ASSERT(!job->submitted);
+
+   if (!_al_atomic_load(&pool.started))
+      start_workers();
+
+   job->submitted = true;
+   if (_al_sub1_and_fetch(&job->unfinished) == 0)
+      push_job(job);
+}
+
+
+
+/* Function: al_is_job_finished
+ */
+bool al_is_job_finished(ALLEGRO_JOB *job)
+{
+   ASSERT(job);
+
+   return _al_atomic_load(&job->finished) != 0;
+}
+
+
+
+/* Function: al_wait_for_job
+ */
+void al_wait_for_job(ALLEGRO_JOB *job)
+{
+   const int w = current_worker();
+   ASSERT(job);
+   ASSERT(job->submitted);
+
+   _al_fetch_and_add1(&job->waiters);
+
+   while (!_al_atomic_load(&job->finished)) {
+      ALLEGRO_JOB *other = pop_job(w);
+      if (other) {
+         run_job(other);
+         continue;
+      }
+
+      _al_mutex_lock(&pool.mutex);
+      _al_fetch_and_add1(&pool.sleepers);
+      if (_al_atomic_load(&pool.queued) == 0
+            && !_al_atomic_load(&job->finished))
+         _al_cond_wait(&pool.cond, &pool.mutex);
+      _al_sub1_and_fetch(&pool.sleepers);
+      _al_mutex_unlock(&pool.mutex);
+   }
+
+   _al_sub1_and_fetch(&job->waiters);
+}
+
+
+
+/* Function: al_destroy_job
+ */
+void al_destroy_job(ALLEGRO_JOB *job)
+{
+   if (!job)
+      return;
+
+   if (job->submitted)
+      al_wait_for_job(job);
+
+   _al_vector_free(&job->dependents);
+   al_free(job);
+}
+
+
+/* vim: set sts=3 sw=3 et: */
@@ -16,12 +16,420 @@
  */
 
 
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
 #include "allegro5/allegro.h"
+#include "allegro5/internal/aintern.h"
+#include "allegro5/internal/aintern_atomicops.h"
+#include "allegro5/internal/aintern_memory.h"
+
+ALLEGRO_DEBUG_CHANNEL("memory")
+
+
+#define MAX_MODULES        32
+#define FILE_CACHE_SIZE    64
+
+
+typedef struct MODULE {
+   const char *name;
+   ALLEGRO_MEMORY_STATS stats;
+} MODULE;
+
+
+/* A live allocation, kept in a hash table keyed by the pointer. */
+typedef struct BLOCK {
+   void *ptr;                 /* NULL if the slot is empty */
+   size_t size;
+   const char *file;
+   int line;
+   int module;
+} BLOCK;
+
+
+/* Live allocations from one line of code, for reports. */
+typedef struct SITE {
+   const char *file;
+   int line;
+   int module;
+   size_t bytes;
+   size_t count;
+} SITE;
 
 
 /* globals */
 static ALLEGRO_MEMORY_INTERFACE *mem = NULL;
 
+/* The tracking state is used before al_install_system and after
+ * al_uninstall_system, and from any thread, so like the object pools it is
+ * protected by a spin lock.  The table itself is allocated with the C
+ * library so that it doesn't track itself.
+ */
+static volatile _AL_ATOMIC tracking = 0;
+static volatile _AL_ATOMIC track_lock = 0;
+
+static BLOCK *blocks = NULL;
+static size_t blocks_capacity = 0;  /* zero or a power of two */
+static size_t blocks_count = 0;
+
+/* Modules are never removed.  Their names are string constants. */
+static MODULE modules[MAX_MODULES];
+static int num_modules = 0;
+static ALLEGRO_MEMORY_STATS total_stats;
+
+/* Remembers which module the last file name pointers belonged to. */
+static struct {
+   const char *file;
+   int module;
+} file_cache[FILE_CACHE_SIZE];
+
+
+
+static size_t hash_ptr(const void *ptr)
+{
+   uintptr_t p = (uintptr_t)ptr;
+   uint32_t h = (uint32_t)(p >> 4);
+
+#if UINTPTR_MAX > 0xFFFFFFFF
+   h ^= (uint32_t)(p >> 32);
+#endif
+   return (size_t)(h * 2654435761u);
+}
+
+
+
+static size_t find_block(const void *ptr)
+{
+   size_t mask = blocks_capacity - 1;
+   size_t i = hash_ptr(ptr) & mask;
+
+   while (blocks[i].ptr && blocks[i].ptr != ptr)
+      i = (i + 1) & mask;
+   return i;
+}
+
+
+
+static bool grow_blocks(void)
+{
+   size_t old_capacity = blocks_capacity;
+   BLOCK *old_blocks = blocks;
+   size_t new_capacity = old_capacity ? old_capacity * 2 : 1024;
+   BLOCK *new_blocks = calloc(new_capacity, sizeof(BLOCK));
+   size_t i;
+
+   if (!new_blocks)
+      return false;
+
+   blocks = new_blocks;
+   blocks_capacity = new_capacity;
+   for (i = 0; i < old_capacity; i++) {
+      if (old_blocks[i].ptr)
+         blocks[find_block(old_blocks[i].ptr)] = old_blocks[i];
+   }
+   free(old_blocks);
+   return true;
+}
+
+
+
+/* Removes the block in slot i, moving later blocks of the same probe
+ * sequence back so that lookups don't need tombstones.
+ */
+static void remove_block(size_t i)
+{
+   size_t mask = blocks_capacity - 1;
+   size_t j = i;
+   size_t k;
+
+   for (;;) {
+      j = (j + 1) & mask;
+      if (!blocks[j].ptr)
+         break;
+      k = hash_ptr(blocks[j].ptr) & mask;
+      /* Move it unless its home slot lies cyclically in (i, j]. */
+      if ((i <= j) ? (i < k && k <= j) : (i < k || k <= j))
+         continue;
+      blocks[i] = blocks[j];
+      i = j;
+   }
+   blocks[i].ptr = NULL;
+   blocks_count--;
+}
+
+
+
+/* Allocations are counted by subsystem.  The addons are grouped by their
+ * directory and the core by the start of the source file's name, or its
+ * directory for platform code.  The first match wins.
+ */
+typedef struct MODULE_MAP {
+   const char *prefix;
+   const char *module;
+} MODULE_MAP;
+
+
+static const MODULE_MAP addon_modules[] = {
+   { "acodec",          "audio" },
+   { "audio",           "audio" },
+   { "font",            "fonts" },
+   { "ttf",             "fonts" },
+   { "image",           "images" },
+   { "primitives",      "primitives" },
+   { "video",           "video" },
+   { "native_dialog",   "dialogs" },
+   { "memfile",         "files" },
+   { "physfs",          "files" },
+   { NULL,              "addons" }
+};
+
+
+static const MODULE_MAP core_dir_modules[] = {
+   { "opengl",          "displays" },
+   { "misc",            NULL },     /* by file name */
+   { NULL,              "platform" }
+};
+
+
+static const MODULE_MAP core_file_modules[] = {
+   { "bitmap",          "bitmaps" },
+   { "blenders",        "bitmaps" },
+   { "convert",         "bitmaps" },
+   { "drawing",         "bitmaps" },
+   { "memblit",         "bitmaps" },
+   { "memdraw",         "bitmaps" },
+   { "pixels",          "bitmaps" },
+   { "tri_soft",        "bitmaps" },
+   { "clipboard",       "displays" },
+   { "display",         "displays" },
+   { "fullscreen_mode", "displays" },
+   { "monitor",         "displays" },
+   { "mouse_cursor",    "displays" },
+   { "shader",          "displays" },
+   { "transformations", "displays" },
+   { "events",          "events" },
+   { "evtsrc",          "events" },
+   { "timernu",         "events" },
+   { "haptic",          "input" },
+   { "joynu",           "input" },
+   { "keybdnu",         "input" },
+   { "mousenu",         "input" },
+   { "touch_input",     "input" },
+   { "config",          "config" },
+   { "file",            "files" },
+   { "fshook",          "files" },
+   { "lz4",             "files" },
+   { "path",            "files" },
+   { "bstrlib",         "strings" },
+   { "utf8",            "strings" },
+   { "jobs",            "threads" },
+   { "threads",         "threads" },
+   { "tls",             "threads" },
+   { NULL,              "core" }
+};
+
+
+static bool is_separator(char c)
+{
+   return c == '/' || c == '\\';
+}
+
+
+
+/* Returns the length of the first component of path. */
+static size_t component_length(const char *path)
+{
+   return strcspn(path, "/\\");
+}
+
+
+
+static const char *map_module(const MODULE_MAP *map, const char *name,
+   size_t n)
+{
+   for (; map->prefix; map++) {
+      size_t len = strlen(map->prefix);
+      if (len <= n && strncmp(name, map->prefix, len) == 0)
+         break;
+   }
+   return map->module;
+}
+
+
+
+/* Returns the length of the path to Allegro's source tree at the start of
+ * __FILE__, which tells Allegro's own files apart from the application's.
+ * Returns zero if this file isn't at src/memory.c in it.
+ */
+static size_t source_root_length(void)
+{
+   const char *file = __FILE__;
+   const size_t n = strlen(file);
+   const size_t tail = strlen("src/memory.c");
+   const char *p;
+
+   if (n < tail)
+      return 0;
+   p = file + n - tail;
+   if (strncmp(p, "src", 3) != 0 || !is_separator(p[3])
+         || strcmp(p + 4, "memory.c") != 0) {
+      return 0;
+   }
+   return n - tail;
+}
+
+
+
+static const char *get_module_name(const char *file)
+{
+   const size_t root = source_root_length();
+   const char *dir;
+   const char *name;
+   const char *module;
+
+   if (!file)
+      return "unknown";
+
+   if (strncmp(file, __FILE__, root) != 0)
+      return "application";
+   file += root;
+
+   if (strncmp(file, "addons", 6) == 0 && is_separator(file[6])) {
+      dir = file + 7;
+      return map_module(addon_modules, dir, component_length(dir));
+   }
+
+   if (strncmp(file, "src", 3) != 0 || !is_separator(file[3]))
+      return "core";
+
+   /* Platform code is grouped by directory. */
+   name = file + 4;
+   if (name[component_length(name)] != '\0') {
+      dir = name;
+      module = map_module(core_dir_modules, dir, component_length(dir));
+      if (module)
+         return module;
+      name = dir + component_length(dir) + 1;
+   }
+   return map_module(core_file_modules, name, component_length(name));
+}
+
+
+
+/* Must be called with the lock held. */
+static int find_module(const char *file)
+{
+   size_t h = ((uintptr_t)file >> 3) % FILE_CACHE_SIZE;
+   const char *name;
+   int i;
+
+   if (file && file_cache[h].file == file)
+      return file_cache[h].module;
+
+   name = get_module_name(file);
+   for (i = 0; i < num_modules; i++) {
+      if (strcmp(modules[i].name, name) == 0)
+         break;
+   }
+
+   if (i == num_modules) {
+      ASSERT(num_modules < MAX_MODULES);
+      modules[i].name = name;
+      modules[i].stats.module = name;
+      num_modules++;
+   }
+
+   file_cache[h].file = file;
+   file_cache[h].module = i;
+   return i;
+}
+
+
+
+static void add_stats(ALLEGRO_MEMORY_STATS *stats, size_t size)
+{
+   stats->current_bytes += size;
+   if (stats->current_bytes > stats->peak_bytes)
+      stats->peak_bytes = stats->current_bytes;
+   stats->current_allocations++;
+   stats->total_allocations++;
+}
+
+
+
+static void sub_stats(ALLEGRO_MEMORY_STATS *stats, size_t size)
+{
+   stats->current_bytes -= size;
+   stats->current_allocations--;
+}
+
+
+
+static void track(void *ptr, size_t size, int line, const char *file)
+{
+   BLOCK *b;
+   int m;
+
+   _al_spin_lock(&track_lock);
+
+   /* Tracking may have been turned off since the caller looked. */
+   if (!_al_atomic_load(&tracking))
+      goto done;
+
+   if ((blocks_count + 1) * 4 > blocks_capacity * 3 && !grow_blocks())
+      goto done;
+
+   m = find_module(file);
+   b = &blocks[find_block(ptr)];
+   if (!b->ptr) {
+      blocks_count++;
+   }
+   else {
+      /* Freed behind our back, for example with free() instead of al_free. */
+      sub_stats(&modules[b->module].stats, b->size);
+      sub_stats(&total_stats, b->size);
+   }
+   b->ptr = ptr;
+   b->size = size;
+   b->file = file;
+   b->line = line;
+   b->module = m;
+   add_stats(&modules[m].stats, size);
+   add_stats(&total_stats, size);
+
+done:
+   _al_spin_unlock(&track_lock);
+}
+
+
+
+/* Forgets ptr, returning what was known about it in *old if it was
+ * tracked.
+ */
+static bool untrack(void *ptr, BLOCK *old)
+{
+   bool found = false;
+   size_t i;
+
+   _al_spin_lock(&track_lock);
+
+   if (blocks_count > 0) {
+      i = find_block(ptr);
+      if (blocks[i].ptr) {
+         if (old)
+            *old = blocks[i];
+         sub_stats(&modules[blocks[i].module].stats, blocks[i].size);
+         sub_stats(&total_stats, blocks[i].size);
+         remove_block(i);
+         found = true;
+      }
+   }
+
+   _al_spin_unlock(&track_lock);
+   return found;
+}
+
 
 
 /* Function: al_set_memory_interface
@@ -38,10 +446,16 @@ void al_set_memory_interface(ALLEGRO_MEMORY_INTERFACE *memory_interface)
 void *al_malloc_with_context(size_t n,
    int line, const char *file, const char *func)
 {
+   void *ptr;
+
    if (mem)
-      return mem->mi_malloc(n, line, file, func);
+      ptr = mem->mi_malloc(n, line, file, func);
    else
-      return malloc(n);
+      ptr = malloc(n);
+
+   if (ptr && _al_atomic_load(&tracking))
+      track(ptr, n, line, file);
+   return ptr;
 }
 
 
@@ -51,6 +465,9 @@ void *al_malloc_with_context(size_t n,
 void al_free_with_context(void *ptr,
    int line, const char *file, const char *func)
 {
+   if (ptr && _al_atomic_load(&tracking))
+      untrack(ptr, NULL);
+
    if (mem)
       mem->mi_free(ptr, line, file, func);
    else
@@ -64,10 +481,30 @@ void al_free_with_context(void *ptr,
 void *al_realloc_with_context(void *ptr, size_t n,
    int line, const char *file, const char *func)
 {
+   BLOCK old;
+   bool tracked = false;
+   void *new_ptr;
+
+   /* Forget the old block first, as another thread may be given the same
+    * address as soon as it is released.
+    */
+   if (ptr && _al_atomic_load(&tracking))
+      tracked = untrack(ptr, &old);
+
    if (mem)
-      return mem->mi_realloc(ptr, n, line, file, func);
+      new_ptr = mem->mi_realloc(ptr, n, line, file, func);
    else
-      return realloc(ptr, n);
+      new_ptr = realloc(ptr, n);
+
+   if (new_ptr) {
+      if (_al_atomic_load(&tracking))
+         track(new_ptr, n, line, file);
+   }
+   else if (tracked && n > 0) {
+      /* The old block is still there. */
+      track(ptr, old.size, old.line, old.file);
+   }
+   return new_ptr;
 }
 
 
@@ -76,11 +513,291 @@ void *al_realloc_with_context(void *ptr, size_t n,
  */
 void *al_calloc_with_context(size_t count, size_t n,
    int line, const char *file, const char *func)
+{
+   void *ptr;
+
+   if (mem)
+      ptr = mem->mi_calloc(count, n, line, file, func);
+   else
+      ptr = calloc(count, n);
+
+   if (ptr && _al_atomic_load(&tracking))
+      track(ptr, count * n, line, file);
+   return ptr;
+}
+
+
+
+/* Internal function: _al_malloc_untracked
+ *  Like al_malloc, but never tracked.  For allocators which hand the
+ *  memory out in smaller pieces and track those instead, see
+ *  _al_track_allocation.
+ */
+void *_al_malloc_untracked(size_t n,
+   int line, const char *file, const char *func)
 {
    if (mem)
-      return mem->mi_calloc(count, n, line, file, func);
+      return mem->mi_malloc(n, line, file, func);
+   return malloc(n);
+}
+
+
+
+/* Internal function: _al_free_untracked
+ *  Frees memory from _al_malloc_untracked.
+ */
+void _al_free_untracked(void *ptr,
+   int line, const char *file, const char *func)
+{
+   if (mem)
+      mem->mi_free(ptr, line, file, func);
    else
-      return calloc(count, n);
+      free(ptr);
+}
+
+
+
+/* Internal function: _al_track_allocation
+ *  Counts `n` bytes at ptr as allocated by the given line, if tracking is
+ *  enabled.
+ */
+void _al_track_allocation(void *ptr, size_t n, int line, const char *file)
+{
+   if (ptr && _al_atomic_load(&tracking))
+      track(ptr, n, line, file);
+}
+
+
+
+/* Internal function: _al_untrack_allocation
+ *  Counts memory given to _al_track_allocation as freed.
+ */
+void _al_untrack_allocation(void *ptr)
+{
+   if (ptr && _al_atomic_load(&tracking))
+      untrack(ptr, NULL);
+}
+
+
+
+/* Function: al_set_memory_tracking
+ */
+void al_set_memory_tracking(bool enable)
+{
+   int i;
+
+   _al_spin_lock(&track_lock);
+
+   if (enable && !_al_atomic_load(&tracking)) {
+      memset(&total_stats, 0, sizeof(total_stats));
+      total_stats.module = "all";
+      for (i = 0; i < num_modules; i++) {
+         memset(&modules[i].stats, 0, sizeof(modules[i].stats));
+         modules[i].stats.module = modules[i].name;
+      }
+   }
+   else if (!enable) {
+      free(blocks);
+      blocks = NULL;
+      blocks_capacity = 0;
+      blocks_count = 0;
+   }
+
+   _al_atomic_store(&tracking, enable ? 1 : 0);
+
+   _al_spin_unlock(&track_lock);
+}
+
+
+
+/* Function: al_get_memory_tracking
+ */
+bool al_get_memory_tracking(void)
+{
+   return _al_atomic_load(&tracking) != 0;
+}
+
+
+
+/* Function: al_get_memory_stats
+ */
+int al_get_memory_stats(ALLEGRO_MEMORY_STATS *stats, int max_stats)
+{
+   int n;
+   int i;
+
+   ASSERT(stats || max_stats == 0);
+
+   _al_spin_lock(&track_lock);
+
+   n = num_modules + 1;
+   if (max_stats > 0) {
+      stats[0] = total_stats;
+      stats[0].module = "all";
+   }
+   for (i = 1; i < max_stats && i < n; i++)
+      stats[i] = modules[i - 1].stats;
+
+   _al_spin_unlock(&track_lock);
+
+   return n;
+}
+
+
+
+static int compare_site_location(const void *pa, const void *pb)
+{
+   const SITE *a = pa;
+   const SITE *b = pb;
+   int c = strcmp(a->file ? a->file : "", b->file ? b->file : "");
+
+   if (c != 0)
+      return c;
+   return a->line - b->line;
+}
+
+
+
+static int compare_site_bytes(const void *pa, const void *pb)
+{
+   const SITE *a = pa;
+   const SITE *b = pb;
+
+   if (a->bytes != b->bytes)
+      return (a->bytes < b->bytes) ? 1 : -1;
+   return compare_site_location(pa, pb);
+}
+
+
+
+/* Returns the live allocations grouped by the line which made them, the
+ * largest first.  The result must be freed with free().
+ */
+static SITE *collect_sites(int *num_sites)
+{
+   SITE *sites;
+   size_t i;
+   int n = 0;
+   int j;
+
+   _al_spin_lock(&track_lock);
+
+   sites = (blocks_count > 0) ? malloc(blocks_count * sizeof(SITE)) : NULL;
+   if (sites) {
+      for (i = 0; i < blocks_capacity; i++) {
+         BLOCK *b = &blocks[i];
+         if (b->ptr) {
+            sites[n].file = b->file;
+            sites[n].line = b->line;
+            sites[n].module = b->module;
+            sites[n].bytes = b->size;
+            sites[n].count = 1;
+            n++;
+         }
+      }
+   }
+
+   _al_spin_unlock(&track_lock);
+
+   if (n == 0) {
+      free(sites);
+      *num_sites = 0;
+      return NULL;
+   }
+
+   qsort(sites, n, sizeof(SITE), compare_site_location);
+   j = 0;
+   for (i = 1; i < (size_t)n; i++) {
+      if (compare_site_location(&sites[j], &sites[i]) == 0) {
+         sites[j].bytes += sites[i].bytes;
+         sites[j].count += sites[i].count;
+      }
+      else {
+         sites[++j] = sites[i];
+      }
+   }
+   n = j + 1;
+   qsort(sites, n, sizeof(SITE), compare_site_bytes);
+
+   *num_sites = n;
+   return sites;
+}
+
+
+
+static void format_site(char *buf, size_t size, const SITE *site)
+{
+   snprintf(buf, size, "%10lu bytes in %6lu blocks  %-12s %s:%d\n",
+      (unsigned long)site->bytes, (unsigned long)site->count,
+      modules[site->module].name, site->file ? site->file : "?",
+      site->line);
+}
+
+
+
+/* Function: al_dump_memory_allocations
+ */
+void al_dump_memory_allocations(ALLEGRO_FILE *f)
+{
+   SITE *sites;
+   char buf[512];
+   int n;
+   int i;
+
+   ASSERT(f);
+
+   sites = collect_sites(&n);
+   for (i = 0; i < n; i++) {
+      format_site(buf, sizeof(buf), &sites[i]);
+      al_fputs(f, buf);
+   }
+   free(sites);
+}
+
+
+
+/* Internal function: _al_report_memory_leaks
+ *  Logs the allocations which are still live, if tracking is enabled.
+ *  Called from al_uninstall_system.
+ */
+void _al_report_memory_leaks(void)
+{
+   ALLEGRO_MEMORY_STATS stats[MAX_MODULES + 1];
+   SITE *sites;
+   char buf[512];
+   int num_stats;
+   int n;
+   int i;
+
+   if (!al_get_memory_tracking())
+      return;
+
+   num_stats = al_get_memory_stats(stats, MAX_MODULES + 1);
+   if (stats[0].current_allocations == 0) {
+      ALLEGRO_INFO("No memory still allocated, peak %lu bytes.\n",
+         (unsigned long)stats[0].peak_bytes);
+      return;
+   }
+
+   ALLEGRO_WARN("%lu bytes in %lu blocks still allocated, peak %lu bytes.\n",
+      (unsigned long)stats[0].current_bytes,
+      (unsigned long)stats[0].current_allocations,
+      (unsigned long)stats[0].peak_bytes);
+
+   for (i = 1; i < num_stats; i++) {
+      if (stats[i].current_allocations > 0) {
+         ALLEGRO_WARN("%10lu bytes in %6lu blocks  %s\n",
+            (unsigned long)stats[i].current_bytes,
+            (unsigned long)stats[i].current_allocations, stats[i].module);
+      }
+   }
+
+   sites = collect_sites(&n);
+   for (i = 0; i < n; i++) {
+      format_site(buf, sizeof(buf), &sites[i]);
+      ALLEGRO_WARN("%s", buf);
+   }
+   free(sites);
 }
 
 
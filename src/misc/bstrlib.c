@@ -23,12 +23,17 @@
 #include <string.h>
 #include <ctype.h>
 #include "allegro5/allegro.h"
+#include "allegro5/internal/aintern_pool.h"
 #include "allegro5/internal/bstrlib.h"
 
 #define bstr__alloc(x)	    al_malloc(x)
 #define bstr__free(p)	    al_free(p)
 #define bstr__realloc(p, x) al_realloc((p), (x))
 
+/* String headers are small and numerous, so they come from the pools. */
+#define bstr__alloc_header()	_al_pool_alloc(sizeof (struct _al_tagbstring))
+#define bstr__free_header(b)	_al_pool_free((b), sizeof (struct _al_tagbstring))
+
 /* Optionally include a mechanism for debugging memory */
 
 #if defined(MEMORY_DEBUG) || defined(BSTRLIB_MEMORY_DEBUG)
@@ -199,11 +204,11 @@ size_t j;
 	i = snapUpSize ((int) (j + (2 - (j != 0))));
 	if (i <= (int) j) return NULL;
 
-	b = (_al_bstring) bstr__alloc (sizeof (struct _al_tagbstring));
+	b = (_al_bstring) bstr__alloc_header ();
 	if (NULL == b) return NULL;
 	b->slen = (int) j;
 	if (NULL == (b->data = (unsigned char *) bstr__alloc (b->mlen = i))) {
-		bstr__free (b);
+		bstr__free_header (b);
 		return NULL;
 	}
 
@@ -227,13 +232,13 @@ size_t j;
 	i = snapUpSize ((int) (j + (2 - (j != 0))));
 	if (i <= (int) j) return NULL;
 
-	b = (_al_bstring) bstr__alloc (sizeof (struct _al_tagbstring));
+	b = (_al_bstring) bstr__alloc_header ();
 	if (b == NULL) return NULL;
 	b->slen = (int) j;
 	if (i < mlen) i = mlen;
 
 	if (NULL == (b->data = (unsigned char *) bstr__alloc (b->mlen = i))) {
-		bstr__free (b);
+		bstr__free_header (b);
 		return NULL;
 	}
 
@@ -251,7 +256,7 @@ _al_bstring b;
 int i;
 
 	if (blk == NULL || len < 0) return NULL;
-	b = (_al_bstring) bstr__alloc (sizeof (struct _al_tagbstring));
+	b = (_al_bstring) bstr__alloc_header ();
 	if (b == NULL) return NULL;
 	b->slen = len;
 
@@ -262,7 +267,7 @@ int i;
 
 	b->data = (unsigned char *) bstr__alloc ((size_t) b->mlen);
 	if (b->data == NULL) {
-		bstr__free (b);
+		bstr__free_header (b);
 		return NULL;
 	}
 
@@ -420,7 +425,7 @@ int i,j;
 	/* Attempted to copy an invalid string? */
 	if (b == NULL || b->slen < 0 || b->data == NULL) return NULL;
 
-	b0 = (_al_bstring) bstr__alloc (sizeof (struct _al_tagbstring));
+	b0 = (_al_bstring) bstr__alloc_header ();
 	if (b0 == NULL) {
 		/* Unable to allocate memory for string header */
 		return NULL;
@@ -435,7 +440,7 @@ int i,j;
 		b0->data = (unsigned char *) bstr__alloc (j);
 		if (b0->data == NULL) {
 			/* Unable to allocate memory for string data */
-			bstr__free (b0);
+			bstr__free_header (b0);
 			return NULL;
 		}
 	}
@@ -1012,7 +1017,7 @@ int _al_bdestroy (_al_bstring b) {
 	b->mlen = -__LINE__;
 	b->data = NULL;
 
-	bstr__free (b);
+	bstr__free_header (b);
 	return _AL_BSTR_OK;
 }
 
@@ -2253,11 +2258,11 @@ int i, c, v;
 
 	if (sep != NULL) c += (bl->qty - 1) * sep->slen;
 
-	b = (_al_bstring) bstr__alloc (sizeof (struct _al_tagbstring));
+	b = (_al_bstring) bstr__alloc_header ();
 	if (NULL == b) return NULL; /* Out of memory */
 	b->data = (unsigned char *) bstr__alloc (c);
 	if (b->data == NULL) {
-		bstr__free (b);
+		bstr__free_header (b);
 		return NULL;
 	}
 
@@ -26,6 +26,7 @@
 #include "allegro5/allegro.h"
 #include "allegro5/internal/aintern.h"
 #include "allegro5/internal/aintern_list.h"
+#include "allegro5/internal/aintern_pool.h"
 
 
 ALLEGRO_DEBUG_CHANNEL("list")
@@ -194,7 +195,9 @@ static _AL_LIST_ITEM* list_create_item(_AL_LIST* list)
    }
    else {
 
-      item = (_AL_LIST_ITEM*)al_malloc(list->item_size_with_extra);
+      item = (_AL_LIST_ITEM*)_al_pool_alloc(list->item_size_with_extra);
+      if (NULL == item)
+         return NULL;
 
       item->list = list;
    }
@@ -219,7 +222,7 @@ static void list_destroy_item(_AL_LIST* list, _AL_LIST_ITEM* item)
       list->next_free = item;
    }
    else
-      al_free(item);
+      _al_pool_free(item, list->item_size_with_extra);
 }
 
 
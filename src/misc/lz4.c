@@ -0,0 +1,279 @@
+/*         ______   ___    ___
+ *        /\  _  \ /\_ \  /\_ \
+ *        \ \ \L\ \\//\ \ \//\ \      __     __   _ __   ___
+ *         \ \  __ \ \ \ \  \ \ \   /'__`\ /'_ `\/\`'__\/ __`\
+ *          \ \ \/\ \ \_\ \_ \_\ \_/\  __//\ \L\ \ \ \//\ \L\ \
+ *           \ \_\ \_\/\____\/\____\ \____\ \____ \ \_\\ \____/
+ *            \/_/\/_/\/____/\/____/\/____/\/___L\ \/_/ \/___/
+ *                                           /\____/
+ *                                           \_/__/
+ *
+ *      LZ4 block compression.
+ *
+ *      See readme.txt for copyright information.
+ *
+ *
+ *      A small implementation of the LZ4 block format, used for A5BMP
+ *      pixel data and pack files.  The compressor is a plain greedy one; decompression is
+ *      what matters and runs at memory speed.
+ *
+ *      Each sequence is a token byte (literal length in the high nibble,
+ *      match length minus 4 in the low nibble, 15 meaning more length
+ *      bytes follow), the literals, then a 16-bit little endian offset
+ *      back into the output.  The last sequence has literals only.
+ */
+
+#include "allegro5/allegro.h"
+#include "allegro5/internal/aintern.h"
+#include "allegro5/internal/aintern_lz4.h"
+
+
+#define MIN_MATCH       4
+#define LAST_LITERALS   5     /* The last bytes are always literals. */
+#define MF_LIMIT        12    /* No match may start this close to the end. */
+#define MAX_OFFSET      65535
+#define HASH_BITS       12
+
+
+static uint32_t read32(const unsigned char *p)
+{
+   uint32_t v;
+   memcpy(&v, p, 4);
+   return v;
+}
+
+
+static unsigned hash32(uint32_t v)
+{
+   return (v * 2654435761u) >> (32 - HASH_BITS);
+}
+
+
+/* Writes a length continuation, returning NULL if it won't fit. */
+static unsigned char *put_length(unsigned char *op, unsigned char *oend,
+   size_t len)
+{
+   while (len >= 255) {
+      if (op >= oend)
+         return NULL;
+      *op++ = 255;
+      len -= 255;
+   }
+   if (op >= oend)
+      return NULL;
+   *op++ = (unsigned char)len;
+   return op;
+}
+
+
+static unsigned char *put_sequence(unsigned char *op, unsigned char *oend,
+   const unsigned char *literals, size_t num_literals, size_t offset,
+   size_t match_len)
+{
+   unsigned char *token;
+
+   if (op >= oend)
+      return NULL;
+   token = op++;
+
+   if (num_literals >= 15) {
+      *token = 15 << 4;
+      op = put_length(op, oend, num_literals - 15);
+      if (!op)
+         return NULL;
+   }
+   else {
+      *token = (unsigned char)(num_literals << 4);
+   }
+
+   if ((size_t)(oend - op) < num_literals)
+      return NULL;
+   memcpy(op, literals, num_literals);
+   op += num_literals;
+
+   if (match_len == 0)
+      return op;
+
+   if (oend - op < 2)
+      return NULL;
+   *op++ = offset & 0xff;
+   *op++ = offset >> 8;
+
+   match_len -= MIN_MATCH;
+   if (match_len >= 15) {
+      *token |= 15;
+      op = put_length(op, oend, match_len - 15);
+   }
+   else {
+      *token |= (unsigned char)match_len;
+   }
+
+   return op;
+}
+
+
+/* Internal function: _al_lz4_compress_bound
+ *  Returns the largest size _al_lz4_compress can produce for `size`
+ *  bytes of input.
+ */
+size_t _al_lz4_compress_bound(size_t size)
+{
+   return size + size / 255 + 16;
+}
+
+
+/* Internal function: _al_lz4_compress
+ *  Compresses `src` into `dst`, returning the compressed size, or 0 if it
+ *  doesn't fit in `dst_capacity` bytes.
+ */
+size_t _al_lz4_compress(const void *src, size_t src_size, void *dst,
+   size_t dst_capacity)
+{
+   const unsigned char *in = src;
+   const unsigned char *ip = in;
+   const unsigned char *anchor = in;
+   const unsigned char *iend = in + src_size;
+   const unsigned char *mflimit = iend - MF_LIMIT;
+   const unsigned char *matchlimit = iend - LAST_LITERALS;
+   unsigned char *op = dst;
+   unsigned char *oend = op + dst_capacity;
+   size_t *table;
+
+   if (src_size > MF_LIMIT) {
+      table = al_calloc(1 << HASH_BITS, sizeof(*table));
+      if (!table)
+         return 0;
+
+      while (ip < mflimit) {
+         unsigned h = hash32(read32(ip));
+         const unsigned char *ref = in + table[h];
+         const unsigned char *start;
+         size_t len;
+
+         table[h] = ip - in;
+         if (ref >= ip || ip - ref > MAX_OFFSET || read32(ref) != read32(ip)) {
+            ip++;
+            continue;
+         }
+
+         /* Extend the match forwards, then backwards over literals. */
+         start = ip;
+         len = MIN_MATCH;
+         while (start + len < matchlimit && start[len] == ref[len])
+            len++;
+         while (start > anchor && ref > in && start[-1] == ref[-1]) {
+            start--;
+            ref--;
+            len++;
+         }
+
+         op = put_sequence(op, oend, anchor, start - anchor, start - ref, len);
+         if (!op) {
+            al_free(table);
+            return 0;
+         }
+
+         ip = anchor = start + len;
+         if (ip < mflimit)
+            table[hash32(read32(ip - 2))] = ip - 2 - in;
+      }
+
+      al_free(table);
+   }
+
+   op = put_sequence(op, oend, anchor, iend - anchor, 0, 0);
+   if (!op)
+      return 0;
+
+   return op - (unsigned char *)dst;
+}
+
+
+/* Internal function: _al_lz4_decompress_bound
+ *  Returns the largest size `src_size` bytes of compressed data can
+ *  decompress to.  No input byte stands for more than 255 output bytes.
+ */
+size_t _al_lz4_decompress_bound(size_t src_size)
+{
+   if (src_size > (size_t)-1 / 255)
+      return (size_t)-1;
+   return src_size * 255;
+}
+
+
+/* Internal function: _al_lz4_decompress
+ *  Decompresses `src`, which must decode to exactly `dst_size` bytes.
+ *  Malformed input is detected and never reads or writes out of bounds.
+ */
+bool _al_lz4_decompress(const void *src, size_t src_size, void *dst,
+   size_t dst_size)
+{
+   const unsigned char *ip = src;
+   const unsigned char *iend = ip + src_size;
+   unsigned char *out = dst;
+   unsigned char *op = out;
+   unsigned char *oend = out + dst_size;
+
+   while (ip < iend) {
+      unsigned token = *ip++;
+      size_t len = token >> 4;
+      size_t offset;
+      const unsigned char *match;
+
+      if (len == 15) {
+         unsigned b;
+         do {
+            if (ip >= iend)
+               return false;
+            b = *ip++;
+            len += b;
+         } while (b == 255);
+      }
+
+      if ((size_t)(iend - ip) < len || (size_t)(oend - op) < len)
+         return false;
+      memcpy(op, ip, len);
+      ip += len;
+      op += len;
+
+      if (ip == iend)
+         break;
+
+      if (iend - ip < 2)
+         return false;
+      offset = ip[0] | (ip[1] << 8);
+      ip += 2;
+      if (offset == 0 || offset > (size_t)(op - out))
+         return false;
+
+      len = token & 15;
+      if (len == 15) {
+         unsigned b;
+         do {
+            if (ip >= iend)
+               return false;
+            b = *ip++;
+            len += b;
+         } while (b == 255);
+      }
+      len += MIN_MATCH;
+
+      if ((size_t)(oend - op) < len)
+         return false;
+
+      match = op - offset;
+      if (offset >= len) {
+         memcpy(op, match, len);
+         op += len;
+      }
+      else {
+         /* Overlapping copy, which repeats the last `offset` bytes. */
+         while (len--)
+            *op++ = *match++;
+      }
+   }
+
+   return op == oend;
+}
+
+/* vim: set sts=3 sw=3 et: */
@@ -0,0 +1,365 @@
+/*         ______   ___    ___
+ *        /\  _  \ /\_ \  /\_ \
+ *        \ \ \L\ \\//\ \ \//\ \      __     __   _ __   ___
+ *         \ \  __ \ \ \ \  \ \ \   /'__`\ /'_ `\/\`'__\/ __`\
+ *          \ \ \/\ \ \_\ \_ \_\ \_/\  __//\ \L\ \ \ \//\ \L\ \
+ *           \ \_\ \_\/\____\/\____\ \____\ \____ \ \_\\ \____/
+ *            \/_/\/_/\/____/\/____/\/____/\/___L\ \/_/ \/___/
+ *                                           /\____/
+ *                                           \_/__/
+ *
+ *      Pools for small internal objects.
+ *
+ *      See readme.txt for copyright information.
+ *
+ *
+ *      Strings, list items, config entries and file system entries are
+ *      small and come and go one at a time.  Instead of a trip to
+ *      al_malloc each, they are cut from larger blocks and recycled
+ *      through one free list per size class.  Callers pass the size back
+ *      to _al_pool_free, so the objects carry no header.
+ *
+ *      Threads started with al_create_thread, and the thread which called
+ *      al_install_system, keep a few free objects of each size to
+ *      themselves so that most calls don't take the lock.  Other threads
+ *      have no way to return their cache when they exit, so they always
+ *      use the shared lists.
+ *
+ *      Blocks are given back at al_uninstall_system if every object has
+ *      been freed by then.  Otherwise they are kept, as objects such as
+ *      strings may outlive it.
+ *
+ *      Memory tracking counts the objects, against the code which asked
+ *      for them, rather than the blocks.
+ */
+
+
+#include <string.h>
+
+#include "allegro5/allegro.h"
+#include "allegro5/internal/aintern.h"
+#include "allegro5/internal/aintern_atomicops.h"
+#include "allegro5/internal/aintern_exitfunc.h"
+#include "allegro5/internal/aintern_memory.h"
+#include "allegro5/internal/aintern_pool.h"
+#include "allegro5/internal/aintern_tls.h"
+
+
+#define GRANULE         16
+#define NUM_CLASSES     (_AL_POOL_MAX_SIZE / GRANULE)
+#define BLOCK_SIZE      16384
+#define CACHE_SIZE      32
+
+
+typedef struct FREE_OBJECT {
+   struct FREE_OBJECT *next;
+} FREE_OBJECT;
+
+
+typedef struct SIZE_CLASS {
+   FREE_OBJECT *free;
+   char *next;                /* unused part of the newest block */
+   char *end;
+   size_t num_objects;        /* objects cut from blocks so far */
+} SIZE_CLASS;
+
+
+struct _AL_POOL_CACHE {
+   FREE_OBJECT *free[NUM_CLASSES];
+   int count[NUM_CLASSES];
+};
+
+
+/* Strings may be used from several threads before al_install_system or
+ * after al_uninstall_system, when a _AL_MUTEX isn't available, so the
+ * shared lists are protected by a spin lock instead.  It is only ever held
+ * for a few list operations, or to allocate a block.
+ */
+static volatile _AL_ATOMIC pool_lock = 0;
+
+static bool pools_inited = false;
+static bool tls_ready = false;
+static SIZE_CLASS classes[NUM_CLASSES];
+
+/* All blocks, linked through their first word. */
+static void *blocks = NULL;
+
+
+static int size_class(size_t size)
+{
+   return size ? (int)((size - 1) / GRANULE) : 0;
+}
+
+
+/* Takes up to n objects of class c from the shared lists, returning them
+ * linked together.  Must be called with the lock held.
+ */
+static FREE_OBJECT *take_objects(int c, int n, int *count)
+{
+   SIZE_CLASS *sc = &classes[c];
+   size_t size = (c + 1) * GRANULE;
+   FREE_OBJECT *list = NULL;
+   FREE_OBJECT *obj;
+   int i;
+
+   for (i = 0; i < n; i++) {
+      if (sc->free) {
+         obj = sc->free;
+         sc->free = obj->next;
+      }
+      else {
+         if ((size_t)(sc->end - sc->next) < size) {
+            char *block = _al_malloc_untracked(BLOCK_SIZE,
+               __LINE__, __FILE__, __func__);
+            if (!block)
+               break;
+            *(void **)block = blocks;
+            blocks = block;
+            /* Keep the objects aligned to the granule. */
+            sc->next = block + GRANULE;
+            sc->end = block + BLOCK_SIZE;
+         }
+         obj = (FREE_OBJECT *)sc->next;
+         sc->next += size;
+         sc->num_objects++;
+      }
+      obj->next = list;
+      list = obj;
+   }
+
+   *count = i;
+   return list;
+}
+
+
+/* Moves up to n objects of class c from a thread's cache to the shared
+ * lists.  Must be called with the lock held.
+ */
+static void give_objects(_AL_POOL_CACHE *cache, int c, int n)
+{
+   SIZE_CLASS *sc = &classes[c];
+
+   while (n-- > 0 && cache->free[c]) {
+      FREE_OBJECT *obj = cache->free[c];
+      cache->free[c] = obj->next;
+      cache->count[c]--;
+      obj->next = sc->free;
+      sc->free = obj;
+   }
+}
+
+
+static _AL_POOL_CACHE *get_cache(void)
+{
+   /* Before al_install_system there is no thread local storage yet. */
+   if (!pools_inited)
+      return NULL;
+   return *_al_tls_get_pool_cache();
+}
+
+
+/* Returns true if every object cut from the blocks is on the shared
+ * lists.  Must be called with the lock held.
+ */
+static bool all_objects_free(void)
+{
+   FREE_OBJECT *obj;
+   size_t n;
+   int c;
+
+   for (c = 0; c < NUM_CLASSES; c++) {
+      n = 0;
+      for (obj = classes[c].free; obj; obj = obj->next)
+         n++;
+      if (n != classes[c].num_objects)
+         return false;
+   }
+   return true;
+}
+
+
+static void free_blocks(void)
+{
+   void *block;
+
+   while (blocks) {
+      block = blocks;
+      blocks = *(void **)block;
+      _al_free_untracked(block, __LINE__, __FILE__, __func__);
+   }
+   memset(classes, 0, sizeof(classes));
+}
+
+
+static void shutdown_pools(void)
+{
+   _al_pool_detach_thread();
+   pools_inited = false;
+
+   /* Threads which are still running keep their caches, so this fails
+    * as long as any of them exist.
+    */
+   _al_spin_lock(&pool_lock);
+   if (all_objects_free())
+      free_blocks();
+   _al_spin_unlock(&pool_lock);
+}
+
+
+/* Internal function: _al_init_pools
+ *  Called from al_install_system.
+ */
+void _al_init_pools(void)
+{
+   pools_inited = true;
+   tls_ready = true;
+   _al_pool_attach_thread();
+   _al_add_exit_func(shutdown_pools, "shutdown_pools");
+}
+
+
+/* Internal function: _al_pool_attach_thread
+ *  Gives the calling thread its own cache of free objects.  The thread
+ *  must call _al_pool_detach_thread before it exits.
+ */
+void _al_pool_attach_thread(void)
+{
+   _AL_POOL_CACHE **cache;
+
+   if (!pools_inited)
+      return;
+
+   cache = _al_tls_get_pool_cache();
+   if (!*cache)
+      *cache = al_calloc(1, sizeof(_AL_POOL_CACHE));
+}
+
+
+/* Internal function: _al_pool_detach_thread
+ *  Returns the calling thread's cached objects to the shared lists.
+ */
+void _al_pool_detach_thread(void)
+{
+   _AL_POOL_CACHE **cache;
+   int c;
+
+   /* The thread may outlive al_uninstall_system, but still has to give
+    * its objects back.
+    */
+   if (!tls_ready)
+      return;
+
+   cache = _al_tls_get_pool_cache();
+   if (!*cache)
+      return;
+
+   _al_spin_lock(&pool_lock);
+   for (c = 0; c < NUM_CLASSES; c++)
+      give_objects(*cache, c, (*cache)->count[c]);
+   _al_spin_unlock(&pool_lock);
+
+   al_free(*cache);
+   *cache = NULL;
+}
+
+
+/* Internal function: _al_pool_alloc_with_context
+ *  Allocates `size` bytes, to be freed with _al_pool_free.
+ */
+void *_al_pool_alloc_with_context(size_t size,
+   int line, const char *file, const char *func)
+{
+   _AL_POOL_CACHE *cache;
+   FREE_OBJECT *obj;
+   int c, n;
+
+   if (size > _AL_POOL_MAX_SIZE)
+      return al_malloc_with_context(size, line, file, func);
+
+   c = size_class(size);
+   cache = get_cache();
+
+   if (!cache) {
+      _al_spin_lock(&pool_lock);
+      obj = take_objects(c, 1, &n);
+      _al_spin_unlock(&pool_lock);
+   }
+   else {
+      if (cache->count[c] == 0) {
+         _al_spin_lock(&pool_lock);
+         cache->free[c] = take_objects(c, CACHE_SIZE / 2, &cache->count[c]);
+         _al_spin_unlock(&pool_lock);
+         if (cache->count[c] == 0)
+            return NULL;
+      }
+
+      obj = cache->free[c];
+      cache->free[c] = obj->next;
+      cache->count[c]--;
+   }
+
+   _al_track_allocation(obj, size, line, file);
+   return obj;
+}
+
+
+/* Internal function: _al_pool_calloc_with_context
+ *  Like _al_pool_alloc_with_context but clears the memory.
+ */
+void *_al_pool_calloc_with_context(size_t size,
+   int line, const char *file, const char *func)
+{
+   void *ptr = _al_pool_alloc_with_context(size, line, file, func);
+
+   if (ptr)
+      memset(ptr, 0, size);
+   return ptr;
+}
+
+
+/* Internal function: _al_pool_free
+ *  Frees memory from _al_pool_alloc.  `size` must be the size which was
+ *  asked for.
+ */
+void _al_pool_free(void *ptr, size_t size)
+{
+   _AL_POOL_CACHE *cache;
+   FREE_OBJECT *obj = ptr;
+   int c;
+
+   if (!ptr)
+      return;
+
+   if (size > _AL_POOL_MAX_SIZE) {
+      al_free(ptr);
+      return;
+   }
+
+   _al_untrack_allocation(ptr);
+
+   c = size_class(size);
+   cache = get_cache();
+
+   if (!cache) {
+      _al_spin_lock(&pool_lock);
+      obj->next = classes[c].free;
+      classes[c].free = obj;
+      _al_spin_unlock(&pool_lock);
+      return;
+   }
+
+   obj->next = cache->free[c];
+   cache->free[c] = obj;
+
+   /* Hand half back once the cache is full, so that a thread which mostly
+    * frees what others allocated doesn't keep it all.
+    */
+   if (++cache->count[c] >= CACHE_SIZE) {
+      _al_spin_lock(&pool_lock);
+      give_objects(cache, c, CACHE_SIZE / 2);
+      _al_spin_unlock(&pool_lock);
+   }
+}
+
+
+/* vim: set sts=3 sw=3 et: */
@@ -29,7 +29,10 @@
 #include "allegro5/internal/aintern_debug.h"
 #include "allegro5/internal/aintern_dtor.h"
 #include "allegro5/internal/aintern_exitfunc.h"
+#include "allegro5/internal/aintern_jobs.h"
+#include "allegro5/internal/aintern_memory.h"
 #include "allegro5/internal/aintern_pixels.h"
+#include "allegro5/internal/aintern_pool.h"
 #include "allegro5/internal/aintern_system.h"
 #include "allegro5/internal/aintern_thread.h"
 #include "allegro5/internal/aintern_timer.h"
@@ -218,6 +221,9 @@ bool al_install_system(int version, int (*atexit_ptr)(void (*)(void)))
    active_sysdrv = &bootstrap;
    read_allegro_cfg();
 
+   if (al_get_config_bool(sys_config, "memory", "tracking", false))
+      al_set_memory_tracking(true);
+
 #ifdef ALLEGRO_BCC32
    /* This supresses exceptions on floating point divide by zero */
    _control87(MCW_EM, MCW_EM);
@@ -248,6 +254,11 @@ bool al_install_system(int version, int (*atexit_ptr)(void (*)(void)))
       al_set_app_name(NULL);
    }
 
+   /* Registered first so that the pools shut down last, after the system
+    * config has been destroyed.
+    */
+   _al_init_pools();
+
    _al_add_exit_func(shutdown_system_driver, "shutdown_system_driver");
 
    _al_dtor_list = _al_init_destructors();
@@ -262,6 +273,8 @@ bool al_install_system(int version, int (*atexit_ptr)(void (*)(void)))
 
    _al_init_timers();
 
+   _al_init_jobs();
+
 #ifdef ALLEGRO_CFG_SHADER_GLSL
    _al_glsl_init_shaders();
 #endif
@@ -288,6 +301,8 @@ bool al_install_system(int version, int (*atexit_ptr)(void (*)(void)))
  */
 void al_uninstall_system(void)
 {
+   bool was_installed = al_is_system_installed();
+
    /* Note: al_uninstall_system may get called multiple times without an
     * al_install_system in between. For example if the user manually
     * calls it at the end of the program it is called right again
@@ -303,6 +318,9 @@ void al_uninstall_system(void)
    _al_glsl_shutdown_shaders();
 #endif
 
+   if (was_installed)
+      _al_report_memory_leaks();
+
    _al_shutdown_logging();
 
    /* shutdown_system_driver is registered as an exit func so we don't need
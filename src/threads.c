@@ -18,6 +18,8 @@
 
 #include "allegro5/allegro.h"
 #include "allegro5/internal/aintern.h"
+#include "allegro5/internal/aintern_atomicops.h"
+#include "allegro5/internal/aintern_pool.h"
 #include "allegro5/internal/aintern_thread.h"
 #include "allegro5/internal/aintern_system.h"
 
@@ -47,6 +49,8 @@ struct ALLEGRO_THREAD {
 
 struct ALLEGRO_MUTEX {
    _AL_MUTEX mutex;
+   bool adaptive;
+   volatile _AL_ATOMIC spin_estimate;  /* written while holding the mutex */
 };
 
 
@@ -55,6 +59,38 @@ struct ALLEGRO_COND {
 };
 
 
+/* Readers and writers only touch the mutex when they have to block or
+ * wake someone up.  `state' is the number of active readers, or -1 while
+ * a writer holds the lock.
+ */
+struct ALLEGRO_RWLOCK {
+   volatile _AL_ATOMIC state;
+   volatile _AL_ATOMIC waiting_readers;
+   volatile _AL_ATOMIC waiting_writers;
+   _AL_MUTEX mutex;
+   _AL_COND cond;
+};
+
+
+/* Bounds on how many times an adaptive mutex polls before going to sleep.
+ * The actual limit follows the number of polls it recently took to get the
+ * lock, in the same way as glibc's PTHREAD_MUTEX_ADAPTIVE_NP.
+ */
+#define ADAPTIVE_MIN_SPINS    10
+#define ADAPTIVE_MAX_SPINS    100
+
+/* How many times _al_spin_lock polls before yielding. */
+#define SPIN_LOCK_SPINS       100
+
+#if defined(__GNUC__) && (defined(__i386__) || defined(__x86_64__))
+   #define CPU_RELAX()  __asm__ __volatile__ ("pause" : : : "memory")
+#elif defined(_MSC_VER)
+   #define CPU_RELAX()  YieldProcessor()
+#else
+   #define CPU_RELAX()  ((void)0)
+#endif
+
+
 static void thread_func_trampoline(_AL_THREAD *inner, void *_outer)
 {
    ALLEGRO_THREAD *outer = (ALLEGRO_THREAD *) _outer;
@@ -76,8 +112,10 @@ static void thread_func_trampoline(_AL_THREAD *inner, void *_outer)
 
    if (outer->thread_state == THREAD_STATE_STARTING) {
       outer->thread_state = THREAD_STATE_STARTED;
+      _al_pool_attach_thread();
       outer->retval =
          ((void *(*)(ALLEGRO_THREAD *, void *))outer->proc)(outer, outer->arg);
+      _al_pool_detach_thread();
    }
 
    if (system && system->vt && system->vt->thread_exit) {
@@ -91,7 +129,9 @@ static void detached_thread_func_trampoline(_AL_THREAD *inner, void *_outer)
    ALLEGRO_THREAD *outer = (ALLEGRO_THREAD *) _outer;
    (void)inner;
 
+   _al_pool_attach_thread();
    ((void *(*)(void *))outer->proc)(outer->arg);
+   _al_pool_detach_thread();
    al_free(outer);
 }
 
@@ -285,6 +325,21 @@ ALLEGRO_MUTEX *al_create_mutex(void)
    if (mutex) {
       _AL_MARK_MUTEX_UNINITED(mutex->mutex);
       _al_mutex_init(&mutex->mutex);
+      mutex->adaptive = false;
+      mutex->spin_estimate = 0;
+   }
+   return mutex;
+}
+
+
+/* Function: al_create_mutex_adaptive
+ */
+ALLEGRO_MUTEX *al_create_mutex_adaptive(void)
+{
+   ALLEGRO_MUTEX *mutex = al_create_mutex();
+   /* Spinning can only help if the owner is running on another CPU. */
+   if (mutex && al_get_cpu_count() > 1) {
+      mutex->adaptive = true;
    }
    return mutex;
 }
@@ -298,17 +353,51 @@ ALLEGRO_MUTEX *al_create_mutex_recursive(void)
    if (mutex) {
       _AL_MARK_MUTEX_UNINITED(mutex->mutex);
       _al_mutex_init_recursive(&mutex->mutex);
+      mutex->adaptive = false;
+      mutex->spin_estimate = 0;
    }
    return mutex;
 }
 
 
+static void update_spin_estimate(ALLEGRO_MUTEX *mutex, int spins)
+{
+   int estimate = _al_atomic_load(&mutex->spin_estimate);
+   _al_atomic_store(&mutex->spin_estimate, estimate + (spins - estimate) / 8);
+}
+
+
+static void lock_adaptive_mutex(ALLEGRO_MUTEX *mutex)
+{
+   int estimate = _al_atomic_load(&mutex->spin_estimate);
+   int max_spins = estimate * 2 + ADAPTIVE_MIN_SPINS;
+   int spins;
+
+   if (max_spins > ADAPTIVE_MAX_SPINS)
+      max_spins = ADAPTIVE_MAX_SPINS;
+
+   for (spins = 0; spins < max_spins; spins++) {
+      if (_al_mutex_trylock(&mutex->mutex)) {
+         update_spin_estimate(mutex, spins);
+         return;
+      }
+      CPU_RELAX();
+   }
+
+   _al_mutex_lock(&mutex->mutex);
+   update_spin_estimate(mutex, max_spins);
+}
+
+
 /* Function: al_lock_mutex
  */
 void al_lock_mutex(ALLEGRO_MUTEX *mutex)
 {
    ASSERT(mutex);
-   _al_mutex_lock(&mutex->mutex);
+   if (mutex->adaptive)
+      lock_adaptive_mutex(mutex);
+   else
+      _al_mutex_lock(&mutex->mutex);
 }
 
 
@@ -400,4 +489,228 @@ void al_signal_cond(ALLEGRO_COND *cond)
 }
 
 
+/* Function: al_create_rwlock
+ */
+ALLEGRO_RWLOCK *al_create_rwlock(void)
+{
+   ALLEGRO_RWLOCK *rwlock = al_malloc(sizeof(*rwlock));
+   if (rwlock) {
+      rwlock->state = 0;
+      rwlock->waiting_readers = 0;
+      rwlock->waiting_writers = 0;
+      _AL_MARK_MUTEX_UNINITED(rwlock->mutex);
+      _al_mutex_init(&rwlock->mutex);
+      _al_cond_init(&rwlock->cond);
+   }
+   return rwlock;
+}
+
+
+/* Function: al_destroy_rwlock
+ */
+void al_destroy_rwlock(ALLEGRO_RWLOCK *rwlock)
+{
+   if (rwlock) {
+      ASSERT(rwlock->state == 0);
+      _al_cond_destroy(&rwlock->cond);
+      _al_mutex_destroy(&rwlock->mutex);
+      al_free(rwlock);
+   }
+}
+
+
+static void wake_rwlock_waiters(ALLEGRO_RWLOCK *rwlock)
+{
+   /* Taking the mutex means a waiter is either already asleep or has yet to
+    * look at the state, so the wakeup cannot be lost.
+    */
+   _al_mutex_lock(&rwlock->mutex);
+   _al_cond_broadcast(&rwlock->cond);
+   _al_mutex_unlock(&rwlock->mutex);
+}
+
+
+static bool try_lock_rwlock_read(ALLEGRO_RWLOCK *rwlock)
+{
+   _AL_ATOMIC state;
+
+   /* New readers queue up behind waiting writers so that a steady stream
+    * of readers cannot starve them.
+    */
+   for (;;) {
+      state = _al_atomic_load(&rwlock->state);
+      if (state < 0 || _al_atomic_load(&rwlock->waiting_writers) > 0)
+         return false;
+      if (_al_compare_and_swap(&rwlock->state, state, state + 1))
+         return true;
+   }
+}
+
+
+/* Function: al_lock_rwlock_read
+ */
+void al_lock_rwlock_read(ALLEGRO_RWLOCK *rwlock)
+{
+   ASSERT(rwlock);
+
+   if (try_lock_rwlock_read(rwlock))
+      return;
+
+   _al_mutex_lock(&rwlock->mutex);
+   _al_fetch_and_add1(&rwlock->waiting_readers);
+   while (!try_lock_rwlock_read(rwlock)) {
+      _al_cond_wait(&rwlock->cond, &rwlock->mutex);
+   }
+   _al_sub1_and_fetch(&rwlock->waiting_readers);
+   _al_mutex_unlock(&rwlock->mutex);
+}
+
+
+/* Function: al_lock_rwlock_write
+ */
+void al_lock_rwlock_write(ALLEGRO_RWLOCK *rwlock)
+{
+   ASSERT(rwlock);
+
+   _al_fetch_and_add1(&rwlock->waiting_writers);
+
+   if (!_al_compare_and_swap(&rwlock->state, 0, -1)) {
+      _al_mutex_lock(&rwlock->mutex);
+      while (!_al_compare_and_swap(&rwlock->state, 0, -1)) {
+         _al_cond_wait(&rwlock->cond, &rwlock->mutex);
+      }
+      _al_mutex_unlock(&rwlock->mutex);
+   }
+
+   _al_sub1_and_fetch(&rwlock->waiting_writers);
+}
+
+
+/* Function: al_unlock_rwlock
+ */
+void al_unlock_rwlock(ALLEGRO_RWLOCK *rwlock)
+{
+   ASSERT(rwlock);
+   ASSERT(_al_atomic_load(&rwlock->state) != 0);
+
+   if (_al_atomic_load(&rwlock->state) < 0) {
+      _al_atomic_store(&rwlock->state, 0);
+      if (_al_atomic_load(&rwlock->waiting_readers) > 0 ||
+            _al_atomic_load(&rwlock->waiting_writers) > 0) {
+         wake_rwlock_waiters(rwlock);
+      }
+   }
+   else {
+      if (_al_sub1_and_fetch(&rwlock->state) == 0 &&
+            _al_atomic_load(&rwlock->waiting_writers) > 0) {
+         wake_rwlock_waiters(rwlock);
+      }
+   }
+}
+
+
+/* Internal function: _al_spin_lock
+ *  Yields to other threads after a while, in case the holder was
+ *  preempted.
+ */
+void _al_spin_lock(volatile _AL_ATOMIC *lock)
+{
+   int spins = 0;
+
+   while (!_al_compare_and_swap(lock, 0, 1)) {
+      CPU_RELAX();
+      if (++spins == SPIN_LOCK_SPINS) {
+         al_rest(0);
+         spins = 0;
+      }
+   }
+}
+
+
+/* Internal function: _al_spin_unlock
+ */
+void _al_spin_unlock(volatile _AL_ATOMIC *lock)
+{
+   _al_atomic_store(lock, 0);
+}
+
+
+/* Function: al_atomic_load_int
+ */
+int al_atomic_load_int(volatile int *ptr)
+{
+   ASSERT(ptr);
+
+   return _al_atomic_load((volatile _AL_ATOMIC *)ptr);
+}
+
+
+/* Function: al_atomic_store_int
+ */
+void al_atomic_store_int(volatile int *ptr, int value)
+{
+   ASSERT(ptr);
+
+   _al_atomic_store((volatile _AL_ATOMIC *)ptr, value);
+}
+
+
+/* Function: al_atomic_add_int
+ */
+int al_atomic_add_int(volatile int *ptr, int value)
+{
+   _AL_ATOMIC old;
+   ASSERT(ptr);
+
+   do {
+      old = _al_atomic_load((volatile _AL_ATOMIC *)ptr);
+   } while (!_al_compare_and_swap((volatile _AL_ATOMIC *)ptr, old,
+      old + value));
+
+   return old + value;
+}
+
+
+/* Function: al_atomic_compare_and_swap_int
+ */
+bool al_atomic_compare_and_swap_int(volatile int *ptr, int oldval,
+   int newval)
+{
+   ASSERT(ptr);
+
+   return _al_compare_and_swap((volatile _AL_ATOMIC *)ptr, oldval, newval);
+}
+
+
+/* Function: al_atomic_load_ptr
+ */
+void *al_atomic_load_ptr(void * volatile *ptr)
+{
+   ASSERT(ptr);
+
+   return _al_atomic_load_ptr(ptr);
+}
+
+
+/* Function: al_atomic_store_ptr
+ */
+void al_atomic_store_ptr(void * volatile *ptr, void *value)
+{
+   ASSERT(ptr);
+
+   _al_atomic_store_ptr(ptr, value);
+}
+
+
+/* Function: al_atomic_compare_and_swap_ptr
+ */
+bool al_atomic_compare_and_swap_ptr(void * volatile *ptr, void *oldval,
+   void *newval)
+{
+   ASSERT(ptr);
+
+   return _al_compare_and_swap_ptr(ptr, oldval, newval);
+}
+
+
 /* vim: set sts=3 sw=3 et: */
@@ -34,7 +34,7 @@
 
 
 /* forward declarations */
-static double timer_thread_handle_tick(double interval);
+static void timer_thread_handle_tick(double now);
 static void timer_handle_tick(ALLEGRO_TIMER *timer);
 
 
@@ -44,21 +44,124 @@ struct ALLEGRO_TIMER
    bool started;
    double speed_secs;
    int64_t count;
-   double counter;		/* counts down to zero=blastoff */
+   double counter;		/* time left until the next tick, while stopped */
+   double deadline;		/* al_get_time() of the next tick, while started */
+   unsigned int heap_index;	/* position in active_timers */
 };
 
 
 
 /*
  * The timer thread that runs in the background to drive the timers.
+ *
+ * active_timers is a binary min-heap ordered by deadline, so the thread
+ * only ever looks at the timers which are due and sleeps until the
+ * earliest deadline.  timers_cond is signalled when that may have
+ * changed.
  */
 
 static _AL_MUTEX timers_mutex = _AL_MUTEX_UNINITED;
+static _AL_COND timers_cond;
 static _AL_VECTOR active_timers = _AL_VECTOR_INITIALIZER(ALLEGRO_TIMER *);
 static _AL_THREAD * volatile timer_thread = NULL;
 
 
 
+static ALLEGRO_TIMER *heap_get(unsigned int i)
+{
+   ALLEGRO_TIMER **slot = _al_vector_ref(&active_timers, i);
+   return *slot;
+}
+
+
+
+static void heap_set(unsigned int i, ALLEGRO_TIMER *timer)
+{
+   ALLEGRO_TIMER **slot = _al_vector_ref(&active_timers, i);
+   *slot = timer;
+   timer->heap_index = i;
+}
+
+
+
+/* heap_sift_up, heap_sift_down:
+ *  Restore the heap property after the deadline of the timer at index i
+ *  decreased or increased.
+ */
+static void heap_sift_up(unsigned int i)
+{
+   ALLEGRO_TIMER *timer = heap_get(i);
+
+   while (i > 0) {
+      unsigned int parent = (i - 1) / 2;
+      ALLEGRO_TIMER *p = heap_get(parent);
+      if (p->deadline <= timer->deadline)
+         break;
+      heap_set(i, p);
+      i = parent;
+   }
+
+   heap_set(i, timer);
+}
+
+
+
+static void heap_sift_down(unsigned int i)
+{
+   const unsigned int size = _al_vector_size(&active_timers);
+   ALLEGRO_TIMER *timer = heap_get(i);
+
+   for (;;) {
+      unsigned int child = 2 * i + 1;
+      ALLEGRO_TIMER *c;
+      if (child >= size)
+         break;
+      c = heap_get(child);
+      if (child + 1 < size && heap_get(child + 1)->deadline < c->deadline) {
+         child++;
+         c = heap_get(child);
+      }
+      if (timer->deadline <= c->deadline)
+         break;
+      heap_set(i, c);
+      i = child;
+   }
+
+   heap_set(i, timer);
+}
+
+
+
+static void heap_insert(ALLEGRO_TIMER *timer)
+{
+   ALLEGRO_TIMER **slot = _al_vector_alloc_back(&active_timers);
+   *slot = timer;
+   heap_sift_up(_al_vector_size(&active_timers) - 1);
+}
+
+
+
+static void heap_remove(ALLEGRO_TIMER *timer)
+{
+   const unsigned int last = _al_vector_size(&active_timers) - 1;
+   const unsigned int i = timer->heap_index;
+
+   ASSERT(heap_get(i) == timer);
+
+   if (i != last) {
+      ALLEGRO_TIMER *moved = heap_get(last);
+      heap_set(i, moved);
+      _al_vector_delete_at(&active_timers, last);
+      heap_sift_up(i);
+      heap_sift_down(moved->heap_index);
+   }
+   else {
+      _al_vector_delete_at(&active_timers, last);
+   }
+}
+
+
+
 /* timer_thread_proc: [timer thread]
  *  The timer thread procedure itself.
  */
@@ -94,57 +197,58 @@ static void timer_thread_proc(_AL_THREAD *self, void *unused)
    }
 #endif
 
-   double old_time = al_get_time();
-   double new_time;
-   double interval = 0.032768;
+   _al_mutex_lock(&timers_mutex);
 
    while (!_al_get_thread_should_stop(self)) {
-      al_rest(interval);
+      ALLEGRO_TIMEOUT timeout;
+      double now;
+      double next;
 
-      _al_mutex_lock(&timers_mutex);
-      {
-         /* Calculate actual time elapsed.  */
-         new_time = al_get_time();
-         interval = new_time - old_time;
-         old_time = new_time;
+      if (_al_vector_is_empty(&active_timers)) {
+         _al_cond_wait(&timers_cond, &timers_mutex);
+         continue;
+      }
 
-         /* Handle a tick.  */
-         interval = timer_thread_handle_tick(interval);
+      /* Sleep until the earliest deadline, or until the set of timers
+       * changes.  The timeout is absolute, so time spent handling ticks
+       * does not add up as drift.
+       */
+      now = al_get_time();
+      next = heap_get(0)->deadline;
+      if (next > now) {
+         al_init_timeout(&timeout, next - now);
+         _al_cond_timedwait(&timers_cond, &timers_mutex, &timeout);
+         continue;
       }
-      _al_mutex_unlock(&timers_mutex);
+
+      timer_thread_handle_tick(now);
    }
 
+   _al_mutex_unlock(&timers_mutex);
+
    (void)unused;
 }
 
 
 
 /* timer_thread_handle_tick: [timer thread]
- *  Call handle_tick() method of every timer in active_timers, and
- *  returns the duration that the timer thread should try to sleep
- *  next time.
+ *  Call handle_tick() method of every timer in active_timers whose
+ *  deadline has passed, as many times as it is behind.
  */
-static double timer_thread_handle_tick(double interval)
+static void timer_thread_handle_tick(double now)
 {
-   double new_delay = 0.032768;
-   unsigned int i;
+   while (_al_vector_is_nonempty(&active_timers)) {
+      ALLEGRO_TIMER *timer = heap_get(0);
 
-   for (i = 0; i < _al_vector_size(&active_timers); i++) {
-      ALLEGRO_TIMER **slot = _al_vector_ref(&active_timers, i);
-      ALLEGRO_TIMER *timer = *slot;
+      if (timer->deadline > now)
+         break;
 
-      timer->counter -= interval;
-
-      while (timer->counter <= 0) {
-         timer_handle_tick(timer);
-         timer->counter += timer->speed_secs;
-      }
-
-      if ((timer->counter > 0) && (timer->counter < new_delay))
-         new_delay = timer->counter;
+      /* The error reported in the event is how late the tick is. */
+      timer->counter = timer->deadline - now;
+      timer_handle_tick(timer);
+      timer->deadline += timer->speed_secs;
+      heap_sift_down(0);
    }
-
-   return new_delay;
 }
 
 
@@ -154,6 +258,7 @@ static void shutdown_timers(void)
    ASSERT(_al_vector_size(&active_timers) == 0);
    ASSERT(timer_thread == NULL);
 
+   _al_cond_destroy(&timers_cond);
    _al_mutex_destroy(&timers_mutex);
 }
 
@@ -173,17 +278,16 @@ static void enable_timer(ALLEGRO_TIMER *timer, bool reset_counter)
 
       _al_mutex_lock(&timers_mutex);
       {
-         ALLEGRO_TIMER **slot;
-
          timer->started = true;
 
          if (reset_counter)
             timer->counter = timer->speed_secs;
 
-         slot = _al_vector_alloc_back(&active_timers);
-         *slot = timer;
+         timer->deadline = al_get_time() + timer->counter;
+         heap_insert(timer);
 
          new_size = _al_vector_size(&active_timers);
+         _al_cond_signal(&timers_cond);
       }
       _al_mutex_unlock(&timers_mutex);
 
@@ -199,6 +303,7 @@ static void enable_timer(ALLEGRO_TIMER *timer, bool reset_counter)
 void _al_init_timers(void)
 {
    _al_mutex_init(&timers_mutex);
+   _al_cond_init(&timers_cond);
    _al_add_exit_func(shutdown_timers, "shutdown_timers");
 }
 
@@ -231,6 +336,8 @@ ALLEGRO_TIMER *al_create_timer(double speed_secs)
          timer->count = 0;
          timer->speed_secs = speed_secs;
          timer->counter = 0;
+         timer->deadline = 0;
+         timer->heap_index = 0;
 
          _al_register_destructor(_al_dtor_list, timer,
             (void (*)(void *)) al_destroy_timer);
@@ -289,8 +396,10 @@ void al_stop_timer(ALLEGRO_TIMER *timer)
 
       _al_mutex_lock(&timers_mutex);
       {
-         _al_vector_find_and_delete(&active_timers, &timer);
+         heap_remove(timer);
          timer->started = false;
+         /* Remember the time left for al_resume_timer. */
+         timer->counter = timer->deadline - al_get_time();
 
          if (_al_vector_size(&active_timers) == 0) {
             _al_vector_free(&active_timers);
@@ -301,6 +410,11 @@ void al_stop_timer(ALLEGRO_TIMER *timer)
       _al_mutex_unlock(&timers_mutex);
 
       if (thread_to_join) {
+         /* The thread may be waiting for a timer to be started. */
+         _al_thread_set_should_stop(thread_to_join);
+         _al_mutex_lock(&timers_mutex);
+         _al_cond_signal(&timers_cond);
+         _al_mutex_unlock(&timers_mutex);
          _al_thread_join(thread_to_join);
          al_free(thread_to_join);
       }
@@ -341,6 +455,13 @@ void al_set_timer_speed(ALLEGRO_TIMER *timer, double new_speed_secs)
    _al_mutex_lock(&timers_mutex);
    {
       if (timer->started) {
+         timer->deadline -= timer->speed_secs;
+         timer->deadline += new_speed_secs;
+         heap_sift_up(timer->heap_index);
+         heap_sift_down(timer->heap_index);
+         _al_cond_signal(&timers_cond);
+      }
+      else {
          timer->counter -= timer->speed_secs;
          timer->counter += new_speed_secs;
       }
@@ -38,6 +38,7 @@
 #include <string.h>
 #include "allegro5/allegro.h"
 #include "allegro5/internal/aintern.h"
+#include "allegro5/internal/aintern_atomicops.h"
 #include "allegro5/internal/aintern_bitmap.h"
 #include "allegro5/internal/aintern_display.h"
 #include "allegro5/internal/aintern_file.h"
@@ -90,6 +91,7 @@ typedef struct thread_local_state {
    /* Files */
    const ALLEGRO_FILE_INTERFACE *new_file_interface;
    const ALLEGRO_FS_INTERFACE *fs_interface;
+   ALLEGRO_PACK *pack;
 
    /* Error code */
    int allegro_errno;
@@ -105,6 +107,15 @@ typedef struct thread_local_state {
 
    /* Destructor ownership count */
    int dtor_owner_count;
+
+   /* Index of the job worker running on this thread, plus one */
+   int job_worker;
+
+   /* Free small objects kept by this thread, see misc/pool.c */
+   struct _AL_POOL_CACHE *pool_cache;
+
+   /* Claimed by addons, see _al_tls_new_addon_slot */
+   void *addon_slots[_AL_TLS_MAX_ADDON_SLOTS];
 } thread_local_state;
 
 
@@ -119,6 +130,10 @@ typedef struct INTERNAL_STATE {
 ALLEGRO_STATIC_ASSERT(tls, sizeof(ALLEGRO_STATE) > sizeof(INTERNAL_STATE));
 
 
+/* Number of addon slots claimed so far. */
+static volatile _AL_ATOMIC num_addon_slots = 0;
+
+
 static void initialize_blender(ALLEGRO_BLENDER *b)
 {
    b->blend_op = ALLEGRO_ADD;
@@ -157,12 +172,28 @@ static void initialize_tls_values(thread_local_state *tls)
    #undef ALLEGRO_CFG_DLL_TLS
 #endif
 
+/* Every drawing call looks up the thread local state, so use the compiler's
+ * thread local variables wherever they exist; they compile down to a load
+ * relative to the thread pointer instead of a call to pthread_getspecific.
+ * Apple's compilers only support them since Xcode 8, and Android emulates
+ * them with pthread keys anyway.
+ */
+#if defined(ALLEGRO_MACOSX) || defined(ALLEGRO_IPHONE)
+   #if defined(__has_feature)
+      #if __has_feature(tls)
+         #define HAVE_NATIVE_TLS
+      #endif
+   #endif
+#elif !defined(ALLEGRO_ANDROID)
+   #define HAVE_NATIVE_TLS
+#endif
+
 #if defined(ALLEGRO_CFG_DLL_TLS)
    #include "tls_dll.inc"
-#elif defined(ALLEGRO_MACOSX) || defined(ALLEGRO_IPHONE) || defined(ALLEGRO_ANDROID) || defined(ALLEGRO_RASPBERRYPI)
-   #include "tls_pthread.inc"
-#else
+#elif defined(HAVE_NATIVE_TLS)
    #include "tls_native.inc"
+#else
+   #include "tls_pthread.inc"
 #endif
 
 
@@ -203,7 +234,7 @@ void al_set_new_window_title(char *title)
       size = ALLEGRO_NEW_WINDOW_TITLE_MAX_SIZE;
    }
 
-   _al_sane_strncpy(tls->new_window_title, title, size);
+   _al_sane_strncpy(tls->new_window_title, title, size + 1);
 }
 
 
@@ -704,7 +735,7 @@ void al_store_state(ALLEGRO_STATE *state, int flags)
       _STORE(new_window_y);
       _STORE(new_display_settings);
       _al_sane_strncpy(stored->tls.new_window_title, tls->new_window_title,
-                       strlen(tls->new_window_title));
+                       sizeof(stored->tls.new_window_title));
    }
 
    if (flags & ALLEGRO_STATE_NEW_BITMAP_PARAMETERS) {
@@ -727,10 +758,11 @@ void al_store_state(ALLEGRO_STATE *state, int flags)
    if (flags & ALLEGRO_STATE_NEW_FILE_INTERFACE) {
       _STORE(new_file_interface);
       _STORE(fs_interface);
+      _STORE(pack);
    }
 
    if (flags & ALLEGRO_STATE_TRANSFORM) {
-      ALLEGRO_BITMAP *target = al_get_target_bitmap();
+      ALLEGRO_BITMAP *target = tls->target_bitmap;
       if (!target)
          al_identity_transform(&stored->stored_transform);
       else
@@ -738,7 +770,7 @@ void al_store_state(ALLEGRO_STATE *state, int flags)
    }
 
    if (flags & ALLEGRO_STATE_PROJECTION_TRANSFORM) {
-      ALLEGRO_BITMAP *target = al_get_target_bitmap();
+      ALLEGRO_BITMAP *target = tls->target_bitmap;
       if (target) {
          stored->stored_projection_transform = target->proj_transform;
       }
@@ -773,7 +805,7 @@ void al_restore_state(ALLEGRO_STATE const *state)
       _RESTORE(new_window_y);
       _RESTORE(new_display_settings);
       _al_sane_strncpy(tls->new_window_title, stored->tls.new_window_title,
-                       strlen(tls->new_window_title));
+                       sizeof(tls->new_window_title));
    }
 
    if (flags & ALLEGRO_STATE_NEW_BITMAP_PARAMETERS) {
@@ -802,18 +834,27 @@ void al_restore_state(ALLEGRO_STATE const *state)
    if (flags & ALLEGRO_STATE_NEW_FILE_INTERFACE) {
       _RESTORE(new_file_interface);
       _RESTORE(fs_interface);
+      _RESTORE(pack);
    }
 
+   /* Using a transform makes the display driver upload it again, so skip
+    * that when the caller didn't actually change it.
+    */
    if (flags & ALLEGRO_STATE_TRANSFORM) {
-      ALLEGRO_BITMAP *bitmap = al_get_target_bitmap();
-      if (bitmap)
+      ALLEGRO_BITMAP *bitmap = tls->target_bitmap;
+      if (bitmap && memcmp(&bitmap->transform, &stored->stored_transform,
+            sizeof(ALLEGRO_TRANSFORM)) != 0) {
          al_use_transform(&stored->stored_transform);
+      }
    }
 
    if (flags & ALLEGRO_STATE_PROJECTION_TRANSFORM) {
-      ALLEGRO_BITMAP *bitmap = al_get_target_bitmap();
-      if (bitmap)
+      ALLEGRO_BITMAP *bitmap = tls->target_bitmap;
+      if (bitmap && memcmp(&bitmap->proj_transform,
+            &stored->stored_projection_transform,
+            sizeof(ALLEGRO_TRANSFORM)) != 0) {
          al_use_projection_transform(&stored->stored_projection_transform);
+      }
    }
 
 #undef _RESTORE
@@ -959,4 +1000,58 @@ int *_al_tls_get_dtor_owner_count(void)
 }
 
 
+int *_al_tls_get_job_worker(void)
+{
+   thread_local_state *tls;
+
+   tls = tls_get();
+   return &tls->job_worker;
+}
+
+
+ALLEGRO_PACK **_al_tls_get_pack(void)
+{
+   thread_local_state *tls;
+
+   tls = tls_get();
+   return &tls->pack;
+}
+
+
+struct _AL_POOL_CACHE **_al_tls_get_pool_cache(void)
+{
+   thread_local_state *tls;
+
+   tls = tls_get();
+   return &tls->pool_cache;
+}
+
+
+/* Internal function: _al_tls_new_addon_slot
+ *  Claims a thread local pointer for an addon, which starts out NULL on
+ *  every thread.  Returns its index for _al_tls_get_addon_slot, or -1 if
+ *  they have all been claimed.  Slots are never given back, so an addon
+ *  should claim one once and keep it across shutdowns.
+ */
+int _al_tls_new_addon_slot(void)
+{
+   int slot = _al_fetch_and_add1(&num_addon_slots);
+
+   if (slot >= _AL_TLS_MAX_ADDON_SLOTS)
+      return -1;
+   return slot;
+}
+
+
+void **_al_tls_get_addon_slot(int slot)
+{
+   thread_local_state *tls;
+
+   ASSERT(slot >= 0 && slot < _AL_TLS_MAX_ADDON_SLOTS);
+
+   tls = tls_get();
+   return &tls->addon_slots[slot];
+}
+
+
 /* vim: set sts=3 sw=3 et: */
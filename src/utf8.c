@@ -42,18 +42,99 @@ ALLEGRO_STATIC_ASSERT(utf8,
 #define IS_TRAIL_BYTE(c)   (((unsigned)(c) & 0xC0) == 0x80)
 
 
+/* Strings are scanned a word at a time where possible.  A byte is a code
+ * point boundary, in the sense of al_ustr_next, unless it is a trail byte or
+ * 0xFE or 0xFF.
+ */
+#define WORD_ONES          (~(uint64_t)0 / 0xFF)
+#define WORD_HIGH_BITS     (WORD_ONES * 0x80)
+#define WORD_LOW_BITS      (WORD_ONES * 0x7F)
+#define IS_BOUNDARY(c)     (IS_SINGLE_BYTE(c) || IS_LEAD_BYTE(c))
+
+
+static uint64_t load_word(const unsigned char *p)
+{
+   uint64_t w;
+   memcpy(&w, p, sizeof(w));
+   return w;
+}
+
+
+/* Returns the number of boundary bytes in the 8 bytes at p. */
+static int word_boundaries(const unsigned char *p)
+{
+   uint64_t w = load_word(p);
+   uint64_t trail, ff, v;
+
+   if ((w & WORD_HIGH_BITS) == 0)
+      return 8;
+
+   /* The high bit of each byte in `trail` is set for 10xxxxxx bytes, and in
+    * `ff` for bytes which are 0xFE or 0xFF.
+    */
+   trail = w & ~(w << 1) & WORD_HIGH_BITS;
+   v = ~(w | WORD_ONES);
+   ff = ~(((v & WORD_LOW_BITS) + WORD_LOW_BITS) | v | WORD_LOW_BITS);
+
+   return 8 - (int)((((trail | ff) >> 7) * WORD_ONES) >> 56);
+}
+
+
+static int count_boundaries(const unsigned char *data, int size)
+{
+   int count = 0;
+   int i = 0;
+
+   for (; i + 8 <= size; i += 8)
+      count += word_boundaries(data + i);
+   for (; i < size; i++)
+      count += IS_BOUNDARY(data[i]);
+
+   return count;
+}
+
+
+/* Returns the offset of the n'th boundary byte (n >= 1), or size if there
+ * are fewer.
+ */
+static int find_boundary(const unsigned char *data, int size, int n)
+{
+   int i = 0;
+
+   for (; i + 8 <= size; i += 8) {
+      int k = word_boundaries(data + i);
+      if (k >= n)
+         break;
+      n -= k;
+   }
+   for (; i < size; i++) {
+      if (IS_BOUNDARY(data[i]) && --n == 0)
+         return i;
+   }
+
+   return size;
+}
+
+
+static int ascii_prefix(const unsigned char *data, int size)
+{
+   int i = 0;
+
+   while (i + 8 <= size && (load_word(data + i) & WORD_HIGH_BITS) == 0)
+      i += 8;
+   while (i < size && IS_SINGLE_BYTE(data[i]))
+      i++;
+
+   return i;
+}
+
+
 static bool all_ascii(const ALLEGRO_USTR *us)
 {
    const unsigned char *data = (const unsigned char *) _al_bdata(us);
    int size = _al_blength(us);
 
-   while (size-- > 0) {
-      if (*data > 127)
-         return false;
-      data++;
-   }
-
-   return true;
+   return ascii_prefix(data, size) == size;
 }
 
 
@@ -204,13 +285,14 @@ size_t al_ustr_size(const ALLEGRO_USTR *us)
  */
 size_t al_ustr_length(const ALLEGRO_USTR *us)
 {
-   int pos = 0;
-   int c = 0;
+   const unsigned char *data = (const unsigned char *) _al_bdata(us);
+   int size = _al_blength(us);
 
-   while (al_ustr_next(us, &pos))
-      c++;
+   if (size <= 0)
+      return 0;
 
-   return c;
+   /* The first code point starts at offset 0 whatever the byte is. */
+   return 1 + count_boundaries(data + 1, size - 1);
 }
 
 
@@ -218,17 +300,16 @@ size_t al_ustr_length(const ALLEGRO_USTR *us)
  */
 int al_ustr_offset(const ALLEGRO_USTR *us, int index)
 {
-   int pos = 0;
+   const unsigned char *data = (const unsigned char *) _al_bdata(us);
+   int size = _al_blength(us);
 
    if (index < 0)
       index += al_ustr_length(us);
 
-   while (index-- > 0) {
-      if (!al_ustr_next(us, &pos))
-         return pos;
-   }
+   if (index <= 0 || size <= 0)
+      return 0;
 
-   return pos;
+   return 1 + find_boundary(data + 1, size - 1, index);
 }
 
 
@@ -329,7 +410,7 @@ int32_t al_ustr_get(const ALLEGRO_USTR *ub, int pos)
       return -2;
    }
 
-   if (pos + remain > _al_blength(ub)) {
+   if (pos + remain >= _al_blength(ub)) {
       al_set_errno(EILSEQ);
       return -2;
    }
@@ -364,7 +445,15 @@ int32_t al_ustr_get(const ALLEGRO_USTR *ub, int pos)
  */
 int32_t al_ustr_get_next(const ALLEGRO_USTR *us, int *pos)
 {
-   int32_t c = al_ustr_get(us, *pos);
+   const unsigned char *data = (const unsigned char *) _al_bdata(us);
+   int32_t c;
+
+   if (*pos >= 0 && *pos < _al_blength(us) && IS_SINGLE_BYTE(data[*pos])) {
+      /* Plain ASCII. */
+      return data[(*pos)++];
+   }
+
+   c = al_ustr_get(us, *pos);
 
    if (c >= 0) {
       (*pos) += al_utf8_width(c);
@@ -395,6 +484,58 @@ int32_t al_ustr_prev_get(const ALLEGRO_USTR *us, int *pos)
 }
 
 
+/* Function: al_ustr_is_valid
+ */
+bool al_ustr_is_valid(const ALLEGRO_USTR *us)
+{
+   const unsigned char *data = (const unsigned char *) _al_bdata(us);
+   int size = _al_blength(us);
+   int pos = 0;
+
+   for (;;) {
+      int32_t c, minc;
+      int remain;
+
+      pos += ascii_prefix(data + pos, size - pos);
+      if (pos >= size)
+         return true;
+
+      c = data[pos++];
+      if (c <= 0xC1)
+         return false;
+      if (c <= 0xDF) {
+         c &= 0x1F;
+         remain = 1;
+         minc = 0x80;
+      }
+      else if (c <= 0xEF) {
+         c &= 0x0F;
+         remain = 2;
+         minc = 0x800;
+      }
+      else if (c <= 0xF4) {
+         c &= 0x07;
+         remain = 3;
+         minc = 0x10000;
+      }
+      else {
+         return false;
+      }
+
+      if (remain > size - pos)
+         return false;
+      while (remain--) {
+         int d = data[pos++];
+         if (!IS_TRAIL_BYTE(d))
+            return false;
+         c = (c << 6) | (d & 0x3F);
+      }
+      if (c < minc || c > 0x10FFFF || (c >= 0xD800 && c <= 0xDFFF))
+         return false;
+   }
+}
+
+
 /* Function: al_ustr_insert
  */
 bool al_ustr_insert(ALLEGRO_USTR *us1, int pos, const ALLEGRO_USTR *us2)